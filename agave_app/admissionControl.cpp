@@ -0,0 +1,154 @@
+#include "admissionControl.h"
+
+#include "commandBuffer.h"
+
+#include <algorithm>
+
+AdmissionControl::Quality
+AdmissionControl::quality(int level)
+{
+  static const Quality levels[MAX_QUALITY_LEVEL + 1] = { { 1.0f, 0 }, { 0.75f, 1 }, { 0.5f, 1 } };
+  return levels[std::max(0, std::min(level, MAX_QUALITY_LEVEL))];
+}
+
+AdmissionControl::AdmissionControl(const Options& options)
+  : m_options(options)
+{
+}
+
+AdmissionControl::Decision
+AdmissionControl::decide(int sessions, int waiting, double renderLoad, bool memoryAvailable) const
+{
+  bool loadAvailable = m_options.maxRenderLoad <= 0.0 || renderLoad < m_options.maxRenderLoad;
+  bool canStart = sessions < m_options.maxSessions && (sessions == 0 || (loadAvailable && memoryAvailable));
+  if (waiting == 0 && canStart) {
+    return Decision::Admit;
+  }
+  if (waiting < m_options.maxWaiting) {
+    return Decision::Wait;
+  }
+  return Decision::Reject;
+}
+
+std::vector<int>
+AdmissionControl::adjustQuality(double renderLoad,
+                                bool memoryPressure,
+                                const std::vector<double>& sessionLoads,
+                                std::vector<int> levels) const
+{
+  bool overloaded = m_options.degradeRenderLoad > 0.0 && renderLoad > m_options.degradeRenderLoad;
+  if (overloaded || memoryPressure) {
+    int busiest = -1;
+    for (size_t i = 0; i < levels.size(); ++i) {
+      if (levels[i] < MAX_QUALITY_LEVEL && (busiest < 0 || sessionLoads[i] > sessionLoads[busiest])) {
+        busiest = (int)i;
+      }
+    }
+    if (busiest >= 0) {
+      levels[busiest]++;
+    }
+  } else if (renderLoad < m_options.restoreRenderLoad) {
+    // ties go to the least busy session, which gains the most for the load it adds
+    int restore = -1;
+    for (size_t i = 0; i < levels.size(); ++i) {
+      if (levels[i] > 0 && (restore < 0 || levels[i] > levels[restore] ||
+                            (levels[i] == levels[restore] && sessionLoads[i] < sessionLoads[restore]))) {
+        restore = (int)i;
+      }
+    }
+    if (restore >= 0) {
+      levels[restore]--;
+    }
+  }
+  return levels;
+}
+
+void
+WaitingQueue::push(uint64_t client)
+{
+  if (!contains(client)) {
+    m_clients.push_back(client);
+  }
+}
+
+bool
+WaitingQueue::contains(uint64_t client) const
+{
+  return std::find(m_clients.begin(), m_clients.end(), client) != m_clients.end();
+}
+
+bool
+WaitingQueue::remove(uint64_t client)
+{
+  auto found = std::find(m_clients.begin(), m_clients.end(), client);
+  if (found == m_clients.end()) {
+    return false;
+  }
+  m_clients.erase(found);
+  m_messages.erase(client);
+  return true;
+}
+
+bool
+WaitingQueue::addMessage(uint64_t client, std::vector<uint8_t> message)
+{
+  std::vector<std::vector<uint8_t>>& messages = m_messages[client];
+  messages.push_back(std::move(message));
+  size_t bytes = 0;
+  for (const std::vector<uint8_t>& m : messages) {
+    bytes += m.size();
+  }
+  if (messages.size() <= MAX_MESSAGES && bytes <= MAX_BYTES) {
+    return true;
+  }
+
+  // merge them into one message, without the commands a later one replaces
+  std::vector<Command*> commands;
+  for (const std::vector<uint8_t>& m : messages) {
+    commandBuffer b(m.size(), m.data());
+    b.processBuffer();
+    commands.insert(commands.end(), b.getQueue().begin(), b.getQueue().end());
+  }
+  std::vector<bool> replaced = replacedCommands(commands);
+  std::vector<Command*> kept;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    if (!replaced[i]) {
+      kept.push_back(commands[i]);
+    }
+  }
+  commandBuffer* merged = commandBuffer::createBuffer(kept);
+  for (Command* c : commands) {
+    delete c;
+  }
+  bool fits = merged->length() <= MAX_BYTES;
+  if (fits) {
+    messages.assign(1, std::vector<uint8_t>(merged->head(), merged->head() + merged->length()));
+  } else {
+    messages.pop_back();
+  }
+  // the buffer does not own its bytes
+  delete[] merged->head();
+  delete merged;
+  return fits;
+}
+
+uint64_t
+WaitingQueue::admit(std::vector<std::vector<uint8_t>>& messages)
+{
+  uint64_t client = m_clients.front();
+  m_clients.pop_front();
+  auto found = m_messages.find(client);
+  if (found != m_messages.end()) {
+    messages = std::move(found->second);
+    m_messages.erase(found);
+  } else {
+    messages.clear();
+  }
+  return client;
+}
+
+std::string
+WaitingQueue::positionMessage(int position)
+{
+  return "{\"queue_position\":" + std::to_string(position) + "}";
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// Decides whether the render server takes on another session, and how much each session's render quality is lowered
+// while the server is under pressure.
+//
+// Render load is the fraction of wall time a GPU spends rendering: the loads of its sessions, summed per device, of
+// the busiest device. The sessions of a device take turns on it, so a load near 1 means that device is saturated and
+// every further session on it slows all the others down.
+class AdmissionControl
+{
+public:
+  struct Options
+  {
+    // sessions rendering at once
+    int maxSessions = 4;
+    // clients kept waiting for a session; beyond that they are turned away
+    int maxWaiting = 16;
+    // no new session while the render load is at or above this; 0 is unlimited
+    double maxRenderLoad = 0.9;
+    // lower the quality of the busiest session while the render load is above this; 0 never lowers quality
+    double degradeRenderLoad = 0.8;
+    // raise the quality of the most degraded session again while the render load is below this
+    double restoreRenderLoad = 0.5;
+    // the memory a new session takes before it loads anything: its render targets at the default resolution
+    size_t sessionMemoryEstimate = (size_t)1024 * 1024 * 40;
+  };
+
+  enum class Decision
+  {
+    Admit,
+    Wait,
+    Reject
+  };
+
+  // 0 is full quality
+  static constexpr int MAX_QUALITY_LEVEL = 2;
+  struct Quality
+  {
+    // fraction of the requested resolution to render at; frames are scaled up to the requested size
+    float resolutionScale;
+    // cap on the client's exposure iterations per frame; 0 leaves them as they are
+    int maxIterations;
+  };
+  static Quality quality(int level);
+
+  AdmissionControl() = default;
+  explicit AdmissionControl(const Options& options);
+
+  const Options& options() const { return m_options; }
+
+  // what to do with a new client, given the sessions running and the clients waiting before it.
+  // memoryAvailable: whether another session fits in the memory budgets.
+  // A client never overtakes waiting ones, and an idle server always admits.
+  Decision decide(int sessions, int waiting, double renderLoad, bool memoryAvailable) const;
+
+  // At most one session changes quality level per call: under pressure the busiest session that can be degraded
+  // goes down a level, and with room to spare the most degraded session goes up a level.
+  // sessionLoads and levels are per session, in the same order; returns the new levels.
+  std::vector<int> adjustQuality(double renderLoad,
+                                 bool memoryPressure,
+                                 const std::vector<double>& sessionLoads,
+                                 std::vector<int> levels) const;
+
+private:
+  Options m_options;
+};
+
+// Clients waiting for a session, in order of arrival, and the command messages they send meanwhile, to run once their
+// session starts.
+//
+// A client that sends more than MAX_MESSAGES messages, or MAX_BYTES, while waiting has them merged into one, keeping
+// only the last of the commands that replace each other (see replacedCommands). Clients are told their place in the
+// queue with positionMessage, and position 0 once they have a session.
+class WaitingQueue
+{
+public:
+  static const size_t MAX_MESSAGES = 64;
+  // of a client's merged messages; beyond this the client is turned away
+  static const size_t MAX_BYTES = (size_t)16 * 1024 * 1024;
+
+  void push(uint64_t client);
+  bool contains(uint64_t client) const;
+  int length() const { return (int)m_clients.size(); }
+  // the waiting clients, first in line first
+  const std::deque<uint64_t>& clients() const { return m_clients; }
+  // forget a client and its messages; false if it was not waiting
+  bool remove(uint64_t client);
+
+  // false if the client's messages no longer fit in MAX_BYTES; the message is then dropped
+  bool addMessage(uint64_t client, std::vector<uint8_t> message);
+  // Take the first client out of the queue, with the messages it sent, in order. The queue is not empty.
+  uint64_t admit(std::vector<std::vector<uint8_t>>& messages);
+
+  // the text message telling a client its place in the queue, 1 for the first; 0 when its session starts
+  static std::string positionMessage(int position);
+
+private:
+  std::deque<uint64_t> m_clients;
+  std::map<uint64_t, std::vector<std::vector<uint8_t>>> m_messages;
+};
@@ -5,6 +5,8 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <cstring>
+#include <stdexcept>
 #include <vector>
 
 #if HAVE_BYTESWAP_H
@@ -29,7 +31,7 @@ commandBuffer::~commandBuffer() {}
 
 CommandBufferIterator::CommandBufferIterator(commandBuffer* buf)
   : _commandBuffer(buf)
-  , _currentPos(const_cast<uint8_t*>(buf->head()))
+  , _currentPos(buf->head())
 {
 }
 
@@ -72,7 +74,13 @@ commandBuffer::processBuffer()
   while (!iterator.end()) {
     // new command.
     // read its int32 enum value.
-    int32_t cmd = iterator.parseInt32();
+    int32_t cmd;
+    try {
+      cmd = iterator.parseInt32();
+    } catch (...) {
+      LOG_WARNING << "Command buffer ends after command index: " << previousCmd;
+      break;
+    }
 
     // lambda that takes our iterator and the cmd id to initialize the command object.
     Command* c = [cmd, &iterator]() -> Command* {
@@ -126,6 +134,7 @@ commandBuffer::processBuffer()
           CMD_CASE(ShowScaleBarCommand);
           CMD_CASE(SetFlipAxisCommand);
           CMD_CASE(SetInterpolationCommand);
+          CMD_CASE(GetMemoryUsageCommand);
           default:
             // ERROR UNRECOGNIZED COMMAND SIGNATURE.
             // PRINT OUT PREVIOUS! BAIL OUT! OR DO SOMETHING CLEVER AND CORRECT!
@@ -170,51 +179,76 @@ CommandBufferIterator::end()
   return (_currentPos >= _commandBuffer->head() + _commandBuffer->length());
 }
 
+const uint8_t*
+CommandBufferIterator::take(size_t bytes)
+{
+  const uint8_t* end = _commandBuffer->head() + _commandBuffer->length();
+  if (bytes > (size_t)(end - _currentPos)) {
+    throw std::out_of_range("command buffer ends inside a command");
+  }
+  const uint8_t* p = _currentPos;
+  _currentPos += bytes;
+  return p;
+}
+
+size_t
+CommandBufferIterator::parseLength(size_t elementSize)
+{
+  int32_t len = parseInt32();
+  const uint8_t* end = _commandBuffer->head() + _commandBuffer->length();
+  if (len < 0 || (size_t)len > (size_t)(end - _currentPos) / elementSize) {
+    throw std::out_of_range("invalid array length in command buffer");
+  }
+  return (size_t)len;
+}
+
 int32_t
 CommandBufferIterator::parseInt32()
 {
-  int32_t value = bswap_32(*((int32_t*)(_currentPos)));
-  _currentPos += sizeof(int32_t);
-  return value;
+  // the buffer need not be aligned
+  uint32_t value;
+  memcpy(&value, take(sizeof(value)), sizeof(value));
+  return (int32_t)bswap_32(value);
 }
 
 float
 CommandBufferIterator::parseFloat32()
 {
-  // assuming sizeof float == sizeof int32 == 4
-  // float value = (float)bswap_32(*((int32_t*)(_currentPos)));
-  float value = *((float*)(_currentPos));
-  _currentPos += sizeof(float);
+  // assuming sizeof float == sizeof int32 == 4; floats are sent in host order
+  float value;
+  memcpy(&value, take(sizeof(value)), sizeof(value));
   return value;
 }
 
 std::string
 CommandBufferIterator::parseString()
 {
-  int32_t len = parseInt32();
-  std::string s(reinterpret_cast<char const*>(_currentPos), (size_t)len);
-  _currentPos += len;
-  return s;
+  size_t len = parseLength(sizeof(char));
+  return std::string(reinterpret_cast<char const*>(take(len)), len);
 }
 
 std::vector<float>
 CommandBufferIterator::parseFloat32Array()
 {
-  int32_t len = parseInt32();
-  float* p = (float*)(_currentPos);
-  std::vector<float> v(p, p + len);
-  _currentPos += len * sizeof(float);
+  size_t len = parseLength(sizeof(float));
+  std::vector<float> v(len);
+  if (len > 0) {
+    memcpy(v.data(), take(len * sizeof(float)), len * sizeof(float));
+  }
   return v;
 }
 
 std::vector<int32_t>
 CommandBufferIterator::parseInt32Array()
 {
-  int32_t len = parseInt32();
+  size_t len = parseLength(sizeof(int32_t));
   std::vector<int32_t> v(len);
-  for (int i = 0; i < len; ++i) {
-    int32_t value = parseInt32();
-    v[i] = value;
+  if (len > 0) {
+    memcpy(v.data(), take(len * sizeof(int32_t)), len * sizeof(int32_t));
+  }
+  // swapped in place, in a loop the compiler can vectorize
+  for (int32_t& value : v) {
+    value = (int32_t)bswap_32((uint32_t)value);
   }
   return v;
 }
@@ -228,8 +262,8 @@ CommandBufferWriter::CommandBufferWriter(commandBuffer* cb)
 size_t
 CommandBufferWriter::writeInt32(int32_t i)
 {
-  int32_t* p = (int32_t*)(_currentPos);
-  *p = bswap_32(i);
+  uint32_t value = bswap_32((uint32_t)i);
+  memcpy(_currentPos, &value, sizeof(value));
   assert(sizeof(int32_t) == 4);
   _currentPos += 4; // sizeof(int32_t);
   return 4;
@@ -238,8 +272,7 @@ CommandBufferWriter::writeInt32(int32_t i)
 size_t
 CommandBufferWriter::writeFloat32(float f)
 {
-  float* p = (float*)(_currentPos);
-  *p = f;
+  memcpy(_currentPos, &f, sizeof(f));
   assert(sizeof(float) == 4);
   _currentPos += 4; // sizeof(float);
   return 4;
@@ -24,7 +24,7 @@ public:
   const uint8_t* head() { return _headPos; }
   size_t length() { return _length; }
 
-  std::vector<Command*> getQueue() { return _commands; }
+  const std::vector<Command*>& getQueue() const { return _commands; }
 
 private:
   size_t _length;
@@ -34,6 +34,8 @@ private:
   std::vector<Command*> _commands;
 };
 
+// Reads the values of commands straight out of the buffer, which may be at any alignment. Reading past the end of the
+// buffer, or a negative length, throws std::out_of_range.
 class CommandBufferIterator : public ParseableStream
 {
 public:
@@ -48,7 +50,13 @@ public:
   virtual std::string parseString();
 
   commandBuffer* _commandBuffer;
-  uint8_t* _currentPos;
+  const uint8_t* _currentPos;
+
+private:
+  // the next bytes of the buffer, which the caller reads
+  const uint8_t* take(size_t bytes);
+  // an array length, and the bytes of its elements
+  size_t parseLength(size_t elementSize);
 };
 
 class CommandBufferWriter : public WriteableStream
@@ -0,0 +1,137 @@
+#include "commandReplay.h"
+
+#include "commandBuffer.h"
+#include "renderrequest.h"
+
+#include "renderlib/AppScene.h"
+#include "renderlib/CCamera.h"
+#include "renderlib/Logging.h"
+#include "renderlib/RenderSettings.h"
+
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// nearest rank
+double
+percentile(std::vector<double> values, double p)
+{
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+  return values[std::max<size_t>(rank, 1) - 1];
+}
+} // namespace
+
+CommandReplay::CommandReplay(const std::vector<CommandTraceEntry>& entries,
+                             renderlib::RendererType rendererType,
+                             double speed,
+                             bool backgroundLoads,
+                             QObject* parent)
+  : QObject(parent)
+  , m_entries(entries)
+  , m_speed(speed)
+  , m_renderer(nullptr)
+  , m_answered(0)
+  , m_streamModeCommandsDropped(0)
+{
+  // the same initial state as a new render server session
+  RenderSettings renderSettings;
+  CCamera camera;
+  camera.m_Film.m_ExposureIterations = 1;
+  camera.m_Film.m_Resolution.SetResX(1024);
+  camera.m_Film.m_Resolution.SetResY(1024);
+  Scene scene;
+  scene.initLights();
+
+  m_renderer = new Renderer("Replay", this, m_gpuScheduler);
+  m_renderer->configure(nullptr, renderSettings, scene, camera, LoadSpec(), rendererType);
+  m_renderer->setBackgroundLoads(backgroundLoads);
+  connect(m_renderer,
+          &Renderer::requestProcessed,
+          this,
+          &CommandReplay::onRequestProcessed,
+          Qt::BlockingQueuedConnection);
+}
+
+CommandReplay::~CommandReplay()
+{
+  m_renderer->requestInterruption();
+  // the renderer may be about to wait for a request
+  while (!m_renderer->wait(100)) {
+    m_renderer->wakeUp();
+  }
+  delete m_renderer;
+}
+
+void
+CommandReplay::start()
+{
+  LOG_INFO << "Replaying " << m_entries.size() << " requests"
+           << (m_speed > 0.0 ? " at " + std::to_string(m_speed) + "x the recorded pace" : " as fast as possible");
+  m_renderer->start();
+  m_clock.start();
+  if (m_entries.empty()) {
+    report();
+    return;
+  }
+  for (size_t i = 0; i < m_entries.size(); ++i) {
+    if (m_speed > 0.0) {
+      int delayMs = (int)(m_entries[i].timeNs / 1.0e6 / m_speed);
+      QTimer::singleShot(delayMs, Qt::PreciseTimer, this, [this, i]() { submit(i); });
+    } else {
+      submit(i);
+    }
+  }
+}
+
+void
+CommandReplay::submit(size_t index)
+{
+  const std::vector<uint8_t>& bytes = m_entries[index].buffer;
+  commandBuffer b(bytes.size(), bytes.data());
+  b.processBuffer();
+
+  std::vector<Command*> commands;
+  for (Command* c : b.getQueue()) {
+    if (dynamic_cast<SetStreamModeCommand*>(c)) {
+      m_streamModeCommandsDropped++;
+      delete c;
+    } else {
+      commands.push_back(c);
+    }
+  }
+  m_renderer->addRequest(new RenderRequest(nullptr, commands));
+}
+
+void
+CommandReplay::onRequestProcessed(RenderRequest* request, QImage image)
+{
+  m_processMs.push_back(request->getActualDuration() / 1.0e6);
+  m_latencyMs.push_back(request->getAge() / 1.0e6);
+  delete request;
+
+  if (++m_answered == m_entries.size()) {
+    report();
+  }
+}
+
+void
+CommandReplay::report()
+{
+  double seconds = m_clock.nsecsElapsed() / 1.0e9;
+  LOG_INFO << "Replayed " << m_answered << " requests in " << seconds << " s ("
+           << (seconds > 0.0 ? m_answered / seconds : 0.0) << " requests/s)";
+  LOG_INFO << "Processing ms: p50 " << percentile(m_processMs, 50) << ", p95 " << percentile(m_processMs, 95)
+           << ", p99 " << percentile(m_processMs, 99);
+  LOG_INFO << "Latency ms: p50 " << percentile(m_latencyMs, 50) << ", p95 " << percentile(m_latencyMs, 95) << ", p99 "
+           << percentile(m_latencyMs, 99);
+  if (m_streamModeCommandsDropped > 0) {
+    LOG_INFO << "Dropped " << m_streamModeCommandsDropped << " stream mode commands";
+  }
+  emit finished();
+}
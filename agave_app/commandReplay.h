@@ -0,0 +1,57 @@
+#pragma once
+
+#include "commandTrace.h"
+#include "renderer.h"
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QObject>
+
+#include <vector>
+
+class RenderRequest;
+
+// Feeds a recorded command trace (see commandTrace.h) through a headless Renderer, as a render server session would
+// see it: one render request per recorded command buffer, either at the recorded pace or all at once, as fast as the
+// renderer goes. When every request is answered, logs how long the requests took and emits finished().
+//
+// Stream mode commands are dropped, so that every request renders exactly one frame and replays are repeatable.
+class CommandReplay : public QObject
+{
+  Q_OBJECT
+
+public:
+  // speed scales the recorded pace; 0 queues every request at once
+  CommandReplay(const std::vector<CommandTraceEntry>& entries,
+                renderlib::RendererType rendererType,
+                double speed,
+                bool backgroundLoads,
+                QObject* parent = nullptr);
+  ~CommandReplay();
+
+  void start();
+
+signals:
+  void finished();
+
+private slots:
+  void onRequestProcessed(RenderRequest* request, QImage image);
+
+private:
+  void submit(size_t index);
+  void report();
+
+  std::vector<CommandTraceEntry> m_entries;
+  double m_speed;
+
+  GpuScheduler m_gpuScheduler;
+  Renderer* m_renderer;
+
+  QElapsedTimer m_clock;
+  size_t m_answered;
+  size_t m_streamModeCommandsDropped;
+  // per request, from the renderer starting on it to its frame
+  std::vector<double> m_processMs;
+  // per request, from submitting it to its frame
+  std::vector<double> m_latencyMs;
+};
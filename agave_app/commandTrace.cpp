@@ -0,0 +1,106 @@
+#include "commandTrace.h"
+
+#include "commandBuffer.h"
+
+#include <cstring>
+
+namespace {
+
+const char MAGIC[8] = { 'A', 'G', 'V', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t VERSION = 1;
+
+void
+writeLE(std::ofstream& out, uint64_t value, int bytes)
+{
+  char buf[8];
+  for (int i = 0; i < bytes; ++i) {
+    buf[i] = (char)((value >> (8 * i)) & 0xff);
+  }
+  out.write(buf, bytes);
+}
+
+bool
+readLE(std::ifstream& in, uint64_t& value, int bytes)
+{
+  unsigned char buf[8];
+  if (!in.read(reinterpret_cast<char*>(buf), bytes)) {
+    return false;
+  }
+  value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= (uint64_t)buf[i] << (8 * i);
+  }
+  return true;
+}
+
+} // namespace
+
+CommandTraceWriter::CommandTraceWriter(const std::string& path)
+  : m_file(path, std::ios::out | std::ios::binary | std::ios::trunc)
+{
+  if (m_file) {
+    m_file.write(MAGIC, sizeof(MAGIC));
+    writeLE(m_file, VERSION, 4);
+    m_file.flush();
+  }
+}
+
+bool
+CommandTraceWriter::append(uint64_t timeNs, const uint8_t* data, size_t length)
+{
+  if (!isOpen()) {
+    return false;
+  }
+  writeLE(m_file, timeNs, 8);
+  writeLE(m_file, (uint32_t)length, 4);
+  m_file.write(reinterpret_cast<const char*>(data), length);
+  m_file.flush();
+  return m_file.good();
+}
+
+bool
+readCommandTrace(const std::string& path, std::vector<CommandTraceEntry>& entries)
+{
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  char magic[sizeof(MAGIC)];
+  uint64_t version = 0;
+  if (!in.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !readLE(in, version, 4) ||
+      version != VERSION) {
+    return false;
+  }
+
+  uint64_t timeNs = 0, length = 0;
+  while (readLE(in, timeNs, 8) && readLE(in, length, 4)) {
+    CommandTraceEntry entry;
+    entry.timeNs = timeNs;
+    entry.buffer.resize(length);
+    if (!in.read(reinterpret_cast<char*>(entry.buffer.data()), length)) {
+      break;
+    }
+    entries.push_back(std::move(entry));
+  }
+  return true;
+}
+
+bool
+writeCommandTrace(const std::string& path, const std::vector<CommandTraceEntry>& entries)
+{
+  CommandTraceWriter writer(path);
+  for (const CommandTraceEntry& entry : entries) {
+    if (!writer.append(entry.timeNs, entry.buffer.data(), entry.buffer.size())) {
+      return false;
+    }
+  }
+  return writer.isOpen();
+}
+
+std::vector<uint8_t>
+encodeCommands(const std::vector<Command*>& commands)
+{
+  commandBuffer* cb = commandBuffer::createBuffer(commands);
+  std::vector<uint8_t> bytes(cb->head(), cb->head() + cb->length());
+  // the buffer does not own its bytes
+  delete[] cb->head();
+  delete cb;
+  return bytes;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class Command;
+
+// A recording of the command buffers sent to a render session, each with the time it was sent.
+// Every buffer is one websocket binary message, i.e. one render request.
+//
+// File layout, all integers little endian:
+//   8 bytes "AGVTRACE", uint32 version
+//   per command buffer: uint64 nanoseconds since the start of the recording, uint32 byte length, the buffer bytes
+struct CommandTraceEntry
+{
+  uint64_t timeNs = 0;
+  std::vector<uint8_t> buffer;
+};
+
+// Appends command buffers to a new trace file as they come.
+class CommandTraceWriter
+{
+public:
+  // replaces any existing file at path
+  explicit CommandTraceWriter(const std::string& path);
+
+  bool isOpen() const { return m_file.is_open() && m_file.good(); }
+
+  // each entry is flushed, so that the trace survives the process being killed.
+  // returns false if it could not be written
+  bool append(uint64_t timeNs, const uint8_t* data, size_t length);
+
+private:
+  std::ofstream m_file;
+};
+
+// Reads a whole trace into entries.
+// returns false if the file is not a command trace; entries before a truncated last entry are still read.
+bool
+readCommandTrace(const std::string& path, std::vector<CommandTraceEntry>& entries);
+
+bool
+writeCommandTrace(const std::string& path, const std::vector<CommandTraceEntry>& entries);
+
+// the serialized command buffer for commands, as a client would send it
+std::vector<uint8_t>
+encodeCommands(const std::vector<Command*>& commands);
@@ -0,0 +1,85 @@
+#include "encoderPool.h"
+
+#include <algorithm>
+#include <thread>
+
+static unsigned
+defaultThreads()
+{
+  return std::max(1u, std::thread::hardware_concurrency() / 2);
+}
+
+EncoderPool::EncoderPool(unsigned threads)
+  : m_pending(0)
+  , m_pool(threads > 0 ? threads : defaultThreads())
+{
+}
+
+EncoderPool::~EncoderPool()
+{
+  waitForAll();
+}
+
+void
+EncoderPool::submit(uint64_t stream, std::function<void()> encode, std::function<void()> deliver)
+{
+  uint64_t ticket;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ticket = m_streams[stream].nextTicket++;
+    ++m_pending;
+  }
+  m_pool.submit([this, stream, ticket, encode, deliver]() {
+    encode();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_streams[stream].ready[ticket] = deliver;
+    }
+    this->deliver(stream);
+  });
+}
+
+void
+EncoderPool::deliver(uint64_t stream)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  Stream& s = m_streams[stream];
+  // another thread is delivering; it picks up whatever is ready when it is done
+  if (s.delivering) {
+    return;
+  }
+  s.delivering = true;
+  for (auto next = s.ready.find(s.nextDelivery); next != s.ready.end(); next = s.ready.find(s.nextDelivery)) {
+    std::function<void()> fn = std::move(next->second);
+    s.ready.erase(next);
+    s.nextDelivery++;
+
+    lock.unlock();
+    fn();
+    lock.lock();
+    --m_pending;
+  }
+  s.delivering = false;
+
+  // nothing in flight: start over with the next frame
+  if (s.nextDelivery == s.nextTicket) {
+    m_streams.erase(stream);
+  }
+  if (m_pending == 0) {
+    m_idle.notify_all();
+  }
+}
+
+size_t
+EncoderPool::pending() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_pending;
+}
+
+void
+EncoderPool::waitForAll()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_idle.wait(lock, [this]() { return m_pending == 0; });
+}
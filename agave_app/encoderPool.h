@@ -0,0 +1,62 @@
+#pragma once
+
+#include "renderlib/threading.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+
+// Encodes frames on its own threads, so that encoding neither holds up the render threads nor waits behind loads on
+// the shared ThreadPool. Frames of one stream are encoded in parallel but delivered in the order they were submitted.
+//
+// Usage example:
+//
+// EncoderPool encoders(4);
+// auto bytes = std::make_shared<QByteArray>();
+// encoders.submit(sessionId, [=]() { *bytes = encode(image); }, [=]() { send(*bytes); });
+class EncoderPool
+{
+public:
+  // 0 threads picks half the hardware threads
+  explicit EncoderPool(unsigned threads = 0);
+  // waits for the frames submitted
+  ~EncoderPool();
+
+  EncoderPool(const EncoderPool&) = delete;
+  EncoderPool& operator=(const EncoderPool&) = delete;
+
+  unsigned size() const { return m_pool.size(); }
+
+  // Run encode on a pool thread, then deliver. Deliveries of a stream run one at a time, in the order of submission,
+  // on whichever pool thread finished the encode that was holding them up.
+  void submit(uint64_t stream, std::function<void()> encode, std::function<void()> deliver);
+
+  // frames submitted and not delivered yet
+  size_t pending() const;
+
+  // block until every frame submitted is delivered
+  void waitForAll();
+
+private:
+  struct Stream
+  {
+    uint64_t nextTicket = 0;
+    uint64_t nextDelivery = 0;
+    // encoded frames waiting for earlier ones, by ticket
+    std::map<uint64_t, std::function<void()>> ready;
+    bool delivering = false;
+  };
+
+  // deliver the frames of stream that are next in line
+  void deliver(uint64_t stream);
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_idle;
+  std::map<uint64_t, Stream> m_streams;
+  size_t m_pending;
+
+  // last, so that its threads stop before the state they use is destroyed
+  ThreadPool m_pool;
+};
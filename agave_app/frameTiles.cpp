@@ -0,0 +1,96 @@
+#include "frameTiles.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace FrameTiles {
+
+const char MAGIC[4] = { 'A', 'G', 'T', 'F' };
+
+static void
+appendUint32(std::vector<uint8_t>& out, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i) {
+    out.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+static bool
+tileChanged(const uint8_t* image, const uint8_t* reference, const Tile& tile, size_t bytesPerLine, float threshold)
+{
+  size_t rowBytes = (size_t)tile.width * 4;
+  // stop counting as soon as the tile is over the threshold
+  uint64_t limit = (uint64_t)(threshold * (float)(rowBytes * tile.height));
+  uint64_t sum = 0;
+  for (int y = tile.y; y < tile.y + tile.height; ++y) {
+    const uint8_t* a = image + (size_t)y * bytesPerLine + (size_t)tile.x * 4;
+    const uint8_t* b = reference + (size_t)y * bytesPerLine + (size_t)tile.x * 4;
+    for (size_t i = 0; i < rowBytes; ++i) {
+      sum += (uint64_t)std::abs((int)a[i] - (int)b[i]);
+    }
+    if (sum > limit) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<Tile>
+changedTiles(const uint8_t* image,
+             const uint8_t* reference,
+             int width,
+             int height,
+             size_t bytesPerLine,
+             int tileSize,
+             float threshold)
+{
+  std::vector<Tile> tiles;
+  tileSize = std::max(tileSize, 1);
+  for (int y = 0; y < height; y += tileSize) {
+    for (int x = 0; x < width; x += tileSize) {
+      Tile tile{ x, y, std::min(tileSize, width - x), std::min(tileSize, height - y) };
+      if (tileChanged(image, reference, tile, bytesPerLine, threshold)) {
+        tiles.push_back(tile);
+      }
+    }
+  }
+  return tiles;
+}
+
+void
+copyTiles(const std::vector<Tile>& tiles, const uint8_t* src, uint8_t* dst, size_t bytesPerLine)
+{
+  for (const Tile& tile : tiles) {
+    for (int y = tile.y; y < tile.y + tile.height; ++y) {
+      size_t offset = (size_t)y * bytesPerLine + (size_t)tile.x * 4;
+      memcpy(dst + offset, src + offset, (size_t)tile.width * 4);
+    }
+  }
+}
+
+std::vector<uint8_t>
+pack(int width, int height, const std::vector<Tile>& tiles, const std::vector<std::vector<uint8_t>>& encodedTiles)
+{
+  size_t size = 16;
+  for (const std::vector<uint8_t>& encoded : encodedTiles) {
+    size += 20 + encoded.size();
+  }
+  std::vector<uint8_t> out;
+  out.reserve(size);
+  out.insert(out.end(), MAGIC, MAGIC + 4);
+  appendUint32(out, (uint32_t)width);
+  appendUint32(out, (uint32_t)height);
+  appendUint32(out, (uint32_t)tiles.size());
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    appendUint32(out, (uint32_t)tiles[i].x);
+    appendUint32(out, (uint32_t)tiles[i].y);
+    appendUint32(out, (uint32_t)tiles[i].width);
+    appendUint32(out, (uint32_t)tiles[i].height);
+    appendUint32(out, (uint32_t)encodedTiles[i].size());
+    out.insert(out.end(), encodedTiles[i].begin(), encodedTiles[i].end());
+  }
+  return out;
+}
+
+} // namespace FrameTiles
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Tile frames update the image a client already has with the tiles that changed, instead of sending a whole image.
+// A streaming client asks for them with ?frames=tiles in the websocket URL.
+//
+// Message layout, little endian:
+//   "AGTF"
+//   uint32 width, uint32 height: of the whole image
+//   uint32 tile count
+//   per tile: uint32 x, uint32 y (of the top left corner), uint32 width, uint32 height, uint32 byte length,
+//             then the tile encoded as an image file
+// Whole images are still sent as plain image files, and replace what the client has.
+namespace FrameTiles {
+
+extern const char MAGIC[4];
+
+struct Tile
+{
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// Tiles of tileSize pixels, smaller along the right and bottom edges, where image differs from reference by more than
+// threshold: the mean absolute difference of the channels, in 8 bit levels. Images are 32 bits per pixel, of the
+// same size and row stride.
+std::vector<Tile>
+changedTiles(const uint8_t* image,
+             const uint8_t* reference,
+             int width,
+             int height,
+             size_t bytesPerLine,
+             int tileSize,
+             float threshold);
+
+// copy the pixels of tiles from src to dst, 32 bit images of the same size and row stride
+void
+copyTiles(const std::vector<Tile>& tiles, const uint8_t* src, uint8_t* dst, size_t bytesPerLine);
+
+// a tile frame message; encodedTiles[i] holds the image file of tiles[i]
+std::vector<uint8_t>
+pack(int width, int height, const std::vector<Tile>& tiles, const std::vector<std::vector<uint8_t>>& encodedTiles);
+
+} // namespace FrameTiles
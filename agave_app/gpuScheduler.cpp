@@ -0,0 +1,189 @@
+#include "gpuScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+GpuScheduler::GpuScheduler(int contexts)
+  : m_contexts((size_t)std::max(contexts, 1), Context{ 0, false })
+  , m_tickets(0)
+  , m_turns(0)
+{
+}
+
+double
+GpuScheduler::now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int
+GpuScheduler::addSession(uint64_t session)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return addSessionLocked(session);
+}
+
+int
+GpuScheduler::addSessionLocked(uint64_t session)
+{
+  auto found = m_sessions.find(session);
+  if (found != m_sessions.end()) {
+    return found->second.context;
+  }
+  int context = 0;
+  for (int i = 1; i < (int)m_contexts.size(); ++i) {
+    if (m_contexts[i].sessions < m_contexts[context].sessions) {
+      context = i;
+    }
+  }
+  m_contexts[context].sessions++;
+  m_sessions[session] = Session{ context, 0, 0 };
+  return context;
+}
+
+void
+GpuScheduler::removeSession(uint64_t session)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto found = m_sessions.find(session);
+  if (found == m_sessions.end()) {
+    return;
+  }
+  Context& context = m_contexts[found->second.context];
+  context.sessions--;
+  if (found->second.depth > 0) {
+    context.busy = false;
+    m_released.notify_all();
+  }
+  m_sessions.erase(found);
+}
+
+int
+GpuScheduler::contextOf(uint64_t session) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto found = m_sessions.find(session);
+  return found == m_sessions.end() ? -1 : found->second.context;
+}
+
+int
+GpuScheduler::contextCount() const
+{
+  return (int)m_contexts.size();
+}
+
+int
+GpuScheduler::waiting(int context) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  int count = 0;
+  for (const Waiter& waiter : m_waiting) {
+    if (m_sessions.at(waiter.session).context == context) {
+      count++;
+    }
+  }
+  return count;
+}
+
+size_t
+GpuScheduler::pickNext(const std::vector<Waiter>& waiters)
+{
+  size_t best = 0;
+  for (size_t i = 1; i < waiters.size(); ++i) {
+    const Waiter& a = waiters[i];
+    const Waiter& b = waiters[best];
+    bool better;
+    if (a.interactive != b.interactive) {
+      better = a.interactive;
+    } else if (a.interactive && a.deadline != b.deadline) {
+      better = a.deadline < b.deadline;
+    } else if (!a.interactive && a.lastServed != b.lastServed) {
+      better = a.lastServed < b.lastServed;
+    } else {
+      better = a.ticket < b.ticket;
+    }
+    if (better) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+int
+GpuScheduler::pickDevice(const std::vector<DeviceLoad>& devices)
+{
+  double queued = 0.0;
+  double memory = 0.0;
+  for (const DeviceLoad& device : devices) {
+    queued += device.queuedRequests;
+    memory += (double)device.memoryBytes;
+  }
+  int best = 0;
+  double bestLoad = 0.0;
+  for (int i = 0; i < (int)devices.size(); ++i) {
+    double load = (queued > 0.0 ? devices[i].queuedRequests / queued : 0.0) +
+                  (memory > 0.0 ? devices[i].memoryBytes / memory : 0.0);
+    if (i == 0 || load < bestLoad || (load == bestLoad && devices[i].sessions < devices[best].sessions)) {
+      best = i;
+      bestLoad = load;
+    }
+  }
+  return best;
+}
+
+int
+GpuScheduler::nextWaiter(int context) const
+{
+  std::vector<Waiter> candidates;
+  std::vector<int> indices;
+  for (size_t i = 0; i < m_waiting.size(); ++i) {
+    if (m_sessions.at(m_waiting[i].session).context == context) {
+      candidates.push_back(m_waiting[i]);
+      indices.push_back((int)i);
+    }
+  }
+  return candidates.empty() ? -1 : indices[pickNext(candidates)];
+}
+
+void
+GpuScheduler::acquire(uint64_t session, bool interactive, double deadline)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  addSessionLocked(session);
+  Session& state = m_sessions[session];
+  if (state.depth > 0) {
+    state.depth++;
+    return;
+  }
+
+  uint64_t ticket = ++m_tickets;
+  m_waiting.push_back(Waiter{ session, interactive, deadline, ticket, state.lastServed });
+  int context = state.context;
+  m_released.wait(lock, [this, context, ticket]() {
+    if (m_contexts[context].busy) {
+      return false;
+    }
+    int next = nextWaiter(context);
+    return next >= 0 && m_waiting[next].ticket == ticket;
+  });
+
+  m_waiting.erase(std::find_if(
+    m_waiting.begin(), m_waiting.end(), [ticket](const Waiter& waiter) { return waiter.ticket == ticket; }));
+  m_contexts[context].busy = true;
+  state.depth = 1;
+  state.lastServed = ++m_turns;
+}
+
+void
+GpuScheduler::release(uint64_t session)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto found = m_sessions.find(session);
+  if (found == m_sessions.end() || found->second.depth == 0) {
+    return;
+  }
+  if (--found->second.depth == 0) {
+    m_contexts[found->second.context].busy = false;
+    m_released.notify_all();
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Hands out turns on a few GL contexts to many render sessions. Each session is placed on the context with the fewest
+// sessions, and the sessions of a context render on it one turn at a time; a turn is one frame, or one command
+// buffer.
+//
+// Interactive turns, for requests a client is waiting on, go first, earliest deadline first. The remaining turns go
+// round robin to the session that was served least recently, so that sessions refining their image in the background
+// get an even share of the GPU.
+class GpuScheduler
+{
+public:
+  explicit GpuScheduler(int contexts = 1);
+
+  // place a session on a context, and return the context's index; a session stays on its context until removed
+  int addSession(uint64_t session);
+  // not while the session waits for a turn; a turn it holds is given up
+  void removeSession(uint64_t session);
+  // -1 for a session that was not added
+  int contextOf(uint64_t session) const;
+  int contextCount() const;
+  // sessions waiting for a turn on the context
+  int waiting(int context) const;
+
+  // seconds on a steady clock, for deadlines
+  static double now();
+
+  // Wait for a turn on the session's context. Turns nest: a session that holds its context gets it again at once,
+  // and gives it up with its outermost release. A session that was not added is added.
+  void acquire(uint64_t session, bool interactive = false, double deadline = 0.0);
+  void release(uint64_t session);
+
+  struct Waiter
+  {
+    uint64_t session;
+    bool interactive;
+    double deadline;
+    // order of arrival
+    uint64_t ticket;
+    // the turn the session was last served in; 0 if never
+    uint64_t lastServed;
+  };
+  // index of the waiter to serve next; waiters is not empty
+  static size_t pickNext(const std::vector<Waiter>& waiters);
+
+  // what is on a GPU, to place a new session by
+  struct DeviceLoad
+  {
+    // render requests waiting in the queues of its sessions
+    int queuedRequests;
+    // GPU memory of its sessions
+    size_t memoryBytes;
+    int sessions;
+  };
+  // The device to place a new session on: the least loaded by its share of all queued requests plus its share of all
+  // memory in use, then the one with the fewest sessions, then the first. devices is not empty.
+  static int pickDevice(const std::vector<DeviceLoad>& devices);
+
+private:
+  struct Session
+  {
+    int context;
+    // nested acquires of the turn it holds
+    int depth;
+    uint64_t lastServed;
+  };
+  struct Context
+  {
+    int sessions;
+    bool busy;
+  };
+
+  int addSessionLocked(uint64_t session);
+  // the waiter of context to serve next, or -1
+  int nextWaiter(int context) const;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_released;
+  std::vector<Context> m_contexts;
+  std::map<uint64_t, Session> m_sessions;
+  std::vector<Waiter> m_waiting;
+  uint64_t m_tickets;
+  uint64_t m_turns;
+};
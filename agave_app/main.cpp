@@ -1,7 +1,13 @@
 #include "agaveGui.h"
 
+#include "admissionControl.h"
+#include "commandReplay.h"
+#include "streamQuality.h"
 #include "mainwindow.h"
+#include "renderlib/ImageXYZC.h"
 #include "renderlib/Logging.h"
+#include "renderlib/MemoryAccounting.h"
+#include "renderlib/Tracing.h"
 #include "renderlib/io/FileReader.h"
 #include "renderlib/renderlib.h"
 #include "renderlib/version.h"
@@ -10,6 +16,7 @@
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QDir>
+#include <QFileInfo>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -21,10 +28,40 @@ struct ServerParams
 {
   int _port;
   QStringList _preloadList;
+  // 0 bins every voxel
+  int _histogramSamples;
+  bool _reuseHistograms;
+  // load data in the background while rendering continues
+  bool _backgroundLoads;
+  // serve Prometheus metrics over HTTP on this port; 0 to not serve them
+  int _metricsPort;
+  // record the commands of every session into this directory; empty to not record
+  QString _recordDir;
+  // megabytes per memory category name (see MemoryAccounting::categoryName) or "total"; missing is unlimited
+  QJsonObject _memoryBudgets;
+  // limits on sessions, and the render load thresholds to queue clients and lower session quality at
+  AdmissionControl::Options _admission;
+  // threads encoding images; 0 picks half the hardware threads
+  int _encoderThreads;
+  // encoding and throttling of streamed images
+  StreamQuality::Options _streamQuality;
+  // tile frames for clients that ask for them: tile edge in pixels, and the mean difference a tile must change by
+  int _tileSize;
+  float _tileThreshold;
+  // GL contexts the sessions take turns on, when headless
+  int _renderContexts;
 
   // defaults
   ServerParams()
     : _port(1235)
+    , _histogramSamples(0)
+    , _reuseHistograms(false)
+    , _backgroundLoads(false)
+    , _metricsPort(0)
+    , _encoderThreads(0)
+    , _tileSize(64)
+    , _tileThreshold(1.0f)
+    , _renderContexts(1)
   {
   }
 };
@@ -54,7 +91,24 @@ readConfig(QString configPath)
   // server config file:
   // {
   //   port: 1235,
-  //   preload: ['/path/to/file1', '/path/to/file2', ...]
+  //   preload: ['/path/to/file1', '/path/to/file2', ...],
+  //   histogramSamples: 1000000,
+  //   reuseHistograms: true,
+  //   backgroundLoads: true,
+  //   metricsPort: 9090,
+  //   recordDir: '/path/to/traces',
+  //   memoryBudgets: { total: 16384, gpu_textures: 8192 },
+  //   maxSessions: 4,
+  //   maxWaiting: 16,
+  //   maxRenderLoad: 0.9,
+  //   degradeRenderLoad: 0.8,
+  //   restoreRenderLoad: 0.5,
+  //   encoderThreads: 4,
+  //   streamQuality: { minQuality: 50, maxQuality: 92, settleIterations: 64, earlyScale: 0.5, earlyIterations: 4,
+  //                    maxFps: 30, maxMbps: 20, losslessLast: false },
+  //   tileSize: 64,
+  //   tileThreshold: 1.0,
+  //   renderContexts: 1
   // }
 
   if (json.contains("port") /* && json["port"].isDouble()*/) {
@@ -71,9 +125,84 @@ readConfig(QString configPath)
     }
   }
 
+  if (json.contains("histogramSamples")) {
+    p._histogramSamples = json["histogramSamples"].toInt(p._histogramSamples);
+  }
+  if (json.contains("reuseHistograms")) {
+    p._reuseHistograms = json["reuseHistograms"].toBool(p._reuseHistograms);
+  }
+  if (json.contains("backgroundLoads")) {
+    p._backgroundLoads = json["backgroundLoads"].toBool(p._backgroundLoads);
+  }
+  if (json.contains("metricsPort")) {
+    p._metricsPort = json["metricsPort"].toInt(p._metricsPort);
+  }
+  if (json.contains("recordDir")) {
+    p._recordDir = json["recordDir"].toString(p._recordDir);
+  }
+  if (json.contains("memoryBudgets") && json["memoryBudgets"].isObject()) {
+    p._memoryBudgets = json["memoryBudgets"].toObject();
+  }
+  if (json.contains("maxSessions")) {
+    p._admission.maxSessions = std::max(1, json["maxSessions"].toInt(p._admission.maxSessions));
+  }
+  if (json.contains("maxWaiting")) {
+    p._admission.maxWaiting = std::max(0, json["maxWaiting"].toInt(p._admission.maxWaiting));
+  }
+  if (json.contains("maxRenderLoad")) {
+    p._admission.maxRenderLoad = json["maxRenderLoad"].toDouble(p._admission.maxRenderLoad);
+  }
+  if (json.contains("degradeRenderLoad")) {
+    p._admission.degradeRenderLoad = json["degradeRenderLoad"].toDouble(p._admission.degradeRenderLoad);
+  }
+  if (json.contains("restoreRenderLoad")) {
+    p._admission.restoreRenderLoad = json["restoreRenderLoad"].toDouble(p._admission.restoreRenderLoad);
+  }
+  if (json.contains("encoderThreads")) {
+    p._encoderThreads = std::max(0, json["encoderThreads"].toInt(p._encoderThreads));
+  }
+  if (json.contains("streamQuality") && json["streamQuality"].isObject()) {
+    QJsonObject quality = json["streamQuality"].toObject();
+    StreamQuality::Options& q = p._streamQuality;
+    q.minQuality = std::max(1, std::min(quality["minQuality"].toInt(q.minQuality), 100));
+    q.maxQuality = std::max(q.minQuality, std::min(quality["maxQuality"].toInt(q.maxQuality), 100));
+    q.settleIterations = quality["settleIterations"].toInt(q.settleIterations);
+    q.earlyScale = std::max(0.1f, std::min((float)quality["earlyScale"].toDouble(q.earlyScale), 1.0f));
+    q.earlyIterations = quality["earlyIterations"].toInt(q.earlyIterations);
+    q.maxFramesPerSecond = quality["maxFps"].toDouble(q.maxFramesPerSecond);
+    // megabits
+    q.maxBytesPerSecond = quality["maxMbps"].toDouble(q.maxBytesPerSecond * 8.0 / 1.0e6) * 1.0e6 / 8.0;
+    q.losslessLast = quality["losslessLast"].toBool(q.losslessLast);
+  }
+  if (json.contains("tileSize")) {
+    p._tileSize = std::max(8, json["tileSize"].toInt(p._tileSize));
+  }
+  if (json.contains("tileThreshold")) {
+    p._tileThreshold = std::max(0.0f, (float)json["tileThreshold"].toDouble(p._tileThreshold));
+  }
+  if (json.contains("renderContexts")) {
+    p._renderContexts = std::max(1, json["renderContexts"].toInt(p._renderContexts));
+  }
+
   return p;
 }
 
+void
+applyMemoryBudgets(const QJsonObject& budgetsMB)
+{
+  static const double MB = 1024.0 * 1024.0;
+  for (size_t i = 0; i < MemoryAccounting::CATEGORY_COUNT; ++i) {
+    MemoryAccounting::Category category = (MemoryAccounting::Category)i;
+    QString name = MemoryAccounting::categoryName(category);
+    if (budgetsMB.contains(name)) {
+      MemoryAccounting::setBudget(category, (uint64_t)(budgetsMB[name].toDouble() * MB));
+    }
+  }
+  if (budgetsMB.contains("total")) {
+    MemoryAccounting::setTotalBudget((uint64_t)(budgetsMB["total"].toDouble() * MB));
+  }
+}
+
 void
 preloadFiles(QStringList preloadlist)
 {
@@ -85,6 +214,8 @@ preloadFiles(QStringList preloadlist)
       loadSpec.scene = 0;
       loadSpec.time = 0;
 
+      // the volume texture stays on the gpu with the cached image
+      MemoryAccounting::ScopedOwner memoryOwner("dataset:" + loadSpec.filepath);
       auto img = FileReader::loadAndCache(loadSpec);
       renderlib::imageAllocGPU(img);
     } else {
@@ -93,6 +224,24 @@ preloadFiles(QStringList preloadlist)
   }
 }
 
+// runs a recorded command trace headlessly; returns the exit code
+int
+replayCommands(QApplication& app, const QString& tracePath, double speed, bool backgroundLoads)
+{
+  std::vector<CommandTraceEntry> entries;
+  if (!readCommandTrace(tracePath.toStdString(), entries)) {
+    LOG_ERROR << tracePath.toStdString() << " is not a command trace";
+    return 1;
+  }
+  // recordings are named session<N>-<renderer type>.agvtrace
+  std::string rendererType = QFileInfo(tracePath).completeBaseName().section('-', -1).toStdString();
+
+  CommandReplay replay(entries, renderlib::stringToRendererType(rendererType), speed, backgroundLoads);
+  QObject::connect(&replay, &CommandReplay::finished, &app, &QApplication::quit, Qt::QueuedConnection);
+  replay.start();
+  return app.exec();
+}
+
 static const QString kAgaveUrlPrefix("agave://");
 
 std::string
@@ -174,7 +323,8 @@ main(int argc, char* argv[])
   parser.addOption(listDevicesOption);
   QCommandLineOption selectGpuOption(
     "gpu",
-    QCoreApplication::translate("main", "Select EGL device by index (only valid in --server mode)."),
+    QCoreApplication::translate(
+      "main", "Select EGL devices by index, as in 0 or 0,2, or all of them with all (only valid in --server mode)."),
     QCoreApplication::translate("main", "gpu"),
     "0");
   parser.addOption(selectGpuOption);
@@ -183,13 +333,44 @@ main(int argc, char* argv[])
                                         QCoreApplication::translate("main", "config"),
                                         QCoreApplication::translate("main", "setup.cfg"));
   parser.addOption(serverConfigOption);
+  QCommandLineOption traceOption(
+    "trace",
+    QCoreApplication::translate("main", "Write load and render timings to this file on exit, as Chrome trace JSON."),
+    QCoreApplication::translate("main", "traceFile"));
+  parser.addOption(traceOption);
+  QCommandLineOption replayOption(
+    "replay",
+    QCoreApplication::translate("main", "Run a recorded command trace without GUI, then exit."),
+    QCoreApplication::translate("main", "commandTrace"));
+  parser.addOption(replayOption);
+  QCommandLineOption replaySpeedOption(
+    "replay_speed",
+    QCoreApplication::translate("main", "Replay at this multiple of the recorded pace; 0 is as fast as possible."),
+    QCoreApplication::translate("main", "speed"),
+    "1");
+  parser.addOption(replaySpeedOption);
 
   // Process the actual command line arguments given by the user
   parser.process(a);
 
-  bool isServer = parser.isSet(serverOption);
+  QString replayFile = parser.value(replayOption);
+  // a replay runs headless like the server
+  bool isServer = parser.isSet(serverOption) || !replayFile.isEmpty();
   bool listDevices = parser.isSet(listDevicesOption);
-  int selectedGpu = parser.value(selectGpuOption).toInt();
+  std::vector<int> selectedGpus;
+  QString gpuOption = parser.value(selectGpuOption);
+  if (gpuOption == "all") {
+    selectedGpus.push_back(renderlib::ALL_GPUS);
+  } else {
+    for (const QString& gpu : gpuOption.split(',', Qt::SkipEmptyParts)) {
+      selectedGpus.push_back(gpu.trimmed().toInt());
+    }
+  }
+  QString traceFile = parser.value(traceOption);
+  if (!traceFile.isEmpty()) {
+    Tracing::enable(true);
+    Tracing::setThreadName("main");
+  }
   QString fileInput = parser.value(loadOption);
   std::string fileToLoad;
   if (fileInput.startsWith(kAgaveUrlPrefix)) {
@@ -207,7 +388,7 @@ main(int argc, char* argv[])
     QStandardPaths::locate(QStandardPaths::AppLocalDataLocation, "assets", QStandardPaths::LocateDirectory);
   LOG_INFO << "Assets path: " << assetsPath.toStdString();
 
-  if (!renderlib::initialize(assetsPath.toStdString(), isServer, listDevices, selectedGpu)) {
+  if (!renderlib::initialize(assetsPath.toStdString(), isServer, listDevices, selectedGpus)) {
     renderlib::cleanup();
     return 0;
   }
@@ -219,24 +400,47 @@ main(int argc, char* argv[])
       QString configPath = parser.value(serverConfigOption);
       ServerParams p = readConfig(configPath);
 
-      StreamServer* server = new StreamServer(p._port, false, 0);
+      ChannelStatsOptions& stats = ImageXYZC::channelStatsOptions();
+      stats.maxHistogramSamples = p._histogramSamples > 0 ? (size_t)p._histogramSamples : 0;
+      stats.reuseHistogramsAcrossTimes = p._reuseHistograms;
+      applyMemoryBudgets(p._memoryBudgets);
 
-      // set to true to show windows, or false to run as a console application
-      static const bool gui = false;
-      if (gui) {
-        MainWindow* _ = new MainWindow(server);
-        _->resize(512, 512);
-        _->show();
+      if (!replayFile.isEmpty()) {
+        result = replayCommands(a, replayFile, parser.value(replaySpeedOption).toDouble(), p._backgroundLoads);
+      } else {
+        StreamServer* server = new StreamServer(p._port, false, 0);
+        server->setBackgroundLoads(p._backgroundLoads);
+        server->setAdmissionOptions(p._admission);
+        server->setStreamQuality(p._streamQuality);
+        server->setTileFrames(p._tileSize, p._tileThreshold);
+        server->setRenderContexts(p._renderContexts);
+        if (p._encoderThreads > 0) {
+          server->setEncoderThreads(p._encoderThreads);
+        }
+        if (p._metricsPort > 0) {
+          server->listenForMetrics(p._metricsPort);
+        }
+        if (!p._recordDir.isEmpty()) {
+          server->setRecordingDirectory(p._recordDir);
+        }
+
+        // set to true to show windows, or false to run as a console application
+        static const bool gui = false;
+        if (gui) {
+          MainWindow* _ = new MainWindow(server);
+          _->resize(512, 512);
+          _->show();
+        }
+
+        LOG_INFO << "Created server at working directory:" << QDir::currentPath().toStdString();
+
+        // delete logFile;
+
+        // must happen after renderlib init
+        preloadFiles(p._preloadList);
+
+        result = a.exec();
       }
-
-      LOG_INFO << "Created server at working directory:" << QDir::currentPath().toStdString();
-
-      // delete logFile;
-
-      // must happen after renderlib init
-      preloadFiles(p._preloadList);
-
-      result = a.exec();
     } else {
       agaveGui* w = new agaveGui();
       a.setGUI(w);
@@ -254,5 +458,13 @@ main(int argc, char* argv[])
 
   renderlib::cleanup();
 
+  if (!traceFile.isEmpty()) {
+    if (Tracing::writeChromeTrace(traceFile.toStdString())) {
+      LOG_INFO << "Wrote trace of " << Tracing::eventCount() << " spans to " << traceFile.toStdString();
+    } else {
+      LOG_ERROR << "Failed to write trace to " << traceFile.toStdString();
+    }
+  }
+
   return result;
 }
@@ -743,7 +743,7 @@ RenderDialog::render()
 
     if (!m_renderThread) {
 
-      m_renderThread = new Renderer("Render dialog render thread ", this, m_mutex);
+      m_renderThread = new Renderer("Render dialog render thread ", this, m_gpuScheduler);
 
       // queued across thread boundary.  requestProcessed is called from another thread, asynchronously.
       connect(m_renderThread, &Renderer::requestProcessed, this, &RenderDialog::onRenderRequestProcessed);
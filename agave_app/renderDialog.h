@@ -6,7 +6,6 @@
 #include "renderer.h"
 
 #include <QDialog>
-#include <QMutex>
 #include <QStandardPaths>
 
 class QButtonGroup;
@@ -103,7 +102,7 @@ private slots:
   void onRenderDurationTypeChanged(int index);
 
 private:
-  QMutex m_mutex;
+  GpuScheduler m_gpuScheduler;
   QOpenGLContext* m_glContext;
   Renderer* m_renderThread;
   IRenderWindow* m_renderer;
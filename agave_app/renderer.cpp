@@ -2,10 +2,12 @@
 
 #include "renderlib/AppScene.h"
 #include "renderlib/CCamera.h"
+#include "renderlib/ImageXYZC.h"
 #include "renderlib/Logging.h"
 #include "renderlib/RenderSettings.h"
 #include "renderlib/ScaleBarTool.h"
 #include "renderlib/SceneView.h"
+#include "renderlib/Tracing.h"
 #include "renderlib/graphics/RenderGL.h"
 #include "renderlib/graphics/RenderGLPT.h"
 #include "renderlib/io/FileReader.h"
@@ -19,20 +21,84 @@
 #include <QMutexLocker>
 #include <QOpenGLFramebufferObjectFormat>
 
-Renderer::Renderer(QString id, QObject* parent, QMutex& mutex)
+// a request a client waits on should get its turn on the GPU within this long of arriving
+static const double INTERACTIVE_TURN_SECONDS = 0.1;
+
+static double
+turnDeadline(const RenderRequest* request)
+{
+  return GpuScheduler::now() - request->getAge() / 1.0e9 + INTERACTIVE_TURN_SECONDS;
+}
+
+Renderer::GpuTurn::GpuTurn(Renderer* renderer, bool interactive, double deadline)
+  : m_renderer(renderer)
+{
+  if (m_renderer->m_gpuTurnDepth++ > 0) {
+    return;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  m_renderer->m_gpuScheduler->acquire(m_renderer->gpuSession(), interactive, deadline);
+  m_renderer->m_metrics.gpuWaitSeconds->observe(timer.nsecsElapsed() / 1.0e9);
+  m_renderer->m_rglContext->makeCurrent();
+  if (m_renderer->m_sharedContext) {
+    m_renderer->restoreGLState();
+  }
+}
+
+Renderer::GpuTurn::~GpuTurn()
+{
+  if (--m_renderer->m_gpuTurnDepth > 0) {
+    return;
+  }
+  m_renderer->m_rglContext->doneCurrent();
+  m_renderer->m_gpuScheduler->release(m_renderer->gpuSession());
+}
+
+Renderer::Renderer(QString id, QObject* parent, GpuScheduler& scheduler)
   : QThread(parent)
   , m_id(id)
   , m_streamMode(false)
   , m_frameIterations(0)
   , m_frameTimeSeconds(0.0f)
   , m_fbo(nullptr)
+  , m_fboMemory(MemoryAccounting::Category::Framebuffers, "session:" + id.toStdString())
+  , m_readbackMemory(MemoryAccounting::Category::Framebuffers, "session:" + id.toStdString())
+  , m_resolutionScale(1.0f)
+  , m_maxIterations(0)
   , m_width(0)
   , m_height(0)
-  , m_openGLMutex(&mutex)
+  , m_gpuScheduler(&scheduler)
   , m_wait()
-  , m_rglContext()
+  , m_rglContext(std::make_shared<RendererGLContext>())
+  , m_sharedContext(false)
+  , m_gpuTurnDepth(0)
 {
-  this->m_totalQueueDuration = 0;
+  // until frames are measured
+  this->m_renderMs = 10.0;
+
+  Metrics::Labels session = { { "session", id.toStdString() } };
+  m_metrics.queueDepth = Metrics::gauge("agave_session_queue_depth", "Render requests waiting in the queue", session);
+  m_metrics.renderSeconds =
+    Metrics::histogram("agave_session_render_seconds", "Time to render and read back a frame", session);
+  m_metrics.frames = Metrics::counter("agave_session_frames_total", "Frames rendered", session);
+  m_metrics.encodeSeconds = Metrics::histogram("agave_session_encode_seconds", "Time to encode a frame", session);
+  m_metrics.requestSeconds = Metrics::histogram(
+    "agave_session_request_seconds", "Time from receiving a render request to sending its frame", session);
+  m_metrics.bytesSent = Metrics::counter("agave_session_sent_bytes_total", "Encoded frame bytes sent", session);
+  m_metrics.framesDropped =
+    Metrics::counter("agave_session_dropped_frames_total", "Stream frames not sent to keep to the frame rate", session);
+  m_metrics.hostBytes = Metrics::gauge("agave_session_host_memory_bytes", "Host memory of the loaded volume", session);
+  m_metrics.gpuBytes =
+    Metrics::gauge("agave_session_gpu_memory_bytes", "GPU memory of the loaded volume and renderer", session);
+  m_metrics.qualityLevel =
+    Metrics::gauge("agave_session_quality_level", "Steps the session's render quality is lowered by", session);
+  m_metrics.gpuWaitSeconds =
+    Metrics::histogram("agave_session_gpu_wait_seconds", "Time waiting for a turn on the GPU", session);
+  m_metrics.requestsCoalesced = Metrics::counter(
+    "agave_session_coalesced_requests_total", "Requests answered by one render with the requests after them", session);
+  m_metrics.commandsSkipped =
+    Metrics::counter("agave_session_skipped_commands_total", "Commands replaced by a later queued command", session);
 
   LOG_DEBUG << "Renderer " << id.toStdString() << " -- Initializing rendering thread...";
   LOG_DEBUG << "Renderer " << id.toStdString() << " -- Done.";
@@ -40,8 +106,20 @@ Renderer::Renderer(QString id, QObject* parent, QMutex& mutex)
 
 Renderer::~Renderer()
 {
+  // jobs report back to this renderer when they finish
+  m_jobs.cancelAll();
+  m_jobs.waitForAll();
+
   // delete all outstanding requests.
-  qDeleteAll(this->m_requests);
+  for (auto& job : m_backgroundJobs) {
+    if (!job->queued) {
+      delete job->request;
+    }
+  }
+  this->m_requests.clear();
+  qDeleteAll(this->m_supersededRequests);
+
+  Metrics::removeSeries("session", m_id.toStdString());
 }
 
 void
@@ -71,6 +149,7 @@ Renderer::configure(IRenderWindow* renderer,
     m_myVolumeData.m_camera->m_Film.m_Resolution.SetResY(1024);
 
     m_myVolumeData.ownRenderer = true;
+    MemoryAccounting::ScopedOwner sessionOwner(memoryOwner());
     m_myVolumeData.m_renderer = renderlib::createRenderer(rendererMode, m_myVolumeData.m_renderSettings);
     m_myVolumeData.m_renderer->setScene(m_myVolumeData.m_scene);
   } else {
@@ -78,13 +157,24 @@ Renderer::configure(IRenderWindow* renderer,
     m_myVolumeData.m_renderer = renderer;
   }
 
-  m_rglContext.configure(glContext);
+  m_rglContext->configure(glContext);
+}
+
+void
+Renderer::shareContext(std::shared_ptr<RendererGLContext> context)
+{
+  m_rglContext = context;
+  m_sharedContext = true;
 }
 
 void
 Renderer::init()
 {
-  m_rglContext.init();
+  if (!m_sharedContext) {
+    m_rglContext->init();
+    m_rglContext->doneCurrent();
+  }
+  GpuTurn turn(this);
 
   int status = gladLoadGL();
   if (!status) {
@@ -99,6 +189,8 @@ Renderer::init()
                                           m_myVolumeData.m_camera->m_Film.m_Resolution.GetResY());
   }
 
+  m_readback.reset(new GLFramebufferReadback(READBACK_BUFFERS));
+
   this->resizeGL(m_myVolumeData.m_camera->m_Film.m_Resolution.GetResX(),
                  m_myVolumeData.m_camera->m_Film.m_Resolution.GetResY());
 
@@ -108,17 +200,32 @@ Renderer::init()
   glEnable(GL_MULTISAMPLE);
 
   reset();
+}
 
-  m_rglContext.doneCurrent();
+void
+Renderer::restoreGLState()
+{
+  // as reset and the renderers' initialize leave it
+  glClearColor(0.0, 0.0, 0.0, 1.0);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glEnable(GL_BLEND);
+  glEnable(GL_LINE_SMOOTH);
+  glEnable(GL_MULTISAMPLE);
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_CULL_FACE);
+  if (m_fbo) {
+    glViewport(0, 0, m_fbo->width(), m_fbo->height());
+  }
 }
 
 void
 Renderer::run()
 {
+  Tracing::setThreadName("renderer " + m_id.toStdString());
+  // whatever this session allocates on its thread, unless it is loaded data
+  MemoryAccounting::ScopedOwner sessionOwner(memoryOwner());
   this->init();
 
-  m_rglContext.makeCurrent();
-
   while (!this->isInterruptionRequested()) {
     this->processRequest();
 
@@ -126,8 +233,8 @@ Renderer::run()
     QApplication::processEvents();
   }
 
-  m_rglContext.makeCurrent();
   if (m_myVolumeData.ownRenderer) {
+    GpuTurn turn(this);
     m_myVolumeData.m_renderer->cleanUpResources();
   }
   shutDown();
@@ -144,13 +251,49 @@ Renderer::addRequest(RenderRequest* request)
 {
   m_requestMutex.lock();
 
-  this->m_requests << request;
-  this->m_totalQueueDuration += request->getDuration();
+  // a newer load does not wait for the one it makes obsolete; the requests held behind it run, then the new load
+  if (this->m_requests.supersedesHeld(request)) {
+    m_backgroundJobs.front()->token->cancel();
+    dropCancelledJobs();
+  }
+
+  // a request takes a frame at most, as the requests queued together share one
+  request->setEstimatedDuration((int)(m_renderMs + 0.5));
+  this->m_requests.push(request);
+  m_metrics.queueDepth->set(this->m_requests.count());
   m_requestMutex.unlock();
 
   this->m_wait.wakeAll();
 }
 
+void
+Renderer::skipReplacedCommands()
+{
+  std::vector<Command*> commands;
+  // the request and index of each of commands
+  std::vector<std::pair<RenderRequest*, size_t>> owners;
+  for (RenderRequest* r : m_requests.requests()) {
+    // a request resumed after its background job continues where it stopped
+    size_t start = 0;
+    if (!m_backgroundJobs.empty() && m_backgroundJobs.front()->queued && m_backgroundJobs.front()->request == r) {
+      start = m_backgroundJobs.front()->resumeIndex;
+    }
+    std::vector<Command*> cmds = r->getParameters();
+    for (size_t i = start; i < cmds.size(); ++i) {
+      if (!r->isSkipped(i)) {
+        commands.push_back(cmds[i]);
+        owners.push_back({ r, i });
+      }
+    }
+  }
+  std::vector<bool> replaced = replacedCommands(commands);
+  for (size_t i = 0; i < replaced.size(); ++i) {
+    if (replaced[i]) {
+      owners[i].first->skipCommand(owners[i].second);
+    }
+  }
+}
+
 bool
 Renderer::shouldContinue()
 {
@@ -170,33 +313,46 @@ Renderer::processRequest()
 {
   // sleep till request queue has a task
   m_requestMutex.lock();
-  if (m_requests.isEmpty()) {
+  if (!m_requests.hasNext()) {
     m_wait.wait(&m_requestMutex);
   }
-  if (m_requests.isEmpty()) {
+  if (!m_requests.hasNext()) {
     m_requestMutex.unlock();
     return false;
   }
+  skipReplacedCommands();
 
   RenderRequest* lastReq = nullptr;
   QImage img;
   if (m_streamMode) {
     QElapsedTimer timer;
     timer.start();
+    // whether a client waits on any of the requests, and by when
+    bool interactive = false;
+    double deadline = 0.0;
 
     // eat requests until done, and then render
     // note that any one request could change the streaming mode.
-    while (!this->m_requests.isEmpty() && m_streamMode && !this->isInterruptionRequested()) {
-      RenderRequest* r = this->m_requests.takeFirst();
-      this->m_totalQueueDuration -= r->getDuration();
+    while (this->m_requests.hasNext() && m_streamMode && !this->isInterruptionRequested()) {
+      RenderRequest* r = this->m_requests.takeNext();
+      if (!r->isRefinement()) {
+        deadline = interactive ? std::min(deadline, turnDeadline(r)) : turnDeadline(r);
+        interactive = true;
+      }
 
       std::vector<Command*> cmds = r->getParameters();
+      bool done = true;
       if (cmds.size() > 0) {
-        this->processCommandBuffer(r);
+        done = this->processCommandBuffer(r);
       }
 
       // the true last request will be passed to "emit" and deleted later
-      if (!this->m_requests.isEmpty() && m_streamMode) {
+      if (!done) {
+        // r waits for its background job; keep streaming the current volume to the client meanwhile
+        lastReq = (this->m_requests.hasNext() && m_streamMode)
+                    ? nullptr
+                    : new RenderRequest(r->getClient(), std::vector<Command*>(), r->isDebug());
+      } else if (this->m_requests.hasNext() && m_streamMode) {
         delete r;
         r = nullptr;
         lastReq = nullptr;
@@ -205,13 +361,16 @@ Renderer::processRequest()
       }
     }
     if (lastReq) {
+      // the frame and, at the end of the stream, its readback in one turn
+      GpuTurn turn(this, interactive, deadline);
       QWebSocket* ws = lastReq->getClient();
       if (ws /* && ws->isValid() && ws->state() == QAbstractSocket::ConnectedState */) {
         LOG_DEBUG << "RENDER for " << ws->peerName().toStdString() << "(" << ws->peerAddress().toString().toStdString()
                   << ":" << QString::number(ws->peerPort()).toStdString() << ")";
       }
 
-      img = this->render();
+      // with pipelined readback img may be an earlier frame, or none yet
+      img = this->render(m_pipelinedReadback && !m_hdrReadback);
       // LOG_DEBUG << "RENDERED sample iteration " << m_frameIterations << " in " << timer.nsecsElapsed() << "ns";
 
       lastReq->setActualDuration(timer.nsecsElapsed());
@@ -220,42 +379,74 @@ Renderer::processRequest()
       // if queue is empty, then keep firing redraws back to client, to build up iterations.
       m_frameIterations++;
       m_frameTimeSeconds += timer.nsecsElapsed() / (1000.0f * 1000.0f * 1000.0f);
-      if (m_streamMode && shouldContinue()) {
+      bool streaming = m_streamMode && shouldContinue();
+      if (streaming) {
         // push another redraw request.
         std::vector<Command*> cmd;
         RequestRedrawCommandD data;
         cmd.push_back(new RequestRedrawCommand(data));
         RenderRequest* rr = new RenderRequest(ws, cmd, false);
+        rr->setRefinement(true);
+        rr->setEstimatedDuration((int)(m_renderMs + 0.5));
 
-        this->m_requests << rr;
-        this->m_totalQueueDuration += rr->getDuration();
+        this->m_requests.push(rr);
+      } else {
+        // the stream stops at this frame, so it has to reach the client
+        QImage newest = this->finishFrames();
+        if (!newest.isNull()) {
+          img = newest;
+        }
       }
+      lastReq->setStreamFrame(m_myVolumeData.m_renderSettings->GetNoIterations(), !streaming);
     }
 
   } else {
-    // if not in stream mode, then process one request, then re-render.
-    if (!this->m_requests.isEmpty() && !this->isInterruptionRequested()) {
-
-      // remove request from the queue
-      RenderRequest* r = this->m_requests.takeFirst();
-      this->m_totalQueueDuration -= r->getDuration();
-
-      // process it
+    // if not in stream mode, then process the queued requests, then render once for all of them.
+    if (this->m_requests.hasNext() && !this->isInterruptionRequested()) {
       QElapsedTimer timer;
       timer.start();
-
-      std::vector<Command*> cmds = r->getParameters();
-      if (cmds.size() > 0) {
-        this->processCommandBuffer(r);
+      // the first request is the oldest, and has the earliest deadline
+      RenderRequest* first = this->m_requests.next();
+      GpuTurn turn(this, !first->isRefinement(), turnDeadline(first));
+
+      QList<RenderRequest*> processed;
+      // a command may switch to stream mode; the requests after it are streamed
+      while (this->m_requests.hasNext() && !m_streamMode && !this->isInterruptionRequested()) {
+        RenderRequest* r = this->m_requests.takeNext();
+
+        std::vector<Command*> cmds = r->getParameters();
+        bool done = true;
+        if (cmds.size() > 0) {
+          done = this->processCommandBuffer(r);
+        }
+        // a request waiting for its background job is rendered when it resumes; the ones before it are answered now
+        if (!done) {
+          break;
+        }
+        processed << r;
       }
 
-      img = this->render();
+      if (!processed.isEmpty()) {
+        img = this->render(false);
 
-      r->setActualDuration(timer.nsecsElapsed());
-      lastReq = r;
+        for (RenderRequest* r : processed) {
+          r->setActualDuration(timer.nsecsElapsed());
+        }
+        lastReq = processed.takeLast();
+        // answered with the same image
+        m_supersededRequests << processed;
+        m_metrics.requestsCoalesced->add((double)processed.size());
+      }
     }
   }
 
+  // superseded requests get the same image as the last one
+  QList<RenderRequest*> superseded;
+  if (lastReq && !img.isNull()) {
+    superseded.swap(m_supersededRequests);
+  }
+  m_metrics.queueDepth->set(this->m_requests.count());
+
   // unlock mutex BEFORE emit, in case the signal handler wants to add a request
   m_requestMutex.unlock();
 
@@ -263,10 +454,23 @@ Renderer::processRequest()
   // TODO : have a mode where we don't need a QImage
   // and can just return rgba byte array as a thread safe shared ptr
   // writable by render thread and readable by anyone else
-  if (!this->isInterruptionRequested()) {
+  if (!this->isInterruptionRequested() && lastReq && img.isNull()) {
+    // the frame is still being read back; it goes out with a later request
+    delete lastReq;
+  } else if (!this->isInterruptionRequested() && lastReq) {
+    holdFrames((int)superseded.size() + 1);
     // TODO look into this way of having the main thread handle this.
     // QMetaObject::invokeMethod(
     //  renderDialog, [=]() { /* ... onRenderRequestProcessed(lastReq, img); ... */ }, Qt::QueuedConnection);
+    if (m_hdrPixels) {
+      for (RenderRequest* r : superseded) {
+        r->setHdrPixels(m_hdrPixels, m_hdrWidth, m_hdrHeight);
+      }
+      lastReq->setHdrPixels(m_hdrPixels, m_hdrWidth, m_hdrHeight);
+    }
+    for (RenderRequest* r : superseded) {
+      emit requestProcessed(r, img);
+    }
     emit requestProcessed(lastReq, img);
 
     if (m_streamMode && !shouldContinue()) {
@@ -278,10 +482,21 @@ Renderer::processRequest()
   return true;
 }
 
-void
+bool
 Renderer::processCommandBuffer(RenderRequest* rr)
 {
-  m_rglContext.makeCurrent();
+  // commands may change GL objects, so they take a turn too
+  GpuTurn turn(this, !rr->isRefinement(), turnDeadline(rr));
+
+  // a request resumed after its background job finished continues where it stopped
+  size_t start = 0;
+  std::function<void(ExecutionContext*)> apply;
+  if (!m_backgroundJobs.empty() && m_backgroundJobs.front()->queued && m_backgroundJobs.front()->request == rr) {
+    start = m_backgroundJobs.front()->resumeIndex;
+    apply = m_backgroundJobs.front()->apply;
+    m_backgroundJobs.pop_front();
+    queueReadyJob();
+  }
 
   std::vector<Command*> cmds = rr->getParameters();
   if (cmds.size() > 0) {
@@ -291,23 +506,143 @@ Renderer::processCommandBuffer(RenderRequest* rr)
     m_ec.m_camera = m_myVolumeData.m_camera;
     m_ec.m_message = "";
 
-    for (auto i = cmds.begin(); i != cmds.end(); ++i) {
-      (*i)->execute(&m_ec);
+    if (apply) {
+      apply(&m_ec);
+      if (!m_ec.m_message.empty()) {
+        emit sendString(rr, QString::fromStdString(m_ec.m_message));
+        m_ec.m_message = "";
+      }
+    }
+
+    for (size_t i = start; i < cmds.size(); ++i) {
+      if (rr->isSkipped(i)) {
+        m_metrics.commandsSkipped->add();
+        continue;
+      }
+      m_commandRequest = rr;
+      m_commandIndex = i;
+      m_commandDeferred = false;
+      {
+        TraceSpan span(cmds[i]->name(), "command");
+        cmds[i]->execute(&m_ec);
+      }
       // commands can fill in the message field of the ec, and we will send it back to the client
       if (!m_ec.m_message.empty()) {
         emit sendString(rr, QString::fromStdString(m_ec.m_message));
         m_ec.m_message = "";
       }
+      if (m_commandDeferred) {
+        return false;
+      }
     }
   }
+  return true;
+}
+
+void
+Renderer::runInBackground(std::function<std::function<void(ExecutionContext*)>(JobToken&)> work, bool replacesData)
+{
+  // called by a command in processCommandBuffer, so m_requestMutex is locked
+  auto job = std::make_shared<BackgroundJob>();
+  job->request = m_commandRequest;
+  job->resumeIndex = m_commandIndex + 1;
+  job->replacesData = replacesData;
+  m_commandDeferred = true;
+
+  // new data makes every pending load obsolete; otherwise only the pending update since the last data load
+  if (replacesData) {
+    m_jobs.cancelAll();
+  }
+  job->token = m_jobs.submit(replacesData ? "data" : "update", [this, job, work](JobToken& token) {
+    std::function<void(ExecutionContext*)> apply = work(token);
+
+    QMutexLocker locker(&m_requestMutex);
+    if (token.isCancelled()) {
+      return;
+    }
+    // applied on the render thread, which has the GL context
+    job->apply = apply;
+    job->ready = true;
+    queueReadyJob();
+    m_wait.wakeAll();
+  });
+  dropCancelledJobs();
+  m_backgroundJobs.push_back(job);
+  queueReadyJob();
+}
+
+void
+Renderer::dropCancelledJobs()
+{
+  for (auto it = m_backgroundJobs.begin(); it != m_backgroundJobs.end();) {
+    if (!(*it)->token->isCancelled()) {
+      ++it;
+      continue;
+    }
+    RenderRequest* r = (*it)->request;
+    if ((*it)->queued) {
+      m_requests.remove(r);
+    }
+    LOG_DEBUG << m_id.toStdString() << " -- superseded a background load";
+    m_supersededRequests << r;
+    it = m_backgroundJobs.erase(it);
+  }
+  // the first remaining job may be finished already
+  queueReadyJob();
+}
+
+void
+Renderer::queueReadyJob()
+{
+  if (m_backgroundJobs.empty()) {
+    m_requests.release();
+    return;
+  }
+  std::shared_ptr<BackgroundJob>& job = m_backgroundJobs.front();
+  if (job->ready && !job->queued) {
+    job->queued = true;
+    this->m_requests.pushFront(job->request);
+  }
+  // the requests after it wait for the rest of its commands
+  if (job->queued) {
+    m_requests.release();
+  } else {
+    m_requests.hold(job->replacesData);
+  }
+}
+
+void
+Renderer::holdFrames(int count)
+{
+  if (m_maxFramesInFlight <= 0) {
+    return;
+  }
+  QMutexLocker locker(&m_framesMutex);
+  while (m_framesInFlight >= m_maxFramesInFlight && !this->isInterruptionRequested()) {
+    // nothing wakes us up on interruption, so look now and then
+    m_framesReleased.wait(&m_framesMutex, 100);
+  }
+  m_framesInFlight += count;
+}
+
+void
+Renderer::releaseFrame()
+{
+  QMutexLocker locker(&m_framesMutex);
+  m_framesInFlight--;
+  m_framesReleased.wakeAll();
 }
 
 QImage
-Renderer::render()
+Renderer::render(bool pipelined)
 {
-  QMutexLocker locker(m_openGLMutex);
+  TraceSpan span("Renderer::render", "render");
+  QElapsedTimer timer;
+  timer.start();
+  GpuTurn turn(this);
 
-  m_rglContext.makeCurrent();
+  // follow quality changes
+  resizeFramebuffer();
 
   // DRAW
   m_myVolumeData.m_camera->Update();
@@ -320,6 +655,16 @@ Renderer::render()
   SceneView sceneView;
   sceneView.viewport.region = { { 0, 0 }, { m_fbo->width(), m_fbo->height() } };
   sceneView.camera = *(m_myVolumeData.m_camera);
+  if (m_fbo->width() != m_width || m_fbo->height() != m_height) {
+    sceneView.camera.m_Film.m_Resolution.SetResX(m_fbo->width());
+    sceneView.camera.m_Film.m_Resolution.SetResY(m_fbo->height());
+    sceneView.camera.Update();
+  }
+  int maxIterations = m_maxIterations;
+  if (maxIterations > 0) {
+    sceneView.camera.m_Film.m_ExposureIterations =
+      std::min(sceneView.camera.m_Film.m_ExposureIterations, maxIterations);
+  }
   sceneView.scene = m_myVolumeData.m_renderer->scene();
   sceneView.renderSettings = m_myVolumeData.m_renderSettings;
 
@@ -331,19 +676,78 @@ Renderer::render()
   // main scene rendering
   m_myVolumeData.m_renderer->renderTo(sceneView.camera, m_fbo);
 
+  if (m_hdrReadback) {
+    // a new buffer each frame, as requests of earlier frames may still hold theirs
+    auto pixels = std::make_shared<std::vector<float>>();
+    if (m_myVolumeData.m_renderer->readHdr(*pixels, m_hdrWidth, m_hdrHeight)) {
+      m_hdrPixels = pixels;
+    } else {
+      m_hdrPixels.reset();
+    }
+  }
+
   m_fbo->bind();
   m_myVolumeData.m_gestureRenderer.draw(sceneView, nullptr, m_myVolumeData.m_gesture.graphics);
   m_fbo->release();
 
-  std::unique_ptr<uint8_t> bytes(new uint8_t[m_fbo->width() * m_fbo->height() * 4]);
-  m_fbo->toImage(bytes.get());
-  QImage img = QImage(bytes.get(), m_fbo->width(), m_fbo->height(), QImage::Format_ARGB32).copy().mirrored();
+  TraceSpan readbackSpan("Renderer readback", "render");
+  QImage img;
+  if (pipelined) {
+    // keep a buffer free for this frame
+    if (m_readback->pending() == m_readback->bufferCount()) {
+      img = finishReadback();
+    }
+    m_readback->start(m_fbo);
+    // an earlier frame may be done by now
+    if (img.isNull() && m_readback->pending() > 1 && m_readback->ready()) {
+      img = finishReadback();
+    }
+  } else {
+    // frames still in flight are older than this one
+    m_readback->discard();
+    m_readback->start(m_fbo);
+    img = finishReadback();
+  }
+  m_readbackMemory.set(m_readback->bytes() + (m_hdrPixels ? m_hdrPixels->size() * sizeof(float) : 0));
 
-  m_rglContext.doneCurrent();
+  m_metrics.renderSeconds->observe(timer.nsecsElapsed() / 1.0e9);
+  m_renderMs += 0.2 * (timer.nsecsElapsed() / 1.0e6 - m_renderMs);
+  m_metrics.frames->add();
+  std::shared_ptr<ImageXYZC> volume = sceneView.scene ? sceneView.scene->m_volume : nullptr;
+  m_metrics.hostBytes->set(volume ? (double)volume->size() : 0.0);
+  MemoryAccounting::Usage memory = MemoryAccounting::ownerUsage(memoryOwner());
+  m_metrics.gpuBytes->set(
+    (double)(memory[MemoryAccounting::Category::GpuTextures] + memory[MemoryAccounting::Category::Framebuffers]));
 
   return img;
 }
 
+QImage
+Renderer::finishReadback()
+{
+  QImage img(m_readback->width(), m_readback->height(), QImage::Format_ARGB32);
+  m_readback->finish(img.bits(), img.bytesPerLine());
+  if (img.width() != m_width || img.height() != m_height) {
+    img = img.scaled(m_width, m_height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+  }
+  return img;
+}
+
+QImage
+Renderer::finishFrames()
+{
+  GpuTurn turn(this);
+
+  QImage img;
+  if (m_readback->pending() > 0) {
+    TraceSpan span("Renderer readback", "render");
+    // only the newest frame matters
+    m_readback->discard(1);
+    img = finishReadback();
+  }
+  return img;
+}
+
 void
 Renderer::resizeGL(int width, int height)
 {
@@ -351,8 +755,29 @@ Renderer::resizeGL(int width, int height)
     return;
   }
 
-  QMutexLocker locker(m_openGLMutex);
-  m_rglContext.makeCurrent();
+  GpuTurn turn(this);
+
+  m_width = width;
+  m_height = height;
+  resizeFramebuffer();
+}
+
+void
+Renderer::setQuality(float resolutionScale, int maxIterations)
+{
+  m_resolutionScale = std::max(0.0f, std::min(resolutionScale, 1.0f));
+  m_maxIterations = std::max(0, maxIterations);
+}
+
+void
+Renderer::resizeFramebuffer()
+{
+  float scale = m_resolutionScale;
+  int width = std::max(2, (int)(m_width * scale + 0.5f));
+  int height = std::max(2, (int)(m_height * scale + 0.5f));
+  if (m_fbo && m_fbo->width() == width && m_fbo->height() == height) {
+    return;
+  }
 
   // RESIZE THE RENDER INTERFACE
   if (m_myVolumeData.m_renderer) {
@@ -361,19 +786,15 @@ Renderer::resizeGL(int width, int height)
 
   delete this->m_fbo;
   this->m_fbo = new GLFramebufferObject(width, height, GL_RGBA8);
+  m_fboMemory.set((size_t)width * (size_t)height * 4);
 
   glViewport(0, 0, width, height);
-
-  m_width = width;
-  m_height = height;
 }
 
 void
 Renderer::reset(int from)
 {
-  QMutexLocker locker(m_openGLMutex);
-
-  m_rglContext.makeCurrent();
+  GpuTurn turn(this);
 
   glClearColor(0.0, 0.0, 0.0, 1.0);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -382,8 +803,6 @@ Renderer::reset(int from)
   glEnable(GL_LINE_SMOOTH);
 
   this->m_time.start();
-
-  m_rglContext.doneCurrent();
 }
 
 int
@@ -395,30 +814,35 @@ Renderer::getTime()
 void
 Renderer::shutDown()
 {
-  m_rglContext.makeCurrent();
+  {
+    GpuTurn turn(this);
 
-  delete this->m_fbo;
+    delete this->m_fbo;
+    m_fboMemory.set(0);
+    m_readback.reset();
+    m_readbackMemory.set(0);
 
-  delete m_myVolumeData.m_captureSettings;
-  m_myVolumeData.m_captureSettings = nullptr;
+    delete m_myVolumeData.m_captureSettings;
+    m_myVolumeData.m_captureSettings = nullptr;
 
-  delete m_myVolumeData.m_renderSettings;
-  m_myVolumeData.m_renderSettings = nullptr;
+    delete m_myVolumeData.m_renderSettings;
+    m_myVolumeData.m_renderSettings = nullptr;
 
-  delete m_myVolumeData.m_camera;
-  m_myVolumeData.m_camera = nullptr;
+    delete m_myVolumeData.m_camera;
+    m_myVolumeData.m_camera = nullptr;
 
-  delete m_myVolumeData.m_scene;
-  m_myVolumeData.m_scene = nullptr;
+    delete m_myVolumeData.m_scene;
+    m_myVolumeData.m_scene = nullptr;
 
-  if (m_myVolumeData.ownRenderer) {
-    delete m_myVolumeData.m_renderer;
+    if (m_myVolumeData.ownRenderer) {
+      delete m_myVolumeData.m_renderer;
+    }
+    m_myVolumeData.m_renderer = nullptr;
   }
-  m_myVolumeData.m_renderer = nullptr;
-
-  m_rglContext.doneCurrent();
-
-  m_rglContext.destroy();
+  if (!m_sharedContext) {
+    m_rglContext->destroy();
+  }
+  m_gpuScheduler->removeSession(gpuSession());
 
   // Stop event processing, move the thread to GUI and make sure it is deleted.
   exit();
@@ -3,13 +3,18 @@
 
 #include "glad/glad.h"
 
+#include "gpuScheduler.h"
 #include "renderlib/command.h"
 #include "renderlib/gesture/gesture.h"
 #include "renderlib/graphics/gl/Util.h"
 #include "renderlib/graphics/GestureGraphicsGL.h"
 #include "renderlib/io/FileReader.h"
+#include "renderlib/JobScheduler.h"
+#include "renderlib/MemoryAccounting.h"
+#include "renderlib/Metrics.h"
 #include "renderlib/renderlib.h"
 #include "renderrequest.h"
+#include "requestQueue.h"
 
 #include <QElapsedTimer>
 #include <QList>
@@ -20,6 +25,8 @@
 #include <QThread>
 #include <QWaitCondition>
 
+#include <deque>
+#include <functional>
 #include <memory>
 
 class commandBuffer;
@@ -84,11 +91,13 @@ struct CaptureSettings
 class Renderer
   : public QThread
   , public RendererCommandInterface
+  , public CommandJobRunner
 {
   Q_OBJECT
 
 public:
-  Renderer(QString id, QObject* parent, QMutex& mutex);
+  // Renders take turns on the GPU with the other renderers of scheduler
+  Renderer(QString id, QObject* parent, GpuScheduler& scheduler);
   virtual ~Renderer();
 
   void configure(IRenderWindow* renderer,
@@ -101,6 +110,13 @@ public:
                  QOpenGLContext* glContext = nullptr,
                  const CaptureSettings* captureSettings = nullptr);
 
+  // Render with a context that other renderers use too, in turns given by the scheduler, instead of a context of this
+  // renderer's own; see RendererGLContext::canShare. The context is initialized and destroyed by its owner.
+  // Call before start().
+  void shareContext(std::shared_ptr<RendererGLContext> context);
+  // this renderer, to the GpuScheduler
+  uint64_t gpuSession() const { return (uint64_t)(uintptr_t)this; }
+
   void run();
 
   void wakeUp();
@@ -108,41 +124,154 @@ public:
   void addRequest(RenderRequest* request);
   bool processRequest();
 
-  inline int getTotalQueueDuration() { return this->m_totalQueueDuration; }
+  inline int getTotalQueueDuration() { return this->m_requests.totalDuration(); }
 
   inline int getRequestCount() { return this->m_requests.count(); }
 
+  // monitoring series of this renderer's session, labelled session="<id>".
+  // They stop being exported when the renderer is destroyed.
+  struct SessionMetrics
+  {
+    std::shared_ptr<Metrics::Gauge> queueDepth;
+    // time to render and read back one frame
+    std::shared_ptr<Metrics::Histogram> renderSeconds;
+    std::shared_ptr<Metrics::Counter> frames;
+    // filled in by whoever encodes and sends the frames
+    std::shared_ptr<Metrics::Histogram> encodeSeconds;
+    std::shared_ptr<Metrics::Histogram> requestSeconds;
+    std::shared_ptr<Metrics::Counter> bytesSent;
+    // stream images not sent, to keep to the client's frame rate and bandwidth
+    std::shared_ptr<Metrics::Counter> framesDropped;
+    // the loaded volume
+    std::shared_ptr<Metrics::Gauge> hostBytes;
+    std::shared_ptr<Metrics::Gauge> gpuBytes;
+    // see setQuality; filled in by whoever sets it
+    std::shared_ptr<Metrics::Gauge> qualityLevel;
+    // time waiting for a turn on the GPU
+    std::shared_ptr<Metrics::Histogram> gpuWaitSeconds;
+    // requests answered with the image of a later request they were rendered together with
+    std::shared_ptr<Metrics::Counter> requestsCoalesced;
+    // commands not executed because a later queued command replaced them
+    std::shared_ptr<Metrics::Counter> commandsSkipped;
+  };
+  SessionMetrics& metrics() { return m_metrics; }
+
+  // owner of the memory this session's renderer allocates (see MemoryAccounting)
+  std::string memoryOwner() const { return "session:" + m_id.toStdString(); }
+
   // 1 = continuous re-render, 0 = only wait for redraw commands
   virtual void setStreamMode(int32_t mode) { m_streamMode = mode > 0 ? true : false; }
 
   virtual void resizeGL(int internalWidth, int internalHeight);
 
+  // Render below the requested resolution and quality to take load off a busy server.
+  // resolutionScale: fraction of the resolution set by the client; frames are scaled back up before they are sent.
+  // maxIterations: cap on the exposure iterations per frame; 0 leaves them as the client set them.
+  // Takes effect with the next frame.
+  void setQuality(float resolutionScale, int maxIterations);
+
+  // Run data loads in the background while the current volume keeps rendering.
+  // A request that starts a load is answered once the loaded data is applied; its remaining commands wait until then.
+  // Call before start().
+  void setBackgroundLoads(bool enabled) { m_ec.m_jobRunner = enabled ? this : nullptr; }
+
+  // In stream mode, read each frame back while the next ones render instead of waiting for it. Frames then reach the
+  // client a frame or two late, and requests whose frame is not read back yet get no image; the stream's last frame
+  // is always sent. Call before start().
+  void setPipelinedReadback(bool enabled) { m_pipelinedReadback = enabled; }
+
+  // Also read back the renderer's linear accumulation buffer with every frame, for RenderRequest::getHdrPixels.
+  // Frames are then read back without pipelining, so that both are of the same frame. Call before start().
+  void setHdrReadback(bool enabled) { m_hdrReadback = enabled; }
+
+  // Before handing over another image with requestProcessed, wait while this many are handed over and not released.
+  // Lets rendering run ahead of whoever sends the images, but only so far. 0 does not wait. Call before start().
+  void setMaxFramesInFlight(int frames) { m_maxFramesInFlight = frames; }
+  // the receiver of requestProcessed is done with an image
+  void releaseFrame();
+
+  virtual void runInBackground(std::function<std::function<void(ExecutionContext*)>(JobToken&)> work,
+                               bool replacesData);
+
 protected:
   QString m_id;
 
-  void processCommandBuffer(RenderRequest* rr);
-  QImage render();
+  // returns false if the request waits for a background job started by one of its commands
+  bool processCommandBuffer(RenderRequest* rr);
+  // pipelined: return without waiting for this frame to be read back. The image returned is then the oldest frame
+  // whose read finished, or null if none did yet; finishFrames() returns the last one.
+  QImage render(bool pipelined);
+  // wait for the frames being read back, and return the newest; null if there are none
+  QImage finishFrames();
 
   void reset(int from = 0);
 
   int getTime();
 
   // this is a task queue
-  QList<RenderRequest*> m_requests;
+  RequestQueue m_requests;
   QMutex m_requestMutex;
   QWaitCondition m_wait;
 
-  int m_totalQueueDuration;
+  // moving average of the milliseconds a frame takes, to estimate the duration of queued requests by
+  double m_renderMs;
+  // mark the commands of the queued requests that later queued commands replace (see replacedCommands)
+  void skipReplacedCommands();
 
   void init();
   void shutDown();
 
 private:
-  QMutex* m_openGLMutex;
+  GpuScheduler* m_gpuScheduler;
+
+  std::shared_ptr<RendererGLContext> m_rglContext;
+  bool m_sharedContext;
 
-  RendererGLContext m_rglContext;
+  // A turn on the GPU, with the GL context current for its length. Turns nest; only the outermost one waits.
+  // interactive: a client is waiting on it, and would like it done by deadline (see GpuScheduler::now)
+  class GpuTurn
+  {
+  public:
+    GpuTurn(Renderer* renderer, bool interactive = false, double deadline = 0.0);
+    ~GpuTurn();
+
+  private:
+    Renderer* m_renderer;
+  };
+  // nesting of the GpuTurns of the render thread
+  int m_gpuTurnDepth;
+  // a shared context comes with the GL state another renderer left; set it back to what this one expects
+  void restoreGLState();
 
   GLFramebufferObject* m_fbo;
+  MemoryAccounting::Allocation m_fboMemory;
+  // size m_fbo for m_width x m_height at the current resolution scale; call with the GL context current
+  void resizeFramebuffer();
+
+  // frames in flight in stream mode
+  static const int READBACK_BUFFERS = 3;
+  bool m_pipelinedReadback = false;
+
+  bool m_hdrReadback = false;
+  // of the last frame rendered; null if the renderer has no accumulation buffer
+  std::shared_ptr<const std::vector<float>> m_hdrPixels;
+  uint32_t m_hdrWidth = 0;
+  uint32_t m_hdrHeight = 0;
+
+  int m_maxFramesInFlight = 0;
+  // guarded by m_framesMutex
+  int m_framesInFlight = 0;
+  QMutex m_framesMutex;
+  QWaitCondition m_framesReleased;
+  // wait for room to hand over count more images
+  void holdFrames(int count);
+  std::unique_ptr<GLFramebufferReadback> m_readback;
+  MemoryAccounting::Allocation m_readbackMemory;
+  // the oldest frame being read back, at the requested size; call with the GL context current
+  QImage finishReadback();
+
+  std::atomic<float> m_resolutionScale;
+  std::atomic<int> m_maxIterations;
 
   std::atomic<bool> m_streamMode;
 
@@ -150,6 +279,7 @@ private:
   float m_frameTimeSeconds;
   bool shouldContinue();
 
+  // as requested by the client
   int32_t m_width, m_height;
 
   QElapsedTimer m_time;
@@ -179,6 +309,42 @@ private:
 
   ExecutionContext m_ec;
 
+  // a background job started by a command, and the request waiting for it
+  struct BackgroundJob
+  {
+    RenderRequest* request;
+    // index of the first command of the request to run after the job is applied
+    size_t resumeIndex;
+    std::function<void(ExecutionContext*)> apply;
+    std::shared_ptr<JobToken> token;
+    // finished loading
+    bool ready = false;
+    // request put back at the front of m_requests to be resumed
+    bool queued = false;
+    // loads new data, rather than another time of the current data
+    bool replacesData = false;
+  };
+
+  // the following are guarded by m_requestMutex
+  // unfinished jobs, applied in this order
+  std::deque<std::shared_ptr<BackgroundJob>> m_backgroundJobs;
+  // requests whose jobs were cancelled; they are answered with the next rendered image
+  QList<RenderRequest*> m_supersededRequests;
+  // the command being executed, for runInBackground
+  RenderRequest* m_commandRequest = nullptr;
+  size_t m_commandIndex = 0;
+  bool m_commandDeferred = false;
+
+  // forget cancelled jobs and supersede their requests
+  void dropCancelledJobs();
+  // resume the request of the first job if it is ready to apply, and hold the queue behind it until then
+  void queueReadyJob();
+
+  // runs the loads started by commands
+  JobScheduler m_jobs;
+
+  SessionMetrics m_metrics;
+
 signals:
   void requestProcessed(RenderRequest* request, QImage img);
   void frameDone(QImage img);
@@ -6,9 +6,16 @@ RenderRequest::RenderRequest(QWebSocket* client, std::vector<Command*> parameter
   : client(client)
   , parameters(parameters)
   , debug(debug)
+  , streamFrame(false)
+  , streamIteration(0)
+  , lastStreamFrame(false)
+  , refinement(false)
+  , hdrWidth(0)
+  , hdrHeight(0)
 {
   this->actualDuration = 0;
   this->estimatedDuration = 10;
+  this->age.start();
 }
 
 RenderRequest::~RenderRequest()
@@ -1,9 +1,13 @@
 #ifndef RENDERREQUEST_H
 #define RENDERREQUEST_H
 
+#include <QElapsedTimer>
 #include <QMatrix4x4>
 #include <QWebSocket>
 
+#include <memory>
+#include <vector>
+
 class Command;
 
 class RenderRequest
@@ -17,6 +21,7 @@ public:
   inline std::vector<Command*> getParameters() { return parameters; }
 
   inline int getDuration() { return this->estimatedDuration; }
+  inline void setEstimatedDuration(int ms) { this->estimatedDuration = ms; }
 
   inline bool isDebug() { return debug; }
 
@@ -24,6 +29,46 @@ public:
 
   inline qint64 getActualDuration() { return actualDuration; }
 
+  // nanoseconds since the request was created
+  inline qint64 getAge() const { return age.nsecsElapsed(); }
+
+  // stream mode: the image answering this request is one of a stream of images converging on the final one
+  inline void setStreamFrame(int iteration, bool last)
+  {
+    this->streamFrame = true;
+    this->streamIteration = iteration;
+    this->lastStreamFrame = last;
+  }
+  inline bool isStreamFrame() const { return streamFrame; }
+  // path tracing iterations in the image
+  inline int getStreamIteration() const { return streamIteration; }
+  inline bool isLastStreamFrame() const { return lastStreamFrame; }
+
+  // made by the renderer to go on refining a stream, rather than sent by a client that waits on it
+  inline void setRefinement(bool refinement) { this->refinement = refinement; }
+  inline bool isRefinement() const { return refinement; }
+
+  // a command of the request that a later queued command replaces, and that is not executed
+  inline void skipCommand(size_t index)
+  {
+    if (skipped.size() < parameters.size()) {
+      skipped.resize(parameters.size(), false);
+    }
+    skipped[index] = true;
+  }
+  inline bool isSkipped(size_t index) const { return index < skipped.size() && skipped[index]; }
+
+  // the linear rgba accumulation buffer behind the image, top row first, if the renderer was asked to read it back
+  inline void setHdrPixels(std::shared_ptr<const std::vector<float>> pixels, uint32_t width, uint32_t height)
+  {
+    this->hdrPixels = pixels;
+    this->hdrWidth = width;
+    this->hdrHeight = height;
+  }
+  inline std::shared_ptr<const std::vector<float>> getHdrPixels() const { return hdrPixels; }
+  inline uint32_t getHdrWidth() const { return hdrWidth; }
+  inline uint32_t getHdrHeight() const { return hdrHeight; }
+
 private:
   QWebSocket* client;
   std::vector<Command*> parameters;
@@ -35,6 +80,18 @@ private:
   qint64 actualDuration;
 
   bool debug;
+
+  bool streamFrame;
+  int streamIteration;
+  bool lastStreamFrame;
+  bool refinement;
+  std::vector<bool> skipped;
+
+  std::shared_ptr<const std::vector<float>> hdrPixels;
+  uint32_t hdrWidth;
+  uint32_t hdrHeight;
+
+  QElapsedTimer age;
 };
 
 #endif // RENDERREQUEST_H
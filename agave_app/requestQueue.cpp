@@ -0,0 +1,118 @@
+#include "requestQueue.h"
+
+#include "renderrequest.h"
+
+#include "renderlib/command.h"
+
+RequestQueue::RequestQueue()
+  : m_totalDuration(0)
+  , m_held(false)
+  , m_heldForData(false)
+{
+}
+
+RequestQueue::~RequestQueue()
+{
+  clear();
+}
+
+void
+RequestQueue::push(RenderRequest* request)
+{
+  if (!request->isRefinement() && !m_held) {
+    for (auto it = m_requests.begin(); it != m_requests.end();) {
+      if ((*it)->isRefinement()) {
+        m_totalDuration -= (*it)->getDuration();
+        delete *it;
+        it = m_requests.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  m_requests << request;
+  m_totalDuration += request->getDuration();
+}
+
+void
+RequestQueue::pushFront(RenderRequest* request)
+{
+  m_requests.prepend(request);
+  m_totalDuration += request->getDuration();
+}
+
+bool
+RequestQueue::remove(RenderRequest* request)
+{
+  if (!m_requests.removeOne(request)) {
+    return false;
+  }
+  m_totalDuration -= request->getDuration();
+  return true;
+}
+
+void
+RequestQueue::clear()
+{
+  qDeleteAll(m_requests);
+  m_requests.clear();
+  m_totalDuration = 0;
+}
+
+void
+RequestQueue::hold(bool replacesData)
+{
+  m_held = true;
+  m_heldForData = replacesData;
+}
+
+void
+RequestQueue::release()
+{
+  m_held = false;
+  m_heldForData = false;
+}
+
+bool
+RequestQueue::supersedesHeld(RenderRequest* request) const
+{
+  if (!m_held) {
+    return false;
+  }
+  for (Command* cmd : request->getParameters()) {
+    if (cmd->id() == LoadDataCommand::m_ID || (cmd->id() == SetTimeCommand::m_ID && !m_heldForData)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int
+RequestQueue::nextIndex() const
+{
+  for (int i = 0; i < m_requests.count(); ++i) {
+    if (!m_held || m_requests[i]->isRefinement()) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+RenderRequest*
+RequestQueue::next() const
+{
+  int i = nextIndex();
+  return i < 0 ? nullptr : m_requests[i];
+}
+
+RenderRequest*
+RequestQueue::takeNext()
+{
+  int i = nextIndex();
+  if (i < 0) {
+    return nullptr;
+  }
+  RenderRequest* request = m_requests.takeAt(i);
+  m_totalDuration -= request->getDuration();
+  return request;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QList>
+
+class RenderRequest;
+
+// The render requests of a session, in the order their commands run. Not thread safe.
+//
+// While a request waits for a background job started by one of its commands, the queue is held: the requests queued
+// after it wait too, so that none of their commands runs before the rest of its commands, against the data the job
+// replaces. Refinements, which only redraw, go on streaming the current image meanwhile. A request that makes the job
+// obsolete does not wait for it: the job is cancelled, and the queue released (see supersedesHeld).
+class RequestQueue
+{
+public:
+  RequestQueue();
+  // deletes the queued requests
+  ~RequestQueue();
+
+  // queue at the back. A client's request renders anyway, and a stream goes on refining after it, so it drops the
+  // queued refinements, unless the queue is held and they are all there is to render.
+  void push(RenderRequest* request);
+  // queue at the front, as a request resumed after its background job
+  void pushFront(RenderRequest* request);
+  // take a queued request out of the queue without deleting it; false if it is not queued
+  bool remove(RenderRequest* request);
+  // delete the queued requests
+  void clear();
+
+  // hold the queue behind a request waiting for a background job; replacesData: the job loads new data, rather than
+  // another time of the current data
+  void hold(bool replacesData);
+  void release();
+  bool isHeld() const { return m_held; }
+  // whether request makes the job the queue is held behind obsolete: a load_data does, and so does a set_time unless
+  // the job loads new data
+  bool supersedesHeld(RenderRequest* request) const;
+
+  // the first request, or the first refinement if the queue is held; null if there is none
+  RenderRequest* next() const;
+  bool hasNext() const { return next() != nullptr; }
+  // take next() out of the queue
+  RenderRequest* takeNext();
+
+  bool isEmpty() const { return m_requests.isEmpty(); }
+  int count() const { return m_requests.count(); }
+  // estimated milliseconds of the queued requests
+  int totalDuration() const { return m_totalDuration; }
+  const QList<RenderRequest*>& requests() const { return m_requests; }
+
+private:
+  QList<RenderRequest*> m_requests;
+  int m_totalDuration;
+  bool m_held;
+  bool m_heldForData;
+
+  // index of next(), or -1
+  int nextIndex() const;
+};
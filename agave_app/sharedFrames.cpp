@@ -0,0 +1,226 @@
+#include "sharedFrames.h"
+
+#include "renderlib/Logging.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char SharedFrameRing::MAGIC[4] = { 'A', 'G', 'S', 'M' };
+
+static const size_t PAGE_BYTES = 4096;
+
+static size_t
+roundUp(size_t bytes, size_t multiple)
+{
+  return (bytes + multiple - 1) / multiple * multiple;
+}
+
+static size_t
+dataOffset(int slotCount)
+{
+  return roundUp(SharedFrameRing::HEADER_BYTES + slotCount * SharedFrameRing::SLOT_HEADER_BYTES, 64);
+}
+
+static std::atomic<uint64_t>*
+slotSequence(uint8_t* memory, int slot)
+{
+  static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "sequences are plain uint64 to readers");
+  return reinterpret_cast<std::atomic<uint64_t>*>(memory + SharedFrameRing::HEADER_BYTES +
+                                                  slot * SharedFrameRing::SLOT_HEADER_BYTES);
+}
+
+static uint64_t*
+slotSize(uint8_t* memory, int slot)
+{
+  return reinterpret_cast<uint64_t*>(memory + SharedFrameRing::HEADER_BYTES +
+                                     slot * SharedFrameRing::SLOT_HEADER_BYTES + 8);
+}
+
+SharedFrameRing::SharedFrameRing(const std::string& prefix, int slotCount, const std::string& owner)
+  : m_prefix(prefix)
+  , m_slotCount(slotCount)
+  , m_generation(0)
+  , m_memory(nullptr)
+  , m_bytes(0)
+  , m_slotBytes(0)
+  , m_dataOffset(dataOffset(slotCount))
+  , m_nextSlot(0)
+  , m_writeSlot(-1)
+  , m_writeSize(0)
+  , m_previousBytes(0)
+  , m_allocation(MemoryAccounting::Category::Framebuffers, owner)
+{
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+  release();
+}
+
+#ifndef _WIN32
+
+bool
+SharedFrameRing::create(size_t slotBytes)
+{
+  // notifications of frames in the current segment may still be on their way
+  release(true);
+  m_name = m_prefix + "-" + std::to_string(m_generation++);
+  size_t bytes = m_dataOffset + slotBytes * m_slotCount;
+
+  // a segment left behind by a crashed server of the same pid is of no use to anyone
+  shm_unlink(m_name.c_str());
+  int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    LOG_ERROR << "Cannot create shared memory " << m_name << ": " << strerror(errno);
+    return false;
+  }
+  void* memory = MAP_FAILED;
+  if (ftruncate(fd, (off_t)bytes) == 0) {
+    memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    LOG_ERROR << "Cannot map " << bytes << " bytes of shared memory " << m_name << ": " << strerror(errno);
+    shm_unlink(m_name.c_str());
+    return false;
+  }
+
+  m_memory = static_cast<uint8_t*>(memory);
+  m_bytes = bytes;
+  m_slotBytes = slotBytes;
+  memset(m_memory, 0, m_dataOffset);
+  memcpy(m_memory, MAGIC, 4);
+  uint32_t header[3] = { VERSION, (uint32_t)m_slotCount, 0 };
+  memcpy(m_memory + 4, header, sizeof(header));
+  uint64_t capacity = slotBytes;
+  memcpy(m_memory + 16, &capacity, sizeof(capacity));
+  m_allocation.set(bytes + m_previousBytes);
+  return true;
+}
+
+void
+SharedFrameRing::release(bool keepLinked)
+{
+  // readers that have a segment mapped keep it until they let go
+  if (!m_previousName.empty()) {
+    shm_unlink(m_previousName.c_str());
+    m_previousName.clear();
+    m_previousBytes = 0;
+  }
+  if (m_memory) {
+    munmap(m_memory, m_bytes);
+    if (keepLinked) {
+      m_previousName = m_name;
+      m_previousBytes = m_bytes;
+    } else {
+      shm_unlink(m_name.c_str());
+    }
+  }
+  m_memory = nullptr;
+  m_bytes = 0;
+  m_slotBytes = 0;
+  // a linked segment takes memory, mapped or not
+  m_allocation.set(m_previousBytes);
+}
+
+bool
+SharedFrameRing::read(const Frame& frame, std::vector<uint8_t>& out)
+{
+  int fd = shm_open(frame.name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  void* memory = MAP_FAILED;
+  if (fstat(fd, &info) == 0) {
+    memory = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+
+  uint8_t* bytes = static_cast<uint8_t*>(memory);
+  uint64_t capacity = 0;
+  memcpy(&capacity, bytes + 16, sizeof(capacity));
+  uint32_t slotCount = 0;
+  memcpy(&slotCount, bytes + 8, sizeof(slotCount));
+  bool ok = memcmp(bytes, MAGIC, 4) == 0 && frame.slot >= 0 && (uint32_t)frame.slot < slotCount &&
+            frame.size <= capacity;
+  if (ok) {
+    ok = slotSequence(bytes, frame.slot)->load(std::memory_order_acquire) == frame.sequence;
+  }
+  if (ok) {
+    const uint8_t* data = bytes + dataOffset((int)slotCount) + frame.slot * capacity;
+    out.assign(data, data + frame.size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    ok = slotSequence(bytes, frame.slot)->load(std::memory_order_relaxed) == frame.sequence;
+  }
+  munmap(memory, (size_t)info.st_size);
+  return ok;
+}
+
+#else
+
+bool
+SharedFrameRing::create(size_t slotBytes)
+{
+  LOG_ERROR << "Shared memory frames are not available on this platform";
+  return false;
+}
+
+void
+SharedFrameRing::release(bool keepLinked)
+{
+}
+
+bool
+SharedFrameRing::read(const Frame& frame, std::vector<uint8_t>& out)
+{
+  return false;
+}
+
+#endif
+
+uint8_t*
+SharedFrameRing::beginWrite(size_t size)
+{
+  // room to grow a little without another segment
+  if ((!m_memory || size > m_slotBytes) && !create(roundUp(size + size / 8, PAGE_BYTES))) {
+    return nullptr;
+  }
+  m_writeSlot = m_nextSlot;
+  m_nextSlot = (m_nextSlot + 1) % m_slotCount;
+  m_writeSize = size;
+  // odd while writing
+  std::atomic<uint64_t>* sequence = slotSequence(m_memory, m_writeSlot);
+  sequence->store(sequence->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return m_memory + m_dataOffset + m_writeSlot * m_slotBytes;
+}
+
+SharedFrameRing::Frame
+SharedFrameRing::endWrite()
+{
+  Frame frame;
+  if (!m_memory || m_writeSlot < 0) {
+    return frame;
+  }
+  *slotSize(m_memory, m_writeSlot) = m_writeSize;
+  std::atomic<uint64_t>* sequence = slotSequence(m_memory, m_writeSlot);
+  frame.name = m_name;
+  frame.slot = m_writeSlot;
+  frame.sequence = sequence->load(std::memory_order_relaxed) + 1;
+  frame.size = m_writeSize;
+  sequence->store(frame.sequence, std::memory_order_release);
+  m_writeSlot = -1;
+  return frame;
+}
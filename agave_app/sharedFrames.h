@@ -0,0 +1,84 @@
+#pragma once
+
+#include "renderlib/MemoryAccounting.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A ring of frame slots in POSIX shared memory, for clients on the same host as the server. The server writes a frame
+// into the next slot and tells the client where to find it over the websocket, so the frame does not go through the
+// socket at all. A client asks for this with ?transport=shm in the websocket URL.
+//
+// Segment layout, in the host's byte order:
+//   "AGSM", uint32 version, uint32 slot count, uint32 unused, uint64 slot capacity in bytes, zero padding to 64 bytes
+//   per slot: uint64 sequence, uint64 frame size in bytes
+//   zero padding to a multiple of 64 bytes, then the slots' data, one slot capacity each
+// A slot's sequence is odd while its frame is being written. A reader copies the frame and then checks that the
+// sequence still is the one it was told about; if not, the slot was reused and the frame is gone.
+//
+// When a frame outgrows the slots, a new segment takes over under a new name. The old one stays linked until the next
+// replacement, so that frames announced in it can still be opened, and after that stays readable to clients that have
+// it mapped. Not available on Windows: beginWrite then returns null.
+class SharedFrameRing
+{
+public:
+  static const char MAGIC[4];
+  static const uint32_t VERSION = 1;
+  static const size_t HEADER_BYTES = 64;
+  static const size_t SLOT_HEADER_BYTES = 16;
+
+  struct Frame
+  {
+    // of the segment, for shm_open
+    std::string name;
+    int slot = 0;
+    uint64_t sequence = 0;
+    size_t size = 0;
+  };
+
+  // segments are named prefix-<n>; prefix starts with a '/' and, for macOS, keeps the name under 31 characters.
+  // The memory mapped is accounted to owner.
+  SharedFrameRing(const std::string& prefix, int slotCount, const std::string& owner);
+  ~SharedFrameRing();
+
+  SharedFrameRing(const SharedFrameRing&) = delete;
+  SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+  // the next slot, to write a frame of size bytes into; null if there is no shared memory.
+  // Writes are not thread safe: one frame at a time, from one thread at a time.
+  uint8_t* beginWrite(size_t size);
+  // publish the frame written since beginWrite
+  Frame endWrite();
+
+  // copy a frame out of its segment; false if the frame was overwritten, or the segment is gone
+  static bool read(const Frame& frame, std::vector<uint8_t>& out);
+
+private:
+  std::string m_prefix;
+  int m_slotCount;
+  int m_generation;
+
+  std::string m_name;
+  uint8_t* m_memory;
+  size_t m_bytes;
+  size_t m_slotBytes;
+  size_t m_dataOffset;
+
+  int m_nextSlot;
+  int m_writeSlot;
+  size_t m_writeSize;
+
+  // the segment the current one replaced, unmapped but still linked
+  std::string m_previousName;
+  size_t m_previousBytes;
+
+  MemoryAccounting::Allocation m_allocation;
+
+  // a segment with slots of at least slotBytes, in place of the current one; false if it cannot be made
+  bool create(size_t slotBytes);
+  // unmap the current segment and unlink the previous one; the current one is unlinked too unless keepLinked, which
+  // makes it the previous one
+  void release(bool keepLinked = false);
+};
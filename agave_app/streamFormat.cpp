@@ -0,0 +1,102 @@
+#include "streamFormat.h"
+
+#include <cstring>
+
+namespace StreamFormat {
+
+const char RAW_MAGIC[4] = { 'A', 'G', 'R', 'W' };
+
+static void
+writeUint32(uint8_t* out, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i) {
+    out[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+bool
+parse(const std::string& name, Format& format)
+{
+  static const struct
+  {
+    const char* name;
+    Format format;
+  } names[] = { { "jpeg", Format::Jpeg },   { "jpg", Format::Jpeg },    { "png", Format::Png },
+                { "webp", Format::Webp },   { "bgra8", Format::Bgra8 }, { "rgba32f", Format::Rgba32f } };
+  for (const auto& n : names) {
+    if (name == n.name) {
+      format = n.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char*
+name(Format format)
+{
+  switch (format) {
+    case Format::Jpeg:
+      return "jpeg";
+    case Format::Png:
+      return "png";
+    case Format::Webp:
+      return "webp";
+    case Format::Bgra8:
+      return "bgra8";
+    case Format::Rgba32f:
+      return "rgba32f";
+  }
+  return "jpeg";
+}
+
+Format
+autoFormat(bool sameHost)
+{
+  return sameHost ? Format::Bgra8 : Format::Jpeg;
+}
+
+bool
+isRaw(Format format)
+{
+  return format == Format::Bgra8 || format == Format::Rgba32f;
+}
+
+size_t
+bytesPerPixel(Format format)
+{
+  switch (format) {
+    case Format::Bgra8:
+      return 4;
+    case Format::Rgba32f:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+size_t
+rawSize(Format format, uint32_t width, uint32_t height)
+{
+  return RAW_HEADER_BYTES + (size_t)width * (size_t)height * bytesPerPixel(format);
+}
+
+void
+packRaw(Format format, uint32_t width, uint32_t height, const uint8_t* pixels, size_t bytesPerLine, uint8_t* out)
+{
+  memcpy(out, RAW_MAGIC, 4);
+  writeUint32(out + 4, width);
+  writeUint32(out + 8, height);
+  writeUint32(out + 12, format == Format::Rgba32f ? 1 : 0);
+  uint8_t* rows = out + RAW_HEADER_BYTES;
+  size_t rowBytes = (size_t)width * bytesPerPixel(format);
+  if (rowBytes == bytesPerLine) {
+    memcpy(rows, pixels, rowBytes * height);
+    return;
+  }
+  for (uint32_t y = 0; y < height; ++y) {
+    memcpy(rows + y * rowBytes, pixels + y * bytesPerLine, rowBytes);
+  }
+}
+
+} // namespace StreamFormat
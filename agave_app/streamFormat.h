@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The image format a client receives. A client asks for one with ?format=<name> in the websocket URL, and may fix the
+// JPEG or WebP quality with &quality=<1..100>. Without a format it gets JPEG; format=auto leaves the choice to the
+// server.
+//
+// Raw frames skip encoding altogether, which is what clients on the same host want. Message layout, little endian:
+//   "AGRW"
+//   uint32 width, uint32 height
+//   uint32 pixel format: 0 for 8 bit BGRA, 1 for 32 bit float RGBA
+//   the rows, top row first, without padding
+namespace StreamFormat {
+
+enum class Format
+{
+  Jpeg,
+  Png,
+  Webp,
+  // the displayed image, 8 bits per channel
+  Bgra8,
+  // the path tracer's linear accumulation buffer, before tone mapping
+  Rgba32f
+};
+
+extern const char RAW_MAGIC[4];
+static const size_t RAW_HEADER_BYTES = 16;
+
+// "jpeg" (or "jpg"), "png", "webp", "bgra8" and "rgba32f"; false for anything else
+bool
+parse(const std::string& name, Format& format);
+
+const char*
+name(Format format);
+
+// for format=auto: raw pixels to a client on the same host, as nothing is cheaper for the server to send, and JPEG
+// over the network
+Format
+autoFormat(bool sameHost);
+
+bool
+isRaw(Format format);
+
+// pixel bytes of a raw frame
+size_t
+bytesPerPixel(Format format);
+
+// size of the raw frame message for an image of width x height
+size_t
+rawSize(Format format, uint32_t width, uint32_t height);
+
+// write the raw frame message to out, which holds rawSize bytes. pixels are rows of bytesPerLine bytes, top row first.
+void
+packRaw(Format format, uint32_t width, uint32_t height, const uint8_t* pixels, size_t bytesPerLine, uint8_t* out);
+
+} // namespace StreamFormat
@@ -0,0 +1,64 @@
+#include "streamQuality.h"
+
+#include <algorithm>
+
+StreamQuality::StreamQuality(const Options& options)
+  : m_options(options)
+{
+}
+
+void
+StreamQuality::refill(double seconds)
+{
+  // up to a second's worth of bytes, so that an idle client cannot save up for a long burst
+  m_allowance = std::min(m_allowance + (seconds - m_allowanceTime) * m_options.maxBytesPerSecond,
+                         m_options.maxBytesPerSecond);
+  m_allowanceTime = seconds;
+}
+
+StreamQuality::Encoding
+StreamQuality::decide(int iteration, bool last, double seconds)
+{
+  Encoding e{ true, m_options.maxQuality, 1.0f, false };
+  if (last) {
+    e.lossless = m_options.losslessLast;
+    m_sentAny = true;
+    m_lastSent = seconds;
+    return e;
+  }
+
+  if (m_sentAny && m_options.maxFramesPerSecond > 0.0 && seconds - m_lastSent < 1.0 / m_options.maxFramesPerSecond) {
+    e.send = false;
+    return e;
+  }
+  if (m_options.maxBytesPerSecond > 0.0) {
+    refill(seconds);
+    if (m_sentAny && m_allowance <= 0.0) {
+      e.send = false;
+      return e;
+    }
+  }
+
+  // renderers that do not iterate draw the final image right away
+  if (iteration > 0) {
+    int settle = std::max(m_options.settleIterations, 2);
+    float t = std::min((float)(iteration - 1) / (float)(settle - 1), 1.0f);
+    e.quality = m_options.minQuality + (int)(t * (m_options.maxQuality - m_options.minQuality) + 0.5f);
+    if (iteration <= m_options.earlyIterations) {
+      e.scale = m_options.earlyScale;
+    }
+  }
+  // images are encoded and sent a while later; the frame rate counts from now
+  m_sentAny = true;
+  m_lastSent = seconds;
+  return e;
+}
+
+void
+StreamQuality::sent(size_t bytes, double seconds)
+{
+  if (m_options.maxBytesPerSecond > 0.0) {
+    refill(seconds);
+    m_allowance -= (double)bytes;
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+
+// Decides how to encode the images streamed to one client while a path traced image converges.
+// Early iterations are noisy and compress badly, and are replaced within moments, so they go out at a lower JPEG
+// quality (and optionally resolution) and no faster than the client's frame rate and bandwidth allow.
+// The last image of a stream always goes out, at full quality.
+class StreamQuality
+{
+public:
+  struct Options
+  {
+    // JPEG quality of the first iteration, rising to maxQuality at settleIterations
+    int minQuality = 50;
+    int maxQuality = 92;
+    int settleIterations = 64;
+    // resolution of the images of the first earlyIterations iterations, as a fraction of the rendered resolution
+    float earlyScale = 1.0f;
+    int earlyIterations = 4;
+    // 0 is unlimited
+    double maxFramesPerSecond = 30.0;
+    double maxBytesPerSecond = 0.0;
+    // send the last image of a stream as PNG instead of JPEG
+    bool losslessLast = false;
+  };
+
+  struct Encoding
+  {
+    // false to drop the image
+    bool send;
+    int quality;
+    float scale;
+    bool lossless;
+  };
+
+  StreamQuality() = default;
+  explicit StreamQuality(const Options& options);
+
+  const Options& options() const { return m_options; }
+
+  // For the next image of the stream, which is taken to be sent unless dropped.
+  // iteration: path tracing iterations in the image; 0 if the renderer does not converge progressively.
+  // last: no more images follow until the client changes something.
+  // seconds: time on a steady clock.
+  Encoding decide(int iteration, bool last, double seconds);
+
+  // an image of this size went out, whether from the stream or not
+  void sent(size_t bytes, double seconds);
+
+private:
+  Options m_options;
+  bool m_sentAny = false;
+  double m_lastSent = 0.0;
+  // bytes that may go out right now; below 0 after a burst
+  double m_allowance = 0.0;
+  double m_allowanceTime = 0.0;
+
+  void refill(double seconds);
+};
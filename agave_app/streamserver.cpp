@@ -1,27 +1,149 @@
 #include "streamserver.h"
 
+#include <QDir>
+#include <QCoreApplication>
 #include <QFileInfo>
+#include <QImageWriter>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QNetworkInterface>
+#include <QPointer>
 #include <QSslCertificate>
 #include <QSslConfiguration>
 #include <QSslKey>
+#include <QTcpServer>
+#include <QTcpSocket>
 #include <QUrlQuery>
 #include <QWebSocket>
 #include <QWebSocketServer>
 
 #include "commandBuffer.h"
+#include "frameTiles.h"
 #include "renderlib/AppScene.h"
 #include "renderlib/CCamera.h"
 #include "renderlib/Logging.h"
+#include "renderlib/MemoryAccounting.h"
+#include "renderlib/Metrics.h"
 #include "renderlib/RenderSettings.h"
+#include "renderlib/Tracing.h"
+
+#include <algorithm>
 
 QT_USE_NAMESPACE
 
-// JPG selected for potentially greater compression
-// (less bytes to push across network) than PNG
-const char* DEFAULT_IMAGE_FORMAT = "JPG";
+const int DEFAULT_IMAGE_QUALITY = 92;
+// frames a client can fall behind by before the ones it has not read are overwritten
+const int SHARED_FRAME_SLOTS = 3;
+
+struct StreamServer::TileStream
+{
+  QImage reference;
+};
+
+namespace {
+bool
+isSameHost(QWebSocket* client)
+{
+  QHostAddress peer = client->peerAddress();
+  return peer.isLoopback() || QNetworkInterface::allAddresses().contains(peer);
+}
+
+// an image file in format, or PNG for a lossless encoding
+bool
+encodeImage(const QImage& image,
+            const StreamQuality::Encoding& encoding,
+            StreamFormat::Format format,
+            QByteArray& bytes)
+{
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::WriteOnly);
+  if (encoding.lossless || format == StreamFormat::Format::Png) {
+    return image.save(&buffer, "PNG");
+  }
+  if (format == StreamFormat::Format::Webp) {
+    return image.save(&buffer, "WEBP", encoding.quality);
+  }
+  return image.save(&buffer, "JPG", encoding.quality);
+}
+
+// a raw frame: the float accumulation buffer if there is one, else the image's 8 bit BGRA pixels
+// (QImage::Format_ARGB32 is BGRA in memory on little endian hosts), with no encoding at all
+struct RawImage
+{
+  StreamFormat::Format format;
+  uint32_t width;
+  uint32_t height;
+  const uint8_t* pixels;
+  size_t bytesPerLine;
+  // hold the pixels
+  QImage frame;
+  std::shared_ptr<const std::vector<float>> hdrPixels;
+
+  RawImage(const QImage& image,
+           StreamFormat::Format requested,
+           std::shared_ptr<const std::vector<float>> hdr,
+           uint32_t hdrWidth,
+           uint32_t hdrHeight)
+  {
+    if (requested == StreamFormat::Format::Rgba32f && hdr) {
+      format = requested;
+      width = hdrWidth;
+      height = hdrHeight;
+      hdrPixels = hdr;
+      pixels = reinterpret_cast<const uint8_t*>(hdrPixels->data());
+      bytesPerLine = (size_t)width * StreamFormat::bytesPerPixel(format);
+    } else {
+      format = StreamFormat::Format::Bgra8;
+      frame = image.format() == QImage::Format_ARGB32 ? image : image.convertToFormat(QImage::Format_ARGB32);
+      width = frame.width();
+      height = frame.height();
+      pixels = frame.constBits();
+      bytesPerLine = frame.bytesPerLine();
+    }
+  }
+
+  size_t size() const { return StreamFormat::rawSize(format, width, height); }
+  void pack(uint8_t* out) const { StreamFormat::packRaw(format, width, height, pixels, bytesPerLine, out); }
+};
+} // namespace
+
+bool
+StreamServer::encodeTiles(TileStream& stream,
+                          const QImage& image,
+                          const StreamQuality::Encoding& encoding,
+                          StreamFormat::Format format,
+                          bool keyframe,
+                          int tileSize,
+                          float threshold,
+                          QByteArray& bytes)
+{
+  QImage frame = image.convertToFormat(QImage::Format_ARGB32);
+  if (keyframe || encoding.lossless || stream.reference.size() != frame.size()) {
+    stream.reference = frame;
+    return encodeImage(frame, encoding, format, bytes);
+  }
+
+  std::vector<FrameTiles::Tile> tiles = FrameTiles::changedTiles(frame.constBits(),
+                                                                 stream.reference.constBits(),
+                                                                 frame.width(),
+                                                                 frame.height(),
+                                                                 frame.bytesPerLine(),
+                                                                 tileSize,
+                                                                 threshold);
+  bool ok = true;
+  std::vector<std::vector<uint8_t>> encodedTiles;
+  for (const FrameTiles::Tile& tile : tiles) {
+    QByteArray tileBytes;
+    ok = encodeImage(frame.copy(tile.x, tile.y, tile.width, tile.height), encoding, format, tileBytes) && ok;
+    encodedTiles.emplace_back(tileBytes.begin(), tileBytes.end());
+  }
+  FrameTiles::copyTiles(tiles, frame.constBits(), stream.reference.bits(), frame.bytesPerLine());
+
+  std::vector<uint8_t> message = FrameTiles::pack(frame.width(), frame.height(), tiles, encodedTiles);
+  bytes = QByteArray(reinterpret_cast<const char*>(message.data()), (qsizetype)message.size());
+  return ok;
+}
 
 void
 StreamServer::createNewRenderer(QWebSocket* client)
@@ -38,8 +160,19 @@ StreamServer::createNewRenderer(QWebSocket* client)
   }
   renderlib::RendererType renderMode = renderlib::stringToRendererType(mode);
 
-  int i = this->_renderers.length();
-  Renderer* r = new Renderer("Thread " + QString::number(i), this, _openGLMutex);
+  int i = _sessionsStarted++;
+  int device = pickDevice();
+  GpuDevice& gpu = _devices[device];
+  Renderer* r = new Renderer("Thread " + QString::number(i), this, *gpu.scheduler);
+  int context = gpu.scheduler->addSession(r->gpuSession());
+  if (!gpu.contexts.empty()) {
+    r->shareContext(gpu.contexts[context]);
+  }
+  _rendererDevices[r] = device;
+  gpu.sessions->set(_rendererDevices.values().count(device));
+  if (_devices.size() > 1) {
+    LOG_INFO << "Thread " << i << " renders on device " << device;
+  }
 
   RenderSettings* rs = new RenderSettings();
   CCamera* camera = new CCamera();
@@ -50,19 +183,38 @@ StreamServer::createNewRenderer(QWebSocket* client)
   scene->initLights();
 
   r->configure(nullptr, *rs, *scene, *camera, LoadSpec(), renderMode);
+  r->setBackgroundLoads(_backgroundLoads);
+  // clients stream frames continuously and only need the latest
+  r->setPipelinedReadback(true);
+  r->setHdrReadback(_formats.value(client) == StreamFormat::Format::Rgba32f);
 
   this->_renderers << r;
 
   // queued across thread boundary.  typically requestProcessed is called from another thread.
-  // BlockingQueuedConnection forces send to happen immediately after render.  Default (QueuedConnection) will be fully
-  // async.
-  connect(r, &Renderer::requestProcessed, this, &StreamServer::sendImage, Qt::BlockingQueuedConnection);
+  // The renderer carries on while its images are encoded, up to a couple of images ahead of the client.
+  connect(r, &Renderer::requestProcessed, this, &StreamServer::sendImage);
+  r->setMaxFramesInFlight(2);
   connect(r, &Renderer::sendString, this, &StreamServer::sendString);
 
   LOG_INFO << "Starting thread" << i << "...";
   r->start();
 
   _clientRenderers[client] = r;
+
+  if (!_recordingDir.isEmpty()) {
+    QString fileName =
+      QString("session%1-%2.agvtrace").arg(i).arg(QString::fromStdString(renderlib::rendererTypeToString(renderMode)));
+    QString path = QDir(_recordingDir).filePath(fileName);
+    auto recording = std::make_shared<SessionRecording>();
+    recording->writer.reset(new CommandTraceWriter(path.toStdString()));
+    recording->clock.start();
+    if (recording->writer->isOpen()) {
+      LOG_INFO << "Recording commands of thread " << i << " to " << path.toStdString();
+      _recordings[client] = recording;
+    } else {
+      LOG_ERROR << "Could not record commands to " << path.toStdString();
+    }
+  }
 }
 
 StreamServer::StreamServer(quint16 port, bool debug, QObject* parent)
@@ -70,11 +222,27 @@ StreamServer::StreamServer(quint16 port, bool debug, QObject* parent)
   , _webSocketServer(new QWebSocketServer(QStringLiteral("AGAVE RENDERSERVER"), QWebSocketServer::NonSecureMode, this))
   , _clients()
   , _renderers()
+  , _sessionsStarted(0)
+  , _renderLoad(0.0)
+  , _metricsServer(nullptr)
   , debug(debug)
+  , _backgroundLoads(false)
+  , _encoders(new EncoderPool())
+  , _tileSize(64)
+  , _tileThreshold(1.0f)
 {
   connect(this, &StreamServer::closed, qApp, &QApplication::quit);
 
-  LOG_INFO << "Server is starting up with " << THREAD_COUNT << " max threads, listening on port " << port << " ...";
+  _devices.resize(1);
+  _devices[0].scheduler.reset(new GpuScheduler());
+  _devices[0].sessions = Metrics::gauge("agave_gpu_sessions", "Sessions rendering on the GPU", { { "device", "0" } });
+
+  LOG_INFO << "Server is starting up, listening on port " << port << " ...";
+
+  connect(&_loadTimer, &QTimer::timeout, this, &StreamServer::onLoadTimer);
+  _loadClock.start();
+  _loadTimer.start(1000);
+  _streamClock.start();
 
   QSslConfiguration sslConfiguration;
   QFile certFile(QStringLiteral("mr.crt"));
@@ -113,11 +281,96 @@ StreamServer::StreamServer(quint16 port, bool debug, QObject* parent)
   LOG_INFO << "Server initialization done.";
 }
 
+void
+StreamServer::setAdmissionOptions(const AdmissionControl::Options& options)
+{
+  _admission = AdmissionControl(options);
+  LOG_INFO << "Accepting " << options.maxSessions << " sessions at once, " << options.maxWaiting << " waiting";
+}
+
+void
+StreamServer::setEncoderThreads(unsigned threads)
+{
+  _encoders.reset(new EncoderPool(threads));
+  LOG_INFO << "Encoding images on " << _encoders->size() << " threads";
+}
+
+void
+StreamServer::setRenderContexts(int contexts)
+{
+  contexts = std::max(contexts, 1);
+  if (!RendererGLContext::canShare()) {
+    LOG_INFO << "Sessions render with GL contexts of their own";
+    return;
+  }
+  for (GpuDevice& gpu : _devices) {
+    for (auto& context : gpu.contexts) {
+      context->destroy();
+    }
+  }
+  _devices.clear();
+  _devices.resize(renderlib::deviceCount());
+  for (int device = 0; device < (int)_devices.size(); ++device) {
+    GpuDevice& gpu = _devices[device];
+    gpu.scheduler.reset(new GpuScheduler(contexts));
+    for (int i = 0; i < contexts; ++i) {
+      auto context = std::make_shared<RendererGLContext>();
+      context->init(gpu.contexts.empty() ? nullptr : gpu.contexts[0].get(), device);
+      context->doneCurrent();
+      gpu.contexts.push_back(context);
+    }
+    gpu.sessions = Metrics::gauge(
+      "agave_gpu_sessions", "Sessions rendering on the GPU", { { "device", std::to_string(device) } });
+  }
+  LOG_INFO << "Sessions take turns on " << contexts << " shared GL contexts on each of " << _devices.size()
+           << " devices";
+}
+
+int
+StreamServer::pickDevice() const
+{
+  std::vector<GpuScheduler::DeviceLoad> loads(_devices.size(), GpuScheduler::DeviceLoad{ 0, 0, 0 });
+  for (auto it = _rendererDevices.begin(); it != _rendererDevices.end(); ++it) {
+    GpuScheduler::DeviceLoad& load = loads[it.value()];
+    MemoryAccounting::Usage memory = MemoryAccounting::ownerUsage(it.key()->memoryOwner());
+    load.queuedRequests += it.key()->getRequestCount();
+    load.memoryBytes +=
+      memory[MemoryAccounting::Category::GpuTextures] + memory[MemoryAccounting::Category::Framebuffers];
+    load.sessions++;
+  }
+  return GpuScheduler::pickDevice(loads);
+}
+
+bool
+StreamServer::listenForMetrics(quint16 port)
+{
+  if (!_metricsServer) {
+    _metricsServer = new QTcpServer(this);
+    connect(_metricsServer, &QTcpServer::newConnection, this, &StreamServer::onMetricsConnection);
+  }
+  if (!_metricsServer->listen(QHostAddress::Any, port)) {
+    LOG_ERROR << "Could not serve metrics on port " << port << ": " << _metricsServer->errorString().toStdString();
+    return false;
+  }
+  LOG_INFO << "Serving metrics at http://localhost:" << port << "/metrics";
+  return true;
+}
+
 StreamServer::~StreamServer()
 {
   _webSocketServer->close();
+  // images still encoding are not sent anymore
+  _encoders.reset();
   qDeleteAll(_clients.begin(), _clients.end());
+  for (uint64_t id : _waiting.clients()) {
+    delete waitingClient(id);
+  }
   qDeleteAll(_renderers.begin(), _renderers.end());
+  for (GpuDevice& gpu : _devices) {
+    for (auto& context : gpu.contexts) {
+      context->destroy();
+    }
+  }
 }
 
 void
@@ -133,11 +386,20 @@ StreamServer::onNewConnection()
 {
   QWebSocket* pSocket = _webSocketServer->nextPendingConnection();
 
-  // fire up new renderer?
-  if (_renderers.length() >= THREAD_COUNT) {
-    // handle this better.
-    pSocket->abort();
-    LOG_DEBUG << "TOO MANY CONNECTIONS.";
+  // if (m_debug)
+  LOG_DEBUG << "new client connection: " << pSocket->requestUrl().toString().toStdString() << "; "
+            << pSocket->resourceName().toStdString() << "; " << pSocket->peerAddress().toString().toStdString() << ":"
+            << pSocket->peerPort() << "; " << pSocket->peerName().toStdString();
+
+  AdmissionControl::Decision decision =
+    _admission.decide(_renderers.length(), _waiting.length(), _renderLoad, memoryAvailable());
+  if (decision == AdmissionControl::Decision::Reject) {
+    LOG_WARNING << "Server busy: turned away a client with " << _waiting.length() << " waiting";
+    QJsonObject error;
+    error["error"] = "Server busy";
+    pSocket->sendTextMessage(QJsonDocument(error).toJson(QJsonDocument::Compact));
+    pSocket->close(QWebSocketProtocol::CloseCodeBadOperation, "Server busy");
+    pSocket->deleteLater();
     return;
   }
 
@@ -150,13 +412,107 @@ StreamServer::onNewConnection()
   //		qDebug() << pSocket->errorString();
   //	});
 
-  _clients << pSocket;
-  createNewRenderer(pSocket);
+  if (decision == AdmissionControl::Decision::Admit) {
+    startSession(pSocket);
+  } else {
+    _waiting.push(waitingId(pSocket));
+    LOG_INFO << "Client waiting for a session at queue position " << _waiting.length();
+    sendQueuePositions();
+  }
+}
 
-  // if (m_debug)
-  LOG_DEBUG << "new client connection: " << pSocket->requestUrl().toString().toStdString() << "; "
-            << pSocket->resourceName().toStdString() << "; " << pSocket->peerAddress().toString().toStdString() << ":"
-            << pSocket->peerPort() << "; " << pSocket->peerName().toStdString();
+void
+StreamServer::startSession(QWebSocket* client, bool fromQueue, const std::vector<std::vector<uint8_t>>& messages)
+{
+  if (fromQueue) {
+    client->sendTextMessage(QString::fromStdString(WaitingQueue::positionMessage(0)));
+  }
+  _clients << client;
+  StreamFormat::Format format = clientFormat(client);
+  _formats[client] = format;
+  LOG_INFO << "Sending " << StreamFormat::name(format) << " images to "
+           << client->peerAddress().toString().toStdString();
+  createNewRenderer(client);
+
+  QUrlQuery query(client->requestUrl());
+  StreamQuality::Options qualityOptions = _streamQualityOptions;
+  bool fixedQuality = false;
+  int quality = query.queryItemValue("quality").toInt(&fixedQuality);
+  if (fixedQuality) {
+    qualityOptions.minQuality = qualityOptions.maxQuality = std::max(1, std::min(quality, 100));
+  }
+  _streamQualities[client] = StreamQuality(qualityOptions);
+  // raw pixels are not diffed
+  if (query.queryItemValue("frames") == "tiles" && !StreamFormat::isRaw(format)) {
+    _tileStreams[client] = std::make_shared<TileStream>();
+  }
+  if (query.queryItemValue("transport") == "shm") {
+    if (isSameHost(client)) {
+      QString prefix = QString("/agave-%1-%2").arg(QCoreApplication::applicationPid()).arg(_sessionsStarted);
+      _sharedFrames[client] = std::make_shared<SharedFrameRing>(
+        prefix.toStdString(), SHARED_FRAME_SLOTS, _clientRenderers[client]->memoryOwner());
+    } else {
+      LOG_WARNING << "Shared memory frames asked for by a client on another host; sending them over the websocket";
+    }
+  }
+  _qualityLevels[_clientRenderers[client]] = 0;
+
+  // the client sent its first commands while waiting
+  for (const std::vector<uint8_t>& message : messages) {
+    handleCommands(client, QByteArray(reinterpret_cast<const char*>(message.data()), (int)message.size()));
+  }
+}
+
+StreamFormat::Format
+StreamServer::clientFormat(QWebSocket* client) const
+{
+  QString name = QUrlQuery(client->requestUrl()).queryItemValue("format").toLower();
+  StreamFormat::Format format = StreamFormat::Format::Jpeg;
+  if (name == "auto") {
+    format = StreamFormat::autoFormat(isSameHost(client));
+  } else if (!name.isEmpty() && !StreamFormat::parse(name.toStdString(), format)) {
+    LOG_WARNING << "Unknown image format " << name.toStdString() << " requested; sending jpeg";
+  }
+  if (format == StreamFormat::Format::Webp && !QImageWriter::supportedImageFormats().contains("webp")) {
+    LOG_WARNING << "No WebP image writer available; sending jpeg";
+    format = StreamFormat::Format::Jpeg;
+  }
+  return format;
+}
+
+bool
+StreamServer::memoryAvailable() const
+{
+  for (size_t i = 0; i < MemoryAccounting::CATEGORY_COUNT; ++i) {
+    if (!MemoryAccounting::fits((MemoryAccounting::Category)i, 0)) {
+      return false;
+    }
+  }
+  return MemoryAccounting::fits(MemoryAccounting::Category::Framebuffers, _admission.options().sessionMemoryEstimate);
+}
+
+void
+StreamServer::admitWaiting()
+{
+  while (_waiting.length() > 0 &&
+         _admission.decide(_renderers.length(), 0, _renderLoad, memoryAvailable()) ==
+           AdmissionControl::Decision::Admit) {
+    std::vector<std::vector<uint8_t>> messages;
+    QWebSocket* client = waitingClient(_waiting.admit(messages));
+    LOG_INFO << "Starting a session for a waiting client";
+    startSession(client, true, messages);
+  }
+  sendQueuePositions();
+}
+
+void
+StreamServer::sendQueuePositions()
+{
+  // position 0 is running; see startSession
+  int position = 1;
+  for (uint64_t id : _waiting.clients()) {
+    waitingClient(id)->sendTextMessage(QString::fromStdString(WaitingQueue::positionMessage(position++)));
+  }
 }
 
 Renderer*
@@ -209,19 +565,43 @@ StreamServer::processBinaryMessage(QByteArray message)
   //	if (debug)
   //		qDebug() << "Binary Message received:" << message;
   if (pClient) {
-    // the message had better be an encoded command stream.  check a header perhaps?
-    commandBuffer b(message.length(), reinterpret_cast<const uint8_t*>(message.constData()));
-    b.processBuffer();
+    if (_waiting.contains(waitingId(pClient))) {
+      // run once the client has a session; a client typically sets up its scene before waiting for images
+      std::vector<uint8_t> bytes(message.constData(), message.constData() + message.length());
+      if (!_waiting.addMessage(waitingId(pClient), std::move(bytes))) {
+        LOG_WARNING << "A waiting client sent more commands than can be held; turning it away";
+        QJsonObject error;
+        error["error"] = "Too many commands while waiting";
+        pClient->sendTextMessage(QJsonDocument(error).toJson(QJsonDocument::Compact));
+        pClient->close(QWebSocketProtocol::CloseCodeTooMuchData, "Too many commands while waiting");
+      }
+      return;
+    }
+    handleCommands(pClient, message);
+  }
+}
+
+void
+StreamServer::handleCommands(QWebSocket* client, const QByteArray& message)
+{
+  std::shared_ptr<SessionRecording> recording = _recordings.value(client);
+  if (recording) {
+    recording->writer->append(
+      recording->clock.nsecsElapsed(), reinterpret_cast<const uint8_t*>(message.constData()), message.length());
+  }
 
-    // one message is a list of commands to run before rendering.
-    // the complete message amounts to a single render request and an image is expected to come out of it.
+  // the message had better be an encoded command stream.  check a header perhaps?
+  commandBuffer b(message.length(), reinterpret_cast<const uint8_t*>(message.constData()));
+  b.processBuffer();
 
-    // hand the commands over to the RenderRequest.
-    // RenderRequest will assume ownership and delete them
+  // one message is a list of commands to run before rendering.
+  // the complete message amounts to a single render request and an image is expected to come out of it.
 
-    RenderRequest* request = new RenderRequest(pClient, b.getQueue());
-    this->getRendererForClient(pClient)->addRequest(request);
-  }
+  // hand the commands over to the RenderRequest.
+  // RenderRequest will assume ownership and delete them
+
+  RenderRequest* request = new RenderRequest(client, b.getQueue());
+  this->getRendererForClient(client)->addRequest(request);
 }
 
 void
@@ -236,6 +616,12 @@ StreamServer::socketDisconnected()
             << QString::number(pClient->peerPort()).toStdString() << ") "
             << "code: (" << pClient->closeCode() << ":" << pClient->closeReason().toStdString() + ")";
   if (pClient) {
+    if (_waiting.remove(waitingId(pClient))) {
+      // never had a session
+      pClient->deleteLater();
+      sendQueuePositions();
+      return;
+    }
     Renderer* r = getRendererForClient(pClient);
     QObject::connect(r, &Renderer::finished, r, &QObject::deleteLater);
     if (r) {
@@ -243,11 +629,68 @@ StreamServer::socketDisconnected()
     }
     _clients.removeAll(pClient);
     _renderers.removeAll(r);
+    if (_rendererDevices.contains(r)) {
+      int device = _rendererDevices.take(r);
+      _devices[device].sessions->set(_rendererDevices.values().count(device));
+    }
     _clientRenderers.remove(pClient);
+    _recordings.remove(pClient);
+    _streamQualities.remove(pClient);
+    _tileStreams.remove(pClient);
+    _formats.remove(pClient);
+    _sharedFrames.remove(pClient);
+    _qualityLevels.remove(r);
+    _renderSecondsSeen.remove(r);
+    _sessionLoads.remove(r);
     pClient->deleteLater();
+
+    admitWaiting();
   }
 }
 
+void
+StreamServer::onLoadTimer()
+{
+  double seconds = _loadClock.restart() / 1000.0;
+  if (seconds <= 0.0) {
+    return;
+  }
+
+  // the fraction of the last interval that each session spent rendering, and their sum per device
+  std::vector<double> deviceLoads(_devices.size(), 0.0);
+  std::vector<double> loads;
+  std::vector<int> levels;
+  for (Renderer* r : _renderers) {
+    double renderSeconds = r->metrics().renderSeconds->snapshot().sum;
+    double load = (renderSeconds - _renderSecondsSeen.value(r, renderSeconds)) / seconds;
+    _renderSecondsSeen[r] = renderSeconds;
+    _sessionLoads[r] = load;
+    int device = _rendererDevices.value(r, 0);
+    if (device >= 0 && device < (int)deviceLoads.size()) {
+      deviceLoads[device] += load;
+    }
+    loads.push_back(load);
+    levels.push_back(_qualityLevels.value(r, 0));
+  }
+  _renderLoad = deviceLoads.empty() ? 0.0 : *std::max_element(deviceLoads.begin(), deviceLoads.end());
+
+  bool memoryPressure = !memoryAvailable();
+  std::vector<int> newLevels = _admission.adjustQuality(_renderLoad, memoryPressure, loads, levels);
+  for (size_t i = 0; i < newLevels.size(); ++i) {
+    if (newLevels[i] == levels[i]) {
+      continue;
+    }
+    Renderer* r = _renderers[(int)i];
+    AdmissionControl::Quality quality = AdmissionControl::quality(newLevels[i]);
+    LOG_INFO << "Session quality level " << levels[i] << " -> " << newLevels[i] << " at render load " << _renderLoad;
+    r->setQuality(quality.resolutionScale, quality.maxIterations);
+    r->metrics().qualityLevel->set(newLevels[i]);
+    _qualityLevels[r] = newLevels[i];
+  }
+
+  admitWaiting();
+}
+
 void
 StreamServer::sendImage(RenderRequest* request, QImage image)
 {
@@ -257,20 +700,181 @@ StreamServer::sendImage(RenderRequest* request, QImage image)
     }
   }
 
+  QWebSocket* client = request->getClient();
+  Renderer* renderer = _clients.contains(client) ? _clientRenderers.value(client) : nullptr;
+  if (!renderer) {
+    // the client is gone
+    delete request;
+    return;
+  }
+
+  StreamQuality::Encoding encoding{ true, DEFAULT_IMAGE_QUALITY, 1.0f, false };
+  if (_streamQualities.contains(client)) {
+    encoding.quality = _streamQualities[client].options().maxQuality;
+  }
+  if (request->isStreamFrame() && _streamQualities.contains(client)) {
+    encoding = _streamQualities[client].decide(
+      request->getStreamIteration(), request->isLastStreamFrame(), _streamClock.nsecsElapsed() / 1.0e9);
+    if (!encoding.send) {
+      renderer->metrics().framesDropped->add();
+      renderer->releaseFrame();
+      delete request;
+      return;
+    }
+  }
+
+  struct EncodedImage
+  {
+    QByteArray bytes;
+    bool ok = false;
+    qint64 encodeNs = 0;
+    // raw pixels bound for shared memory are written straight into their slot
+    std::shared_ptr<RawImage> raw;
+    bool sharedFrame = false;
+  };
+  auto encoded = std::make_shared<EncodedImage>();
+  StreamFormat::Format format = _formats.value(client, StreamFormat::Format::Jpeg);
+  if (format != StreamFormat::Format::Jpeg && format != StreamFormat::Format::Webp) {
+    // exact pixels: early images are not sent smaller
+    encoding.scale = 1.0f;
+  }
+  std::shared_ptr<const std::vector<float>> hdrPixels = request->getHdrPixels();
+  uint32_t hdrWidth = request->getHdrWidth();
+  uint32_t hdrHeight = request->getHdrHeight();
+  std::shared_ptr<TileStream> tileStream = _tileStreams.value(client);
+  std::shared_ptr<SharedFrameRing> ring = _sharedFrames.value(client);
+  // the last image of a stream is sent whole, so that lossy tiles do not pile up in what the client keeps
+  bool keyframe = !request->isStreamFrame() || request->isLastStreamFrame();
+  std::function<void()> encode = [encoded,
+                                  image,
+                                  encoding,
+                                  format,
+                                  hdrPixels,
+                                  hdrWidth,
+                                  hdrHeight,
+                                  tileStream,
+                                  shared = (bool)ring,
+                                  keyframe,
+                                  tileSize = _tileSize,
+                                  threshold = _tileThreshold]() {
+    TraceSpan span("StreamServer encode", "encode");
+    QElapsedTimer encodeTimer;
+    encodeTimer.start();
+    QImage scaled = image;
+    if (encoding.scale < 1.0f) {
+      QSize size(std::max(1, (int)(image.width() * encoding.scale)),
+                 std::max(1, (int)(image.height() * encoding.scale)));
+      scaled = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    if (StreamFormat::isRaw(format) && shared) {
+      encoded->raw = std::make_shared<RawImage>(scaled, format, hdrPixels, hdrWidth, hdrHeight);
+      encoded->ok = true;
+    } else if (StreamFormat::isRaw(format)) {
+      RawImage raw(scaled, format, hdrPixels, hdrWidth, hdrHeight);
+      encoded->bytes.resize((qsizetype)raw.size());
+      raw.pack(reinterpret_cast<uint8_t*>(encoded->bytes.data()));
+      encoded->ok = true;
+    } else if (tileStream) {
+      encoded->ok = encodeTiles(*tileStream, scaled, encoding, format, keyframe, tileSize, threshold, encoded->bytes);
+    } else {
+      encoded->ok = encodeImage(scaled, encoding, format, encoded->bytes);
+    }
+    encoded->encodeNs = encodeTimer.nsecsElapsed();
+  };
+  // the renderer may be gone by the time the image is encoded
+  QPointer<Renderer> session(renderer);
+  std::function<void()> send = [this, encoded, request, session, size = image.size()]() {
+    // sockets are used on the server's thread only
+    QMetaObject::invokeMethod(
+      this,
+      [this, encoded, request, session, size]() {
+        if (session) {
+          session->releaseFrame();
+        }
+        sendEncodedImage(request, encoded->bytes, encoded->sharedFrame, encoded->ok, encoded->encodeNs, size);
+      },
+      Qt::QueuedConnection);
+  };
+  std::function<void()> deliver = send;
+  if (ring) {
+    // frames go into the ring in order, and the client is told where to find them
+    deliver = [encoded, ring, send]() {
+      TraceSpan span("StreamServer shared frame", "encode");
+      QElapsedTimer writeTimer;
+      writeTimer.start();
+      size_t size = encoded->raw ? encoded->raw->size() : (size_t)encoded->bytes.size();
+      uint8_t* slot = ring->beginWrite(size);
+      if (slot) {
+        if (encoded->raw) {
+          encoded->raw->pack(slot);
+        } else {
+          memcpy(slot, encoded->bytes.constData(), size);
+        }
+        SharedFrameRing::Frame frame = ring->endWrite();
+        QJsonObject location;
+        location["name"] = QString::fromStdString(frame.name);
+        location["slot"] = frame.slot;
+        location["sequence"] = (double)frame.sequence;
+        location["size"] = (double)frame.size;
+        QJsonObject notification;
+        notification["shm_frame"] = location;
+        encoded->bytes = QJsonDocument(notification).toJson(QJsonDocument::Compact);
+        encoded->sharedFrame = true;
+      } else if (encoded->raw) {
+        // no shared memory after all
+        encoded->bytes.resize((qsizetype)size);
+        encoded->raw->pack(reinterpret_cast<uint8_t*>(encoded->bytes.data()));
+      }
+      encoded->raw.reset();
+      encoded->encodeNs += writeTimer.nsecsElapsed();
+      send();
+    };
+  }
+
+  if (tileStream) {
+    // each image is sent against the one before, so they are encoded one at a time, in order
+    _encoders->submit((uintptr_t)client, []() {}, [encode, deliver]() {
+      encode();
+      deliver();
+    });
+  } else {
+    _encoders->submit((uintptr_t)client, encode, deliver);
+  }
+}
+
+void
+StreamServer::sendEncodedImage(RenderRequest* request,
+                               const QByteArray& bytes,
+                               bool sharedFrame,
+                               bool ok,
+                               qint64 encodeNs,
+                               QSize size)
+{
   QWebSocket* client = request->getClient();
   if (client != 0 && _clients.contains(client) && client->isValid() &&
       client->state() == QAbstractSocket::ConnectedState) {
-    QByteArray ba;
-    QBuffer buffer(&ba);
-    buffer.open(QIODevice::WriteOnly);
-    bool ok = image.save(&buffer, DEFAULT_IMAGE_FORMAT, 92);
     if (!ok) {
       LOG_ERROR << "Failed to save image to buffer.";
     }
-    LOG_DEBUG << "Send Image (" << image.width() << "x" << image.height() << ") " << buffer.size() << " bytes to "
+    LOG_DEBUG << "Send Image (" << size.width() << "x" << size.height() << ") " << bytes.size() << " bytes to "
               << client->peerName().toStdString() << "(" << client->peerAddress().toString().toStdString() << ":"
               << QString::number(client->peerPort()).toStdString() << ")";
-    client->sendBinaryMessage(ba);
+    if (sharedFrame) {
+      client->sendTextMessage(QString::fromUtf8(bytes));
+    } else {
+      client->sendBinaryMessage(bytes);
+    }
+    if (_streamQualities.contains(client)) {
+      _streamQualities[client].sent(bytes.size(), _streamClock.nsecsElapsed() / 1.0e9);
+    }
+
+    Renderer* renderer = _clientRenderers.value(client);
+    if (renderer) {
+      Renderer::SessionMetrics& metrics = renderer->metrics();
+      metrics.encodeSeconds->observe(encodeNs / 1.0e9);
+      metrics.bytesSent->add((double)bytes.size());
+      metrics.requestSeconds->observe(request->getAge() / 1.0e9);
+    }
   }
 
   // this is the end of the line for a request.
@@ -288,3 +892,58 @@ StreamServer::sendString(RenderRequest* request, QString s)
   // do not dispose of request here.
   // see requestProcessed<-->sendImage from Renderer.
 }
+
+void
+StreamServer::onMetricsConnection()
+{
+  while (_metricsServer->hasPendingConnections()) {
+    QTcpSocket* socket = _metricsServer->nextPendingConnection();
+    connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+
+    // a minimal HTTP/1.1 responder: one GET per connection
+    auto request = std::make_shared<QByteArray>();
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket, request]() {
+      request->append(socket->readAll());
+      if (!request->contains("\r\n\r\n")) {
+        // wait for the rest of the headers, within reason
+        if (request->size() > 16384) {
+          socket->abort();
+        }
+        return;
+      }
+
+      QList<QByteArray> requestLine = request->left(request->indexOf("\r\n")).split(' ');
+      QByteArray status = "200 OK";
+      QByteArray body;
+      if (requestLine.size() < 2 || requestLine[0] != "GET") {
+        status = "405 Method Not Allowed";
+      } else if (requestLine[1].split('?')[0] != "/metrics") {
+        status = "404 Not Found";
+      } else {
+        Metrics::gauge("agave_sessions", "Connected render sessions")->set(_clients.count());
+        Metrics::gauge("agave_sessions_max", "Render sessions accepted at once")
+          ->set(_admission.options().maxSessions);
+        Metrics::gauge("agave_sessions_waiting", "Clients waiting for a render session")->set(_waiting.length());
+        Metrics::gauge("agave_render_load", "Fraction of the last second the busiest GPU spent rendering")
+          ->set(_renderLoad);
+        MemoryAccounting::Usage memory = MemoryAccounting::total();
+        for (size_t i = 0; i < MemoryAccounting::CATEGORY_COUNT; ++i) {
+          MemoryAccounting::Category category = (MemoryAccounting::Category)i;
+          Metrics::Labels labels = { { "category", MemoryAccounting::categoryName(category) } };
+          Metrics::gauge("agave_memory_bytes", "Host and GPU memory in use", labels)->set((double)memory[category]);
+          Metrics::gauge("agave_memory_budget_bytes", "Memory budget; 0 is unlimited", labels)
+            ->set((double)MemoryAccounting::budget(category));
+        }
+        body = QByteArray::fromStdString(Metrics::prometheusText());
+      }
+
+      QByteArray response = "HTTP/1.1 " + status + "\r\n";
+      response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+      response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+      response += "Connection: close\r\n\r\n";
+      response += body;
+      socket->write(response);
+      socket->disconnectFromHost();
+    });
+  }
+}
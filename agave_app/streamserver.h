@@ -14,13 +14,22 @@
 #include <QtDebug>
 
 #include <QSslError>
-
+#include <QTimer>
+
+#include "admissionControl.h"
+#include "commandTrace.h"
+#include "encoderPool.h"
+#include "gpuScheduler.h"
+#include "sharedFrames.h"
+#include "streamFormat.h"
+#include "streamQuality.h"
 #include "renderer.h"
 
+#include <memory>
+
 QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
 QT_FORWARD_DECLARE_CLASS(QWebSocket)
-
-#define THREAD_COUNT 4
+QT_FORWARD_DECLARE_CLASS(QTcpServer)
 
 class StreamServer : public QObject
 {
@@ -35,6 +44,44 @@ public:
 
   inline int getThreadsCount() { return _renderers.length(); }
 
+  // applies to renderers of clients that connect afterwards
+  inline void setBackgroundLoads(bool enabled) { _backgroundLoads = enabled; }
+
+  // Record the command buffers of every client that connects afterwards to <dir>/session<N>-<renderer type>.agvtrace,
+  // to be replayed with agave --replay.
+  inline void setRecordingDirectory(const QString& dir) { _recordingDir = dir; }
+
+  // Limits on the sessions rendering at once, and on the render load and memory they may use.
+  // Clients beyond the limits wait in a queue; sessions lose quality while the server is under pressure.
+  void setAdmissionOptions(const AdmissionControl::Options& options);
+
+  inline int getWaitingCount() { return _waiting.length(); }
+
+  // How the images of streaming clients are encoded and throttled; applies to clients that connect afterwards
+  inline void setStreamQuality(const StreamQuality::Options& options) { _streamQualityOptions = options; }
+
+  // Clients that ask for tile frames with ?frames=tiles get the tiles of tileSize pixels that changed by more than
+  // threshold (the mean difference in 8 bit levels) instead of whole images; see FrameTiles.
+  inline void setTileFrames(int tileSize, float threshold)
+  {
+    _tileSize = tileSize;
+    _tileThreshold = threshold;
+  }
+
+  // Encode images on this many threads; 0 picks half the hardware threads. Call before clients connect.
+  void setEncoderThreads(unsigned threads);
+
+  // Render all sessions on this many GL contexts per GPU that share their objects, so that sessions of the same data
+  // on a GPU share its volume texture; the sessions of a context take turns on it (see GpuScheduler). New sessions go
+  // to the least loaded of the GPUs renderlib was initialized with. Where contexts cannot share (see
+  // RendererGLContext::canShare), or without a call to this, every session has a context of its own on the first GPU
+  // and they all take turns on it. Call before clients connect.
+  void setRenderContexts(int contexts);
+
+  // Serve the process metrics over HTTP at http://<host>:<port>/metrics, in the Prometheus text format.
+  // returns false if the port could not be opened
+  bool listenForMetrics(quint16 port);
+
   inline QList<int> getThreadsLoad()
   {
     QList<int> loads;
@@ -66,6 +113,9 @@ private slots:
   void socketDisconnected();
   void sendImage(RenderRequest* request, QImage image);
   void sendString(RenderRequest* request, QString s);
+  void onMetricsConnection();
+  // measures the render load and adjusts admission and quality to it
+  void onLoadTimer();
 
 private:
   // Renderer *getLeastBusyRenderer();
@@ -76,12 +126,93 @@ private:
   QList<QWebSocket*> _clients;
   QList<Renderer*> _renderers;
   QMap<QWebSocket*, Renderer*> _clientRenderers;
+  // numbers the sessions, so that the metrics of each session are kept apart
+  int _sessionsStarted;
+
+  AdmissionControl _admission;
+  // connected clients without a session, by waitingId
+  WaitingQueue _waiting;
+  static uint64_t waitingId(QWebSocket* client) { return (uint64_t)(uintptr_t)client; }
+  static QWebSocket* waitingClient(uint64_t id) { return (QWebSocket*)(uintptr_t)id; }
+  QMap<Renderer*, int> _qualityLevels;
+  // render load, measured from the render time histograms of the sessions
+  QTimer _loadTimer;
+  QElapsedTimer _loadClock;
+  QMap<Renderer*, double> _renderSecondsSeen;
+  QMap<Renderer*, double> _sessionLoads;
+  double _renderLoad;
+
+  bool memoryAvailable() const;
+  // messages: sent by the client while it waited in the queue, which it is told it left
+  void startSession(QWebSocket* client, bool fromQueue = false, const std::vector<std::vector<uint8_t>>& messages = {});
+  // start sessions for waiting clients while admission allows
+  void admitWaiting();
+  void sendQueuePositions();
+  void handleCommands(QWebSocket* client, const QByteArray& message);
+
+  QTcpServer* _metricsServer;
+
+  struct SessionRecording
+  {
+    std::unique_ptr<CommandTraceWriter> writer;
+    // since the client connected
+    QElapsedTimer clock;
+  };
+  QString _recordingDir;
+  QMap<QWebSocket*, std::shared_ptr<SessionRecording>> _recordings;
 
   bool debug;
+  bool _backgroundLoads;
+
+  std::unique_ptr<EncoderPool> _encoders;
+  StreamQuality::Options _streamQualityOptions;
+  QMap<QWebSocket*, StreamQuality> _streamQualities;
+  QElapsedTimer _streamClock;
+
+  // as negotiated when the session started
+  QMap<QWebSocket*, StreamFormat::Format> _formats;
+  // for clients on this host that asked for frames in shared memory
+  QMap<QWebSocket*, std::shared_ptr<SharedFrameRing>> _sharedFrames;
+  // the format a client asked for in its URL, or JPEG; one this server cannot write falls back to JPEG
+  StreamFormat::Format clientFormat(QWebSocket* client) const;
+
+  // the image a client receiving tile frames has, to send the next one against
+  struct TileStream;
+  QMap<QWebSocket*, std::shared_ptr<TileStream>> _tileStreams;
+  int _tileSize;
+  float _tileThreshold;
+  // a keyframe, or an image of a new size, is sent whole and replaces the reference; otherwise only the tiles that
+  // changed are sent, and copied into the reference
+  static bool encodeTiles(TileStream& stream,
+                          const QImage& image,
+                          const StreamQuality::Encoding& encoding,
+                          StreamFormat::Format format,
+                          bool keyframe,
+                          int tileSize,
+                          float threshold,
+                          QByteArray& bytes);
+  // on the server's thread, once the image of request is encoded
+  // sharedFrame: bytes are the notification of a frame in shared memory, sent as text
+  void sendEncodedImage(RenderRequest* request,
+                        const QByteArray& bytes,
+                        bool sharedFrame,
+                        bool ok,
+                        qint64 encodeNs,
+                        QSize size);
 
   void createNewRenderer(QWebSocket* client);
 
-  QMutex _openGLMutex;
+  struct GpuDevice
+  {
+    std::unique_ptr<GpuScheduler> scheduler;
+    // empty when sessions have contexts of their own
+    std::vector<std::shared_ptr<RendererGLContext>> contexts;
+    std::shared_ptr<Metrics::Gauge> sessions;
+  };
+  std::vector<GpuDevice> _devices;
+  QMap<Renderer*, int> _rendererDevices;
+  // the least loaded device, for a new session
+  int pickDevice() const;
 };
 
 #endif // STREAMSERVER_H
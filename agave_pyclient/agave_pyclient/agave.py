@@ -6,10 +6,12 @@ import json
 import math
 import numpy
 import queue
+import struct
 from PIL import Image
 from typing import List
 
 from .commandbuffer import CommandBuffer
+from .sharedframes import SharedFrameReader
 
 
 def lerp(startframe, endframe, startval, endval):
@@ -82,6 +84,13 @@ class AgaveClient(WebSocketClient):
         self.onOpened = None
         self.onClose = None
         self.messages = queue.Queue()
+        # with tile frames, the image the server sends changed tiles against
+        self.tiles = False
+        self.frame = None
+        # the pixels of the last raw image, as a numpy array
+        self.pixels = None
+        # set when frames come through shared memory
+        self.shared_frames = None
 
     def load_image(self, image_path, onLoaded=None):
         self.get_info(image_path, callback=onLoaded)
@@ -96,13 +105,70 @@ class AgaveClient(WebSocketClient):
             m = self.receive()
             if m is not None:
                 if m.is_binary:
-                    return io.BytesIO(m.data)
+                    return self.decode(m.data)
+                message = json.loads(m.data)
+                if self.shared_frames is not None and "shm_frame" in message:
+                    data = self.shared_frames.read(message["shm_frame"])
+                    if data is not None:
+                        return self.decode(data)
+                    print("Shared memory frame gone before it was read")
                 else:
                     print("Non binary ws message returned")
             else:
                 break
         return None
 
+    def decode_frame(self, data):
+        # "AGTF", width, height, tile count, then per tile x, y, width, height,
+        # byte count and the encoded tile; anything else is a whole image
+        if data[:4] != b"AGTF":
+            self.frame = Image.open(io.BytesIO(data)).convert("RGB")
+            return io.BytesIO(data)
+        width, height, count = struct.unpack_from("<III", data, 4)
+        if self.frame is None or self.frame.size != (width, height):
+            self.frame = Image.new("RGB", (width, height))
+        offset = 16
+        for _ in range(count):
+            x, y, w, h, length = struct.unpack_from("<IIIII", data, offset)
+            offset += 20
+            tile = Image.open(io.BytesIO(data[offset : offset + length]))
+            self.frame.paste(tile.convert("RGB"), (x, y))
+            offset += length
+        out = io.BytesIO()
+        self.frame.save(out, format="PNG")
+        out.seek(0)
+        return out
+
+    def decode(self, data):
+        if data[:4] == b"AGRW":
+            return self.decode_raw(data)
+        if self.tiles:
+            return self.decode_frame(data)
+        return io.BytesIO(data)
+
+    def decode_raw(self, data):
+        # "AGRW", width, height, pixel format (0: 8 bit BGRA, 1: float RGBA),
+        # then the rows, top first
+        width, height, pixel_format = struct.unpack_from("<III", data, 4)
+        if pixel_format == 1:
+            self.pixels = numpy.frombuffer(
+                data, dtype=numpy.float32, offset=16, count=width * height * 4
+            ).reshape((height, width, 4))
+            rgba = (numpy.clip(self.pixels, 0.0, 1.0) * 255.0).astype(numpy.uint8)
+        else:
+            bgra = numpy.frombuffer(
+                data, dtype=numpy.uint8, offset=16, count=width * height * 4
+            ).reshape((height, width, 4))
+            self.pixels = bgra[:, :, [2, 1, 0, 3]]
+            rgba = self.pixels
+        out = io.BytesIO()
+        # without alpha, as the images of the other formats
+        Image.fromarray(numpy.ascontiguousarray(rgba[:, :, :3]), "RGB").save(
+            out, format="PNG"
+        )
+        out.seek(0)
+        return out
+
     def wait_for_json(self):
         while True:
             m = self.receive()
@@ -161,6 +227,20 @@ class AgaveRenderer:
         Full url to websocket server including port
     mode: str
         "pathtrace" or "raymarch" (pathtrace is default)
+    frames: str
+        "full" or "tiles" (full is default). With "tiles" the server only sends
+        the parts of each image that changed
+    format: str
+        "jpeg", "png", "webp", "bgra8", "rgba32f" or "auto" (auto is default).
+        "bgra8" and "rgba32f" send unencoded pixels, available with pixels();
+        "rgba32f" is the path tracer's linear image before tone mapping. "auto"
+        is "bgra8" for a server on this host and "jpeg" otherwise
+    quality: int
+        JPEG or WebP quality from 1 to 100; by default the server's
+    transport: str
+        "websocket" or "shm" (websocket is default). With "shm" a server on this
+        host hands over frames in shared memory instead of sending them; best with
+        format "bgra8" or "rgba32f". Not available on Windows
 
     Examples
     --------
@@ -170,12 +250,31 @@ class AgaveRenderer:
 
     """
 
-    def __init__(self, url="ws://localhost:1235/", mode="pathtrace") -> None:
+    def __init__(
+        self,
+        url="ws://localhost:1235/",
+        mode="pathtrace",
+        frames="full",
+        format="auto",
+        quality=None,
+        transport="websocket",
+    ) -> None:
         self.cb = CommandBuffer()
         self.session_name = ""
         if mode != "pathtrace" and mode != "raymarch":
             mode = "pathtrace"
-        self.ws = AgaveClient(f"{url}?mode={mode}", protocols=["http-only", "chat"])
+        query = f"mode={mode}"
+        if frames == "tiles":
+            query += "&frames=tiles"
+        query += f"&format={format}"
+        if quality is not None:
+            query += f"&quality={int(quality)}"
+        if transport == "shm":
+            query += "&transport=shm"
+        self.ws = AgaveClient(f"{url}?{query}", protocols=["http-only", "chat"])
+        if transport == "shm":
+            self.ws.shared_frames = SharedFrameReader()
+        self.ws.tiles = frames == "tiles"
         # self.ws.onOpened = self.onOpen
         self.ws.connect()
         # self.ws.run_forever()
@@ -435,6 +534,14 @@ class AgaveRenderer:
         self.session_name = ""
         self.cb = CommandBuffer()
 
+    def pixels(self):
+        """
+        The pixels of the last image received in the "bgra8" or "rgba32f" format, as a
+        numpy array of height x width x 4 RGBA values: uint8 for "bgra8", float32 for
+        "rgba32f". None if no such image was received.
+        """
+        return self.ws.pixels
+
     def set_resolution(self, x: int, y: int):
         """
         Set the image resolution in pixels.
@@ -949,6 +1056,32 @@ class AgaveRenderer:
         # 47
         self.cb.add_command("SET_INTERPOLATION", x)
 
+    def memory_usage(self):
+        """
+        Ask the server how much host and GPU memory is in use. Any commands not yet
+        sent are sent first. This function will block and wait for the answer.
+
+        Returns
+        -------
+        dict
+            "total", "budget" and "owners", each giving bytes per category
+            ("voxel_data", "derived_volumes", "caches", "gpu_textures",
+            "framebuffers") and in "total". Owners are named "dataset:<path>"
+            or "session:<id>". A budget of 0 is unlimited.
+        """
+        # 48
+        self.cb.add_command("GET_MEMORY_USAGE")
+        buf = self.cb.make_buffer()
+        self.ws.send(buf, True)
+        # skip replies to other commands in the same buffer
+        usage = self.ws.wait_for_json()
+        while usage is not None and usage.get("commandId") != 48:
+            usage = self.ws.wait_for_json()
+        # the server answers every request with an image too
+        self.ws.wait_for_image()
+        self.cb = CommandBuffer()
+        return usage
+
     def batch_render_turntable(
         self, number_of_frames=90, direction=1, output_name="frame", first_frame=0
     ):
@@ -77,6 +77,8 @@ COMMANDS = {
     "SHOW_SCALE_BAR": [45, "I32"],
     "SET_FLIP_AXIS": [46, "I32", "I32", "I32"],
     "SET_INTERPOLATION": [47, "I32"],
+    # reply with memory use as json
+    "GET_MEMORY_USAGE": [48],
 }
 
 
@@ -0,0 +1,75 @@
+import mmap
+import os
+import struct
+
+# Reads the frames an AGAVE server on the same host writes to shared memory for a
+# client connected with transport=shm. The websocket then carries only
+# {"shm_frame": {"name", "slot", "sequence", "size"}} notifications.
+#
+# Segment layout, in the host's byte order: "AGSM", uint32 version, uint32 slot
+# count, uint32 unused, uint64 slot capacity, padding to 64 bytes; per slot uint64
+# sequence and uint64 size; padding to a multiple of 64 bytes; then the slots.
+# A slot whose sequence no longer matches the notification has been reused.
+
+HEADER_BYTES = 64
+SLOT_HEADER_BYTES = 16
+
+
+def _open_shared_memory(name):
+    try:
+        import _posixshmem
+
+        return _posixshmem.shm_open(name, os.O_RDONLY, mode=0o600)
+    except ImportError:
+        # Linux keeps POSIX shared memory in /dev/shm
+        return os.open("/dev/shm" + name, os.O_RDONLY)
+
+
+class SharedFrameReader:
+    def __init__(self):
+        self.name = None
+        self.memory = None
+
+    def close(self):
+        if self.memory is not None:
+            self.memory.close()
+        self.memory = None
+        self.name = None
+
+    def read(self, location):
+        """
+        Returns a copy of the frame at location, as announced by the server, or None
+        if the frame was overwritten, or its segment removed, before it could be read.
+        """
+        if location["name"] != self.name:
+            # the server moved to a larger segment
+            self.close()
+            try:
+                fd = _open_shared_memory(location["name"])
+                try:
+                    self.memory = mmap.mmap(fd, 0, access=mmap.ACCESS_READ)
+                finally:
+                    os.close(fd)
+            except OSError:
+                # replaced twice since the frame was announced
+                return None
+            self.name = location["name"]
+        memory = self.memory
+        if memory[:4] != b"AGSM":
+            return None
+        slot_count = struct.unpack_from("=I", memory, 8)[0]
+        capacity = struct.unpack_from("=Q", memory, 16)[0]
+        slot = int(location["slot"])
+        sequence = int(location["sequence"])
+        size = int(location["size"])
+        if slot >= slot_count or size > capacity:
+            return None
+        sequence_offset = HEADER_BYTES + slot * SLOT_HEADER_BYTES
+        if struct.unpack_from("=Q", memory, sequence_offset)[0] != sequence:
+            return None
+        data_offset = -(-(HEADER_BYTES + slot_count * SLOT_HEADER_BYTES) // 64) * 64
+        start = data_offset + slot * capacity
+        data = memory[start : start + size]
+        if struct.unpack_from("=Q", memory, sequence_offset)[0] != sequence:
+            return None
+        return data
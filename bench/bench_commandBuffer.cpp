@@ -0,0 +1,71 @@
+#include <benchmark/benchmark.h>
+
+#include "agave_app/commandBuffer.h"
+#include "renderlib/command.h"
+
+#include <vector>
+
+namespace {
+// a batch like the ones clients send per frame: camera, a transfer function edit and a redraw
+std::vector<Command*>
+makeBatch(size_t nframes, size_t controlPoints)
+{
+  std::vector<Command*> cmds;
+  for (size_t i = 0; i < nframes; ++i) {
+    float f = (float)i;
+    cmds.push_back(new SetCameraPosCommand({ f, 2.0f, 3.0f }));
+    cmds.push_back(new SetCameraTargetCommand({ 0.0f, 0.0f, f }));
+    cmds.push_back(new SetCameraUpCommand({ 0.0f, 1.0f, 0.0f }));
+    SetControlPointsCommandD cp;
+    cp.m_channel = 0;
+    cp.m_data.resize(controlPoints * 5, 0.5f);
+    cmds.push_back(new SetControlPointsCommand(cp));
+    cmds.push_back(new RequestRedrawCommand({}));
+  }
+  return cmds;
+}
+
+void
+deleteAll(const std::vector<Command*>& cmds)
+{
+  for (Command* c : cmds) {
+    delete c;
+  }
+}
+} // namespace
+
+static void
+BM_CommandBufferSerialize(benchmark::State& state)
+{
+  std::vector<Command*> cmds = makeBatch((size_t)state.range(0), (size_t)state.range(1));
+  size_t bytes = 0;
+  for (auto _ : state) {
+    commandBuffer* buffer = commandBuffer::createBuffer(cmds);
+    bytes = buffer->length();
+    // the buffer does not own its bytes
+    delete[] buffer->head();
+    delete buffer;
+  }
+  state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)bytes);
+  deleteAll(cmds);
+}
+BENCHMARK(BM_CommandBufferSerialize)->ArgsProduct({ { 1, 100 }, { 2, 256 } })->ArgNames({ "frames", "points" });
+
+static void
+BM_CommandBufferParse(benchmark::State& state)
+{
+  std::vector<Command*> cmds = makeBatch((size_t)state.range(0), (size_t)state.range(1));
+  commandBuffer* buffer = commandBuffer::createBuffer(cmds);
+  deleteAll(cmds);
+  for (auto _ : state) {
+    commandBuffer parsed(buffer->length(), buffer->head());
+    parsed.processBuffer();
+    std::vector<Command*> out = parsed.getQueue();
+    benchmark::DoNotOptimize(out.data());
+    deleteAll(out);
+  }
+  state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)buffer->length());
+  delete[] buffer->head();
+  delete buffer;
+}
+BENCHMARK(BM_CommandBufferParse)->ArgsProduct({ { 1, 100 }, { 2, 256 } })->ArgNames({ "frames", "points" });
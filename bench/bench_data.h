@@ -0,0 +1,56 @@
+#pragma once
+
+#include "renderlib/ImageXYZC.h"
+#include "renderlib/Logging.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Volume sizes (cube edge length) and channel counts that benchmarks are run with.
+#define AGAVE_BENCH_VOLUME_ARGS ArgsProduct({ { 64, 128, 256 }, { 1, 4 } })
+
+// Deterministic pseudo-random intensities with a different range per channel,
+// so that histograms and LUTs are not degenerate.
+inline void
+fillChannelData(uint16_t* data, size_t count, uint32_t channel)
+{
+  uint32_t range = 1000 + 3000 * channel;
+  for (size_t i = 0; i < count; ++i) {
+    data[i] = (uint16_t)(((i * 2654435761u) >> 16) % range);
+  }
+}
+
+inline std::vector<uint16_t>
+makeChannelData(size_t count, uint32_t channel = 0)
+{
+  std::vector<uint16_t> data(count);
+  fillChannelData(data.data(), count, channel);
+  return data;
+}
+
+// A size x size x size volume with nchannels channels.
+inline std::shared_ptr<ImageXYZC>
+makeVolume(uint32_t size, uint32_t nchannels)
+{
+  // channel statistics are logged on construction
+  Logging::Enable(false);
+
+  size_t nvox = (size_t)size * size * size;
+  uint16_t* data = new uint16_t[nvox * nchannels];
+  for (uint32_t c = 0; c < nchannels; ++c) {
+    fillChannelData(data + c * nvox, nvox, c);
+  }
+  // the image owns data
+  return std::make_shared<ImageXYZC>(
+    size, size, size, nchannels, ImageXYZC::IN_MEMORY_BPP, reinterpret_cast<uint8_t*>(data), 1.0f, 1.0f, 1.0f);
+}
+
+// report throughput in voxels processed
+inline void
+setVoxelsProcessed(benchmark::State& state, size_t voxelsPerIteration)
+{
+  state.SetItemsProcessed((int64_t)state.iterations() * (int64_t)voxelsPerIteration);
+}
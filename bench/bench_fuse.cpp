@@ -0,0 +1,58 @@
+#include "bench_data.h"
+
+#include "renderlib/Fuse.h"
+
+static std::vector<glm::vec3>
+channelColors(uint32_t nchannels)
+{
+  static const glm::vec3 palette[] = { { 1.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f },
+                                       { 1.0f, 0.5f, 0.0f } };
+  std::vector<glm::vec3> colors;
+  for (uint32_t i = 0; i < nchannels; ++i) {
+    colors.push_back(palette[i % 4]);
+  }
+  return colors;
+}
+
+static void
+BM_Fuse(benchmark::State& state, FuseMode mode, bool withGradient)
+{
+  uint32_t size = (uint32_t)state.range(0);
+  uint32_t nchannels = (uint32_t)state.range(1);
+  auto img = makeVolume(size, nchannels);
+  std::vector<glm::vec3> colors = channelColors(nchannels);
+  size_t nvox = (size_t)size * size * size;
+  std::vector<uint8_t> rgb(3 * nvox);
+  std::vector<uint16_t> gradient(withGradient ? nvox : 0);
+  uint8_t* outRGB = rgb.data();
+  uint16_t* outGradient = gradient.data();
+  const FuseKernel& kernel = FuseKernel::get(mode);
+
+  for (auto _ : state) {
+    Fuse::fuse(img.get(), colors, &outRGB, withGradient ? &outGradient : nullptr, kernel);
+    benchmark::ClobberMemory();
+  }
+  setVoxelsProcessed(state, nvox);
+}
+BENCHMARK_CAPTURE(BM_Fuse, max, FuseMode::MAX, false)->AGAVE_BENCH_VOLUME_ARGS->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Fuse, additive, FuseMode::ADDITIVE, false)->AGAVE_BENCH_VOLUME_ARGS->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Fuse, average, FuseMode::AVERAGE, false)->AGAVE_BENCH_VOLUME_ARGS->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Fuse, maxWithGradient, FuseMode::MAX, true)
+  ->AGAVE_BENCH_VOLUME_ARGS->Unit(benchmark::kMillisecond);
+
+static void
+BM_GradientMagnitudeVolume(benchmark::State& state)
+{
+  uint32_t size = (uint32_t)state.range(0);
+  uint32_t nchannels = (uint32_t)state.range(1);
+  auto img = makeVolume(size, nchannels);
+
+  for (auto _ : state) {
+    for (uint32_t c = 0; c < nchannels; ++c) {
+      uint16_t* gradient = img->channel(c)->generateGradientMagnitudeVolume(1.0f, 1.0f, 1.0f);
+      benchmark::DoNotOptimize(gradient);
+    }
+  }
+  setVoxelsProcessed(state, (size_t)size * size * size * nchannels);
+}
+BENCHMARK(BM_GradientMagnitudeVolume)->AGAVE_BENCH_VOLUME_ARGS->Unit(benchmark::kMillisecond);
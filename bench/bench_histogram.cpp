@@ -0,0 +1,51 @@
+#include "bench_data.h"
+
+#include "renderlib/Histogram.h"
+
+#include <functional>
+
+static void
+BM_HistogramConstruct(benchmark::State& state)
+{
+  size_t size = (size_t)state.range(0);
+  size_t nvox = size * size * size;
+  std::vector<uint16_t> data = makeChannelData(nvox);
+  for (auto _ : state) {
+    Histogram h(data.data(), nvox);
+    benchmark::DoNotOptimize(h._maxBin);
+  }
+  setVoxelsProcessed(state, nvox);
+}
+BENCHMARK(BM_HistogramConstruct)->Arg(64)->Arg(128)->Arg(256)->Unit(benchmark::kMillisecond);
+
+static void
+BM_HistogramLut(benchmark::State& state, std::function<float*(const Histogram&)> generate)
+{
+  // LUT generation only depends on the bins, not on the volume size
+  std::vector<uint16_t> data = makeChannelData(128 * 128 * 128);
+  Histogram h(data.data(), data.size());
+  for (auto _ : state) {
+    float* lut = generate(h);
+    benchmark::DoNotOptimize(lut);
+    delete[] lut;
+  }
+}
+BENCHMARK_CAPTURE(BM_HistogramLut, fullRange, [](const Histogram& h) { return h.generate_fullRange(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, dataRange, [](const Histogram& h) { return h.generate_dataRange(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, bestFit, [](const Histogram& h) { return h.generate_bestFit(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, auto2, [](const Histogram& h) { return h.generate_auto2(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, auto, [](const Histogram& h) { return h.generate_auto(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, percentiles, [](const Histogram& h) { return h.generate_percentiles(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, windowLevel, [](const Histogram& h) {
+  return h.generate_windowLevel(0.5f, 0.5f);
+});
+BENCHMARK_CAPTURE(BM_HistogramLut, controlPoints, [](const Histogram& h) {
+  return h.generate_controlPoints({ { 0.0f, 0.0f }, { 0.3f, 0.1f }, { 0.7f, 0.9f }, { 1.0f, 1.0f } });
+});
+BENCHMARK_CAPTURE(BM_HistogramLut, equalized, [](const Histogram& h) { return h.generate_equalized(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, thresholds, [](const Histogram& h) { return h.initialize_thresholds(); });
+BENCHMARK_CAPTURE(BM_HistogramLut, isovalue, [](const Histogram& h) {
+  GradientData gradientData;
+  gradientData.m_activeMode = GradientEditMode::ISOVALUE;
+  return h.generateFromGradientData(gradientData);
+});
@@ -0,0 +1,26 @@
+#include "bench_data.h"
+
+#include "renderlib/graphics/ImageXyzcGpu.h"
+
+// only the host side interleave; the texture upload needs a GL context
+static void
+BM_Interleave4x16(benchmark::State& state)
+{
+  uint32_t size = (uint32_t)state.range(0);
+  uint32_t nchannels = (uint32_t)state.range(1);
+  auto img = makeVolume(size, nchannels);
+  size_t nvox = (size_t)size * size * size;
+  std::vector<uint16_t> dest(4 * nvox);
+  // channels are repeated when there are fewer than 4, as in ImageGpu::allocGpuInterleaved
+  int channels[4];
+  for (int i = 0; i < 4; ++i) {
+    channels[i] = std::min(i, (int)nchannels - 1);
+  }
+
+  for (auto _ : state) {
+    ImageGpu::interleave4x16(img.get(), channels, dest.data());
+    benchmark::ClobberMemory();
+  }
+  setVoxelsProcessed(state, nvox);
+}
+BENCHMARK(BM_Interleave4x16)->AGAVE_BENCH_VOLUME_ARGS->Unit(benchmark::kMillisecond);
@@ -0,0 +1,40 @@
+#include "bench_data.h"
+
+#include "renderlib/VolumeDimensions.h"
+#include "renderlib/io/FileReader.h"
+
+static void
+BM_ConvertChannelData(benchmark::State& state)
+{
+  uint32_t size = (uint32_t)state.range(0);
+  int bitsPerPixel = (int)state.range(1);
+  VolumeDimensions dims;
+  dims.sizeX = dims.sizeY = dims.sizeZ = size;
+  dims.bitsPerPixel = bitsPerPixel;
+  size_t nvox = (size_t)size * size * size;
+
+  std::vector<uint8_t> src(nvox * bitsPerPixel / 8);
+  if (bitsPerPixel == 32) {
+    float* f = reinterpret_cast<float*>(src.data());
+    for (size_t i = 0; i < nvox; ++i) {
+      f[i] = (float)((i * 2654435761u) >> 16) * 0.001f;
+    }
+  } else {
+    for (size_t i = 0; i < src.size(); ++i) {
+      src[i] = (uint8_t)((i * 2654435761u) >> 24);
+    }
+  }
+  std::vector<uint16_t> dest(nvox);
+
+  for (auto _ : state) {
+    size_t ok = convertChannelData(reinterpret_cast<uint8_t*>(dest.data()), src.data(), dims);
+    benchmark::DoNotOptimize(ok);
+    benchmark::ClobberMemory();
+  }
+  setVoxelsProcessed(state, nvox);
+  state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)src.size());
+}
+BENCHMARK(BM_ConvertChannelData)
+  ->ArgsProduct({ { 64, 128, 256 }, { 8, 16, 32 } })
+  ->ArgNames({ "size", "bits" })
+  ->Unit(benchmark::kMillisecond);
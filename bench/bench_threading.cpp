@@ -0,0 +1,32 @@
+#include "bench_data.h"
+
+#include "renderlib/threading.h"
+
+#include <atomic>
+
+// cost of dispatching and joining a parallel_for whose chunks do almost nothing
+static void
+BM_ParallelForOverhead(benchmark::State& state)
+{
+  size_t n = (size_t)state.range(0);
+  size_t grain = (size_t)state.range(1);
+  std::atomic<size_t> chunks(0);
+  for (auto _ : state) {
+    parallel_for(
+      n, [&chunks](size_t s, size_t e) { chunks.fetch_add(1, std::memory_order_relaxed); }, true, grain);
+  }
+  state.counters["chunks"] = benchmark::Counter((double)chunks.load(), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_ParallelForOverhead)->ArgsProduct({ { 1, 1024, 1 << 20 }, { 0, 1024 } })->ArgNames({ "n", "grain" });
+
+static void
+BM_ParallelForNoThreads(benchmark::State& state)
+{
+  size_t n = (size_t)state.range(0);
+  std::atomic<size_t> chunks(0);
+  for (auto _ : state) {
+    parallel_for(
+      n, [&chunks](size_t s, size_t e) { chunks.fetch_add(1, std::memory_order_relaxed); }, false);
+  }
+}
+BENCHMARK(BM_ParallelForNoThreads)->Arg(1024)->Arg(1 << 20);
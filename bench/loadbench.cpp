@@ -0,0 +1,348 @@
+// agave_loadbench: end to end load timings of the file readers on synthetic data.
+//
+//   agave_loadbench generate <dir> [volume options]
+//     writes the standard synthetic datasets (see writeSyntheticDatasets) into <dir>
+//   agave_loadbench run <dataset>... [--repeat N] [--json file]
+//     loads each dataset with FileReader::getReader(...)->loadFromFile and reports the fastest of N loads
+//   agave_loadbench all <dir> [volume options] [--repeat N] [--json file]
+//     generate, then run on everything generated
+//
+// volume options:
+//   --size X,Y,Z        (default 256,256,64)
+//   --channels C        (default 2)
+//   --times T           (default 1)
+//   --dtype uint8|uint16|float32 (default uint16)
+//   --tiff-compression list of none,lzw,deflate (default all)
+//   --zarr-compression list of none,zlib,blosc (default all)
+//
+// Repeated loads read from the OS file cache; drop the caches between runs to time cold reads.
+// Peak RSS is reset before each load on Linux; elsewhere it is the peak of the whole process so far.
+
+#include "synthetic_datasets.h"
+
+#include "renderlib/IFileReader.h"
+#include "renderlib/ImageXYZC.h"
+#include "renderlib/Logging.h"
+#include "renderlib/VolumeDimensions.h"
+#include "renderlib/io/FileReader.h"
+
+#include <nlohmann/json.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
+
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const double MB = 1024.0 * 1024.0;
+
+struct LoadResult
+{
+  std::string path;
+  bool ok = false;
+  double seconds = 0.0;
+  // bytes on disk
+  size_t fileBytes = 0;
+  // bytes of the loaded image in memory
+  size_t imageBytes = 0;
+  double peakRssMB = 0.0;
+  LoadProfile profile;
+};
+
+void
+resetPeakRss()
+{
+#if defined(__linux__)
+  // "5" resets the peak resident set size of the process (VmHWM)
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+#endif
+}
+
+double
+peakRssMB()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize / MB;
+  }
+  return 0.0;
+#elif defined(__linux__)
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0) {
+      return std::stod(line.substr(6)) / 1024.0;
+    }
+  }
+  return 0.0;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // bytes on macOS
+  return usage.ru_maxrss / MB;
+#endif
+}
+
+size_t
+diskSize(const std::string& path)
+{
+  std::error_code ec;
+  if (!std::filesystem::is_directory(path, ec)) {
+    return std::filesystem::file_size(path, ec);
+  }
+  size_t total = 0;
+  for (auto& entry : std::filesystem::recursive_directory_iterator(path, ec)) {
+    if (entry.is_regular_file(ec)) {
+      total += entry.file_size(ec);
+    }
+  }
+  return total;
+}
+
+LoadResult
+loadOnce(const std::string& path)
+{
+  LoadResult result;
+  result.path = path;
+  result.fileBytes = diskSize(path);
+
+  // released after the timing, so that freeing it is not counted
+  std::shared_ptr<ImageXYZC> image;
+
+  resetPeakRss();
+  auto tStart = std::chrono::high_resolution_clock::now();
+  {
+    ScopedLoadProfile scopedProfile(result.profile);
+    std::unique_ptr<IFileReader> reader(FileReader::getReader(path));
+    if (!reader) {
+      std::cerr << "No reader for " << path << std::endl;
+      return result;
+    }
+    // full resolution level of the first scene
+    std::vector<MultiscaleDims> levels = reader->loadMultiscaleDims(path, 0);
+    LoadSpec loadSpec;
+    loadSpec.filepath = path;
+    loadSpec.subpath = levels.empty() ? "" : levels[0].path;
+    image = reader->loadFromFile(loadSpec);
+    result.ok = (image != nullptr);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - tStart;
+  result.seconds = elapsed.count();
+  result.peakRssMB = peakRssMB();
+  if (image) {
+    result.imageBytes = image->size();
+  }
+  return result;
+}
+
+// fastest of `repeat` loads
+LoadResult
+runDataset(const std::string& path, int repeat)
+{
+  LoadResult best;
+  for (int i = 0; i < repeat; ++i) {
+    LoadResult result = loadOnce(path);
+    if (!result.ok) {
+      return result;
+    }
+    if (i == 0 || result.seconds < best.seconds) {
+      best = result;
+    }
+  }
+  return best;
+}
+
+void
+printResults(const std::vector<LoadResult>& results)
+{
+  printf("%-40s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+         "dataset",
+         "ms",
+         "MB/s",
+         "file MB",
+         "data MB",
+         "RSS MB",
+         "read ms",
+         "conv ms",
+         "stats ms");
+  for (const LoadResult& r : results) {
+    std::string name = std::filesystem::path(r.path).filename().string();
+    if (!r.ok) {
+      printf("%-40s FAILED\n", name.c_str());
+      continue;
+    }
+    printf("%-40s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+           name.c_str(),
+           r.seconds * 1000.0,
+           r.profile.bytesRead / MB / r.seconds,
+           r.fileBytes / MB,
+           r.profile.bytesRead / MB,
+           r.peakRssMB,
+           r.profile.seconds[LoadProfile::READ] * 1000.0,
+           r.profile.seconds[LoadProfile::CONVERT] * 1000.0,
+           r.profile.seconds[LoadProfile::STATS] * 1000.0);
+  }
+}
+
+bool
+writeResultsJson(const std::string& path, const std::vector<LoadResult>& results)
+{
+  nlohmann::json json = nlohmann::json::array();
+  for (const LoadResult& r : results) {
+    nlohmann::json phases = nlohmann::json::object();
+    for (int p = 0; p < LoadProfile::NUM_PHASES; ++p) {
+      phases[LoadProfile::phaseName((LoadProfile::Phase)p)] = r.profile.seconds[p];
+    }
+    json.push_back({ { "dataset", r.path },
+                     { "ok", r.ok },
+                     { "seconds", r.seconds },
+                     { "mb_per_second", r.ok ? r.profile.bytesRead / MB / r.seconds : 0.0 },
+                     { "file_bytes", r.fileBytes },
+                     { "data_bytes", r.profile.bytesRead },
+                     { "image_bytes", r.imageBytes },
+                     { "peak_rss_mb", r.peakRssMB },
+                     { "phase_seconds", phases } });
+  }
+  std::ofstream file(path);
+  file << json.dump(2);
+  return (bool)file;
+}
+
+std::vector<std::string>
+splitList(const std::string& s)
+{
+  std::vector<std::string> items;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+int
+usage()
+{
+  std::cerr << "usage:\n"
+            << "  agave_loadbench generate <dir> [--size X,Y,Z] [--channels C] [--times T] [--dtype D]\n"
+            << "                  [--tiff-compression none,lzw,deflate] [--zarr-compression none,zlib,blosc]\n"
+            << "  agave_loadbench run <dataset>... [--repeat N] [--json file]\n"
+            << "  agave_loadbench all <dir> [generate options] [--repeat N] [--json file]\n"
+            << "  --verbose logs everything the readers log" << std::endl;
+  return 1;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  if (argc < 3) {
+    return usage();
+  }
+  std::string command = argv[1];
+  if (command != "generate" && command != "run" && command != "all") {
+    return usage();
+  }
+
+  SyntheticVolumeSpec spec;
+  std::vector<std::string> tiffCompressions = { "none", "lzw", "deflate" };
+  std::vector<std::string> zarrCompressions = { "none", "zlib", "blosc" };
+  int repeat = 3;
+  std::string jsonPath;
+  bool verbose = false;
+  std::vector<std::string> positional;
+
+  try {
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      bool hasValue = (i + 1 < argc);
+      if (arg == "--size" && hasValue) {
+        std::vector<std::string> size = splitList(argv[++i]);
+        if (size.size() != 3) {
+          return usage();
+        }
+        spec.sizeX = std::stoul(size[0]);
+        spec.sizeY = std::stoul(size[1]);
+        spec.sizeZ = std::stoul(size[2]);
+      } else if (arg == "--channels" && hasValue) {
+        spec.sizeC = std::stoul(argv[++i]);
+      } else if (arg == "--times" && hasValue) {
+        spec.sizeT = std::stoul(argv[++i]);
+      } else if (arg == "--dtype" && hasValue) {
+        spec.dtype = argv[++i];
+      } else if (arg == "--tiff-compression" && hasValue) {
+        tiffCompressions = splitList(argv[++i]);
+      } else if (arg == "--zarr-compression" && hasValue) {
+        zarrCompressions = splitList(argv[++i]);
+      } else if (arg == "--repeat" && hasValue) {
+        repeat = std::max(1, std::stoi(argv[++i]));
+      } else if (arg == "--json" && hasValue) {
+        jsonPath = argv[++i];
+      } else if (arg == "--verbose") {
+        verbose = true;
+      } else if (arg.rfind("--", 0) == 0) {
+        return usage();
+      } else {
+        positional.push_back(arg);
+      }
+    }
+  } catch (const std::exception&) {
+    return usage();
+  }
+  if (positional.empty() || spec.bytesPerPixel() == 0) {
+    return usage();
+  }
+
+  // the readers log every load at debug level
+  spdlog::set_level(verbose ? spdlog::level::trace : spdlog::level::warn);
+
+  std::vector<std::string> datasets = positional;
+  if (command == "generate" || command == "all") {
+    std::cout << "Writing " << spec.sizeX << "x" << spec.sizeY << "x" << spec.sizeZ << " x " << spec.sizeC
+              << " channels x " << spec.sizeT << " times of " << spec.dtype << " to " << positional[0] << std::endl;
+    datasets = writeSyntheticDatasets(positional[0], spec, tiffCompressions, zarrCompressions);
+    for (const std::string& path : datasets) {
+      std::cout << "  " << path << std::endl;
+    }
+    if (command == "generate") {
+      return 0;
+    }
+  }
+
+  std::vector<LoadResult> results;
+  for (const std::string& path : datasets) {
+    results.push_back(runDataset(path, repeat));
+  }
+  printResults(results);
+
+  if (!jsonPath.empty() && !writeResultsJson(jsonPath, results)) {
+    std::cerr << "Failed to write " << jsonPath << std::endl;
+    return 1;
+  }
+  for (const LoadResult& r : results) {
+    if (!r.ok) {
+      return 1;
+    }
+  }
+  return 0;
+}
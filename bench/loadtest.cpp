@@ -0,0 +1,571 @@
+// agave_loadtest: drives a running render server (agave --server) with many concurrent websocket sessions and reports
+// the frame latency and throughput each session sees.
+//
+//   agave_loadtest --data <path> [options]
+//     every session loads <path>, then orbits the camera, edits a lookup table and redraws at --rate requests/second
+//   agave_loadtest --trace <file> [options]
+//     every session replays a recorded command trace (see agave_app/commandTrace.h) at its recorded pace
+//
+// options:
+//   --url ws://host:port   the server (default ws://localhost:1235)
+//   --sessions N           concurrent sessions (default 4)
+//   --duration S           seconds to send requests for (default 30); a trace also ends when it runs out
+//   --rate R               requests per second per session with --data (default 10)
+//   --speed X              trace playback speed; 0 sends as fast as the server answers (default 1)
+//   --loop                 replay the trace from the start when it runs out
+//   --in-flight N          unanswered requests a session may have before it waits for a frame (default 2)
+//   --size WxH             render resolution with --data (default 512x512)
+//   --metrics URL          the server's metrics endpoint (e.g. http://localhost:9090/metrics), to sample queue depth
+//   --json file            also write the results as json
+//
+// The server answers every request with one frame, so a frame's latency is the time from sending the oldest
+// unanswered request to receiving the frame. A trace that turns on stream mode gets more frames than requests;
+// the extra frames count towards frames per second but not latency.
+
+#include "agave_app/commandTrace.h"
+#include "renderlib/command.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+#include <QWebSocket>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+  QUrl url = QUrl("ws://localhost:1235");
+  int sessions = 4;
+  double durationSeconds = 30.0;
+  double rate = 10.0;
+  double speed = 1.0;
+  bool loop = false;
+  int inFlight = 2;
+  int width = 512;
+  int height = 512;
+  QUrl metricsUrl;
+  QString jsonPath;
+};
+
+// what every session sends
+struct Workload
+{
+  std::vector<CommandTraceEntry> entries;
+  bool loop = false;
+  // when looping, the entries from loopFrom on are sent again every loopPeriodNs
+  size_t loopFrom = 0;
+  uint64_t loopPeriodNs = 0;
+};
+
+std::vector<uint8_t>
+encodeAndDelete(std::vector<Command*> commands)
+{
+  std::vector<uint8_t> bytes = encodeCommands(commands);
+  for (Command* c : commands) {
+    delete c;
+  }
+  return bytes;
+}
+
+// load once, then keep interacting
+Workload
+interactiveWorkload(const QString& dataPath, const Options& options)
+{
+  Workload workload;
+  uint64_t intervalNs = (uint64_t)(1.0e9 / std::max(options.rate, 0.001));
+
+  CommandTraceEntry setup;
+  setup.buffer = encodeAndDelete({ new SetResolutionCommand({ options.width, options.height }),
+                                   new LoadDataCommand({ dataPath.toStdString(), 0, 0, 0, {}, 0, 0, 0, 0, 0, 0 }),
+                                   new RequestRedrawCommand({}) });
+  workload.entries.push_back(setup);
+
+  std::vector<std::vector<uint8_t>> interactions = {
+    encodeAndDelete({ new OrbitCameraCommand({ 5.0f, 0.0f }), new RequestRedrawCommand({}) }),
+    encodeAndDelete({ new SetPercentileThresholdCommand({ 0, 0.5f, 0.98f }), new RequestRedrawCommand({}) }),
+    encodeAndDelete({ new OrbitCameraCommand({ 0.0f, 5.0f }), new RequestRedrawCommand({}) }),
+    encodeAndDelete({ new SetPercentileThresholdCommand({ 0, 0.6f, 0.99f }), new RequestRedrawCommand({}) }),
+    encodeAndDelete({ new RequestRedrawCommand({}) }),
+  };
+  for (size_t i = 0; i < interactions.size(); ++i) {
+    CommandTraceEntry entry;
+    entry.timeNs = (i + 1) * intervalNs;
+    entry.buffer = interactions[i];
+    workload.entries.push_back(entry);
+  }
+  workload.loop = true;
+  workload.loopFrom = 1;
+  workload.loopPeriodNs = interactions.size() * intervalNs;
+  return workload;
+}
+
+struct SessionResult
+{
+  int id = 0;
+  bool connected = false;
+  QString error;
+  int requestsSent = 0;
+  int framesReceived = 0;
+  // times a request was due while too many were unanswered
+  int sendsDeferred = 0;
+  qint64 bytesReceived = 0;
+  std::vector<double> latenciesMs;
+  // from connecting to the last frame
+  double activeSeconds = 0.0;
+};
+
+class LoadTestSession
+{
+public:
+  LoadTestSession(int id, const Options& options, const Workload& workload, std::function<void()> onFinished)
+    : m_options(options)
+    , m_workload(workload)
+    , m_onFinished(onFinished)
+  {
+    m_result.id = id;
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&m_timer, &QTimer::timeout, [this]() { sendDue(); });
+    QObject::connect(&m_socket, &QWebSocket::connected, [this]() {
+      m_result.connected = true;
+      m_clock.start();
+      sendDue();
+    });
+    QObject::connect(&m_socket, &QWebSocket::binaryMessageReceived, [this](const QByteArray& m) { onFrame(m); });
+    QObject::connect(&m_socket, &QWebSocket::disconnected, [this]() {
+      if (!m_finished && m_result.error.isEmpty()) {
+        m_result.error = "disconnected by the server";
+      }
+      finish();
+    });
+    QObject::connect(&m_socket, &QWebSocket::errorOccurred, [this](QAbstractSocket::SocketError) {
+      m_result.error = m_socket.errorString();
+      finish();
+    });
+  }
+
+  void start() { m_socket.open(m_options.url); }
+
+  // stop sending; finishes once every request sent is answered
+  void stop()
+  {
+    m_stopping = true;
+    m_timer.stop();
+    if (m_sentAt.empty()) {
+      finish();
+    }
+  }
+
+  // give up on unanswered requests
+  void abort()
+  {
+    m_stopping = true;
+    finish();
+  }
+
+  bool isFinished() const { return m_finished; }
+  const SessionResult& result() const { return m_result; }
+
+private:
+  const Options& m_options;
+  const Workload& m_workload;
+  std::function<void()> m_onFinished;
+  SessionResult m_result;
+
+  QWebSocket m_socket;
+  QTimer m_timer;
+  QElapsedTimer m_clock;
+  // send times of unanswered requests, oldest first
+  std::deque<qint64> m_sentAt;
+  size_t m_next = 0;
+  uint64_t m_iteration = 0;
+  bool m_waitingForFrame = false;
+  bool m_stopping = false;
+  bool m_finished = false;
+
+  qint64 dueNs(size_t entry) const
+  {
+    double ns = (double)m_workload.entries[entry].timeNs + (double)m_iteration * m_workload.loopPeriodNs;
+    return (qint64)(ns / m_options.speed);
+  }
+
+  void sendDue()
+  {
+    while (!m_stopping) {
+      if (m_next >= m_workload.entries.size()) {
+        if (!m_workload.loop || m_workload.loopFrom >= m_workload.entries.size()) {
+          stop();
+          return;
+        }
+        m_next = m_workload.loopFrom;
+        m_iteration++;
+      }
+      if (m_options.speed > 0.0) {
+        qint64 wait = dueNs(m_next) - m_clock.nsecsElapsed();
+        if (wait > 0) {
+          m_timer.start((int)std::ceil(wait / 1.0e6));
+          return;
+        }
+      }
+      if ((int)m_sentAt.size() >= m_options.inFlight) {
+        // sent as soon as a frame comes back
+        if (!m_waitingForFrame && m_options.speed > 0.0) {
+          m_result.sendsDeferred++;
+        }
+        m_waitingForFrame = true;
+        return;
+      }
+      m_waitingForFrame = false;
+      const std::vector<uint8_t>& buffer = m_workload.entries[m_next].buffer;
+      m_sentAt.push_back(m_clock.nsecsElapsed());
+      m_socket.sendBinaryMessage(QByteArray(reinterpret_cast<const char*>(buffer.data()), (int)buffer.size()));
+      m_result.requestsSent++;
+      m_next++;
+    }
+  }
+
+  void onFrame(const QByteArray& message)
+  {
+    qint64 now = m_clock.nsecsElapsed();
+    m_result.framesReceived++;
+    m_result.bytesReceived += message.size();
+    m_result.activeSeconds = now / 1.0e9;
+    if (!m_sentAt.empty()) {
+      m_result.latenciesMs.push_back((now - m_sentAt.front()) / 1.0e6);
+      m_sentAt.pop_front();
+    }
+    if (m_stopping) {
+      if (m_sentAt.empty()) {
+        finish();
+      }
+    } else if (m_waitingForFrame) {
+      sendDue();
+    }
+  }
+
+  void finish()
+  {
+    if (m_finished) {
+      return;
+    }
+    m_finished = true;
+    m_timer.stop();
+    m_socket.close();
+    m_onFinished();
+  }
+};
+
+// samples the total request queue depth of all sessions on the server
+class QueueDepthSampler
+{
+public:
+  explicit QueueDepthSampler(const QUrl& url)
+    : m_url(url)
+  {
+    QObject::connect(&m_timer, &QTimer::timeout, [this]() {
+      QNetworkReply* reply = m_network.get(QNetworkRequest(m_url));
+      QObject::connect(reply, &QNetworkReply::finished, [this, reply]() {
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError) {
+          return;
+        }
+        double total = 0.0;
+        for (const QByteArray& line : reply->readAll().split('\n')) {
+          if (line.startsWith("agave_session_queue_depth")) {
+            total += line.mid(line.lastIndexOf(' ') + 1).toDouble();
+          }
+        }
+        m_samples.push_back(total);
+      });
+    });
+  }
+
+  void start() { m_timer.start(500); }
+  void stop() { m_timer.stop(); }
+  const std::vector<double>& samples() const { return m_samples; }
+
+private:
+  QUrl m_url;
+  QNetworkAccessManager m_network;
+  QTimer m_timer;
+  std::vector<double> m_samples;
+};
+
+// nearest rank
+double
+percentile(std::vector<double> values, double p)
+{
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+  return values[std::max<size_t>(rank, 1) - 1];
+}
+
+QJsonObject
+latencyJson(const std::vector<double>& latenciesMs)
+{
+  QJsonObject json;
+  json["p50_ms"] = percentile(latenciesMs, 50);
+  json["p95_ms"] = percentile(latenciesMs, 95);
+  json["p99_ms"] = percentile(latenciesMs, 99);
+  json["max_ms"] = latenciesMs.empty() ? 0.0 : *std::max_element(latenciesMs.begin(), latenciesMs.end());
+  return json;
+}
+
+void
+printRow(const char* name,
+         int sent,
+         int frames,
+         double seconds,
+         const std::vector<double>& latenciesMs,
+         double mbReceived,
+         int deferred)
+{
+  printf("%-10s %8d %8d %8.1f %9.1f %9.1f %9.1f %9.1f %10.1f %9d\n",
+         name,
+         sent,
+         frames,
+         seconds > 0.0 ? frames / seconds : 0.0,
+         percentile(latenciesMs, 50),
+         percentile(latenciesMs, 95),
+         percentile(latenciesMs, 99),
+         latenciesMs.empty() ? 0.0 : *std::max_element(latenciesMs.begin(), latenciesMs.end()),
+         mbReceived,
+         deferred);
+}
+
+const double MB = 1024.0 * 1024.0;
+
+// returns false if any session failed
+bool
+report(const std::vector<std::unique_ptr<LoadTestSession>>& sessions,
+       const std::vector<double>& queueDepths,
+       const Options& options)
+{
+  printf("%-10s %8s %8s %8s %9s %9s %9s %9s %10s %9s\n",
+         "session",
+         "sent",
+         "frames",
+         "fps",
+         "p50 ms",
+         "p95 ms",
+         "p99 ms",
+         "max ms",
+         "recv MB",
+         "deferred");
+
+  bool ok = true;
+  std::vector<double> allLatencies;
+  int totalSent = 0, totalFrames = 0, totalDeferred = 0;
+  qint64 totalBytes = 0;
+  double longest = 0.0;
+  QJsonArray sessionsJson;
+  for (const auto& session : sessions) {
+    const SessionResult& r = session->result();
+    QString name = QString("%1").arg(r.id);
+    if (!r.connected || !r.error.isEmpty()) {
+      ok = false;
+      printf("%-10s FAILED: %s\n", name.toStdString().c_str(), r.error.toStdString().c_str());
+    }
+    if (r.connected) {
+      printRow(name.toStdString().c_str(),
+               r.requestsSent,
+               r.framesReceived,
+               r.activeSeconds,
+               r.latenciesMs,
+               r.bytesReceived / MB,
+               r.sendsDeferred);
+    }
+    allLatencies.insert(allLatencies.end(), r.latenciesMs.begin(), r.latenciesMs.end());
+    totalSent += r.requestsSent;
+    totalFrames += r.framesReceived;
+    totalDeferred += r.sendsDeferred;
+    totalBytes += r.bytesReceived;
+    longest = std::max(longest, r.activeSeconds);
+
+    QJsonObject json = latencyJson(r.latenciesMs);
+    json["session"] = r.id;
+    json["connected"] = r.connected;
+    json["error"] = r.error;
+    json["requests_sent"] = r.requestsSent;
+    json["frames_received"] = r.framesReceived;
+    json["fps"] = r.activeSeconds > 0.0 ? r.framesReceived / r.activeSeconds : 0.0;
+    json["bytes_received"] = (double)r.bytesReceived;
+    json["sends_deferred"] = r.sendsDeferred;
+    sessionsJson.append(json);
+  }
+  // total fps is the sum over concurrently running sessions
+  printRow("all", totalSent, totalFrames, longest, allLatencies, totalBytes / MB, totalDeferred);
+
+  QJsonObject summary = latencyJson(allLatencies);
+  summary["sessions"] = (int)sessions.size();
+  summary["requests_sent"] = totalSent;
+  summary["frames_received"] = totalFrames;
+  summary["fps"] = longest > 0.0 ? totalFrames / longest : 0.0;
+  if (!queueDepths.empty()) {
+    double mean = std::accumulate(queueDepths.begin(), queueDepths.end(), 0.0) / queueDepths.size();
+    double max = *std::max_element(queueDepths.begin(), queueDepths.end());
+    printf("server queue depth, all sessions: mean %.2f, max %.0f (%zu samples)\n", mean, max, queueDepths.size());
+    summary["queue_depth_mean"] = mean;
+    summary["queue_depth_max"] = max;
+  }
+
+  if (!options.jsonPath.isEmpty()) {
+    QJsonObject json;
+    json["url"] = options.url.toString();
+    json["summary"] = summary;
+    json["sessions"] = sessionsJson;
+    QFile file(options.jsonPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(json).toJson()) < 0) {
+      fprintf(stderr, "Failed to write %s\n", options.jsonPath.toStdString().c_str());
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Load test for the AGAVE render server");
+  parser.addHelpOption();
+  QCommandLineOption urlOption("url", "Render server websocket url.", "url", "ws://localhost:1235");
+  QCommandLineOption sessionsOption("sessions", "Concurrent sessions.", "count", "4");
+  QCommandLineOption durationOption("duration", "Seconds to send requests for.", "seconds", "30");
+  QCommandLineOption dataOption("data", "Volume every session loads and interacts with.", "path");
+  QCommandLineOption rateOption("rate", "Requests per second per session with --data.", "rate", "10");
+  QCommandLineOption sizeOption("size", "Render resolution with --data.", "WxH", "512x512");
+  QCommandLineOption traceOption("trace", "Command trace every session replays.", "file");
+  QCommandLineOption speedOption("speed", "Trace playback speed; 0 is as fast as the server answers.", "factor", "1");
+  QCommandLineOption loopOption("loop", "Replay the trace from the start when it runs out.");
+  QCommandLineOption inFlightOption("in-flight", "Unanswered requests a session may have.", "count", "2");
+  QCommandLineOption metricsOption("metrics", "Server metrics url, to sample request queue depth.", "url");
+  QCommandLineOption jsonOption("json", "Write the results as json to this file.", "file");
+  parser.addOptions({ urlOption,
+                      sessionsOption,
+                      durationOption,
+                      dataOption,
+                      rateOption,
+                      sizeOption,
+                      traceOption,
+                      speedOption,
+                      loopOption,
+                      inFlightOption,
+                      metricsOption,
+                      jsonOption });
+  parser.process(app);
+
+  Options options;
+  options.url = QUrl(parser.value(urlOption));
+  options.sessions = std::max(1, parser.value(sessionsOption).toInt());
+  options.durationSeconds = parser.value(durationOption).toDouble();
+  options.rate = parser.value(rateOption).toDouble();
+  options.speed = std::max(0.0, parser.value(speedOption).toDouble());
+  options.loop = parser.isSet(loopOption);
+  options.inFlight = std::max(1, parser.value(inFlightOption).toInt());
+  QStringList size = parser.value(sizeOption).split('x');
+  if (size.length() == 2) {
+    options.width = size[0].toInt();
+    options.height = size[1].toInt();
+  }
+  if (parser.isSet(metricsOption)) {
+    options.metricsUrl = QUrl(parser.value(metricsOption));
+  }
+  options.jsonPath = parser.value(jsonOption);
+
+  Workload workload;
+  if (parser.isSet(traceOption)) {
+    std::string tracePath = parser.value(traceOption).toStdString();
+    if (!readCommandTrace(tracePath, workload.entries) || workload.entries.empty()) {
+      fprintf(stderr, "%s is not a command trace, or it is empty\n", tracePath.c_str());
+      return 1;
+    }
+    workload.loop = options.loop;
+    workload.loopFrom = 0;
+    // start over one millisecond after the last request
+    workload.loopPeriodNs = workload.entries.back().timeNs + 1000000;
+  } else if (parser.isSet(dataOption)) {
+    // paced by --rate
+    options.speed = 1.0;
+    workload = interactiveWorkload(parser.value(dataOption), options);
+  } else {
+    parser.showHelp(1);
+  }
+
+  std::vector<std::unique_ptr<LoadTestSession>> sessions;
+  std::unique_ptr<QueueDepthSampler> sampler;
+  if (options.metricsUrl.isValid()) {
+    sampler.reset(new QueueDepthSampler(options.metricsUrl));
+  }
+
+  bool reported = false;
+  bool ok = true;
+  auto onSessionFinished = [&]() {
+    for (const auto& s : sessions) {
+      if (!s->isFinished()) {
+        return;
+      }
+    }
+    if (!reported) {
+      reported = true;
+      if (sampler) {
+        sampler->stop();
+      }
+      ok = report(sessions, sampler ? sampler->samples() : std::vector<double>(), options);
+      app.quit();
+    }
+  };
+
+  for (int i = 0; i < options.sessions; ++i) {
+    sessions.emplace_back(new LoadTestSession(i, options, workload, onSessionFinished));
+  }
+  printf("%d sessions to %s for %.0f s\n",
+         options.sessions,
+         options.url.toString().toStdString().c_str(),
+         options.durationSeconds);
+  for (auto& s : sessions) {
+    s->start();
+  }
+  if (sampler) {
+    sampler->start();
+  }
+
+  // stop sending at the end, then give the server a few seconds to answer what it has
+  QTimer::singleShot((int)(options.durationSeconds * 1000.0), [&]() {
+    for (auto& s : sessions) {
+      s->stop();
+    }
+  });
+  QTimer::singleShot((int)(options.durationSeconds * 1000.0) + 10000, [&]() {
+    for (auto& s : sessions) {
+      s->abort();
+    }
+  });
+
+  app.exec();
+  return ok ? 0 : 1;
+}
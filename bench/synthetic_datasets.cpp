@@ -0,0 +1,481 @@
+#include "synthetic_datasets.h"
+
+#include "renderlib/Logging.h"
+
+#include "tensorstore/array.h"
+#include "tensorstore/index_space/dim_expression.h"
+#include "tensorstore/open.h"
+
+#include <nlohmann/json.hpp>
+#include <tiff.h>
+#include <tiffio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+uint32_t
+SyntheticVolumeSpec::bytesPerPixel() const
+{
+  if (dtype == "uint8") {
+    return 1;
+  } else if (dtype == "uint16") {
+    return 2;
+  } else if (dtype == "float32") {
+    return 4;
+  }
+  return 0;
+}
+
+size_t
+SyntheticVolumeSpec::bytesPerTime() const
+{
+  return (size_t)sizeX * sizeY * sizeZ * sizeC * bytesPerPixel();
+}
+
+namespace {
+
+const uint32_t NUM_BLOBS = 6;
+
+struct Blob
+{
+  float x, y, z;
+  float radius2;
+  float intensity;
+};
+
+uint32_t
+hash32(uint32_t v)
+{
+  v ^= v >> 16;
+  v *= 0x7feb352d;
+  v ^= v >> 15;
+  v *= 0x846ca68b;
+  v ^= v >> 16;
+  return v;
+}
+
+float
+unitHash(uint32_t v)
+{
+  return (float)(hash32(v) & 0xffff) / 65535.0f;
+}
+
+// a different set of blobs per channel, drifting a little from one timepoint to the next
+std::vector<Blob>
+makeBlobs(const SyntheticVolumeSpec& spec, uint32_t c, uint32_t t)
+{
+  std::vector<Blob> blobs;
+  float minSize = (float)std::min(spec.sizeX, std::min(spec.sizeY, spec.sizeZ));
+  for (uint32_t i = 0; i < NUM_BLOBS; ++i) {
+    uint32_t seed = (c * NUM_BLOBS + i) * 16;
+    float drift = 0.02f * t;
+    Blob b;
+    b.x = spec.sizeX * std::fmod(unitHash(seed + 0) + drift, 1.0f);
+    b.y = spec.sizeY * std::fmod(unitHash(seed + 1) + drift, 1.0f);
+    b.z = spec.sizeZ * unitHash(seed + 2);
+    float radius = std::max(2.0f, minSize * (0.05f + 0.2f * unitHash(seed + 3)));
+    b.radius2 = radius * radius;
+    b.intensity = 0.3f + 0.6f * unitHash(seed + 4);
+    blobs.push_back(b);
+  }
+  return blobs;
+}
+
+template<typename T>
+void
+fillPlaneTyped(T* dest, const SyntheticVolumeSpec& spec, const std::vector<Blob>& blobs, uint32_t z, float maxValue)
+{
+  for (uint32_t y = 0; y < spec.sizeY; ++y) {
+    for (uint32_t x = 0; x < spec.sizeX; ++x) {
+      float v = 0.05f + 0.1f * (float)x / (float)spec.sizeX;
+      for (const Blob& b : blobs) {
+        float dx = x - b.x, dy = y - b.y, dz = z - b.z;
+        float d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 < b.radius2) {
+          float f = 1.0f - d2 / b.radius2;
+          v += b.intensity * f * f;
+        }
+      }
+      v += 0.05f * unitHash(x + spec.sizeX * (y + spec.sizeY * z));
+      dest[(size_t)y * spec.sizeX + x] = (T)(std::min(v, 1.0f) * maxValue);
+    }
+  }
+}
+
+// one XY plane of raw pixels of spec.dtype
+void
+fillPlane(uint8_t* dest, const SyntheticVolumeSpec& spec, const std::vector<Blob>& blobs, uint32_t z)
+{
+  if (spec.dtype == "uint8") {
+    fillPlaneTyped<uint8_t>(dest, spec, blobs, z, 255.0f);
+  } else if (spec.dtype == "uint16") {
+    // 12 bits, like most camera data
+    fillPlaneTyped<uint16_t>(reinterpret_cast<uint16_t*>(dest), spec, blobs, z, 4095.0f);
+  } else {
+    fillPlaneTyped<float>(reinterpret_cast<float*>(dest), spec, blobs, z, 1000.0f);
+  }
+}
+
+std::string
+omeXml(const SyntheticVolumeSpec& spec)
+{
+  std::ostringstream xml;
+  xml << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+      << "<OME xmlns=\"http://www.openmicroscopy.org/Schemas/OME/2016-06\">"
+      << "<Image ID=\"Image:0\" Name=\"synthetic\">"
+      << "<Pixels ID=\"Pixels:0\" DimensionOrder=\"XYZCT\" Type=\"" << (spec.dtype == "float32" ? "float" : spec.dtype)
+      << "\" SizeX=\"" << spec.sizeX << "\" SizeY=\"" << spec.sizeY << "\" SizeZ=\"" << spec.sizeZ << "\" SizeC=\""
+      << spec.sizeC << "\" SizeT=\"" << spec.sizeT << "\" PhysicalSizeX=\"1\" PhysicalSizeY=\"1\" PhysicalSizeZ=\"1\">";
+  for (uint32_t c = 0; c < spec.sizeC; ++c) {
+    xml << "<Channel ID=\"Channel:0:" << c << "\" Name=\"C" << c << "\" SamplesPerPixel=\"1\"/>";
+  }
+  xml << "<TiffData/></Pixels></Image></OME>";
+  return xml.str();
+}
+
+bool
+writeJson(const std::filesystem::path& path, const nlohmann::json& json)
+{
+  std::ofstream file(path);
+  file << json.dump(2);
+  if (!file) {
+    LOG_ERROR << "Failed to write " << path.string();
+    return false;
+  }
+  return true;
+}
+
+template<typename T>
+bool
+writeZarrVolume(tensorstore::TensorStore<>& store,
+                const SyntheticVolumeSpec& spec,
+                const uint8_t* volume,
+                uint32_t c,
+                uint32_t t)
+{
+  tensorstore::Index shape[3] = { spec.sizeZ, spec.sizeY, spec.sizeX };
+  auto arr = tensorstore::Array(reinterpret_cast<const T*>(volume), shape, tensorstore::c_order);
+  auto target = store | tensorstore::Dims(0, 1).IndexSlice({ (tensorstore::Index)t, (tensorstore::Index)c });
+  if (!target.ok()) {
+    LOG_ERROR << "Error: " << target.status();
+    return false;
+  }
+  auto status = tensorstore::Write(tensorstore::UnownedToShared(arr), target.value()).status();
+  if (!status.ok()) {
+    LOG_ERROR << "Error: " << status;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool
+writeOmeTiff(const std::string& path, const SyntheticVolumeSpec& spec, const std::string& compression, bool tiled)
+{
+  uint16_t tiffCompression = COMPRESSION_NONE;
+  if (compression == "lzw") {
+    tiffCompression = COMPRESSION_LZW;
+  } else if (compression == "deflate") {
+    tiffCompression = COMPRESSION_ADOBE_DEFLATE;
+  } else if (compression != "none") {
+    LOG_ERROR << "Unknown TIFF compression " << compression;
+    return false;
+  }
+  if (spec.bytesPerPixel() == 0) {
+    LOG_ERROR << "Unknown dtype " << spec.dtype;
+    return false;
+  }
+  if (tiled && (spec.sizeX % 16 != 0 || spec.sizeY % 16 != 0)) {
+    LOG_ERROR << "Tiled TIFF needs sizeX and sizeY to be multiples of 16";
+    return false;
+  }
+
+  // BigTIFF when the classic 4GB offsets may not be enough
+  size_t totalBytes = spec.bytesPerTime() * spec.sizeT;
+  TIFF* tiff = TIFFOpen(path.c_str(), totalBytes > 0xF0000000ull ? "w8" : "w");
+  if (!tiff) {
+    LOG_ERROR << "Failed to open " << path << " for writing";
+    return false;
+  }
+
+  std::string description = omeXml(spec);
+  uint16_t sampleFormat = (spec.dtype == "float32") ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT;
+  size_t rowBytes = (size_t)spec.sizeX * spec.bytesPerPixel();
+  std::vector<uint8_t> plane(rowBytes * spec.sizeY);
+
+  bool ok = true;
+  bool first = true;
+  for (uint32_t t = 0; t < spec.sizeT && ok; ++t) {
+    for (uint32_t c = 0; c < spec.sizeC && ok; ++c) {
+      std::vector<Blob> blobs = makeBlobs(spec, c, t);
+      for (uint32_t z = 0; z < spec.sizeZ && ok; ++z) {
+        fillPlane(plane.data(), spec, blobs, z);
+
+        TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, spec.sizeX);
+        TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, spec.sizeY);
+        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, spec.bytesPerPixel() * 8);
+        TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 1);
+        TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, sampleFormat);
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+        TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tiff, TIFFTAG_COMPRESSION, tiffCompression);
+        if (tiffCompression != COMPRESSION_NONE && sampleFormat == SAMPLEFORMAT_UINT) {
+          TIFFSetField(tiff, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+        }
+        // the readers only look for metadata in the first IFD
+        if (first) {
+          TIFFSetField(tiff, TIFFTAG_IMAGEDESCRIPTION, description.c_str());
+          first = false;
+        }
+
+        if (tiled) {
+          TIFFSetField(tiff, TIFFTAG_TILEWIDTH, spec.sizeX);
+          TIFFSetField(tiff, TIFFTAG_TILELENGTH, spec.sizeY);
+          ok = TIFFWriteEncodedTile(tiff, 0, plane.data(), plane.size()) >= 0;
+        } else {
+          uint32_t rowsPerStrip = TIFFDefaultStripSize(tiff, 0);
+          TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+          for (uint32_t row = 0; row < spec.sizeY && ok; row += rowsPerStrip) {
+            uint32_t rows = std::min(rowsPerStrip, spec.sizeY - row);
+            ok = TIFFWriteEncodedStrip(tiff, row / rowsPerStrip, plane.data() + row * rowBytes, rows * rowBytes) >= 0;
+          }
+        }
+        ok = ok && TIFFWriteDirectory(tiff);
+      }
+    }
+  }
+  TIFFClose(tiff);
+
+  if (!ok) {
+    LOG_ERROR << "Failed to write " << path;
+  }
+  return ok;
+}
+
+bool
+writeOmeZarr(const std::string& path,
+             const SyntheticVolumeSpec& spec,
+             const std::vector<uint32_t>& chunkZYX,
+             const std::string& compression)
+{
+  nlohmann::json compressor = nullptr;
+  if (compression == "zlib") {
+    compressor = { { "id", "zlib" }, { "level", 1 } };
+  } else if (compression == "blosc") {
+    compressor = { { "id", "blosc" }, { "cname", "lz4" }, { "clevel", 5 }, { "shuffle", 1 } };
+  } else if (compression != "none") {
+    LOG_ERROR << "Unknown zarr compression " << compression;
+    return false;
+  }
+  std::string zarrDtype;
+  if (spec.dtype == "uint8") {
+    zarrDtype = "|u1";
+  } else if (spec.dtype == "uint16") {
+    zarrDtype = "<u2";
+  } else if (spec.dtype == "float32") {
+    zarrDtype = "<f4";
+  } else {
+    LOG_ERROR << "Unknown dtype " << spec.dtype;
+    return false;
+  }
+  if (chunkZYX.size() != 3) {
+    LOG_ERROR << "Zarr chunk shape must have 3 dimensions";
+    return false;
+  }
+
+  std::filesystem::path root(path);
+  std::error_code ec;
+  std::filesystem::remove_all(root, ec);
+  std::filesystem::create_directories(root, ec);
+  if (ec) {
+    LOG_ERROR << "Failed to create " << path << ": " << ec.message();
+    return false;
+  }
+
+  nlohmann::json channels = nlohmann::json::array();
+  for (uint32_t c = 0; c < spec.sizeC; ++c) {
+    channels.push_back({ { "label", "C" + std::to_string(c) } });
+  }
+  nlohmann::json attrs = {
+    { "multiscales",
+      { { { "version", "0.4" },
+          { "name", "synthetic" },
+          { "axes",
+            { { { "name", "t" }, { "type", "time" } },
+              { { "name", "c" }, { "type", "channel" } },
+              { { "name", "z" }, { "type", "space" }, { "unit", "micrometer" } },
+              { { "name", "y" }, { "type", "space" }, { "unit", "micrometer" } },
+              { { "name", "x" }, { "type", "space" }, { "unit", "micrometer" } } } },
+          { "datasets",
+            { { { "path", "0" },
+                { "coordinateTransformations", { { { "type", "scale" }, { "scale", { 1, 1, 1, 1, 1 } } } } } } } } } } },
+    { "omero", { { "channels", channels } } }
+  };
+  if (!writeJson(root / ".zgroup", { { "zarr_format", 2 } }) || !writeJson(root / ".zattrs", attrs)) {
+    return false;
+  }
+
+  nlohmann::json metadata = {
+    { "shape", { spec.sizeT, spec.sizeC, spec.sizeZ, spec.sizeY, spec.sizeX } },
+    { "chunks",
+      { 1,
+        1,
+        std::min(chunkZYX[0], spec.sizeZ),
+        std::min(chunkZYX[1], spec.sizeY),
+        std::min(chunkZYX[2], spec.sizeX) } },
+    { "dtype", zarrDtype },
+    { "compressor", compressor },
+    { "dimension_separator", "/" },
+  };
+  auto opened =
+    tensorstore::Open({ { "driver", "zarr" },
+                        { "kvstore", { { "driver", "file" }, { "path", (root / "0").string() + "/" } } },
+                        { "metadata", metadata } },
+                      tensorstore::OpenMode::create | tensorstore::OpenMode::delete_existing,
+                      tensorstore::ReadWriteMode::read_write)
+      .result();
+  if (!opened.ok()) {
+    LOG_ERROR << "Error: " << opened.status();
+    return false;
+  }
+  tensorstore::TensorStore<> store = opened.value();
+
+  size_t planeBytes = (size_t)spec.sizeX * spec.sizeY * spec.bytesPerPixel();
+  std::vector<uint8_t> volume(planeBytes * spec.sizeZ);
+  for (uint32_t t = 0; t < spec.sizeT; ++t) {
+    for (uint32_t c = 0; c < spec.sizeC; ++c) {
+      std::vector<Blob> blobs = makeBlobs(spec, c, t);
+      for (uint32_t z = 0; z < spec.sizeZ; ++z) {
+        fillPlane(volume.data() + z * planeBytes, spec, blobs, z);
+      }
+      bool ok = false;
+      if (spec.dtype == "uint8") {
+        ok = writeZarrVolume<uint8_t>(store, spec, volume.data(), c, t);
+      } else if (spec.dtype == "uint16") {
+        ok = writeZarrVolume<uint16_t>(store, spec, volume.data(), c, t);
+      } else {
+        ok = writeZarrVolume<float>(store, spec, volume.data(), c, t);
+      }
+      if (!ok) {
+        LOG_ERROR << "Failed to write " << path;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool
+writeMrc(const std::string& path, const SyntheticVolumeSpec& spec)
+{
+  int32_t mode = 0;
+  if (spec.dtype == "uint8") {
+    mode = 0;
+  } else if (spec.dtype == "uint16") {
+    mode = 6;
+  } else if (spec.dtype == "float32") {
+    mode = 2;
+  } else {
+    LOG_ERROR << "Unknown dtype " << spec.dtype;
+    return false;
+  }
+
+  // 256 little endian words; see the layout at the top of FileReaderCCP4.cpp
+  int32_t header[256] = {};
+  auto setFloat = [&header](int word, float value) { memcpy(&header[word], &value, 4); };
+  header[0] = spec.sizeX;
+  header[1] = spec.sizeY;
+  header[2] = spec.sizeZ;
+  header[3] = mode;
+  // sampling along each axis
+  header[7] = spec.sizeX;
+  header[8] = spec.sizeY;
+  header[9] = spec.sizeZ;
+  // cell dimensions, one unit per voxel
+  setFloat(10, (float)spec.sizeX);
+  setFloat(11, (float)spec.sizeY);
+  setFloat(12, (float)spec.sizeZ);
+  setFloat(13, 90.0f);
+  setFloat(14, 90.0f);
+  setFloat(15, 90.0f);
+  // axis order
+  header[16] = 1;
+  header[17] = 2;
+  header[18] = 3;
+  // dmax < dmin and dmean < both: statistics not computed
+  setFloat(19, 0.0f);
+  setFloat(20, -1.0f);
+  setFloat(21, -2.0f);
+  header[27] = 20140;
+  memcpy(&header[52], "MAP ", 4);
+  const uint8_t machineStamp[4] = { 0x44, 0x44, 0, 0 };
+  memcpy(&header[53], machineStamp, 4);
+
+  std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  std::vector<uint8_t> plane((size_t)spec.sizeX * spec.sizeY * spec.bytesPerPixel());
+  std::vector<Blob> blobs = makeBlobs(spec, 0, 0);
+  for (uint32_t z = 0; z < spec.sizeZ && file; ++z) {
+    fillPlane(plane.data(), spec, blobs, z);
+    file.write(reinterpret_cast<const char*>(plane.data()), plane.size());
+  }
+  if (!file) {
+    LOG_ERROR << "Failed to write " << path;
+    return false;
+  }
+  return true;
+}
+
+std::vector<std::string>
+writeSyntheticDatasets(const std::string& directory,
+                       const SyntheticVolumeSpec& spec,
+                       const std::vector<std::string>& tiffCompressions,
+                       const std::vector<std::string>& zarrCompressions)
+{
+  std::vector<std::string> paths;
+  std::filesystem::path dir(directory);
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+
+  for (const std::string& compression : tiffCompressions) {
+    for (bool tiled : { false, true }) {
+      if (tiled && (spec.sizeX % 16 != 0 || spec.sizeY % 16 != 0)) {
+        LOG_WARNING << "Skipping tiled TIFF: sizeX and sizeY must be multiples of 16";
+        continue;
+      }
+      std::string path = (dir / ((tiled ? "tiff_tile_" : "tiff_strip_") + compression + ".ome.tiff")).string();
+      if (writeOmeTiff(path, spec, compression, tiled)) {
+        paths.push_back(path);
+      }
+    }
+  }
+
+  struct Chunking
+  {
+    const char* name;
+    std::vector<uint32_t> chunkZYX;
+  };
+  const Chunking chunkings[] = { { "plane", { 1, spec.sizeY, spec.sizeX } },
+                                 { "brick64", { 64, 64, 64 } },
+                                 { "channel", { spec.sizeZ, spec.sizeY, spec.sizeX } } };
+  for (const std::string& compression : zarrCompressions) {
+    for (const Chunking& chunking : chunkings) {
+      std::string path = (dir / (std::string("zarr_") + chunking.name + "_" + compression + ".zarr")).string();
+      if (writeOmeZarr(path, spec, chunking.chunkZYX, compression)) {
+        paths.push_back(path);
+      }
+    }
+  }
+
+  std::string path = (dir / "volume.mrc").string();
+  if (writeMrc(path, spec)) {
+    paths.push_back(path);
+  }
+  return paths;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Shape and pixel type of a synthetic volume.
+struct SyntheticVolumeSpec
+{
+  uint32_t sizeX = 256;
+  uint32_t sizeY = 256;
+  uint32_t sizeZ = 64;
+  uint32_t sizeC = 2;
+  uint32_t sizeT = 1;
+  // "uint8", "uint16" or "float32"
+  std::string dtype = "uint16";
+
+  uint32_t bytesPerPixel() const;
+  // bytes of one full-resolution timepoint
+  size_t bytesPerTime() const;
+};
+
+// Writes test volumes with deterministic contents (smooth background, bright blobs and some noise, so that
+// compressors see something like microscopy data) in each of the formats the readers in renderlib/io load.
+// Every writer returns false and logs the reason on failure.
+
+// OME-TIFF with one IFD per plane in XYZCT order.
+// `compression` is "none", "lzw" or "deflate".
+// Tiled files have one tile per plane, which is what FileReaderTIFF supports; sizeX and sizeY must be multiples
+// of 16.
+bool
+writeOmeTiff(const std::string& path, const SyntheticVolumeSpec& spec, const std::string& compression, bool tiled);
+
+// Single-scale local OME-Zarr (zarr v2, NGFF 0.4) with its full resolution array at "0".
+// `chunkZYX` is the chunk shape of the Z, Y and X axes; chunks always hold one channel of one timepoint.
+// `compression` is "none", "zlib" or "blosc".
+bool
+writeOmeZarr(const std::string& path,
+             const SyntheticVolumeSpec& spec,
+             const std::vector<uint32_t>& chunkZYX,
+             const std::string& compression);
+
+// MRC/CCP4 map of the first channel and timepoint (the format holds a single volume).
+bool
+writeMrc(const std::string& path, const SyntheticVolumeSpec& spec);
+
+// Writes the standard set of datasets for `spec` into `directory` and returns their paths:
+// OME-TIFF stripped and tiled with each of `tiffCompressions`,
+// OME-Zarr chunked by plane, by 64^3 bricks and by whole channel with each of `zarrCompressions`,
+// and one MRC.
+std::vector<std::string>
+writeSyntheticDatasets(const std::string& directory,
+                       const SyntheticVolumeSpec& spec,
+                       const std::vector<std::string>& tiffCompressions,
+                       const std::vector<std::string>& zarrCompressions);
@@ -1,69 +1,529 @@
 #include "Fuse.h"
 
+#include "GradientMagnitude.h"
 #include "ImageXYZC.h"
+#include "Tracing.h"
 
 #include "threading.h"
 
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+// number of voxels processed together across all channels.
+// Each contributing channel is gathered into 4 planar 8-bit arrays of this size, which stay cache-resident
+// while the kernel combines them.
+static const size_t FUSE_TILE_SIZE = 1024;
+// number of voxels per parallel_for chunk, in whole tiles
+static const size_t FUSE_GRAIN_SIZE = 64 * FUSE_TILE_SIZE;
+
+// Per-channel lookup from raw 16-bit intensity straight to 8-bit r,g,b contribution and transfer function value.
+// Indexed by (intensity - chmin); intensities in a channel are always within [chmin, chmax]
+// because chmin and chmax come from the channel's own histogram.
+struct FuseChannelLut
+{
+  const uint16_t* data;
+  uint16_t chmin;
+  std::vector<uint8_t> r, g, b, a;
+};
+
+void
+buildFuseChannelLut(const Channelu16* channel, const glm::vec3& color, FuseChannelLut& out)
+{
+  const float* lut = channel->m_lut;
+  const float chmax = (float)channel->m_max;
+  const float chmin = (float)channel->m_min;
+  const size_t n = (size_t)(channel->m_max - channel->m_min) + 1;
+
+  out.data = channel->m_ptr;
+  out.chmin = channel->m_min;
+  out.r.resize(n);
+  out.g.resize(n);
+  out.b.resize(n);
+  out.a.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    // same arithmetic as the per-voxel float path, evaluated once per intensity
+    float value = (chmax > chmin) ? (float)i / (float)(chmax - chmin) : 0.0f;
+    value = lut[(int)(value * 255.0 + 0.5)]; // 0..1
+    out.r[i] = static_cast<uint8_t>(color.x * value * 255);
+    out.g[i] = static_cast<uint8_t>(color.y * value * 255);
+    out.b[i] = static_cast<uint8_t>(color.z * value * 255);
+    out.a[i] = static_cast<uint8_t>(value * 255);
+  }
+}
+
+class FuseMaxKernel : public FuseKernel
+{
+public:
+  void fuseTile(const FuseTileChannel* channels,
+                size_t nchannels,
+                size_t n,
+                uint8_t* outR,
+                uint8_t* outG,
+                uint8_t* outB) const override
+  {
+    // byte-wise max over contiguous memory
+    for (size_t c = 0; c < nchannels; ++c) {
+      // local copies: byte stores could otherwise alias the pointers and force a reload every iteration
+      const uint8_t* r = channels[c].r;
+      const uint8_t* g = channels[c].g;
+      const uint8_t* b = channels[c].b;
+      for (size_t i = 0; i < n; ++i) {
+        outR[i] = std::max(outR[i], r[i]);
+        outG[i] = std::max(outG[i], g[i]);
+        outB[i] = std::max(outB[i], b[i]);
+      }
+    }
+  }
+  bool usesWeights() const override { return false; }
+  bool isDecomposable() const override { return true; }
+};
+
+class FuseAdditiveKernel : public FuseKernel
+{
+public:
+  void fuseTile(const FuseTileChannel* channels,
+                size_t nchannels,
+                size_t n,
+                uint8_t* outR,
+                uint8_t* outG,
+                uint8_t* outB) const override
+  {
+    // saturating add; clamping after every channel gives the same result as clamping the total
+    for (size_t c = 0; c < nchannels; ++c) {
+      const uint8_t* r = channels[c].r;
+      const uint8_t* g = channels[c].g;
+      const uint8_t* b = channels[c].b;
+      for (size_t i = 0; i < n; ++i) {
+        outR[i] = (uint8_t)std::min(255, outR[i] + r[i]);
+        outG[i] = (uint8_t)std::min(255, outG[i] + g[i]);
+        outB[i] = (uint8_t)std::min(255, outB[i] + b[i]);
+      }
+    }
+  }
+  bool usesWeights() const override { return false; }
+  bool isDecomposable() const override { return true; }
+};
+
+class FuseAverageKernel : public FuseKernel
+{
+public:
+  void fuseTile(const FuseTileChannel* channels,
+                size_t nchannels,
+                size_t n,
+                uint8_t* outR,
+                uint8_t* outG,
+                uint8_t* outB) const override
+  {
+    // the starting color is always zero for a non-decomposable kernel, so it is not part of the average
+    static const size_t BLOCK = 256;
+    uint32_t sumR[BLOCK], sumG[BLOCK], sumB[BLOCK], sumA[BLOCK];
+    for (size_t s = 0; s < n; s += BLOCK) {
+      const size_t m = std::min(BLOCK, n - s);
+      std::fill(sumR, sumR + m, 0);
+      std::fill(sumG, sumG + m, 0);
+      std::fill(sumB, sumB + m, 0);
+      std::fill(sumA, sumA + m, 0);
+      for (size_t c = 0; c < nchannels; ++c) {
+        const uint8_t* r = channels[c].r + s;
+        const uint8_t* g = channels[c].g + s;
+        const uint8_t* b = channels[c].b + s;
+        const uint8_t* a = channels[c].a + s;
+        for (size_t i = 0; i < m; ++i) {
+          const uint32_t w = a[i];
+          sumR[i] += w * r[i];
+          sumG[i] += w * g[i];
+          sumB[i] += w * b[i];
+          sumA[i] += w;
+        }
+      }
+      for (size_t i = 0; i < m; ++i) {
+        const uint32_t w = sumA[i];
+        // rounded weighted mean; a voxel where no channel has any weight is black
+        outR[s + i] = w ? (uint8_t)((sumR[i] + w / 2) / w) : 0;
+        outG[s + i] = w ? (uint8_t)((sumG[i] + w / 2) / w) : 0;
+        outB[s + i] = w ? (uint8_t)((sumB[i] + w / 2) / w) : 0;
+      }
+    }
+  }
+  bool isDecomposable() const override { return false; }
+};
+
+// per-thread working memory for fuseRange
+struct FuseTileScratch
+{
+  explicit FuseTileScratch(size_t nchannels)
+    : gathered(4 * FUSE_TILE_SIZE * nchannels)
+    , channels(nchannels)
+  {
+    for (size_t c = 0; c < nchannels; ++c) {
+      uint8_t* p = gathered.data() + 4 * FUSE_TILE_SIZE * c;
+      channels[c] = { p, p + FUSE_TILE_SIZE, p + 2 * FUSE_TILE_SIZE, p + 3 * FUSE_TILE_SIZE };
+    }
+  }
+
+  std::vector<uint8_t> gathered;
+  std::vector<FuseTileChannel> channels;
+  uint8_t r[FUSE_TILE_SIZE];
+  uint8_t g[FUSE_TILE_SIZE];
+  uint8_t b[FUSE_TILE_SIZE];
+};
+
+// Fuse count voxels starting at voxel index start.
+// baseRGB, outRGB and outIntensity point at the first voxel of the range; any of them may be null.
+// outIntensity receives the brightest component of each fused color.
+void
+fuseRange(const std::vector<FuseChannelLut>& luts,
+          const FuseKernel& kernel,
+          size_t start,
+          size_t count,
+          const uint8_t* baseRGB,
+          uint8_t* outRGB,
+          uint8_t* outIntensity,
+          FuseTileScratch& scratch)
+{
+  const bool usesWeights = kernel.usesWeights();
+  for (size_t t = 0; t < count; t += FUSE_TILE_SIZE) {
+    const size_t n = std::min(FUSE_TILE_SIZE, count - t);
+    if (baseRGB) {
+      const uint8_t* base = baseRGB + 3 * t;
+      for (size_t i = 0; i < n; ++i) {
+        scratch.r[i] = base[3 * i + 0];
+        scratch.g[i] = base[3 * i + 1];
+        scratch.b[i] = base[3 * i + 2];
+      }
+    } else {
+      std::fill(scratch.r, scratch.r + n, 0);
+      std::fill(scratch.g, scratch.g + n, 0);
+      std::fill(scratch.b, scratch.b + n, 0);
+    }
+
+    // gather every channel's contribution for this tile; this replaces all per-voxel float math.
+    for (size_t c = 0; c < luts.size(); ++c) {
+      const FuseChannelLut& lut = luts[c];
+      const uint16_t* channeldata = lut.data + start + t;
+      const uint16_t chmin = lut.chmin;
+      const uint8_t* lr = lut.r.data();
+      const uint8_t* lg = lut.g.data();
+      const uint8_t* lb = lut.b.data();
+      const uint8_t* la = lut.a.data();
+      // the same memory that scratch.channels[c] points to
+      uint8_t* gr = scratch.gathered.data() + 4 * FUSE_TILE_SIZE * c;
+      uint8_t* gg = gr + FUSE_TILE_SIZE;
+      uint8_t* gb = gg + FUSE_TILE_SIZE;
+      uint8_t* ga = gb + FUSE_TILE_SIZE;
+      for (size_t i = 0; i < n; ++i) {
+        const size_t v = channeldata[i] - chmin;
+        gr[i] = lr[v];
+        gg[i] = lg[v];
+        gb[i] = lb[v];
+      }
+      if (usesWeights) {
+        for (size_t i = 0; i < n; ++i) {
+          ga[i] = la[channeldata[i] - chmin];
+        }
+      }
+    }
+
+    kernel.fuseTile(scratch.channels.data(), luts.size(), n, scratch.r, scratch.g, scratch.b);
+
+    if (outRGB) {
+      // fused data is RGB so offset in multiples of 3
+      uint8_t* out = outRGB + 3 * t;
+      for (size_t i = 0; i < n; ++i) {
+        out[3 * i + 0] = scratch.r[i];
+        out[3 * i + 1] = scratch.g[i];
+        out[3 * i + 2] = scratch.b[i];
+      }
+    }
+    if (outIntensity) {
+      uint8_t* out = outIntensity + t;
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = std::max(scratch.r[i], std::max(scratch.g[i], scratch.b[i]));
+      }
+    }
+  }
+}
+
+// Fuse every channel lut into rgbVolume, starting each voxel from baseRGBVolume (or zero if null).
+void
+fuseChannels(const std::vector<FuseChannelLut>& luts,
+             const FuseKernel& kernel,
+             size_t nvoxels,
+             const uint8_t* baseRGBVolume,
+             uint8_t* rgbVolume)
+{
+  const bool FUSE_THREADED = true;
+
+  parallel_for(
+    nvoxels,
+    [&luts, &kernel, baseRGBVolume, rgbVolume](size_t s, size_t e) {
+      FuseTileScratch scratch(luts.size());
+      fuseRange(luts,
+                kernel,
+                s,
+                e - s,
+                baseRGBVolume ? baseRGBVolume + 3 * s : nullptr,
+                rgbVolume + 3 * s,
+                nullptr,
+                scratch);
+    },
+    FUSE_THREADED,
+    FUSE_GRAIN_SIZE);
+}
+
+// Same as fuseChannels, and also writes the gradient magnitude of the fused intensity into gradientVolume.
+// Each chunk is a slab of whole planes, fused in z order, keeping the fused intensity of the last 3 planes,
+// so the gradient of a plane is computed as soon as the plane after it has been fused.
+// The planes just outside a slab are fused once more for it, but only their intensity is kept.
+void
+fuseChannelsWithGradient(const std::vector<FuseChannelLut>& luts,
+                         const FuseKernel& kernel,
+                         const ImageXYZC* img,
+                         const uint8_t* baseRGBVolume,
+                         uint8_t* rgbVolume,
+                         uint16_t* gradientVolume)
+{
+  const bool FUSE_THREADED = true;
+
+  const size_t nx = img->sizeX();
+  const size_t ny = img->sizeY();
+  const size_t nz = img->sizeZ();
+  const size_t dz = nx * ny;
+
+  // same spacing convention as Channelu16::generateGradientMagnitudeVolume,
+  // with 8-bit intensity differences scaled to the 16-bit range.
+  const float sx = img->physicalSizeX();
+  const float sy = img->physicalSizeY();
+  const float sz = img->physicalSizeZ();
+  const float maxspacing = std::max(sx, std::max(sy, sz));
+  const float invxspacing = 257.0f * maxspacing / sx;
+  const float invyspacing = 257.0f * maxspacing / sy;
+  const float invzspacing = 257.0f * maxspacing / sz;
+
+  // one slab per thread: every slab fuses 2 extra planes, so they should not be too thin
+  static const size_t MIN_SLAB_SIZE = 4;
+  const size_t nthreads = ThreadPool::instance().size() + 1;
+  const size_t slabSize = std::max(MIN_SLAB_SIZE, (nz + nthreads - 1) / nthreads);
+
+  parallel_for(
+    nz,
+    [&](size_t z0, size_t z1) {
+      FuseTileScratch scratch(luts.size());
+      std::vector<uint8_t> intensity(3 * dz);
+      auto plane = [&](size_t z) { return intensity.data() + (z % 3) * dz; };
+
+      auto fusePlane = [&](size_t z) {
+        const bool owned = (z >= z0 && z < z1);
+        fuseRange(luts,
+                  kernel,
+                  z * dz,
+                  dz,
+                  baseRGBVolume ? baseRGBVolume + 3 * z * dz : nullptr,
+                  owned ? rgbVolume + 3 * z * dz : nullptr,
+                  plane(z),
+                  scratch);
+      };
+
+      auto gradientPlane = [&](size_t z, const uint8_t* zlo, const uint8_t* zhi) {
+        const uint8_t* c = plane(z);
+        for (size_t y = 0; y < ny; ++y) {
+          const size_t offset = y * nx;
+          const uint8_t* ylo = (y == 0) ? c + offset : c + offset - nx;
+          const uint8_t* yhi = (y >= ny - 1) ? c + offset : c + offset + nx;
+          gradientMagnitudeRow(c + offset,
+                               ylo,
+                               yhi,
+                               zlo + offset,
+                               zhi + offset,
+                               gradientVolume + z * dz + offset,
+                               nx,
+                               invxspacing,
+                               invyspacing,
+                               invzspacing);
+        }
+      };
+
+      const size_t first = (z0 == 0) ? 0 : z0 - 1;
+      const size_t last = std::min(z1, nz - 1);
+      for (size_t z = first; z <= last; ++z) {
+        fusePlane(z);
+        // plane z-1 now has both of its z neighbors
+        if (z >= 1 && z - 1 >= z0 && z - 1 < z1) {
+          const size_t q = z - 1;
+          gradientPlane(q, (q == 0) ? plane(q) : plane(q - 1), plane(z));
+        }
+      }
+      if (z1 == nz) {
+        // the last plane of the volume is its own upper neighbor
+        const size_t q = nz - 1;
+        gradientPlane(q, (q == 0) ? plane(q) : plane(q - 1), plane(q));
+      }
+    },
+    FUSE_THREADED,
+    slabSize);
+}
+
+std::vector<FuseChannelLut>
+buildFuseChannelLuts(const ImageXYZC* img, const std::vector<glm::vec3>& colorsPerChannel)
+{
+  // build one lookup per contributing channel
+  size_t nch = std::min((size_t)img->sizeC(), colorsPerChannel.size());
+  std::vector<FuseChannelLut> luts;
+  luts.reserve(nch);
+  for (uint32_t i = 0; i < nch; ++i) {
+    const glm::vec3& c = colorsPerChannel[i];
+    if (c == glm::vec3(0, 0, 0)) {
+      continue;
+    }
+    luts.emplace_back();
+    buildFuseChannelLut(img->channel(i), c, luts.back());
+  }
+  return luts;
+}
+
+size_t
+voxelCount(const ImageXYZC* img)
+{
+  return (size_t)img->sizeX() * (size_t)img->sizeY() * (size_t)img->sizeZ();
+}
+
+} // namespace
+
+const FuseKernel&
+FuseKernel::get(FuseMode mode)
+{
+  static const FuseMaxKernel maxKernel;
+  static const FuseAdditiveKernel additiveKernel;
+  static const FuseAverageKernel averageKernel;
+  switch (mode) {
+    case FuseMode::ADDITIVE:
+      return additiveKernel;
+    case FuseMode::AVERAGE:
+      return averageKernel;
+    case FuseMode::MAX:
+    default:
+      return maxKernel;
+  }
+}
+
 // fuse: fill volume of color data, plus volume of gradients
-// n channels with n colors: use "max" or "avg"
-// n channels with gradients: use "max" or "avg"
+// n channels with n colors: combined by the kernel, e.g. "max", "add" or "avg"
+// gradients are taken of the fused result, so they match what is shown
 void
 Fuse::fuse(const ImageXYZC* img,
            const std::vector<glm::vec3>& colorsPerChannel,
            uint8_t** outRGBVolume,
-           uint16_t** outGradientVolume)
+           uint16_t** outGradientVolume,
+           const FuseKernel& kernel)
 {
   // todo: this can easily be a cuda kernel that loops over channels and does a max operation, if it has the full volume
   // data in gpu mem.
+  fuseOnto(img, colorsPerChannel, kernel, nullptr, *outRGBVolume, outGradientVolume ? *outGradientVolume : nullptr);
+}
 
-  // create and zero
-  uint8_t* rgbVolume = *outRGBVolume;
-  memset(*outRGBVolume, 0, 3 * img->sizeX() * img->sizeY() * img->sizeZ() * sizeof(uint8_t));
+void
+Fuse::fuseOnto(const ImageXYZC* img,
+               const std::vector<glm::vec3>& colorsPerChannel,
+               const FuseKernel& kernel,
+               const uint8_t* baseRGBVolume,
+               uint8_t* outRGBVolume,
+               uint16_t* outGradientVolume)
+{
+  TraceSpan span("Fuse::fuseOnto", "fuse");
+  assert(baseRGBVolume == nullptr || kernel.isDecomposable());
+  std::vector<FuseChannelLut> luts = buildFuseChannelLuts(img, colorsPerChannel);
+  if (outGradientVolume) {
+    fuseChannelsWithGradient(luts, kernel, img, baseRGBVolume, outRGBVolume, outGradientVolume);
+  } else {
+    fuseChannels(luts, kernel, voxelCount(img), baseRGBVolume, outRGBVolume);
+  }
+}
 
-  const bool FUSE_THREADED = true;
+bool
+IncrementalFuse::ChannelState::matches(const Channelu16* channel, const glm::vec3& c) const
+{
+  if (c != color || channel->m_ptr != data) {
+    return false;
+  }
+  // a channel that does not contribute is unchanged no matter what its lut is
+  if (c == glm::vec3(0, 0, 0)) {
+    return true;
+  }
+  return std::equal(lut.begin(), lut.end(), channel->m_lut);
+}
 
-  parallel_for(
-    img->sizeX() * img->sizeY() * img->sizeZ(),
-    [&img, &colorsPerChannel, &rgbVolume](size_t s, size_t e) {
-      float value = 0;
-      float r = 0, g = 0, b = 0;
-      uint8_t ar = 0, ag = 0, ab = 0;
-
-      size_t ncolors = colorsPerChannel.size();
-      size_t nch = std::min((size_t)img->sizeC(), ncolors);
-
-      for (uint32_t i = 0; i < nch; ++i) {
-        glm::vec3 c = colorsPerChannel[i];
-        if (c == glm::vec3(0, 0, 0)) {
-          continue;
-        }
-        r = c.x; // 0..1
-        g = c.y;
-        b = c.z;
-        uint16_t* channeldata = reinterpret_cast<uint16_t*>(img->ptr(i));
-
-        // array of 256 floats
-        float* lut = img->channel(i)->m_lut;
-        float chmax = (float)img->channel(i)->m_max;
-        float chmin = (float)img->channel(i)->m_min;
-        // lut = luts[idx][c.enhancement];
-
-        // channel data cx is scalar so loop from s to e
-        // fused data is RGB so offset in multiples of 3
-        for (size_t cx = s, fx = s * 3; cx < e; cx++, fx += 3) {
-          value = (float)(channeldata[cx] - chmin) / (float)(chmax - chmin);
-          // value = (float)channeldata[cx] / 65535.0f;
-          value = lut[(int)(value * 255.0 + 0.5)]; // 0..255
-
-          // what if rgb*value > 1?
-          ar = rgbVolume[fx + 0];
-          rgbVolume[fx + 0] = std::max(ar, static_cast<uint8_t>(r * value * 255));
-          ag = rgbVolume[fx + 1];
-          rgbVolume[fx + 1] = std::max(ag, static_cast<uint8_t>(g * value * 255));
-          ab = rgbVolume[fx + 2];
-          rgbVolume[fx + 2] = std::max(ab, static_cast<uint8_t>(b * value * 255));
-        }
+void
+IncrementalFuse::ChannelState::set(const Channelu16* channel, const glm::vec3& c)
+{
+  color = c;
+  data = channel->m_ptr;
+  lut.assign(channel->m_lut, channel->m_lut + LUT_SIZE);
+}
+
+void
+IncrementalFuse::invalidate()
+{
+  m_image = nullptr;
+  m_kernel = nullptr;
+  m_channels.clear();
+  m_excludedChannel = -1;
+  m_excludedComposite.clear();
+  m_excludedComposite.shrink_to_fit();
+  m_excludedCompositeMemory.set(0);
+}
+
+bool
+IncrementalFuse::update(const ImageXYZC* img,
+                        const std::vector<glm::vec3>& colorsPerChannel,
+                        uint8_t* outRGBVolume,
+                        const FuseKernel& kernel)
+{
+  TraceSpan span("IncrementalFuse::update", "fuse");
+  size_t nch = std::min((size_t)img->sizeC(), colorsPerChannel.size());
+
+  // which channels differ from what is currently fused into outRGBVolume?
+  std::vector<uint32_t> changed;
+  bool fullRefuse = (img != m_image) || (&kernel != m_kernel) || (m_channels.size() != nch);
+  if (!fullRefuse) {
+    for (uint32_t i = 0; i < nch; ++i) {
+      if (!m_channels[i].matches(img->channel(i), colorsPerChannel[i])) {
+        changed.push_back(i);
       }
-    },
-    FUSE_THREADED);
+    }
+    if (changed.empty()) {
+      // only non-visual parameters changed; the fused volume is still valid.
+      return false;
+    }
+    fullRefuse = (changed.size() > 1) || !kernel.isDecomposable();
+  }
+
+  if (fullRefuse) {
+    Fuse::fuseOnto(img, colorsPerChannel, kernel, nullptr, outRGBVolume);
+    // the composite excluding a channel is stale now
+    m_excludedChannel = -1;
+  } else {
+    const uint32_t k = changed[0];
+    if (m_excludedChannel != (int)k) {
+      // first edit of this channel: composite everything else once, then reuse it while the same channel is edited.
+      std::vector<glm::vec3> others(colorsPerChannel.begin(), colorsPerChannel.begin() + nch);
+      others[k] = glm::vec3(0, 0, 0);
+      m_excludedComposite.resize(3 * voxelCount(img));
+      m_excludedCompositeMemory.set(m_excludedComposite.size());
+      Fuse::fuseOnto(img, others, kernel, nullptr, m_excludedComposite.data());
+      m_excludedChannel = (int)k;
+    }
+    std::vector<glm::vec3> only(nch, glm::vec3(0, 0, 0));
+    only[k] = colorsPerChannel[k];
+    Fuse::fuseOnto(img, only, kernel, m_excludedComposite.data(), outRGBVolume);
+  }
+
+  m_image = img;
+  m_kernel = &kernel;
+  m_channels.resize(nch);
+  for (uint32_t i = 0; i < nch; ++i) {
+    m_channels[i].set(img->channel(i), colorsPerChannel[i]);
+  }
+  return true;
 }
@@ -1,10 +1,62 @@
 #pragma once
 
+#include "MemoryAccounting.h"
 #include "glm.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 class ImageXYZC;
+struct Channelu16;
+
+// How the per-channel colors are combined into one fused color.
+enum class FuseMode
+{
+  // brightest contribution wins, per color component
+  MAX = 0,
+  // contributions are summed and clamped to 255
+  ADDITIVE = 1,
+  // contributions are averaged, each weighted by its channel's transfer function value
+  AVERAGE = 2
+};
+
+// One channel's contribution to a tile of voxels, as planar 8-bit arrays.
+// r,g,b is the channel color scaled by the transfer function value; a is the transfer function value itself.
+struct FuseTileChannel
+{
+  const uint8_t* r;
+  const uint8_t* g;
+  const uint8_t* b;
+  const uint8_t* a;
+};
+
+// Combines channel contributions into fused colors, a tile of voxels at a time.
+// Derive from this to add a new fusion operator; it is called concurrently from several threads.
+class FuseKernel
+{
+public:
+  virtual ~FuseKernel() {}
+
+  // Fuse n voxels of nchannels channels into outR, outG, outB.
+  // On entry the outputs hold each voxel's starting color (zero, or the base volume of Fuse::fuseOnto).
+  virtual void fuseTile(const FuseTileChannel* channels,
+                        size_t nchannels,
+                        size_t n,
+                        uint8_t* outR,
+                        uint8_t* outG,
+                        uint8_t* outB) const = 0;
+
+  // false if the kernel never reads FuseTileChannel::a, which then is not gathered.
+  virtual bool usesWeights() const { return true; }
+
+  // true if fusing some channels onto the fused result of the others gives the same result as fusing all at once.
+  // Only decomposable kernels can be used with a base volume.
+  virtual bool isDecomposable() const = 0;
+
+  // built-in kernels
+  static const FuseKernel& get(FuseMode mode);
+};
 
 // Runs a processing step that applies a color into each channel,
 // and then combines the channels to result in a single RGB colored volume
@@ -12,9 +64,63 @@ class Fuse
 {
 public:
   // if channel color is 0, then channel will not contribute.
-  // allocates memory for outRGBVolume and outGradientVolume
+  // outRGBVolume must point to 3 bytes per voxel.
+  // if outGradientVolume is not null, it must point to one uint16_t per voxel, and receives the gradient magnitude of
+  // the fused intensity (the brightest component of each fused color, 255 scaled to 65535), computed in the same pass.
   static void fuse(const ImageXYZC* img,
                    const std::vector<glm::vec3>& colorsPerChannel,
                    uint8_t** outRGBVolume,
-                   uint16_t** outGradientVolume);
+                   uint16_t** outGradientVolume,
+                   const FuseKernel& kernel = FuseKernel::get(FuseMode::MAX));
+
+  // same as fuse, but each voxel starts from the corresponding voxel of baseRGBVolume instead of zero.
+  // baseRGBVolume may be null, and may not alias outRGBVolume. It requires a decomposable kernel.
+  static void fuseOnto(const ImageXYZC* img,
+                       const std::vector<glm::vec3>& colorsPerChannel,
+                       const FuseKernel& kernel,
+                       const uint8_t* baseRGBVolume,
+                       uint8_t* outRGBVolume,
+                       uint16_t* outGradientVolume = nullptr);
+};
+
+// Remembers what went into a fused volume so that repeated fuses only redo what changed.
+// While the transfer function of a single channel is being edited, the other channels are composited
+// once and each edit only re-fuses the edited channel on top of that composite.
+// Kernels that are not decomposable always re-fuse every channel.
+class IncrementalFuse
+{
+public:
+  // Brings outRGBVolume up to date with the image and colors.
+  // outRGBVolume must be the same buffer on every call, until invalidate() is called.
+  // Returns false if nothing visual changed and outRGBVolume was left untouched.
+  // Changing the kernel causes a full fuse.
+  bool update(const ImageXYZC* img,
+              const std::vector<glm::vec3>& colorsPerChannel,
+              uint8_t* outRGBVolume,
+              const FuseKernel& kernel = FuseKernel::get(FuseMode::MAX));
+
+  // forget all cached state; the next update will do a full fuse.
+  void invalidate();
+
+private:
+  static const size_t LUT_SIZE = 256;
+
+  struct ChannelState
+  {
+    glm::vec3 color;
+    const uint16_t* data = nullptr;
+    std::vector<float> lut;
+
+    bool matches(const Channelu16* channel, const glm::vec3& c) const;
+    void set(const Channelu16* channel, const glm::vec3& c);
+  };
+
+  const ImageXYZC* m_image = nullptr;
+  const FuseKernel* m_kernel = nullptr;
+  std::vector<ChannelState> m_channels;
+
+  // composite of every channel except m_excludedChannel
+  int m_excludedChannel = -1;
+  std::vector<uint8_t> m_excludedComposite;
+  MemoryAccounting::Allocation m_excludedCompositeMemory{ MemoryAccounting::Category::Caches };
 };
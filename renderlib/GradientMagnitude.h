@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+inline uint16_t
+gradientMagnitude(float gx, float gy, float gz)
+{
+  float m = std::sqrt(gx * gx + gy * gy + gz * gz);
+  return static_cast<uint16_t>(std::min(m, 65535.0f));
+}
+
+// Central differences for one row of x voxels.
+// c is the row itself, ylo/yhi are the neighboring rows in y and zlo/zhi the neighboring rows in z
+// (at the volume boundary the neighbor row is the row itself).
+// Each difference is multiplied by the matching inverse spacing; results saturate at 65535.
+template<typename T>
+void
+gradientMagnitudeRow(const T* c,
+                     const T* ylo,
+                     const T* yhi,
+                     const T* zlo,
+                     const T* zhi,
+                     uint16_t* out,
+                     size_t nx,
+                     float invxspacing,
+                     float invyspacing,
+                     float invzspacing)
+{
+  if (nx == 1) {
+    out[0] = gradientMagnitude(
+      0.0f, ((float)ylo[0] - (float)yhi[0]) * invyspacing, ((float)zlo[0] - (float)zhi[0]) * invzspacing);
+    return;
+  }
+
+  // first and last voxels use one-sided differences in x
+  out[0] = gradientMagnitude(((float)c[0] - (float)c[1]) * invxspacing,
+                             ((float)ylo[0] - (float)yhi[0]) * invyspacing,
+                             ((float)zlo[0] - (float)zhi[0]) * invzspacing);
+
+  // interior: no branches, so the compiler is free to vectorize this loop
+  for (size_t x = 1; x < nx - 1; ++x) {
+    float gx = ((float)c[x - 1] - (float)c[x + 1]) * invxspacing;
+    float gy = ((float)ylo[x] - (float)yhi[x]) * invyspacing;
+    float gz = ((float)zlo[x] - (float)zhi[x]) * invzspacing;
+    out[x] = gradientMagnitude(gx, gy, gz);
+  }
+
+  size_t last = nx - 1;
+  out[last] = gradientMagnitude(((float)c[last - 1] - (float)c[last]) * invxspacing,
+                                ((float)ylo[last] - (float)yhi[last]) * invyspacing,
+                                ((float)zlo[last] - (float)zhi[last]) * invzspacing);
+}
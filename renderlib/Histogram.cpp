@@ -18,7 +18,17 @@ clamp(const T& v, const T& lo, const T& hi)
 const float Histogram::DEFAULT_PCT_LOW = 0.5f;
 const float Histogram::DEFAULT_PCT_HIGH = 0.983f;
 
-Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins)
+size_t
+Histogram::strideForSampleCount(size_t length, size_t maxSamples)
+{
+  if (maxSamples == 0 || length <= maxSamples) {
+    return 1;
+  }
+  size_t stride = length / maxSamples;
+  return (stride % 2 == 0) ? stride + 1 : stride;
+}
+
+Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins, size_t stride)
   : _bins(num_bins)
   , _ccounts(num_bins)
   , _dataMin(0)
@@ -48,7 +58,8 @@ Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins)
     range = 1.0f;
   }
   float binmax = (float)(num_bins - 1);
-  for (size_t i = 0; i < length; ++i) {
+  stride = std::max(stride, (size_t)1);
+  for (size_t i = 0; i < length; i += stride) {
     size_t whichbin = (size_t)((float)(data[i] - rangeMin) / range * binmax + 0.5);
     //		val = data[i];
     //		// normalize to 0..1 range
@@ -62,8 +73,8 @@ Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins)
     // bins goes from min to max of data range. not datatype range.
   }
 
-  // total number of pixels
-  _pixelCount = length;
+  // total number of pixels binned
+  _pixelCount = (length + stride - 1) / stride;
 
   // get the bin with the most frequently occurring value
   _maxBin = 0;
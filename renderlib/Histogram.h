@@ -8,7 +8,12 @@
 
 struct Histogram
 {
-  Histogram(uint16_t* data, size_t length, size_t bins = 512);
+  // Only every stride-th value is binned; _dataMin and _dataMax always cover every value.
+  Histogram(uint16_t* data, size_t length, size_t bins = 512, size_t stride = 1);
+
+  // A stride that bins about maxSamples of length values (every value if maxSamples is 0).
+  // The stride is odd, so that it does not keep landing on the same columns of power-of-two wide images.
+  static size_t strideForSampleCount(size_t length, size_t maxSamples);
 
   static const float DEFAULT_PCT_LOW;
   static const float DEFAULT_PCT_HIGH;
@@ -21,6 +26,7 @@ struct Histogram
   uint16_t _dataMax;
   // index of bin with most pixels
   size_t _maxBin;
+  // number of values binned
   size_t _pixelCount;
 
   void computeWindowLevelFromPercentiles(float pct_low, float pct_high, float& window, float& level) const;
@@ -1,11 +1,65 @@
 #include "ImageXYZC.h"
 
+#include "GradientMagnitude.h"
 #include "Logging.h"
+#include "Tracing.h"
+#include "threading.h"
 
 #include <algorithm>
+#include <cmath>
 #include <math.h>
 #include <sstream>
 
+namespace {
+// options of the innermost ScopedChannelStatsOptions on this thread
+thread_local const ChannelStatsOptions* tScopedStatsOptions = nullptr;
+
+const ChannelStatsOptions&
+currentChannelStatsOptions()
+{
+  return tScopedStatsOptions ? *tScopedStatsOptions : ImageXYZC::channelStatsOptions();
+}
+
+Histogram
+channelHistogram(uint16_t* ptr, size_t length, size_t stride, const Histogram* source)
+{
+  TraceSpan span("channelHistogram", "stats");
+  if (source && length > 0) {
+    // finding the data range is far cheaper than binning the data
+    uint16_t dataMin = ptr[0];
+    uint16_t dataMax = ptr[0];
+    for (size_t i = 1; i < length; ++i) {
+      dataMin = std::min(dataMin, ptr[i]);
+      dataMax = std::max(dataMax, ptr[i]);
+    }
+    // the histogram range must contain every value: it determines the channel min and max
+    if (dataMin >= source->_dataMin && dataMax <= source->_dataMax) {
+      return *source;
+    }
+  }
+  return Histogram(ptr, length, 512, stride);
+}
+} // namespace
+
+ScopedChannelStatsOptions::ScopedChannelStatsOptions(const ChannelStatsOptions& options)
+  : m_options(options)
+  , m_previous(tScopedStatsOptions)
+{
+  tScopedStatsOptions = &m_options;
+}
+
+ScopedChannelStatsOptions::~ScopedChannelStatsOptions()
+{
+  tScopedStatsOptions = m_previous;
+}
+
+ChannelStatsOptions&
+ImageXYZC::channelStatsOptions()
+{
+  static ChannelStatsOptions options;
+  return options;
+}
+
 ImageXYZC::ImageXYZC(uint32_t x,
                      uint32_t y,
                      uint32_t z,
@@ -28,9 +82,16 @@ ImageXYZC::ImageXYZC(uint32_t x,
   , m_spatialUnits(spatialUnits)
   , m_flipped(1, 1, 1)
 {
+  const ChannelStatsOptions& stats = currentChannelStatsOptions();
+  const size_t stride = Histogram::strideForSampleCount((size_t)x * y * z, stats.maxHistogramSamples);
   for (uint32_t i = 0; i < m_c; ++i) {
-    m_channels.push_back(new Channelu16(x, y, z, reinterpret_cast<uint16_t*>(ptr(i))));
+    const Histogram* source = nullptr;
+    if (stats.histogramSource && i < stats.histogramSource->sizeC()) {
+      source = &stats.histogramSource->channel(i)->m_histogram;
+    }
+    m_channels.push_back(new Channelu16(x, y, z, reinterpret_cast<uint16_t*>(ptr(i)), stride, source));
   }
+  m_voxelMemory.set(size());
   for (uint32_t i = 0; i < m_c; ++i) {
     LOG_INFO << "Channel " << i << ":" << (m_channels[i]->m_min) << "," << (m_channels[i]->m_max);
   }
@@ -45,6 +106,12 @@ ImageXYZC::~ImageXYZC()
   delete[] m_data;
 }
 
+void
+ImageXYZC::setMemoryAccounting(MemoryAccounting::Category category, const std::string& owner)
+{
+  m_voxelMemory.reassign(category, owner);
+}
+
 void
 ImageXYZC::setChannelNames(std::vector<std::string>& channelNames)
 {
@@ -185,8 +252,13 @@ ImageXYZC::spatialUnits() const
 
 // 3d median filter?
 
-Channelu16::Channelu16(uint32_t x, uint32_t y, uint32_t z, uint16_t* ptr)
-  : m_histogram(ptr, x * y * z)
+Channelu16::Channelu16(uint32_t x,
+                       uint32_t y,
+                       uint32_t z,
+                       uint16_t* ptr,
+                       size_t histogramStride,
+                       const Histogram* histogramSource)
+  : m_histogram(channelHistogram(ptr, (size_t)x * y * z, histogramStride, histogramSource))
 {
   m_gradientMagnitudePtr = nullptr;
   m_ptr = ptr;
@@ -199,6 +271,8 @@ Channelu16::Channelu16(uint32_t x, uint32_t y, uint32_t z, uint16_t* ptr)
   m_max = m_histogram._dataMax;
 
   m_lut = m_histogram.generate_percentiles();
+  // every lut generator makes the default length
+  m_lutMemory.set(256 * sizeof(float));
 }
 
 Channelu16::~Channelu16()
@@ -211,56 +285,43 @@ uint16_t*
 Channelu16::generateGradientMagnitudeVolume(float scalex, float scaley, float scalez)
 {
   float maxspacing = std::max(scalex, std::max(scaley, scalez));
-  float xspacing = scalex / maxspacing;
-  float yspacing = scaley / maxspacing;
-  float zspacing = scalez / maxspacing;
-
-  uint16_t* outptr = new uint16_t[m_x * m_y * m_z];
-  m_gradientMagnitudePtr = outptr;
-
-  int useZmin, useZmax, useYmin, useYmax, useXmin, useXmax;
-
-  double d, sum;
-
+  // differences are divided by the spacing relative to the largest spacing;
+  // precompute the reciprocals so the inner loop only multiplies.
+  const float invxspacing = maxspacing / scalex;
+  const float invyspacing = maxspacing / scaley;
+  const float invzspacing = maxspacing / scalez;
+
+  // use size_t everywhere: x*y*z can exceed 32 bits for large stacks
+  const size_t nx = m_x;
+  const size_t ny = m_y;
+  const size_t nz = m_z;
   // deltaz is one plane of data (x*y pixels)
-  const int32_t dz = m_x * m_y;
+  const size_t dz = nx * ny;
   // deltay is one row of data (x pixels)
-  const int32_t dy = m_x;
-  // deltax is one pixel
-  const int32_t dx = 1;
-
-  uint16_t* inptr = m_ptr;
-  for (uint32_t z = 0; z < m_z; ++z) {
-    useZmin = (z <= 0) ? 0 : -dz;
-    useZmax = (z >= m_z - 1) ? 0 : dz;
-    for (uint32_t y = 0; y < m_y; ++y) {
-      useYmin = (y <= 0) ? 0 : -dy;
-      useYmax = (y >= m_y - 1) ? 0 : dy;
-      for (uint32_t x = 0; x < m_x; ++x) {
-        useXmin = (x <= 0) ? 0 : -dx;
-        useXmax = (x >= m_x - 1) ? 0 : dx;
-
-        d = static_cast<double>(inptr[useXmin]);
-        d -= static_cast<double>(inptr[useXmax]);
-        d /= xspacing; // divide or multiply here??
-        sum = d * d;
-
-        d = static_cast<double>(inptr[useYmin]);
-        d -= static_cast<double>(inptr[useYmax]);
-        d /= yspacing; // divide or multiply here??
-        sum += d * d;
-
-        d = static_cast<double>(inptr[useZmin]);
-        d -= static_cast<double>(inptr[useZmax]);
-        d /= zspacing; // divide or multiply here??
-        sum += d * d;
-
-        *outptr = static_cast<uint16_t>(sqrt(sum));
-        outptr++;
-        inptr++;
-      }
+  const size_t dy = nx;
+
+  delete[] m_gradientMagnitudePtr;
+  uint16_t* outptr = new uint16_t[dz * nz];
+  m_gradientMagnitudePtr = outptr;
+  m_gradientMagnitudeMemory.set(dz * nz * sizeof(uint16_t));
+
+  const uint16_t* inptr = m_ptr;
+
+  // Work is split over contiguous ranges of rows (z-major), so each thread walks a slab of whole
+  // planes. Each row only reads 5 input rows from at most 3 planes, which keeps the working set in cache.
+  parallel_for(nz * ny, [=](size_t rowstart, size_t rowend) {
+    for (size_t r = rowstart; r < rowend; ++r) {
+      const size_t z = r / ny;
+      const size_t y = r % ny;
+      const size_t offset = z * dz + y * dy;
+      const uint16_t* c = inptr + offset;
+      const uint16_t* ylo = (y == 0) ? c : c - dy;
+      const uint16_t* yhi = (y >= ny - 1) ? c : c + dy;
+      const uint16_t* zlo = (z == 0) ? c : c - dz;
+      const uint16_t* zhi = (z >= nz - 1) ? c : c + dz;
+      gradientMagnitudeRow(c, ylo, yhi, zlo, zhi, outptr + offset, nx, invxspacing, invyspacing, invzspacing);
     }
-  }
+  });
 
   return outptr;
 }
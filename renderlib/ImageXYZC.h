@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Histogram.h"
+#include "MemoryAccounting.h"
 
 #include "glm.h"
 
@@ -8,9 +9,18 @@
 #include <string>
 #include <vector>
 
+class ImageXYZC;
+
 struct Channelu16
 {
-  Channelu16(uint32_t x, uint32_t y, uint32_t z, uint16_t* ptr);
+  // histogramStride: bin only every n-th voxel (see Histogram).
+  // histogramSource: if this channel's data range fits inside it, copy it instead of computing a new histogram.
+  Channelu16(uint32_t x,
+             uint32_t y,
+             uint32_t z,
+             uint16_t* ptr,
+             size_t histogramStride = 1,
+             const Histogram* histogramSource = nullptr);
   ~Channelu16();
 
   uint32_t m_x, m_y, m_z;
@@ -62,11 +72,44 @@ struct Channelu16
   void debugprint();
 
   std::string m_name;
+
+  // owned by whoever owns the image (see MemoryAccounting::ScopedOwner)
+  MemoryAccounting::Allocation m_lutMemory{ MemoryAccounting::Category::DerivedVolumes };
+  MemoryAccounting::Allocation m_gradientMagnitudeMemory{ MemoryAccounting::Category::DerivedVolumes };
+};
+
+// How channel statistics are computed when an ImageXYZC is constructed.
+struct ChannelStatsOptions
+{
+  // bin about this many evenly strided voxels per channel histogram; 0 bins every voxel.
+  // channel min and max are exact unless a histogram is reused; they are then the reused histogram's range, which
+  // contains the data, so that lookup tables built from the histogram line up with the channel range.
+  size_t maxHistogramSamples = 0;
+  // reuse the previous timepoint's histograms when stepping through time (see SetTimeCommand)
+  bool reuseHistogramsAcrossTimes = false;
+  // channel i of a new image copies histogramSource->channel(i)'s histogram whenever its data range fits inside it
+  const ImageXYZC* histogramSource = nullptr;
+};
+
+// ImageXYZC objects constructed on the current thread while this is alive use these options
+// instead of ImageXYZC::channelStatsOptions().
+class ScopedChannelStatsOptions
+{
+public:
+  explicit ScopedChannelStatsOptions(const ChannelStatsOptions& options);
+  ~ScopedChannelStatsOptions();
+
+private:
+  ChannelStatsOptions m_options;
+  const ChannelStatsOptions* m_previous;
 };
 
 class ImageXYZC
 {
 public:
+  // process-wide channel statistics options
+  static ChannelStatsOptions& channelStatsOptions();
+
   // how many channels to enable on first load by default
   static const int FIRST_N_CHANNELS = 1;
 
@@ -119,6 +162,9 @@ public:
 
   void setChannelNames(std::vector<std::string>& channelNames);
 
+  // files the voxel data, e.g. of a cached image, under another memory category and owner
+  void setMemoryAccounting(MemoryAccounting::Category category, const std::string& owner);
+
 private:
   uint32_t m_x, m_y, m_z, m_c, m_bpp;
   uint8_t* m_data;
@@ -126,4 +172,5 @@ private:
   glm::ivec3 m_flipped;
   std::string m_spatialUnits;
   std::vector<Channelu16*> m_channels;
+  MemoryAccounting::Allocation m_voxelMemory{ MemoryAccounting::Category::VoxelData };
 };
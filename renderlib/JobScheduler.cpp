@@ -0,0 +1,89 @@
+#include "JobScheduler.h"
+
+JobScheduler::JobScheduler(ThreadPool& pool)
+  : m_pool(pool)
+{
+}
+
+JobScheduler::~JobScheduler()
+{
+  cancelAll();
+  waitForAll();
+}
+
+std::shared_ptr<JobToken>
+JobScheduler::submit(const std::string& key, std::function<void(JobToken&)> job, TaskPriority priority)
+{
+  auto token = std::make_shared<JobToken>();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_current.find(key);
+    if (it != m_current.end()) {
+      it->second->cancel();
+    }
+    m_current[key] = token;
+    ++m_active;
+  }
+
+  m_pool.submit(
+    [this, key, token, job]() {
+      if (!token->isCancelled()) {
+        job(*token);
+      }
+      token->setProgress(1.0f);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_current.find(key);
+      if (it != m_current.end() && it->second == token) {
+        m_current.erase(it);
+      }
+      if (--m_active == 0) {
+        m_idle.notify_all();
+      }
+    },
+    priority);
+  return token;
+}
+
+void
+JobScheduler::cancel(const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_current.find(key);
+  if (it != m_current.end()) {
+    it->second->cancel();
+    m_current.erase(it);
+  }
+}
+
+void
+JobScheduler::cancelAll()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto& it : m_current) {
+    it.second->cancel();
+  }
+  m_current.clear();
+}
+
+float
+JobScheduler::progress(const std::string& key) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_current.find(key);
+  return (it != m_current.end()) ? it->second->progress() : -1.0f;
+}
+
+size_t
+JobScheduler::activeJobs() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_active;
+}
+
+void
+JobScheduler::waitForAll()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_idle.wait(lock, [this]() { return m_active == 0; });
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "threading.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Shared between a background job and whoever started it.
+// The owner cancels; the job checks isCancelled() between its stages and reports how far along it is.
+class JobToken
+{
+public:
+  void cancel() { m_cancelled = true; }
+  bool isCancelled() const { return m_cancelled; }
+
+  // fraction of the job done, 0 to 1
+  void setProgress(float progress) { m_progress = progress; }
+  float progress() const { return m_progress; }
+
+private:
+  std::atomic<bool> m_cancelled{ false };
+  std::atomic<float> m_progress{ 0.0f };
+};
+
+// Runs long jobs (loads, preprocessing) on the ThreadPool, below the priority of parallel_for work.
+// Jobs are keyed: submitting a job cancels the unfinished job with the same key.
+// A job cancelled before it starts never runs; a running job stops at its next cancellation check.
+//
+// Usage example:
+//
+// JobScheduler jobs;
+// jobs.submit("load", [](JobToken& token) {
+//   auto image = loadImage();
+//   if (token.isCancelled()) {
+//     return;
+//   }
+//   token.setProgress(0.5f);
+//   ...
+// });
+class JobScheduler
+{
+public:
+  explicit JobScheduler(ThreadPool& pool = ThreadPool::instance());
+  // cancels everything and waits for jobs already running
+  ~JobScheduler();
+
+  JobScheduler(const JobScheduler&) = delete;
+  JobScheduler& operator=(const JobScheduler&) = delete;
+
+  std::shared_ptr<JobToken> submit(const std::string& key,
+                                   std::function<void(JobToken&)> job,
+                                   TaskPriority priority = TaskPriority::LOW);
+
+  void cancel(const std::string& key);
+  void cancelAll();
+
+  // progress of the unfinished job with this key, or -1 if there is none
+  float progress(const std::string& key) const;
+
+  // number of jobs queued or running
+  size_t activeJobs() const;
+
+  // block until no job is queued or running
+  void waitForAll();
+
+private:
+  ThreadPool& m_pool;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_idle;
+  // latest job for each key, until it finishes
+  std::map<std::string, std::shared_ptr<JobToken>> m_current;
+  size_t m_active = 0;
+};
@@ -0,0 +1,248 @@
+#include "MemoryAccounting.h"
+
+#include "Logging.h"
+
+#include "json/json.hpp"
+
+#include <mutex>
+
+namespace {
+
+struct Registry
+{
+  std::mutex mutex;
+  MemoryAccounting::Usage total;
+  std::map<std::string, MemoryAccounting::Usage> owners;
+  // 0 is unlimited
+  std::array<uint64_t, MemoryAccounting::CATEGORY_COUNT> budgets{};
+  uint64_t totalBudget = 0;
+};
+
+// never destroyed, so that allocations held by static objects can still be released at exit
+Registry&
+registry()
+{
+  static Registry* r = new Registry();
+  return *r;
+}
+
+thread_local std::string tCurrentOwner;
+
+bool
+exceeds(uint64_t bytes, uint64_t budget)
+{
+  return budget > 0 && bytes > budget;
+}
+
+// called with the registry locked
+void
+change(Registry& r, MemoryAccounting::Category category, const std::string& owner, size_t from, size_t to)
+{
+  if (from == to) {
+    return;
+  }
+  size_t c = (size_t)category;
+  uint64_t categoryBefore = r.total.bytes[c];
+  uint64_t totalBefore = r.total.total();
+
+  r.total.bytes[c] = r.total.bytes[c] - from + to;
+  MemoryAccounting::Usage& usage = r.owners[owner];
+  usage.bytes[c] = usage.bytes[c] - from + to;
+  if (usage.total() == 0) {
+    r.owners.erase(owner);
+  }
+
+  // warn when crossing a budget, not on every allocation beyond it
+  if (exceeds(r.total.bytes[c], r.budgets[c]) && !exceeds(categoryBefore, r.budgets[c])) {
+    LOG_WARNING << "Memory for " << MemoryAccounting::categoryName(category) << " is over budget: "
+                << r.total.bytes[c] << " of " << r.budgets[c] << " bytes";
+  }
+  if (exceeds(r.total.total(), r.totalBudget) && !exceeds(totalBefore, r.totalBudget)) {
+    LOG_WARNING << "Memory is over budget: " << r.total.total() << " of " << r.totalBudget << " bytes";
+  }
+}
+
+nlohmann::json
+usageJson(const MemoryAccounting::Usage& usage)
+{
+  nlohmann::json j;
+  for (size_t c = 0; c < MemoryAccounting::CATEGORY_COUNT; ++c) {
+    j[MemoryAccounting::categoryName((MemoryAccounting::Category)c)] = usage.bytes[c];
+  }
+  j["total"] = usage.total();
+  return j;
+}
+
+} // namespace
+
+namespace MemoryAccounting {
+
+const char*
+categoryName(Category category)
+{
+  switch (category) {
+    case Category::VoxelData:
+      return "voxel_data";
+    case Category::DerivedVolumes:
+      return "derived_volumes";
+    case Category::Caches:
+      return "caches";
+    case Category::GpuTextures:
+      return "gpu_textures";
+    case Category::Framebuffers:
+      return "framebuffers";
+    default:
+      return "unknown";
+  }
+}
+
+uint64_t
+Usage::total() const
+{
+  uint64_t sum = 0;
+  for (uint64_t b : bytes) {
+    sum += b;
+  }
+  return sum;
+}
+
+ScopedOwner::ScopedOwner(const std::string& owner)
+  : m_previous(tCurrentOwner)
+{
+  tCurrentOwner = owner;
+}
+
+ScopedOwner::~ScopedOwner()
+{
+  tCurrentOwner = m_previous;
+}
+
+std::string
+currentOwner()
+{
+  return tCurrentOwner;
+}
+
+Allocation::Allocation(Category category)
+  : Allocation(category, currentOwner())
+{
+}
+
+Allocation::Allocation(Category category, const std::string& owner)
+  : m_category(category)
+  , m_owner(owner)
+  , m_bytes(0)
+{
+}
+
+Allocation::~Allocation()
+{
+  set(0);
+}
+
+void
+Allocation::set(size_t bytes)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  change(r, m_category, m_owner, m_bytes, bytes);
+  m_bytes = bytes;
+}
+
+void
+Allocation::reassign(Category category, const std::string& owner)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  change(r, m_category, m_owner, m_bytes, 0);
+  change(r, category, owner, 0, m_bytes);
+  m_category = category;
+  m_owner = owner;
+}
+
+Usage
+total()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  return r.total;
+}
+
+Usage
+ownerUsage(const std::string& owner)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  auto found = r.owners.find(owner);
+  return found == r.owners.end() ? Usage() : found->second;
+}
+
+std::map<std::string, Usage>
+usageByOwner()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  return r.owners;
+}
+
+void
+setBudget(Category category, uint64_t bytes)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.budgets[(size_t)category] = bytes;
+}
+
+uint64_t
+budget(Category category)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  return r.budgets[(size_t)category];
+}
+
+void
+setTotalBudget(uint64_t bytes)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.totalBudget = bytes;
+}
+
+uint64_t
+totalBudget()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  return r.totalBudget;
+}
+
+bool
+fits(Category category, uint64_t moreBytes)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  size_t c = (size_t)category;
+  return !exceeds(r.total.bytes[c] + moreBytes, r.budgets[c]) &&
+         !exceeds(r.total.total() + moreBytes, r.totalBudget);
+}
+
+std::string
+toJson()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  nlohmann::json j;
+  j["total"] = usageJson(r.total);
+  Usage budgets;
+  budgets.bytes = r.budgets;
+  j["budget"] = usageJson(budgets);
+  j["budget"]["total"] = r.totalBudget;
+  j["owners"] = nlohmann::json::object();
+  for (const auto& owner : r.owners) {
+    j["owners"][owner.first] = usageJson(owner.second);
+  }
+  return j.dump();
+}
+
+} // namespace MemoryAccounting
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Process wide accounting of the host and GPU memory held by loaded datasets and render sessions.
+// Memory is tracked by Allocation objects that live next to the buffers they describe; every allocation belongs to a
+// category and an owner. By convention datasets are owned by "dataset:<file path>" and render sessions by
+// "session:<id>".
+// Budgets per category and in total can be set for admission control; nothing is refused here, but fits() tells
+// whether more memory can be taken.
+//
+// Usage example:
+//
+// MemoryAccounting::ScopedOwner owner("dataset:" + filepath);
+// ...
+// MemoryAccounting::Allocation m_voxelMemory(MemoryAccounting::Category::VoxelData);
+// m_voxelMemory.set(sizeInBytes);
+namespace MemoryAccounting {
+
+enum class Category
+{
+  // raw channel data of loaded volumes
+  VoxelData = 0,
+  // lookup tables, gradient magnitude volumes and fused volumes computed from voxel data
+  DerivedVolumes,
+  // memory kept only to make later work faster
+  Caches,
+  // volume and lookup table textures
+  GpuTextures,
+  // render targets
+  Framebuffers,
+  Count
+};
+
+static const size_t CATEGORY_COUNT = (size_t)Category::Count;
+
+// snake case, e.g. "voxel_data"
+const char*
+categoryName(Category category);
+
+struct Usage
+{
+  std::array<uint64_t, CATEGORY_COUNT> bytes{};
+
+  uint64_t operator[](Category category) const { return bytes[(size_t)category]; }
+  uint64_t total() const;
+};
+
+// Owner of allocations created on the current thread while this is alive, unless they name their own.
+class ScopedOwner
+{
+public:
+  explicit ScopedOwner(const std::string& owner);
+  ~ScopedOwner();
+
+private:
+  std::string m_previous;
+};
+
+// "" if there is no ScopedOwner on this thread
+std::string
+currentOwner();
+
+// Bytes of one category held by one owner, counted for as long as this object lives.
+class Allocation
+{
+public:
+  explicit Allocation(Category category);
+  Allocation(Category category, const std::string& owner);
+  ~Allocation();
+
+  Allocation(const Allocation&) = delete;
+  Allocation& operator=(const Allocation&) = delete;
+
+  void set(size_t bytes);
+  size_t bytes() const { return m_bytes; }
+
+  // move the bytes to another category and owner
+  void reassign(Category category, const std::string& owner);
+
+  Category category() const { return m_category; }
+  const std::string& owner() const { return m_owner; }
+
+private:
+  Category m_category;
+  std::string m_owner;
+  size_t m_bytes;
+};
+
+// everything that is allocated
+Usage
+total();
+
+// what one owner holds
+Usage
+ownerUsage(const std::string& owner);
+
+// every owner that holds memory
+std::map<std::string, Usage>
+usageByOwner();
+
+// 0 means unlimited
+void
+setBudget(Category category, uint64_t bytes);
+uint64_t
+budget(Category category);
+void
+setTotalBudget(uint64_t bytes);
+uint64_t
+totalBudget();
+
+// whether another moreBytes of the category stay within its budget and the total budget
+bool
+fits(Category category, uint64_t moreBytes);
+
+// JSON object with "total", "budget" and "owners", each mapping category names and "total" to bytes
+std::string
+toJson();
+
+} // namespace MemoryAccounting
@@ -0,0 +1,298 @@
+#include "Metrics.h"
+
+#include "Logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <sstream>
+
+namespace {
+
+enum class MetricType
+{
+  Counter,
+  Gauge,
+  Histogram
+};
+
+const char*
+typeName(MetricType type)
+{
+  switch (type) {
+    case MetricType::Counter:
+      return "counter";
+    case MetricType::Gauge:
+      return "gauge";
+    default:
+      return "histogram";
+  }
+}
+
+struct Series
+{
+  std::shared_ptr<Metrics::Counter> counter;
+  std::shared_ptr<Metrics::Gauge> gauge;
+  std::shared_ptr<Metrics::Histogram> histogram;
+};
+
+struct Family
+{
+  MetricType type;
+  std::string help;
+  std::map<Metrics::Labels, Series> series;
+};
+
+std::mutex sFamiliesMutex;
+// sorted by name, for a stable output
+std::map<std::string, Family> sFamilies;
+
+// returns nullptr if the name is already used by a metric of another type
+Series*
+findOrAddSeries(const std::string& name, MetricType type, const std::string& help, const Metrics::Labels& labels)
+{
+  auto family = sFamilies.find(name);
+  if (family == sFamilies.end()) {
+    family = sFamilies.emplace(name, Family{ type, help, {} }).first;
+  } else if (family->second.type != type) {
+    LOG_ERROR << "Metric " << name << " is a " << typeName(family->second.type) << ", not a " << typeName(type);
+    return nullptr;
+  }
+  return &family->second.series[labels];
+}
+
+void
+appendNumber(std::ostringstream& out, double value)
+{
+  if (std::isinf(value)) {
+    out << (value > 0 ? "+Inf" : "-Inf");
+    return;
+  }
+  char buf[32];
+  if (value == std::floor(value) && std::fabs(value) < 1e15) {
+    snprintf(buf, sizeof(buf), "%.0f", value);
+  } else {
+    snprintf(buf, sizeof(buf), "%.9g", value);
+  }
+  out << buf;
+}
+
+void
+appendLabels(std::ostringstream& out, const Metrics::Labels& labels, const char* le = nullptr)
+{
+  if (labels.empty() && !le) {
+    return;
+  }
+  out << '{';
+  bool first = true;
+  for (const auto& label : labels) {
+    out << (first ? "" : ",") << label.first << "=\"";
+    for (char c : label.second) {
+      if (c == '\\' || c == '"') {
+        out << '\\' << c;
+      } else if (c == '\n') {
+        out << "\\n";
+      } else {
+        out << c;
+      }
+    }
+    out << '"';
+    first = false;
+  }
+  if (le) {
+    out << (first ? "" : ",") << "le=\"" << le << '"';
+  }
+  out << '}';
+}
+
+void
+appendHelp(std::ostringstream& out, const std::string& help)
+{
+  for (char c : help) {
+    if (c == '\\') {
+      out << "\\\\";
+    } else if (c == '\n') {
+      out << "\\n";
+    } else {
+      out << c;
+    }
+  }
+}
+
+} // namespace
+
+namespace Metrics {
+
+void
+Counter::add(double amount)
+{
+  double current = m_value.load(std::memory_order_relaxed);
+  while (!m_value.compare_exchange_weak(current, current + amount, std::memory_order_relaxed)) {
+  }
+}
+
+Histogram::Histogram(const std::vector<double>& upperBounds)
+  : m_upperBounds(upperBounds)
+  , m_counts(upperBounds.size() + 1, 0)
+  , m_sum(0.0)
+  , m_count(0)
+{
+  std::sort(m_upperBounds.begin(), m_upperBounds.end());
+}
+
+void
+Histogram::observe(double value)
+{
+  size_t bucket = std::lower_bound(m_upperBounds.begin(), m_upperBounds.end(), value) - m_upperBounds.begin();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_counts[bucket]++;
+  m_sum += value;
+  m_count++;
+}
+
+Histogram::Snapshot
+Histogram::snapshot() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Snapshot s;
+  s.upperBounds = m_upperBounds;
+  s.counts = m_counts;
+  s.sum = m_sum;
+  s.count = m_count;
+  return s;
+}
+
+std::vector<double>
+secondsBuckets()
+{
+  return { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+}
+
+std::shared_ptr<Counter>
+counter(const std::string& name, const std::string& help, const Labels& labels)
+{
+  std::lock_guard<std::mutex> lock(sFamiliesMutex);
+  Series* series = findOrAddSeries(name, MetricType::Counter, help, labels);
+  if (!series) {
+    // still usable, just not exported
+    return std::make_shared<Counter>();
+  }
+  if (!series->counter) {
+    series->counter = std::make_shared<Counter>();
+  }
+  return series->counter;
+}
+
+std::shared_ptr<Gauge>
+gauge(const std::string& name, const std::string& help, const Labels& labels)
+{
+  std::lock_guard<std::mutex> lock(sFamiliesMutex);
+  Series* series = findOrAddSeries(name, MetricType::Gauge, help, labels);
+  if (!series) {
+    return std::make_shared<Gauge>();
+  }
+  if (!series->gauge) {
+    series->gauge = std::make_shared<Gauge>();
+  }
+  return series->gauge;
+}
+
+std::shared_ptr<Histogram>
+histogram(const std::string& name,
+          const std::string& help,
+          const Labels& labels,
+          const std::vector<double>& upperBounds)
+{
+  std::lock_guard<std::mutex> lock(sFamiliesMutex);
+  Series* series = findOrAddSeries(name, MetricType::Histogram, help, labels);
+  if (!series) {
+    return std::make_shared<Histogram>(upperBounds);
+  }
+  if (!series->histogram) {
+    // every series of a histogram must have the same buckets
+    const Family& family = sFamilies[name];
+    for (const auto& other : family.series) {
+      if (other.second.histogram) {
+        series->histogram = std::make_shared<Histogram>(other.second.histogram->snapshot().upperBounds);
+        return series->histogram;
+      }
+    }
+    series->histogram = std::make_shared<Histogram>(upperBounds);
+  }
+  return series->histogram;
+}
+
+void
+removeSeries(const std::string& labelName, const std::string& labelValue)
+{
+  std::lock_guard<std::mutex> lock(sFamiliesMutex);
+  for (auto& family : sFamilies) {
+    auto& series = family.second.series;
+    for (auto it = series.begin(); it != series.end();) {
+      bool matches = std::find(it->first.begin(), it->first.end(), std::make_pair(labelName, labelValue)) !=
+                     it->first.end();
+      it = matches ? series.erase(it) : std::next(it);
+    }
+  }
+}
+
+void
+clear()
+{
+  std::lock_guard<std::mutex> lock(sFamiliesMutex);
+  sFamilies.clear();
+}
+
+std::string
+prometheusText()
+{
+  std::ostringstream out;
+  std::lock_guard<std::mutex> lock(sFamiliesMutex);
+  for (const auto& entry : sFamilies) {
+    const std::string& name = entry.first;
+    const Family& family = entry.second;
+    if (family.series.empty()) {
+      continue;
+    }
+    out << "# HELP " << name << ' ';
+    appendHelp(out, family.help);
+    out << "\n# TYPE " << name << ' ' << typeName(family.type) << '\n';
+
+    for (const auto& series : family.series) {
+      const Labels& labels = series.first;
+      if (series.second.counter || series.second.gauge) {
+        out << name;
+        appendLabels(out, labels);
+        out << ' ';
+        appendNumber(out, series.second.counter ? series.second.counter->value() : series.second.gauge->value());
+        out << '\n';
+      } else if (series.second.histogram) {
+        Histogram::Snapshot s = series.second.histogram->snapshot();
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < s.counts.size(); ++i) {
+          cumulative += s.counts[i];
+          std::ostringstream le;
+          if (i < s.upperBounds.size()) {
+            appendNumber(le, s.upperBounds[i]);
+          } else {
+            le << "+Inf";
+          }
+          out << name << "_bucket";
+          appendLabels(out, labels, le.str().c_str());
+          out << ' ' << cumulative << '\n';
+        }
+        out << name << "_sum";
+        appendLabels(out, labels);
+        out << ' ';
+        appendNumber(out, s.sum);
+        out << '\n' << name << "_count";
+        appendLabels(out, labels);
+        out << ' ' << s.count << '\n';
+      }
+    }
+  }
+  return out.str();
+}
+
+} // namespace Metrics
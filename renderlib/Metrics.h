@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Process wide counters, gauges and histograms for monitoring a running render server, exported in the Prometheus
+// text exposition format.
+// A series is identified by its metric name and labels; asking for the same name and labels again returns the same
+// series. Series are shared pointers, so a caller may keep using one after it has been removed from the registry.
+//
+// Usage example:
+//
+// static std::shared_ptr<Metrics::Counter> loads = Metrics::counter("agave_loads_total", "Volumes loaded");
+// loads->add();
+// ...
+// std::string text = Metrics::prometheusText();
+namespace Metrics {
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+// only ever increases
+class Counter
+{
+public:
+  void add(double amount = 1.0);
+  double value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> m_value{ 0.0 };
+};
+
+class Gauge
+{
+public:
+  void set(double value) { m_value.store(value, std::memory_order_relaxed); }
+  double value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> m_value{ 0.0 };
+};
+
+// counts observations into buckets of increasing upper bounds, plus an unbounded last bucket
+class Histogram
+{
+public:
+  explicit Histogram(const std::vector<double>& upperBounds);
+
+  void observe(double value);
+
+  struct Snapshot
+  {
+    std::vector<double> upperBounds;
+    // per bucket, not cumulative; one more than upperBounds
+    std::vector<uint64_t> counts;
+    double sum = 0.0;
+    uint64_t count = 0;
+  };
+  Snapshot snapshot() const;
+
+private:
+  mutable std::mutex m_mutex;
+  std::vector<double> m_upperBounds;
+  std::vector<uint64_t> m_counts;
+  double m_sum;
+  uint64_t m_count;
+};
+
+// 1 ms to 10 s, for durations in seconds
+std::vector<double>
+secondsBuckets();
+
+std::shared_ptr<Counter>
+counter(const std::string& name, const std::string& help, const Labels& labels = {});
+
+std::shared_ptr<Gauge>
+gauge(const std::string& name, const std::string& help, const Labels& labels = {});
+
+// upperBounds only apply to the first series of the name
+std::shared_ptr<Histogram>
+histogram(const std::string& name,
+          const std::string& help,
+          const Labels& labels = {},
+          const std::vector<double>& upperBounds = secondsBuckets());
+
+// stop exporting every series that has this label value, e.g. all series of a closed session
+void
+removeSeries(const std::string& labelName, const std::string& labelValue);
+
+// drop every series
+void
+clear();
+
+// every series, in the Prometheus text exposition format (version 0.0.4)
+std::string
+prometheusText();
+
+} // namespace Metrics
@@ -2,6 +2,10 @@
 
 #include "AppScene.h"
 #include "ImageXYZC.h"
+#include "MemoryAccounting.h"
+
+#include <iomanip>
+#include <sstream>
 
 inline std::string
 FormatVector(const glm::vec3& Vector, const int& Precision = 2)
@@ -35,6 +39,14 @@ FormatSize(const glm::ivec3& Size)
   return ss.str();
 }
 
+inline std::string
+FormatMegabytes(uint64_t bytes)
+{
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(1) << (double)bytes / (1024.0 * 1024.0);
+  return ss.str();
+}
+
 void
 CStatus::SetRenderBegin(void)
 {
@@ -152,3 +164,21 @@ CStatus::onNewImage(const std::string& name, Scene* scene)
   SetStatisticChanged(
     "Volume", "Time Points", std::to_string(scene->m_timeLine.maxTime() - scene->m_timeLine.minTime() + 1), "");
 }
+
+void
+CStatus::onMemoryUsage()
+{
+  if (!mUpdatesEnabled) {
+    return;
+  }
+
+  // in MemoryAccounting::Category order
+  static const char* names[MemoryAccounting::CATEGORY_COUNT] = {
+    "Voxel Data", "Derived Volumes", "Caches", "GPU Textures", "Framebuffers"
+  };
+  MemoryAccounting::Usage usage = MemoryAccounting::total();
+  for (size_t i = 0; i < MemoryAccounting::CATEGORY_COUNT; ++i) {
+    SetStatisticChanged("Memory", names[i], FormatMegabytes(usage.bytes[i]), "MB");
+  }
+  SetStatisticChanged("Memory", "Total", FormatMegabytes(usage.total()), "MB");
+}
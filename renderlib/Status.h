@@ -43,6 +43,8 @@ public:
                            const std::string& Icon = "");
 
   void onNewImage(const std::string& name, Scene* scene);
+  // process wide memory use per category (see MemoryAccounting)
+  void onMemoryUsage();
 
   void addObserver(IStatusObserver* ob) { mObservers.push_back(ob); }
   void removeObserver(IStatusObserver* ob)
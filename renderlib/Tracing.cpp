@@ -0,0 +1,213 @@
+#include "Tracing.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// beyond this a thread's spans are counted but not kept
+const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+struct TraceEvent
+{
+  const char* name;
+  const char* category;
+  uint64_t start;
+  uint64_t duration;
+  uint32_t depth;
+};
+
+struct ThreadBuffer
+{
+  std::mutex mutex;
+  uint32_t tid = 0;
+  std::string name;
+  std::vector<TraceEvent> events;
+  size_t dropped = 0;
+};
+
+std::chrono::steady_clock::time_point
+traceEpoch()
+{
+  static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  return epoch;
+}
+
+// buffers outlive their threads, so that spans of finished threads can still be exported
+std::mutex sBuffersMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> sBuffers;
+
+thread_local std::shared_ptr<ThreadBuffer> tBuffer;
+thread_local std::string tThreadName;
+thread_local uint32_t tDepth = 0;
+
+ThreadBuffer&
+threadBuffer()
+{
+  if (!tBuffer) {
+    tBuffer = std::make_shared<ThreadBuffer>();
+    tBuffer->name = tThreadName;
+    std::lock_guard<std::mutex> lock(sBuffersMutex);
+    tBuffer->tid = (uint32_t)sBuffers.size() + 1;
+    sBuffers.push_back(tBuffer);
+  }
+  return *tBuffer;
+}
+
+void
+appendEscaped(std::ostringstream& out, const char* s)
+{
+  for (; *s; ++s) {
+    char c = *s;
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if ((unsigned char)c < 0x20) {
+      char hex[8];
+      snprintf(hex, sizeof(hex), "\\u%04x", c);
+      out << hex;
+    } else {
+      out << c;
+    }
+  }
+}
+
+// microseconds, the unit of chrome trace timestamps, keeping nanosecond precision
+void
+appendMicroseconds(std::ostringstream& out, uint64_t ns)
+{
+  out << (ns / 1000) << '.';
+  char frac[4];
+  snprintf(frac, sizeof(frac), "%03u", (unsigned)(ns % 1000));
+  out << frac;
+}
+
+} // namespace
+
+namespace Tracing {
+
+namespace detail {
+
+std::atomic<bool> sEnabled(false);
+
+uint64_t
+beginSpan()
+{
+  ++tDepth;
+  // never 0, which marks a span that is not recorded
+  return now() | 1;
+}
+
+void
+endSpan(const char* name, const char* category, uint64_t start)
+{
+  uint64_t end = now();
+  --tDepth;
+  ThreadBuffer& buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  if (buffer.events.size() < MAX_EVENTS_PER_THREAD) {
+    buffer.events.push_back({ name, category, start, end > start ? end - start : 0, tDepth });
+  } else {
+    buffer.dropped++;
+  }
+}
+
+} // namespace detail
+
+void
+enable(bool enabled)
+{
+  // start the clock
+  traceEpoch();
+  detail::sEnabled = enabled;
+}
+
+uint64_t
+now()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch())
+    .count();
+}
+
+void
+setThreadName(const std::string& name)
+{
+  tThreadName = name;
+  if (tBuffer) {
+    std::lock_guard<std::mutex> lock(tBuffer->mutex);
+    tBuffer->name = name;
+  }
+}
+
+void
+clear()
+{
+  std::lock_guard<std::mutex> lock(sBuffersMutex);
+  for (auto& buffer : sBuffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    buffer->events.clear();
+    buffer->dropped = 0;
+  }
+}
+
+size_t
+eventCount()
+{
+  size_t count = 0;
+  std::lock_guard<std::mutex> lock(sBuffersMutex);
+  for (auto& buffer : sBuffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    count += buffer->events.size();
+  }
+  return count;
+}
+
+std::string
+chromeTraceJson()
+{
+  std::ostringstream out;
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  size_t dropped = 0;
+
+  std::lock_guard<std::mutex> lock(sBuffersMutex);
+  for (auto& buffer : sBuffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    dropped += buffer->dropped;
+    if (!buffer->name.empty()) {
+      out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+          << ",\"args\":{\"name\":\"";
+      appendEscaped(out, buffer->name.c_str());
+      out << "\"}}";
+      first = false;
+    }
+    for (const TraceEvent& e : buffer->events) {
+      out << (first ? "" : ",") << "\n{\"name\":\"";
+      appendEscaped(out, e.name);
+      out << "\",\"cat\":\"";
+      appendEscaped(out, e.category);
+      out << "\",\"ph\":\"X\",\"ts\":";
+      appendMicroseconds(out, e.start);
+      out << ",\"dur\":";
+      appendMicroseconds(out, e.duration);
+      out << ",\"pid\":1,\"tid\":" << buffer->tid << ",\"args\":{\"depth\":" << e.depth << "}}";
+      first = false;
+    }
+  }
+  out << "\n],\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+  return out.str();
+}
+
+bool
+writeChromeTrace(const std::string& path)
+{
+  std::ofstream file(path, std::ios::out | std::ios::trunc);
+  file << chromeTraceJson();
+  return (bool)file;
+}
+
+} // namespace Tracing
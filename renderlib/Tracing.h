@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped spans that record where time goes, for diagnosing slow sessions.
+// While tracing is enabled, every TraceSpan records its name, category, thread, nesting depth, start and duration
+// (in nanoseconds) into a buffer owned by its thread. The spans of all threads can be exported as Chrome trace event
+// JSON, to be viewed in chrome://tracing or https://ui.perfetto.dev.
+// While tracing is disabled a TraceSpan costs one relaxed atomic load.
+//
+// Usage example:
+//
+// Tracing::enable(true);
+// {
+//   TraceSpan span("loadVolume", "io");
+//   ...
+// }
+// Tracing::writeChromeTrace("agave_trace.json");
+namespace Tracing {
+
+namespace detail {
+extern std::atomic<bool> sEnabled;
+// returns the start time and enters a span on this thread
+uint64_t beginSpan();
+// leaves the span and records it
+void endSpan(const char* name, const char* category, uint64_t start);
+} // namespace detail
+
+void
+enable(bool enabled);
+
+inline bool
+isEnabled()
+{
+  return detail::sEnabled.load(std::memory_order_relaxed);
+}
+
+// nanoseconds since the first use of Tracing in this process
+uint64_t
+now();
+
+// name the calling thread in exported traces
+void
+setThreadName(const std::string& name);
+
+// drop every recorded span
+void
+clear();
+
+// number of spans recorded so far, across all threads
+size_t
+eventCount();
+
+std::string
+chromeTraceJson();
+
+// returns false if the file could not be written
+bool
+writeChromeTrace(const std::string& path);
+
+} // namespace Tracing
+
+class TraceSpan
+{
+public:
+  // name and category are not copied and must outlive the trace: use string literals.
+  explicit TraceSpan(const char* name, const char* category = "agave")
+    : m_name(name)
+    , m_category(category)
+    , m_start(Tracing::isEnabled() ? Tracing::detail::beginSpan() : 0)
+  {
+  }
+  ~TraceSpan()
+  {
+    if (m_start) {
+      Tracing::detail::endSpan(m_name, m_category, m_start);
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  const char* m_name;
+  const char* m_category;
+  // 0 when tracing was disabled at construction
+  uint64_t m_start;
+};
@@ -3,7 +3,9 @@
 #include "AppScene.h"
 #include "CCamera.h"
 #include "ImageXYZC.h"
+#include "JobScheduler.h"
 #include "Logging.h"
+#include "MemoryAccounting.h"
 #include "RenderSettings.h"
 #include "VolumeDimensions.h"
 
@@ -11,6 +13,7 @@
 
 #include <errno.h>
 #include <sys/stat.h>
+#include <unordered_set>
 
 #if defined(WIN32)
 #define STAT64_STRUCT __stat64
@@ -547,43 +550,49 @@ LoadVolumeFromFileCommand::execute(ExecutionContext* c)
   }
 }
 
-void
-SetTimeCommand::execute(ExecutionContext* c)
+namespace {
+std::shared_ptr<ImageXYZC>
+loadTime(const LoadSpec& loadSpec, const ImageXYZC* histogramSource)
 {
-  LOG_DEBUG << "SetTime command: "
-            << " T=" << m_data.m_time;
-
-  // setting same time is a no-op.
-  if (m_data.m_time == c->m_appScene->m_timeLine.currentTime()) {
-    return;
-  }
-
-  LoadSpec loadSpec = c->m_loadSpec;
-  loadSpec.time = m_data.m_time;
   std::shared_ptr<ImageXYZC> image;
   try {
 
     std::unique_ptr<IFileReader> reader(FileReader::getReader(loadSpec.filepath, loadSpec.isImageSequence));
     if (!reader) {
       LOG_ERROR << "Could not find a reader for file " << loadSpec.filepath;
-      image = nullptr;
-      return;
+      return nullptr;
+    }
+
+    // timepoints of one dataset usually share their intensity statistics;
+    // reusing the current histograms skips rebuilding them for every step.
+    ChannelStatsOptions stats = ImageXYZC::channelStatsOptions();
+    if (stats.reuseHistogramsAcrossTimes) {
+      stats.histogramSource = histogramSource;
     }
+    ScopedChannelStatsOptions scopedStats(stats);
 
     image = reader->loadFromFile(loadSpec);
   } catch (...) {
-    LOG_ERROR << "Failed to load time " << m_data.m_time << " from file " << c->m_loadSpec.toString();
+    LOG_ERROR << "Failed to load time " << loadSpec.time << " from file " << loadSpec.toString();
     image = nullptr;
   }
   if (!image) {
     LOG_WARNING << "SetTime command called without a file loaded";
+  }
+  return image;
+}
+
+void
+applyTime(ExecutionContext* c, const LoadSpec& loadSpec, std::shared_ptr<ImageXYZC> image)
+{
+  if (!c->m_appScene->m_volume) {
+    LOG_WARNING << "SetTime command applied without a volume in the scene";
     return;
   }
 
   // successfully loaded; update loadspec in context
   c->m_loadSpec = loadSpec;
-
-  c->m_appScene->m_timeLine.setCurrentTime(m_data.m_time);
+  c->m_appScene->m_timeLine.setCurrentTime(loadSpec.time);
 
   // we expect the scene volume dimensions to be the same; we want to preserve all view settings here.
   // BUT we want to convert the old lookup tables to new lookup tables
@@ -620,6 +629,44 @@ SetTimeCommand::execute(ExecutionContext* c)
 
   c->m_message = j.dump();
 }
+} // namespace
+
+void
+SetTimeCommand::execute(ExecutionContext* c)
+{
+  LOG_DEBUG << "SetTime command: "
+            << " T=" << m_data.m_time;
+
+  // setting same time is a no-op.
+  if (m_data.m_time == c->m_appScene->m_timeLine.currentTime()) {
+    return;
+  }
+
+  LoadSpec loadSpec = c->m_loadSpec;
+  loadSpec.time = m_data.m_time;
+
+  if (!c->m_jobRunner) {
+    std::shared_ptr<ImageXYZC> image = loadTime(loadSpec, c->m_appScene->m_volume.get());
+    if (!image) {
+      return;
+    }
+    applyTime(c, loadSpec, image);
+    return;
+  }
+
+  // the current volume keeps rendering while the new time loads. No command runs before the load is applied (see
+  // CommandJobRunner), so it is the volume the new time replaces, and the histograms to reuse are its own.
+  std::shared_ptr<ImageXYZC> histogramSource = c->m_appScene->m_volume;
+  c->m_jobRunner->runInBackground(
+    [loadSpec, histogramSource](JobToken& token) -> std::function<void(ExecutionContext*)> {
+      std::shared_ptr<ImageXYZC> image = loadTime(loadSpec, histogramSource.get());
+      if (!image || token.isCancelled()) {
+        return nullptr;
+      }
+      return [loadSpec, image](ExecutionContext* c) { applyTime(c, loadSpec, image); };
+    },
+    false);
+}
 
 void
 SetBoundingBoxColorCommand::execute(ExecutionContext* c)
@@ -645,40 +692,34 @@ TrackballCameraCommand::execute(ExecutionContext* c)
   c->m_renderSettings->m_DirtyFlags.SetFlag(CameraDirty);
 }
 
-void
-LoadDataCommand::execute(ExecutionContext* c)
+namespace {
+std::shared_ptr<ImageXYZC>
+loadData(const LoadSpec& loadSpec, VolumeDimensions& dims, JobToken* token)
 {
-  // TODO handle errors in a client/server remote situation
-
-  LOG_DEBUG << "LoadData " << m_data.m_path << " " << m_data.m_scene << " " << m_data.m_level << " " << m_data.m_time;
-  c->m_loadSpec.filepath = m_data.m_path;
-  c->m_loadSpec.scene = m_data.m_scene;
-  c->m_loadSpec.subpath = std::to_string(m_data.m_level);
-  c->m_loadSpec.time = m_data.m_time;
-  c->m_loadSpec.channels = std::vector<uint32_t>(m_data.m_channels.begin(), m_data.m_channels.end());
-  c->m_loadSpec.minx = m_data.m_xmin;
-  c->m_loadSpec.maxx = m_data.m_xmax;
-  c->m_loadSpec.miny = m_data.m_ymin;
-  c->m_loadSpec.maxy = m_data.m_ymax;
-  c->m_loadSpec.minz = m_data.m_zmin;
-  c->m_loadSpec.maxz = m_data.m_zmax;
-
   // TODO can we load time sequences of separate files here?
-  std::unique_ptr<IFileReader> reader(FileReader::getReader(m_data.m_path));
+  std::unique_ptr<IFileReader> reader(FileReader::getReader(loadSpec.filepath));
   if (!reader) {
-    LOG_ERROR << "Could not find a reader for file " << m_data.m_path;
-    return;
+    LOG_ERROR << "Could not find a reader for file " << loadSpec.filepath;
+    return nullptr;
   }
 
-  VolumeDimensions dims = reader->loadDimensions(m_data.m_path, m_data.m_scene);
-
-  std::shared_ptr<ImageXYZC> image = reader->loadFromFile(c->m_loadSpec);
-  if (!image) {
-    return;
+  dims = reader->loadDimensions(loadSpec.filepath, loadSpec.scene);
+  if (token) {
+    if (token->isCancelled()) {
+      return nullptr;
+    }
+    token->setProgress(0.1f);
   }
 
+  return reader->loadFromFile(loadSpec);
+}
+
+void
+applyData(ExecutionContext* c, const LoadSpec& loadSpec, const VolumeDimensions& dims, std::shared_ptr<ImageXYZC> image)
+{
+  c->m_loadSpec = loadSpec;
   c->m_appScene->m_timeLine.setRange(0, dims.sizeT - 1);
-  c->m_appScene->m_timeLine.setCurrentTime(m_data.m_time);
+  c->m_appScene->m_timeLine.setCurrentTime(loadSpec.time);
 
   c->m_appScene->m_volume = image;
   c->m_appScene->initSceneFromImg(image);
@@ -726,6 +767,50 @@ LoadDataCommand::execute(ExecutionContext* c)
 
   c->m_message = j.dump();
 }
+} // namespace
+
+void
+LoadDataCommand::execute(ExecutionContext* c)
+{
+  // TODO handle errors in a client/server remote situation
+
+  LOG_DEBUG << "LoadData " << m_data.m_path << " " << m_data.m_scene << " " << m_data.m_level << " " << m_data.m_time;
+  // the context keeps the loaded data's spec until the new data is applied
+  LoadSpec loadSpec = c->m_loadSpec;
+  loadSpec.filepath = m_data.m_path;
+  loadSpec.scene = m_data.m_scene;
+  loadSpec.subpath = std::to_string(m_data.m_level);
+  loadSpec.time = m_data.m_time;
+  loadSpec.channels = std::vector<uint32_t>(m_data.m_channels.begin(), m_data.m_channels.end());
+  loadSpec.minx = m_data.m_xmin;
+  loadSpec.maxx = m_data.m_xmax;
+  loadSpec.miny = m_data.m_ymin;
+  loadSpec.maxy = m_data.m_ymax;
+  loadSpec.minz = m_data.m_zmin;
+  loadSpec.maxz = m_data.m_zmax;
+
+  if (!c->m_jobRunner) {
+    VolumeDimensions dims;
+    std::shared_ptr<ImageXYZC> image = loadData(loadSpec, dims, nullptr);
+    if (!image) {
+      return;
+    }
+    applyData(c, loadSpec, dims, image);
+    return;
+  }
+
+  // the current volume keeps rendering while the new one loads
+  c->m_jobRunner->runInBackground(
+    [loadSpec](JobToken& token) -> std::function<void(ExecutionContext*)> {
+      VolumeDimensions dims;
+      std::shared_ptr<ImageXYZC> image = loadData(loadSpec, dims, &token);
+      if (!image || token.isCancelled()) {
+        return nullptr;
+      }
+      return [loadSpec, dims, image](ExecutionContext* c) { applyData(c, loadSpec, dims, image); };
+    },
+    true);
+}
 
 void
 ShowScaleBarCommand::execute(ExecutionContext* c)
@@ -750,6 +835,112 @@ SetInterpolationCommand::execute(ExecutionContext* c)
   c->m_renderSettings->m_DirtyFlags.SetFlag(RenderParamsDirty);
 }
 
+void
+GetMemoryUsageCommand::execute(ExecutionContext* c)
+{
+  LOG_DEBUG << "GetMemoryUsage";
+  nlohmann::json j = nlohmann::json::parse(MemoryAccounting::toJson());
+  j["commandId"] = (int)GetMemoryUsageCommand::m_ID;
+  c->m_message = j.dump();
+}
+
+uint64_t
+commandKey(const Command* command)
+{
+  // the channel or light set, for the setters of one
+  uint32_t index = 0;
+  switch (command->id()) {
+    case SetCameraPosCommand::m_ID:
+    case SetCameraTargetCommand::m_ID:
+    case SetCameraUpCommand::m_ID:
+    case SetCameraApertureCommand::m_ID:
+    case SetCameraProjectionCommand::m_ID:
+    case SetCameraFocalDistanceCommand::m_ID:
+    case SetCameraExposureCommand::m_ID:
+    case SetRenderIterationsCommand::m_ID:
+    case RequestRedrawCommand::m_ID:
+    case SetResolutionCommand::m_ID:
+    case SetDensityCommand::m_ID:
+    case SetSkylightTopColorCommand::m_ID:
+    case SetSkylightMiddleColorCommand::m_ID:
+    case SetSkylightBottomColorCommand::m_ID:
+    case SetClipRegionCommand::m_ID:
+    case SetVoxelScaleCommand::m_ID:
+    case SetPrimaryRayStepSizeCommand::m_ID:
+    case SetSecondaryRayStepSizeCommand::m_ID:
+    case SetBackgroundColorCommand::m_ID:
+    case SetBoundingBoxColorCommand::m_ID:
+    case ShowBoundingBoxCommand::m_ID:
+    case ShowScaleBarCommand::m_ID:
+    case SetFlipAxisCommand::m_ID:
+    case SetInterpolationCommand::m_ID:
+      break;
+    case SetDiffuseColorCommand::m_ID:
+      index = static_cast<const SetDiffuseColorCommand*>(command)->m_data.m_channel;
+      break;
+    case SetSpecularColorCommand::m_ID:
+      index = static_cast<const SetSpecularColorCommand*>(command)->m_data.m_channel;
+      break;
+    case SetEmissiveColorCommand::m_ID:
+      index = static_cast<const SetEmissiveColorCommand*>(command)->m_data.m_channel;
+      break;
+    case SetGlossinessCommand::m_ID:
+      index = static_cast<const SetGlossinessCommand*>(command)->m_data.m_channel;
+      break;
+    case EnableChannelCommand::m_ID:
+      index = static_cast<const EnableChannelCommand*>(command)->m_data.m_channel;
+      break;
+    case SetWindowLevelCommand::m_ID:
+      index = static_cast<const SetWindowLevelCommand*>(command)->m_data.m_channel;
+      break;
+    case SetLightPosCommand::m_ID:
+      index = static_cast<const SetLightPosCommand*>(command)->m_data.m_index;
+      break;
+    case SetLightColorCommand::m_ID:
+      index = static_cast<const SetLightColorCommand*>(command)->m_data.m_index;
+      break;
+    case SetLightSizeCommand::m_ID:
+      index = static_cast<const SetLightSizeCommand*>(command)->m_data.m_index;
+      break;
+    case AutoThresholdCommand::m_ID:
+      index = static_cast<const AutoThresholdCommand*>(command)->m_data.m_channel;
+      break;
+    case SetPercentileThresholdCommand::m_ID:
+      index = static_cast<const SetPercentileThresholdCommand*>(command)->m_data.m_channel;
+      break;
+    case SetOpacityCommand::m_ID:
+      index = static_cast<const SetOpacityCommand*>(command)->m_data.m_channel;
+      break;
+    case SetIsovalueThresholdCommand::m_ID:
+      index = static_cast<const SetIsovalueThresholdCommand*>(command)->m_data.m_channel;
+      break;
+    case SetControlPointsCommand::m_ID:
+      index = static_cast<const SetControlPointsCommand*>(command)->m_data.m_channel;
+      break;
+    default:
+      // loads, relative camera moves, and commands that reply; SetTime does all of these
+      return 0;
+  }
+  return ((uint64_t)command->id() << 32) | index;
+}
+
+std::vector<bool>
+replacedCommands(const std::vector<Command*>& commands)
+{
+  std::vector<bool> replaced(commands.size(), false);
+  // keys set later, since the last unkeyed command
+  std::unordered_set<uint64_t> later;
+  for (size_t i = commands.size(); i-- > 0;) {
+    uint64_t key = commandKey(commands[i]);
+    if (key == 0) {
+      later.clear();
+    } else if (!later.insert(key).second) {
+      replaced[i] = true;
+    }
+  }
+  return replaced;
+}
+
 SessionCommand*
 SessionCommand::parse(ParseableStream* c)
 {
@@ -1686,6 +1877,21 @@ SetInterpolationCommand::write(WriteableStream* o) const
   return bytesWritten;
 }
 
+GetMemoryUsageCommand*
+GetMemoryUsageCommand::parse(ParseableStream* c)
+{
+  GetMemoryUsageCommandD data;
+  return new GetMemoryUsageCommand(data);
+}
+
+size_t
+GetMemoryUsageCommand::write(WriteableStream* o) const
+{
+  size_t bytesWritten = 0;
+  bytesWritten += o->writeInt32(m_ID);
+  return bytesWritten;
+}
+
 std::string
 SessionCommand::toPythonString() const
 {
@@ -2160,3 +2366,12 @@ SetInterpolationCommand::toPythonString() const
   ss << ")";
   return ss.str();
 }
+
+std::string
+GetMemoryUsageCommand::toPythonString() const
+{
+  std::ostringstream ss;
+  ss << PythonName() << "(";
+  ss << ")";
+  return ss.str();
+}
@@ -2,10 +2,12 @@
 
 #include "io/FileReader.h"
 
+#include <functional>
 #include <string>
 #include <vector>
 
 class CCamera;
+class JobToken;
 class Renderer;
 class RenderSettings;
 class Scene;
@@ -46,6 +48,22 @@ enum class CommandArgType
   I32A
 };
 
+struct ExecutionContext;
+
+// Lets commands move slow work (loading data) off the thread that executes them.
+class CommandJobRunner
+{
+public:
+  // The work function runs in the background and returns the step that applies its result,
+  // or an empty function if there is nothing to apply.
+  // The apply step and the commands after the submitting one in the same batch run later on the command thread,
+  // in submission order, and the batches queued after it wait for them.
+  // A job that replaces the data cancels every unfinished job; other jobs only cancel unfinished jobs of their own
+  // kind submitted after the last data replacement.
+  virtual void runInBackground(std::function<std::function<void(ExecutionContext*)>(JobToken&)> work,
+                               bool replacesData) = 0;
+};
+
 struct ExecutionContext
 {
   // we may need to reload data from the file again
@@ -56,6 +74,9 @@ struct ExecutionContext
   Scene* m_appScene;
   CCamera* m_camera;
   std::string m_message;
+
+  // if set, loads run in the background; m_loadSpec changes when the loaded data is applied
+  CommandJobRunner* m_jobRunner = nullptr;
 };
 
 class Command
@@ -64,6 +85,10 @@ public:
   virtual void execute(ExecutionContext* context) = 0;
   virtual std::string toPythonString() const = 0;
   virtual size_t write(WriteableStream* buffer) const = 0;
+  // class name of the command, e.g. for tracing
+  virtual const char* name() const = 0;
+  // m_ID of the command's class
+  virtual uint32_t id() const = 0;
 
   virtual ~Command() {}
 };
@@ -81,6 +106,8 @@ public:
     virtual void execute(ExecutionContext* context);                                                                   \
     virtual std::string toPythonString() const;                                                                        \
     virtual size_t write(WriteableStream* buffer) const;                                                               \
+    virtual const char* name() const { return #NAME; }                                                                 \
+    virtual uint32_t id() const { return m_ID; }                                                                       \
     static NAME* parse(ParseableStream* buffer);                                                                       \
     static const uint32_t m_ID = CMDID;                                                                                \
     static const std::string PythonName()                                                                              \
@@ -487,4 +514,20 @@ struct SetInterpolationCommandD
 {
   int32_t m_on;
 };
-CMDDECL(SetInterpolationCommand, 47, "set_interpolation", CMD_ARGS({ CommandArgType::I32 }));
\ No newline at end of file
+CMDDECL(SetInterpolationCommand, 47, "set_interpolation", CMD_ARGS({ CommandArgType::I32 }));
+
+// replies with the process wide memory use, per category and per owner (see MemoryAccounting)
+struct GetMemoryUsageCommandD
+{};
+CMDDECL(GetMemoryUsageCommand, 48, "memory_usage", CMD_ARGS({}));
+
+// The state a command sets, if all it does is set it: a later command with the same key replaces its effect entirely.
+// Setters of one channel or light have a key per channel or light. RequestRedraw, which does nothing, has a key too.
+// 0 for every other command; those may read or depend on what the commands before them set.
+uint64_t
+commandKey(const Command* command);
+
+// Which of commands, executed in order, are replaced by a later one of the same key with only keyed commands in
+// between (see commandKey), and can be skipped with the same outcome.
+std::vector<bool>
+replacedCommands(const std::vector<Command*>& commands);
@@ -9,6 +9,7 @@ class RenderSettings;
 class Scene;
 
 #include <memory>
+#include <vector>
 
 class IRenderWindow
 {
@@ -28,6 +29,10 @@ public:
   // Alternative impl could be to create at app layer and pass down into renderers
   virtual std::shared_ptr<CStatus> getStatusInterface() { return nullptr; }
 
+  // Read back the linear rgba image the last render accumulated, before tone mapping, top row first.
+  // Returns false if this renderer has none. Call with the GL context current.
+  virtual bool readHdr(std::vector<float>& rgba, uint32_t& w, uint32_t& h) { return false; }
+
   // I own these.
   virtual RenderSettings& renderSettings() = 0;
 
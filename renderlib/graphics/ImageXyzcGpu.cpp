@@ -2,6 +2,7 @@
 
 #include "ImageXYZC.h"
 #include "Logging.h"
+#include "Tracing.h"
 #include "threading.h"
 
 #include "gl/Util.h"
@@ -67,6 +68,7 @@ void
 ImageGpu::createVolumeTextureFusedRGBA8(ImageXYZC* img)
 {
   m_gpuBytes += (8 + 8 + 8 + 8) / 8 * img->sizeX() * img->sizeY() * img->sizeZ();
+  m_gpuMemory.set(m_gpuBytes);
 
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   glGenTextures(1, &m_VolumeGLTexture);
@@ -116,13 +118,10 @@ ImageGpu::updateVolumeData4x16(ImageXYZC* img, int c0, int c1, int c2, int c3)
   size_t xyz = img->sizeX() * img->sizeY() * img->sizeZ();
   uint16_t* v = new uint16_t[xyz * N];
 
-  parallel_for(xyz, [&N, &v, &img, &ch](size_t s, size_t e) {
-    for (size_t i = s; i < e; ++i) {
-      for (int j = 0; j < N; ++j) {
-        v[N * (i) + j] = img->channel(ch[j])->m_ptr[(i)];
-      }
-    }
-  });
+  {
+    TraceSpan span("ImageGpu::interleave4x16", "gpu");
+    interleave4x16(img, ch, v);
+  }
 
   auto endTime = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double> elapsed = endTime - startTime;
@@ -130,6 +129,7 @@ ImageGpu::updateVolumeData4x16(ImageXYZC* img, int c0, int c1, int c2, int c3)
 
   startTime = std::chrono::high_resolution_clock::now();
 
+  TraceSpan span("ImageGpu::uploadVolume4x16", "gpu");
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, 0);
@@ -145,14 +145,57 @@ ImageGpu::updateVolumeData4x16(ImageXYZC* img, int c0, int c1, int c2, int c3)
   delete[] v;
 }
 
+void
+ImageGpu::interleave4x16(const ImageXYZC* img, const int channels[4], uint16_t* dest)
+{
+  const uint16_t* src0 = img->channel(channels[0])->m_ptr;
+  const uint16_t* src1 = img->channel(channels[1])->m_ptr;
+  const uint16_t* src2 = img->channel(channels[2])->m_ptr;
+  const uint16_t* src3 = img->channel(channels[3])->m_ptr;
+  size_t xyz = (size_t)img->sizeX() * img->sizeY() * img->sizeZ();
+
+  parallel_for(xyz, [src0, src1, src2, src3, dest](size_t s, size_t e) {
+    for (size_t i = s; i < e; ++i) {
+      dest[4 * i + 0] = src0[i];
+      dest[4 * i + 1] = src1[i];
+      dest[4 * i + 2] = src2[i];
+      dest[4 * i + 3] = src3[i];
+    }
+  });
+}
+
 void
 ImageGpu::allocGpuInterleaved(ImageXYZC* img, uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3)
 {
-  deallocGpu();
-  m_channels.clear();
+  TraceSpan span("ImageGpu::allocGpuInterleaved", "gpu");
 
   auto startTime = std::chrono::high_resolution_clock::now();
 
+  allocGpuVolume(img, c0, c1, c2, c3);
+
+  uint32_t numChannels = img->sizeC();
+  for (uint32_t i = 0; i < numChannels; ++i) {
+    ChannelGpu c;
+    c.m_index = i;
+    c.allocGpu(img, i);
+    m_channels.push_back(c);
+
+    m_gpuBytes += c.m_gpuBytes;
+  }
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = endTime - startTime;
+  LOG_DEBUG << "allocGPUinterleaved: Image to GPU in " << (elapsed.count() * 1000.0) << "ms";
+  LOG_DEBUG << "allocGPUinterleaved: GPU bytes: " << m_gpuBytes;
+  m_gpuMemory.set(m_gpuBytes);
+}
+
+void
+ImageGpu::allocGpuVolume(ImageXYZC* img, uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3)
+{
+  deallocGpu();
+  m_channels.clear();
+
   createVolumeTexture4x16(img);
   uint32_t numChannels = img->sizeC();
   updateVolumeData4x16(img,
@@ -160,7 +203,28 @@ ImageGpu::allocGpuInterleaved(ImageXYZC* img, uint32_t c0, uint32_t c1, uint32_t
                        std::min(c1, numChannels - 1),
                        std::min(c2, numChannels - 1),
                        std::min(c3, numChannels - 1));
+  m_gpuMemory.set(m_gpuBytes);
+}
 
+void
+ImageGpu::allocGpuShared(std::shared_ptr<ImageGpu> volume, ImageXYZC* img)
+{
+  deallocGpu();
+  m_channels.clear();
+
+  m_sharedVolume = volume;
+  m_VolumeGLTexture = volume->m_VolumeGLTexture;
+
+  // the texture's own sampling state belongs to all its renderers
+  glGenSamplers(1, &m_VolumeSampler);
+  glSamplerParameteri(m_VolumeSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glSamplerParameteri(m_VolumeSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glSamplerParameteri(m_VolumeSampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glSamplerParameteri(m_VolumeSampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glSamplerParameteri(m_VolumeSampler, GL_TEXTURE_WRAP_R, GL_REPEAT);
+  check_gl("volume sampler creation");
+
+  uint32_t numChannels = img->sizeC();
   for (uint32_t i = 0; i < numChannels; ++i) {
     ChannelGpu c;
     c.m_index = i;
@@ -169,11 +233,7 @@ ImageGpu::allocGpuInterleaved(ImageXYZC* img, uint32_t c0, uint32_t c1, uint32_t
 
     m_gpuBytes += c.m_gpuBytes;
   }
-
-  auto endTime = std::chrono::high_resolution_clock::now();
-  std::chrono::duration<double> elapsed = endTime - startTime;
-  LOG_DEBUG << "allocGPUinterleaved: Image to GPU in " << (elapsed.count() * 1000.0) << "ms";
-  LOG_DEBUG << "allocGPUinterleaved: GPU bytes: " << m_gpuBytes;
+  m_gpuMemory.set(m_gpuBytes);
 }
 
 void
@@ -185,6 +245,16 @@ ImageGpu::deallocGpu()
 
   // needs current gl context.
 
+  if (m_VolumeSampler) {
+    glDeleteSamplers(1, &m_VolumeSampler);
+    m_VolumeSampler = 0;
+  }
+  if (m_sharedVolume) {
+    // deleted with the last image borrowing it
+    m_sharedVolume.reset();
+    m_VolumeGLTexture = 0;
+  }
+
   check_gl("pre-destroy gl volume texture");
   //  glBindTexture(GL_TEXTURE_3D, 0);
   glDeleteTextures(1, &m_VolumeGLTexture);
@@ -192,6 +262,7 @@ ImageGpu::deallocGpu()
   m_VolumeGLTexture = 0;
 
   m_gpuBytes = 0;
+  m_gpuMemory.set(0);
 }
 
 void
@@ -203,6 +274,11 @@ ImageGpu::updateLutGpu(int channel, ImageXYZC* img)
 void
 ImageGpu::setVolumeTextureFiltering(bool linear)
 {
+  if (m_VolumeSampler) {
+    glSamplerParameteri(m_VolumeSampler, GL_TEXTURE_MIN_FILTER, linear ? GL_LINEAR : GL_NEAREST);
+    glSamplerParameteri(m_VolumeSampler, GL_TEXTURE_MAG_FILTER, linear ? GL_LINEAR : GL_NEAREST);
+    return;
+  }
   glBindTexture(GL_TEXTURE_3D, m_VolumeGLTexture);
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, linear ? GL_LINEAR : GL_NEAREST);
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, linear ? GL_LINEAR : GL_NEAREST);
@@ -2,6 +2,9 @@
 
 #include <glad/glad.h>
 
+#include "MemoryAccounting.h"
+
+#include <memory>
 #include <vector>
 
 class ImageXYZC;
@@ -23,11 +26,20 @@ struct ImageGpu
   std::vector<ChannelGpu> m_channels;
 
   GLuint m_VolumeGLTexture = 0;
+  // the image whose volume texture this one borrows, if any; the texture's sampling state then is in the sampler
+  std::shared_ptr<ImageGpu> m_sharedVolume;
+  GLuint m_VolumeSampler = 0;
 
   size_t m_gpuBytes = 0;
+  // m_gpuBytes, as seen by the rest of the process
+  MemoryAccounting::Allocation m_gpuMemory{ MemoryAccounting::Category::GpuTextures };
 
   // put first 4 channels into gpu array
   void allocGpuInterleaved(ImageXYZC* img, uint32_t c0 = 0u, uint32_t c1 = 1u, uint32_t c2 = 2u, uint32_t c3 = 3u);
+  // only the volume texture, without the lookup tables of the channels
+  void allocGpuVolume(ImageXYZC* img, uint32_t c0 = 0u, uint32_t c1 = 1u, uint32_t c2 = 2u, uint32_t c3 = 3u);
+  // the volume texture of volume, which may be shared with other renderers, and lookup tables of this image's own
+  void allocGpuShared(std::shared_ptr<ImageGpu> volume, ImageXYZC* img);
 
   void deallocGpu();
 
@@ -39,6 +51,9 @@ struct ImageGpu
   // similar to allocGpuInterleaved, change which channels are in the gpu volume buffer.
   void updateVolumeData4x16(ImageXYZC* img, int c0, int c1, int c2, int c3);
 
+  // the host side of updateVolumeData4x16: dest gets 4 interleaved uint16 values per voxel
+  static void interleave4x16(const ImageXYZC* img, const int channels[4], uint16_t* dest);
+
   void setVolumeTextureFiltering(bool linear);
 
   ~ImageGpu() { deallocGpu(); }
@@ -5,6 +5,7 @@
 #include "ImageXYZC.h"
 #include "Logging.h"
 #include "RenderSettings.h"
+#include "Tracing.h"
 #include "gl/Image3D.h"
 #include "gl/Util.h"
 
@@ -93,6 +94,7 @@ RenderGL::doClear()
 void
 RenderGL::renderTo(const CCamera& camera, GLFramebufferObject* fbo)
 {
+  TraceSpan span("RenderGL::renderTo", "render");
   bool haveScene = prepareToRender();
 
   // COPY TO MY FBO
@@ -174,6 +176,7 @@ RenderGL::render(const CCamera& camera)
   std::chrono::duration<double> elapsed = endTime - mStartTime;
   m_timingRender.AddDuration((float)(elapsed.count() * 1000.0));
   m_status->SetStatisticChanged("Performance", "Render Image", m_timingRender.filteredDurationAsString(), "ms.");
+  m_status->onMemoryUsage();
   mStartTime = std::chrono::high_resolution_clock::now();
 }
 
@@ -6,6 +6,7 @@
 #include "Framebuffer.h"
 #include "ImageXYZC.h"
 #include "Logging.h"
+#include "Tracing.h"
 #include "gl/FSQ.h"
 #include "gl/Image3D.h"
 #include "gl/Util.h"
@@ -13,7 +14,9 @@
 #include "glsl/GLImageShader2DnoLut.h"
 #include "glsl/GLPTVolumeShader.h"
 #include "glsl/GLToneMapShader.h"
+#include "renderlib.h"
 
+#include <algorithm>
 #include <array>
 
 const std::string RenderGLPT::TYPE_NAME = "pathtrace";
@@ -64,6 +67,7 @@ RenderGLPT::cleanUpFB()
   m_fsq = 0;
 
   m_gpuBytes = 0;
+  m_framebufferMemory.set(0);
 }
 
 void
@@ -107,6 +111,7 @@ RenderGLPT::initFB(uint32_t w, uint32_t h)
 
   m_fb = new Framebuffer(w, h, GL_RGBA8, true);
   m_gpuBytes += (size_t)w * (size_t)h * 4;
+  m_framebufferMemory.set(m_gpuBytes);
 
   // clear this fb to black
   glClearColor(0.0, 0.0, 0.0, 0.0);
@@ -127,7 +132,9 @@ RenderGLPT::initVolumeTextureGpu()
   uint32_t c0, c1, c2, c3;
   m_scene->getFirst4EnabledChannels(c0, c1, c2, c3);
 
-  m_imgGpu.allocGpuInterleaved(m_scene->m_volume.get(), c0, c1, c2, c3);
+  // renderers of the same data on contexts that share objects upload it once
+  m_imgGpu.allocGpuShared(renderlib::volumeAllocGPU(m_scene->m_volume, c0, c1, c2, c3), m_scene->m_volume.get());
+  m_imgGpu.setVolumeTextureFiltering(m_renderSettings->m_RenderSettings.m_InterpolatedVolumeSampling);
 }
 
 void
@@ -152,6 +159,7 @@ RenderGLPT::initialize(uint32_t w, uint32_t h)
 void
 RenderGLPT::doRender(const CCamera& camera)
 {
+  TraceSpan span("RenderGLPT::doRender", "render");
   if (!m_scene || !m_scene->m_volume) {
     return;
   }
@@ -198,7 +206,10 @@ RenderGLPT::doRender(const CCamera& camera)
   if (m_renderSettings->m_DirtyFlags.HasFlag(VolumeDataDirty)) {
     uint32_t c0, c1, c2, c3;
     m_scene->getFirst4EnabledChannels(c0, c1, c2, c3);
-    m_imgGpu.updateVolumeData4x16(m_scene->m_volume.get(), c0, c1, c2, c3);
+    // other renderers may be sampling the texture of the old channels; then take the one of the new channels
+    if (!renderlib::volumeUpdateGPU(m_imgGpu.m_sharedVolume, m_scene->m_volume, c0, c1, c2, c3)) {
+      initVolumeTextureGpu();
+    }
     m_renderSettings->SetNoIterations(0);
   }
   // At this point, all dirty flags should have been taken care of, since the flags in the original scene are now
@@ -282,6 +293,8 @@ RenderGLPT::doRender(const CCamera& camera)
     // unbind the prevAccumTargetTex
     glActiveTexture(GL_TEXTURE0 + 1);
     glBindTexture(GL_TEXTURE_2D, 0);
+    // and the volume's sampler, which would override the sampling of the textures below
+    glBindSampler(0, 0);
 
     // 2. copy to accumTargetTex texture that will be used as accumulator for next pass
 
@@ -426,6 +439,7 @@ RenderGLPT::doRender(const CCamera& camera)
   m_status->SetStatisticChanged("Performance", "De-noise Image", m_timingDenoise.filteredDurationAsString(), "ms.");
 
   m_status->SetStatisticChanged("Performance", "No. Iterations", std::to_string(m_renderSettings->GetNoIterations()));
+  m_status->onMemoryUsage();
 
   // restore prior framebuffer
   glBindFramebuffer(GL_FRAMEBUFFER, drawFboId);
@@ -527,6 +541,34 @@ RenderGLPT::setScene(Scene* s)
   m_scene = s;
 }
 
+bool
+RenderGLPT::readHdr(std::vector<float>& rgba, uint32_t& w, uint32_t& h)
+{
+  if (!m_fbF32Accum) {
+    return false;
+  }
+  TraceSpan span("RenderGLPT::readHdr", "render");
+  w = m_w;
+  h = m_h;
+  rgba.resize((size_t)m_w * (size_t)m_h * 4);
+
+  GLint readFboId = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFboId);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbF32Accum->id());
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, m_w, m_h, GL_RGBA, GL_FLOAT, rgba.data());
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, readFboId);
+  check_gl("read accumulation buffer");
+
+  // gl rows are bottom up
+  size_t row = (size_t)m_w * 4;
+  for (int y = 0; y < m_h / 2; ++y) {
+    std::swap_ranges(
+      rgba.begin() + y * row, rgba.begin() + (y + 1) * row, rgba.begin() + (size_t)(m_h - 1 - y) * row);
+  }
+  return true;
+}
+
 size_t
 RenderGLPT::getGpuBytes()
 {
@@ -7,6 +7,7 @@
 #include "RenderSettings.h"
 
 #include "ImageXyzcGpu.h"
+#include "MemoryAccounting.h"
 #include "Status.h"
 #include "Timing.h"
 
@@ -45,6 +46,7 @@ public:
   virtual void setScene(Scene* s);
 
   virtual std::shared_ptr<CStatus> getStatusInterface() { return m_status; }
+  virtual bool readHdr(std::vector<float>& rgba, uint32_t& w, uint32_t& h);
 
   Image3D* getImage() const { return nullptr; };
 
@@ -95,4 +97,6 @@ private:
   std::shared_ptr<CStatus> m_status;
 
   size_t m_gpuBytes;
+  // m_gpuBytes, as seen by the rest of the process
+  MemoryAccounting::Allocation m_framebufferMemory{ MemoryAccounting::Category::Framebuffers };
 };
@@ -34,7 +34,12 @@ Image3D::~Image3D()
 void
 Image3D::create(std::shared_ptr<ImageXYZC> img)
 {
-  m_fusedrgbvolume = new uint8_t[3 * img->sizeX() * img->sizeY() * img->sizeZ()];
+  delete[] m_fusedrgbvolume;
+  m_fusedrgbvolume = new uint8_t[3 * (size_t)img->sizeX() * (size_t)img->sizeY() * (size_t)img->sizeZ()];
+  m_fusedMemory.set(3 * (size_t)img->sizeX() * (size_t)img->sizeY() * (size_t)img->sizeZ());
+  // filled in by the first prepareTexture
+  m_textureMemory.set(0);
+  m_fuse.invalidate();
   // destroy old
   glDeleteTextures(1, &m_textureid);
   // Create image texture.
@@ -238,11 +243,14 @@ Image3D::prepareTexture(Scene& s, bool useLinearInterpolation)
     }
   }
 
-  Fuse::fuse(s.m_volume.get(), colors, &m_fusedrgbvolume, nullptr);
+  // only re-fuses the channels whose color or lut changed
+  bool fusedVolumeChanged = m_fuse.update(s.m_volume.get(), colors, m_fusedrgbvolume);
 
   auto endTime = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double> elapsed = endTime - startTime;
-  LOG_DEBUG << "fuse operation: " << (elapsed.count() * 1000.0) << "ms";
+  if (fusedVolumeChanged) {
+    LOG_DEBUG << "fuse operation: " << (elapsed.count() * 1000.0) << "ms";
+  }
   startTime = std::chrono::high_resolution_clock::now();
 
   // destroy old
@@ -263,6 +271,11 @@ Image3D::prepareTexture(Scene& s, bool useLinearInterpolation)
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
   check_gl("Set texture wrap r");
 
+  if (!fusedVolumeChanged) {
+    // e.g. only the interpolation mode changed; the texture contents are still valid
+    return;
+  }
+
   GLenum internal_format = GL_RGBA8;
   GLenum external_type = GL_UNSIGNED_BYTE;
   GLenum external_format = GL_RGB;
@@ -281,6 +294,7 @@ Image3D::prepareTexture(Scene& s, bool useLinearInterpolation)
                external_type,   // external type
                m_fusedrgbvolume);
   check_gl("Volume Texture create");
+  m_textureMemory.set(4 * (size_t)s.m_volume->sizeX() * (size_t)s.m_volume->sizeY() * (size_t)s.m_volume->sizeZ());
   //	glGenerateMipmap(GL_TEXTURE_3D);
 
   endTime = std::chrono::high_resolution_clock::now();
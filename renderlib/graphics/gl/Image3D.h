@@ -1,6 +1,8 @@
 #pragma once
 
 #include "AppScene.h"
+#include "Fuse.h"
+#include "MemoryAccounting.h"
 #include "glsl/GLBasicVolumeShader.h"
 #include <memory>
 
@@ -63,4 +65,8 @@ private:
   GLBasicVolumeShader* m_image3d_shader;
 
   uint8_t* m_fusedrgbvolume;
+  MemoryAccounting::Allocation m_fusedMemory{ MemoryAccounting::Category::DerivedVolumes };
+  MemoryAccounting::Allocation m_textureMemory{ MemoryAccounting::Category::GpuTextures };
+  // tracks what is in m_fusedrgbvolume so unchanged channels are not re-fused
+  IncrementalFuse m_fuse;
 };
@@ -7,7 +7,9 @@
 
 #include "glm.h"
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
@@ -673,6 +675,140 @@ GLFramebufferObject::toImage(void* pixels)
   }
 }
 
+GLFramebufferReadback::GLFramebufferReadback(int bufferCount)
+  : m_buffers(std::max(bufferCount, 1))
+  , m_first(0)
+  , m_pending(0)
+{
+}
+
+GLFramebufferReadback::~GLFramebufferReadback()
+{
+  discard();
+  for (Buffer& b : m_buffers) {
+    if (b.pbo) {
+      glDeleteBuffers(1, &b.pbo);
+    }
+  }
+}
+
+size_t
+GLFramebufferReadback::bytes() const
+{
+  size_t sum = 0;
+  for (const Buffer& b : m_buffers) {
+    sum += b.capacity;
+  }
+  return sum;
+}
+
+void
+GLFramebufferReadback::start(GLFramebufferObject* fbo)
+{
+  if (m_pending == bufferCount()) {
+    discard(m_pending - 1);
+  }
+  Buffer& b = m_buffers[(m_first + m_pending) % bufferCount()];
+  b.width = fbo->width();
+  b.height = fbo->height();
+  size_t size = (size_t)b.width * (size_t)b.height * 4;
+
+  if (!b.pbo) {
+    glGenBuffers(1, &b.pbo);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+  if (b.capacity < size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    b.capacity = size;
+  }
+
+  GLuint prevFbo = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, (GLint*)&prevFbo);
+  fbo->bind();
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  // into the bound buffer: returns as soon as the copy is queued
+  glReadPixels(0, 0, b.width, b.height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, nullptr);
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  b.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  // make sure the read gets going while the caller carries on
+  glFlush();
+  m_pending++;
+}
+
+bool
+GLFramebufferReadback::ready()
+{
+  if (m_pending == 0) {
+    return false;
+  }
+  GLenum status = glClientWaitSync(m_buffers[m_first].fence, 0, 0);
+  return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+int
+GLFramebufferReadback::width() const
+{
+  return m_pending > 0 ? m_buffers[m_first].width : 0;
+}
+
+int
+GLFramebufferReadback::height() const
+{
+  return m_pending > 0 ? m_buffers[m_first].height : 0;
+}
+
+void
+GLFramebufferReadback::finish(uint8_t* pixels, size_t bytesPerLine)
+{
+  if (m_pending == 0) {
+    return;
+  }
+  Buffer& b = m_buffers[m_first];
+
+  static const GLuint64 ONE_SECOND = 1000000000;
+  GLenum status = glClientWaitSync(b.fence, GL_SYNC_FLUSH_COMMANDS_BIT, ONE_SECOND);
+  while (status == GL_TIMEOUT_EXPIRED) {
+    status = glClientWaitSync(b.fence, 0, ONE_SECOND);
+  }
+  if (status == GL_WAIT_FAILED) {
+    LOG_ERROR << "Waiting for a framebuffer read failed";
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+  size_t rowBytes = (size_t)b.width * 4;
+  const uint8_t* src =
+    (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rowBytes * (size_t)b.height, GL_MAP_READ_BIT);
+  if (src) {
+    // GL rows are bottom up
+    for (int y = 0; y < b.height; ++y) {
+      memcpy(pixels + (size_t)y * bytesPerLine, src + (size_t)(b.height - 1 - y) * rowBytes, rowBytes);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  } else {
+    LOG_ERROR << "Could not map a framebuffer read";
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  glDeleteSync(b.fence);
+  b.fence = nullptr;
+  m_first = (m_first + 1) % bufferCount();
+  m_pending--;
+}
+
+void
+GLFramebufferReadback::discard(int keep)
+{
+  while (m_pending > std::max(keep, 0)) {
+    Buffer& b = m_buffers[m_first];
+    glDeleteSync(b.fence);
+    b.fence = nullptr;
+    m_first = (m_first + 1) % bufferCount();
+    m_pending--;
+  }
+}
+
 GLShader::GLShader(GLenum shaderType)
 {
   m_isCompiled = false;
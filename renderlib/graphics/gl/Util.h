@@ -6,6 +6,7 @@
 #include "Logging.h"
 
 #include <string>
+#include <vector>
 
 /**
  * Check OpenGL status.
@@ -121,6 +122,50 @@ private:
   int m_height;
 };
 
+// Reads frames back from framebuffers through a ring of pixel buffer objects, so that the read of one frame overlaps
+// the rendering of the next ones instead of stalling until the GPU is done.
+// Must have a current gl context whenever it is used, including destruction.
+class GLFramebufferReadback
+{
+public:
+  GLFramebufferReadback(int bufferCount = 3);
+  ~GLFramebufferReadback();
+
+  int bufferCount() const { return (int)m_buffers.size(); }
+  // reads started and not finished yet
+  int pending() const { return m_pending; }
+  // graphics memory held by the buffers
+  size_t bytes() const;
+
+  // Queue a read of the color attachment of fbo, as it will be when the commands issued so far are done, and return
+  // without waiting. When every buffer is pending, the oldest read is dropped to make room.
+  void start(GLFramebufferObject* fbo);
+  // whether the oldest pending read is done, so that finish() will not wait
+  bool ready();
+  // size of the oldest pending read
+  int width() const;
+  int height() const;
+  // Wait for the oldest pending read and copy it to pixels, top row first, with 32 bits per pixel in the byte order
+  // of QImage::Format_ARGB32. Rows start bytesPerLine apart.
+  void finish(uint8_t* pixels, size_t bytesPerLine);
+  // drop pending reads, oldest first, until only the newest keep are left
+  void discard(int keep = 0);
+
+private:
+  struct Buffer
+  {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    size_t capacity = 0;
+    int width = 0;
+    int height = 0;
+  };
+  std::vector<Buffer> m_buffers;
+  // index of the oldest pending read
+  int m_first;
+  int m_pending;
+};
+
 class GLShader
 {
 public:
@@ -1343,6 +1343,8 @@ GLPTVolumeShader::setShadingUniforms(const Scene* scene,
   check_gl("post vol textures");
   glBindTexture(GL_TEXTURE_3D, imggpu.m_VolumeGLTexture);
   check_gl("post vol textures");
+  glBindSampler(0, imggpu.m_VolumeSampler);
+  check_gl("post vol sampler");
 
   glUniform1i(m_tPreviousTexture, 1);
   glActiveTexture(GL_TEXTURE0 + 1);
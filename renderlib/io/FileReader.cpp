@@ -7,13 +7,153 @@
 #include "FileReaderZarr.h"
 #include "ImageXYZC.h"
 #include "Logging.h"
+#include "VolumeDimensions.h"
 
+#include <cfloat>
 #include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <map>
 
 std::map<std::string, std::shared_ptr<ImageXYZC>> FileReader::sPreloadedImageCache;
 
+// profile of the innermost ScopedLoadProfile on this thread
+thread_local LoadProfile* tLoadProfile = nullptr;
+
+namespace {
+Metrics::Counter&
+phaseSecondsMetric(LoadProfile::Phase phase)
+{
+  static const std::vector<std::shared_ptr<Metrics::Counter>> counters = []() {
+    std::vector<std::shared_ptr<Metrics::Counter>> c;
+    for (int p = 0; p < LoadProfile::NUM_PHASES; ++p) {
+      c.push_back(Metrics::counter("agave_load_phase_seconds_total",
+                                   "Time spent in each phase of loading volumes",
+                                   { { "phase", LoadProfile::phaseName((LoadProfile::Phase)p) } }));
+    }
+    return c;
+  }();
+  return *counters[phase];
+}
+
+Metrics::Counter&
+bytesReadMetric()
+{
+  static std::shared_ptr<Metrics::Counter> counter =
+    Metrics::counter("agave_load_bytes_read_total", "Decoded pixel bytes read from files");
+  return *counter;
+}
+
+void
+countImageCacheLookup(bool hit)
+{
+  static const char* help = "Lookups in the preloaded image cache";
+  static std::shared_ptr<Metrics::Counter> hits =
+    Metrics::counter("agave_image_cache_lookups_total", help, { { "result", "hit" } });
+  static std::shared_ptr<Metrics::Counter> misses =
+    Metrics::counter("agave_image_cache_lookups_total", help, { { "result", "miss" } });
+  (hit ? hits : misses)->add();
+}
+} // namespace
+
+const char*
+LoadProfile::phaseName(Phase phase)
+{
+  static const char* names[NUM_PHASES] = { "read", "convert", "stats" };
+  return (phase >= 0 && phase < NUM_PHASES) ? names[phase] : "";
+}
+
+ScopedLoadProfile::ScopedLoadProfile(LoadProfile& profile)
+  : m_previous(tLoadProfile)
+{
+  tLoadProfile = &profile;
+}
+
+ScopedLoadProfile::~ScopedLoadProfile()
+{
+  tLoadProfile = m_previous;
+}
+
+LoadPhaseTimer::LoadPhaseTimer(LoadProfile::Phase phase, size_t bytesRead)
+  : m_span(LoadProfile::phaseName(phase), "io")
+  , m_profile(tLoadProfile)
+  , m_phase(phase)
+  , m_bytesRead(bytesRead)
+  , m_start(std::chrono::high_resolution_clock::now())
+{
+}
+
+LoadPhaseTimer::~LoadPhaseTimer()
+{
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - m_start;
+  phaseSecondsMetric(m_phase).add(elapsed.count());
+  bytesReadMetric().add((double)m_bytesRead);
+  if (m_profile) {
+    m_profile->seconds[m_phase] += elapsed.count();
+    m_profile->bytesRead += m_bytesRead;
+  }
+}
+
+LoadTimer::LoadTimer(const char* format)
+  : m_seconds(Metrics::histogram("agave_load_seconds", "Duration of volume loads", { { "format", format } }))
+  , m_start(std::chrono::high_resolution_clock::now())
+{
+}
+
+LoadTimer::~LoadTimer()
+{
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - m_start;
+  m_seconds->observe(elapsed.count());
+}
+
+size_t
+convertChannelData(uint8_t* dest, const uint8_t* src, const VolumeDimensions& dims)
+{
+  LoadPhaseTimer timer(LoadProfile::CONVERT);
+  // how many pixels in this channel:
+  size_t numPixels = dims.sizeX * dims.sizeY * dims.sizeZ;
+  int srcBitsPerPixel = dims.bitsPerPixel;
+
+  // dest bits per pixel is IN_MEMORY_BPP which is currently 16, or 2 bytes
+  if (ImageXYZC::IN_MEMORY_BPP == srcBitsPerPixel) {
+    memcpy(dest, src, numPixels * (srcBitsPerPixel / 8));
+    return 1;
+  } else if (srcBitsPerPixel == 8) {
+    uint16_t* dataptr16 = reinterpret_cast<uint16_t*>(dest);
+    for (size_t b = 0; b < numPixels; ++b) {
+      *dataptr16 = (uint16_t)src[b];
+      dataptr16++;
+    }
+    return 1;
+  } else if (srcBitsPerPixel == 32) {
+    // assumes 32-bit floating point (not int or uint)
+    uint16_t* dataptr16 = reinterpret_cast<uint16_t*>(dest);
+    const float* src32 = reinterpret_cast<const float*>(src);
+    // compute min and max; and then rescale values to fill dynamic range.
+    float lowest = FLT_MAX;
+    float highest = -FLT_MAX;
+    float f;
+    for (size_t b = 0; b < numPixels; ++b) {
+      f = src32[b];
+      if (f < lowest) {
+        lowest = f;
+      }
+      if (f > highest) {
+        highest = f;
+      }
+    }
+    for (size_t b = 0; b < numPixels; ++b) {
+      *dataptr16 = (uint16_t)((src32[b] - lowest) / (highest - lowest) * 65535.0);
+      dataptr16++;
+    }
+    return 1;
+  } else {
+    LOG_ERROR << "Unexpected pixel size " << srcBitsPerPixel << " bits";
+    return 0;
+  }
+  return 0;
+}
+
 // return file extension as lowercase
 std::string
 getExtension(const std::string filepath)
@@ -63,6 +203,7 @@ FileReader::loadAndCache(const LoadSpec& loadSpec)
 {
   // check cache first of all.
   auto cached = sPreloadedImageCache.find(loadSpec.filepath);
+  countImageCacheLookup(cached != sPreloadedImageCache.end());
   if (cached != sPreloadedImageCache.end()) {
     return cached->second;
   }
@@ -82,6 +223,8 @@ FileReader::loadAndCache(const LoadSpec& loadSpec)
   image = reader->loadFromFile(loadSpec);
 
   if (image) {
+    // preloaded images are kept for good, whether or not a session shows them
+    image->setMemoryAccounting(MemoryAccounting::Category::Caches, "dataset:" + filepath);
     sPreloadedImageCache[filepath] = image;
   }
 
@@ -100,6 +243,7 @@ FileReader::loadFromArray_4D(uint8_t* dataArray,
 {
   // check cache first of all.
   auto cached = sPreloadedImageCache.find(name);
+  countImageCacheLookup(cached != sPreloadedImageCache.end());
   if (cached != sPreloadedImageCache.end()) {
     return cached->second;
   }
@@ -126,6 +270,7 @@ FileReader::loadFromArray_4D(uint8_t* dataArray,
 
   auto startTime = std::chrono::high_resolution_clock::now();
 
+  MemoryAccounting::ScopedOwner memoryOwner("dataset:" + name);
   // note that im will take ownership of dataArray
   ImageXYZC* im = new ImageXYZC(
     sizeX, sizeY, sizeZ, sizeC, uint32_t(bpp), dataArray, physicalSizeX, physicalSizeY, physicalSizeZ, spatialUnits);
@@ -138,6 +283,7 @@ FileReader::loadFromArray_4D(uint8_t* dataArray,
 
   std::shared_ptr<ImageXYZC> sharedImage(im);
   if (addToCache) {
+    sharedImage->setMemoryAccounting(MemoryAccounting::Category::Caches, "dataset:" + name);
     sPreloadedImageCache[name] = sharedImage;
   }
   return sharedImage;
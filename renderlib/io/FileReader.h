@@ -1,7 +1,11 @@
 #pragma once
 
 #include "IFileReader.h"
+#include "MemoryAccounting.h"
+#include "Metrics.h"
+#include "Tracing.h"
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <string>
@@ -11,6 +15,72 @@ class ImageXYZC;
 struct VolumeDimensions;
 struct MultiscaleDims;
 
+// Convert one channel of tightly packed pixels of dims.bitsPerPixel (8, 16, or 32-bit float) to IN_MEMORY_BPP.
+// 32-bit float data is rescaled from its min and max to the full 16-bit range.
+// returns 1 for successful conversion, 0 on failure (e.g. unacceptable bitsPerPixel)
+size_t
+convertChannelData(uint8_t* dest, const uint8_t* src, const VolumeDimensions& dims);
+
+// Where the time of a load goes, accumulated over every load on the current thread while a ScopedLoadProfile is alive.
+struct LoadProfile
+{
+  enum Phase
+  {
+    // file IO and decompression; libtiff and tensorstore do both in one call, so they are timed together
+    READ = 0,
+    // conversion of raw pixels to IN_MEMORY_BPP
+    CONVERT,
+    // ImageXYZC construction: channel min/max and histograms
+    STATS,
+    NUM_PHASES
+  };
+  static const char* phaseName(Phase phase);
+
+  double seconds[NUM_PHASES] = {};
+  // raw (decoded) pixel bytes delivered by READ
+  size_t bytesRead = 0;
+};
+
+// Loads on the current thread add their phase timings to `profile` while this is alive.
+class ScopedLoadProfile
+{
+public:
+  explicit ScopedLoadProfile(LoadProfile& profile);
+  ~ScopedLoadProfile();
+
+private:
+  LoadProfile* m_previous;
+};
+
+// Adds the time until it goes out of scope to one phase of the current thread's LoadProfile, if there is one,
+// and to the process wide agave_load_phase_seconds_total metric, and traces it as a span named after the phase.
+class LoadPhaseTimer
+{
+public:
+  explicit LoadPhaseTimer(LoadProfile::Phase phase, size_t bytesRead = 0);
+  ~LoadPhaseTimer();
+
+private:
+  TraceSpan m_span;
+  LoadProfile* m_profile;
+  LoadProfile::Phase m_phase;
+  size_t m_bytesRead;
+  std::chrono::high_resolution_clock::time_point m_start;
+};
+
+// Observes the time until it goes out of scope in the agave_load_seconds metric, labelled with the file format.
+// One per loadFromFile of each reader.
+class LoadTimer
+{
+public:
+  explicit LoadTimer(const char* format);
+  ~LoadTimer();
+
+private:
+  std::shared_ptr<Metrics::Histogram> m_seconds;
+  std::chrono::high_resolution_clock::time_point m_start;
+};
+
 class FileReader
 {
 public:
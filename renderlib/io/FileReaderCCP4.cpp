@@ -1,6 +1,7 @@
 #include "FileReaderCCP4.h"
 
 #include "BoundingBox.h"
+#include "FileReader.h"
 #include "ImageXYZC.h"
 #include "Logging.h"
 #include "VolumeDimensions.h"
@@ -169,6 +170,7 @@ readCCP4Dimensions(const std::string filepath, VolumeDimensions& dims, uint32_t
     case 6:
       dims.bitsPerPixel = 16;
       dims.sampleFormat = 1;
+      break;
     case 12:
       dims.bitsPerPixel = 16;
       dims.sampleFormat = 3;
@@ -257,57 +259,6 @@ copyDirect(uint8_t* dest, const uint8_t* src, size_t numBytes, int srcBitsPerPix
   return numBytes;
 }
 
-// convert pixels
-// this assumes tight packing of pixels in both buf(source) and dataptr(dest)
-// assumes dest is of format IN_MEMORY_BPP
-// return 1 for successful conversion, 0 on failure (e.g. unacceptable srcBitsPerPixel)
-static size_t
-convertChannelData(uint8_t* dest, const uint8_t* src, const VolumeDimensions& dims)
-{
-  // how many pixels in this channel:
-  size_t numPixels = dims.sizeX * dims.sizeY * dims.sizeZ;
-  int srcBitsPerPixel = dims.bitsPerPixel;
-
-  // dest bits per pixel is IN_MEMORY_BPP which is currently 16, or 2 bytes
-  if (ImageXYZC::IN_MEMORY_BPP == srcBitsPerPixel) {
-    memcpy(dest, src, numPixels * (srcBitsPerPixel / 8));
-    return 1;
-  } else if (srcBitsPerPixel == 8) {
-    uint16_t* dataptr16 = reinterpret_cast<uint16_t*>(dest);
-    for (size_t b = 0; b < numPixels; ++b) {
-      *dataptr16 = (uint16_t)src[b];
-      dataptr16++;
-    }
-    return 1;
-  } else if (srcBitsPerPixel == 32) {
-    // assumes 32-bit floating point (not int or uint)
-    uint16_t* dataptr16 = reinterpret_cast<uint16_t*>(dest);
-    const float* src32 = reinterpret_cast<const float*>(src);
-    // compute min and max; and then rescale values to fill dynamic range.
-    float lowest = FLT_MAX;
-    float highest = -FLT_MAX;
-    float f;
-    for (size_t b = 0; b < numPixels; ++b) {
-      f = src32[b];
-      if (f < lowest) {
-        lowest = f;
-      }
-      if (f > highest) {
-        highest = f;
-      }
-    }
-    for (size_t b = 0; b < numPixels; ++b) {
-      *dataptr16 = (uint16_t)((src32[b] - lowest) / (highest - lowest) * 65535.0);
-      dataptr16++;
-    }
-    return 1;
-  } else {
-    LOG_ERROR << "Unexpected tiff pixel size " << srcBitsPerPixel << " bits";
-    return 0;
-  }
-  return 0;
-}
-
 // DANGER: assumes dataPtr has enough space allocated!!!!
 bool
 readCCP4Plane(std::ifstream& myFile, size_t offset, size_t numBytes, const VolumeDimensions& dims, uint8_t* dataPtr)
@@ -335,6 +286,9 @@ FileReaderCCP4::loadDimensions(const std::string& filepath, uint32_t scene)
 std::shared_ptr<ImageXYZC>
 FileReaderCCP4::loadFromFile(const LoadSpec& loadSpec)
 {
+  TraceSpan span("FileReaderCCP4::loadFromFile", "io");
+  LoadTimer loadTimer("ccp4");
+  MemoryAccounting::ScopedOwner memoryOwner("dataset:" + loadSpec.filepath);
   std::string filepath = loadSpec.filepath;
   uint32_t scene = loadSpec.scene;
   uint32_t time = loadSpec.time;
@@ -391,6 +345,7 @@ FileReaderCCP4::loadFromFile(const LoadSpec& loadSpec)
 
     // read entire channel into its native size
     for (uint32_t slice = 0; slice < dims.sizeZ; ++slice) {
+      LoadPhaseTimer readTimer(LoadProfile::READ, rawPlanesize);
       uint32_t planeIndex = dims.getPlaneIndex(slice, channelToLoad, time);
       destptr = channelRawMem + slice * rawPlanesize;
       if (!readCCP4Plane(myFile, dataOffset + rawPlanesize * planeIndex, rawPlanesize, dims, destptr)) {
@@ -412,16 +367,20 @@ FileReaderCCP4::loadFromFile(const LoadSpec& loadSpec)
 
   // TODO: convert data to uint16_t pixels if not already.
   // we can release the smartPtr because ImageXYZC will now own the raw data memory
-  ImageXYZC* im = new ImageXYZC(dims.sizeX,
-                                dims.sizeY,
-                                dims.sizeZ,
-                                nch,
-                                ImageXYZC::IN_MEMORY_BPP, // dims.bitsPerPixel,
-                                smartPtr.release(),
-                                dims.physicalSizeX,
-                                dims.physicalSizeY,
-                                dims.physicalSizeZ,
-                                dims.spatialUnits);
+  ImageXYZC* im = nullptr;
+  {
+    LoadPhaseTimer statsTimer(LoadProfile::STATS);
+    im = new ImageXYZC(dims.sizeX,
+                       dims.sizeY,
+                       dims.sizeZ,
+                       nch,
+                       ImageXYZC::IN_MEMORY_BPP, // dims.bitsPerPixel,
+                       smartPtr.release(),
+                       dims.physicalSizeX,
+                       dims.physicalSizeY,
+                       dims.physicalSizeZ,
+                       dims.spatialUnits);
+  }
 
   std::vector<std::string> channelNames = dims.getChannelNames(loadSpec.channels);
   im->setChannelNames(channelNames);
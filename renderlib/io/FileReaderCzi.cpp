@@ -1,6 +1,7 @@
 #include "FileReaderCzi.h"
 
 #include "BoundingBox.h"
+#include "FileReader.h"
 #include "ImageXYZC.h"
 #include "Logging.h"
 #include "VolumeDimensions.h"
@@ -296,6 +297,9 @@ FileReaderCzi::loadDimensions(const std::string& filepath, uint32_t scene)
 std::shared_ptr<ImageXYZC>
 FileReaderCzi::loadFromFile(const LoadSpec& loadSpec)
 {
+  TraceSpan span("FileReaderCzi::loadFromFile", "io");
+  LoadTimer loadTimer("czi");
+  MemoryAccounting::ScopedOwner memoryOwner("dataset:" + loadSpec.filepath);
   std::string filepath = loadSpec.filepath;
   uint32_t scene = loadSpec.scene;
   uint32_t time = loadSpec.time;
@@ -381,6 +385,7 @@ FileReaderCzi::loadFromFile(const LoadSpec& loadSpec)
         // since scene tiles can not overlap, passing the scene bounding box in to readCziPlane is enough produce the
         // scene, and I don't need to add Scene to the planeCoord.
 
+        LoadPhaseTimer readTimer(LoadProfile::READ, planesize);
         if (!readCziPlane(cziReader, planeRect, planeCoord, dims, &o, destptr)) {
           return emptyimage;
         }
@@ -395,16 +400,20 @@ FileReaderCzi::loadFromFile(const LoadSpec& loadSpec)
 
     // TODO: convert data to uint16_t pixels if not already.
     // we can release the smartPtr because ImageXYZC will now own the raw data memory
-    ImageXYZC* im = new ImageXYZC(dims.sizeX,
-                                  dims.sizeY,
-                                  dims.sizeZ,
-                                  nch,
-                                  ImageXYZC::IN_MEMORY_BPP, // dims.bitsPerPixel,
-                                  smartPtr.release(),
-                                  dims.physicalSizeX,
-                                  dims.physicalSizeY,
-                                  dims.physicalSizeZ,
-                                  dims.spatialUnits);
+    ImageXYZC* im = nullptr;
+    {
+      LoadPhaseTimer statsTimer(LoadProfile::STATS);
+      im = new ImageXYZC(dims.sizeX,
+                         dims.sizeY,
+                         dims.sizeZ,
+                         nch,
+                         ImageXYZC::IN_MEMORY_BPP, // dims.bitsPerPixel,
+                         smartPtr.release(),
+                         dims.physicalSizeX,
+                         dims.physicalSizeY,
+                         dims.physicalSizeZ,
+                         dims.spatialUnits);
+    }
 
     std::vector<std::string> channelNames = dims.getChannelNames(loadSpec.channels);
     im->setChannelNames(channelNames);
@@ -1,6 +1,7 @@
 #include "FileReaderZarr.h"
 
 #include "BoundingBox.h"
+#include "FileReader.h"
 #include "ImageXYZC.h"
 #include "Logging.h"
 #include "StringUtil.h"
@@ -162,57 +163,6 @@ copyDirect(uint8_t* dest, const uint8_t* src, size_t numBytes, int srcBitsPerPix
   return numBytes;
 }
 
-// convert pixels
-// this assumes tight packing of pixels in both buf(source) and dataptr(dest)
-// assumes dest is of format IN_MEMORY_BPP
-// return 1 for successful conversion, 0 on failure (e.g. unacceptable srcBitsPerPixel)
-static size_t
-convertChannelData(uint8_t* dest, const uint8_t* src, const VolumeDimensions& dims)
-{
-  // how many pixels in this channel:
-  size_t numPixels = dims.sizeX * dims.sizeY * dims.sizeZ;
-  int srcBitsPerPixel = dims.bitsPerPixel;
-
-  // dest bits per pixel is IN_MEMORY_BPP which is currently 16, or 2 bytes
-  if (ImageXYZC::IN_MEMORY_BPP == srcBitsPerPixel) {
-    memcpy(dest, src, numPixels * (srcBitsPerPixel / 8));
-    return 1;
-  } else if (srcBitsPerPixel == 8) {
-    uint16_t* dataptr16 = reinterpret_cast<uint16_t*>(dest);
-    for (size_t b = 0; b < numPixels; ++b) {
-      *dataptr16 = (uint16_t)src[b];
-      dataptr16++;
-    }
-    return 1;
-  } else if (srcBitsPerPixel == 32) {
-    // assumes 32-bit floating point (not int or uint)
-    uint16_t* dataptr16 = reinterpret_cast<uint16_t*>(dest);
-    const float* src32 = reinterpret_cast<const float*>(src);
-    // compute min and max; and then rescale values to fill dynamic range.
-    float lowest = FLT_MAX;
-    float highest = -FLT_MAX;
-    float f;
-    for (size_t b = 0; b < numPixels; ++b) {
-      f = src32[b];
-      if (f < lowest) {
-        lowest = f;
-      }
-      if (f > highest) {
-        highest = f;
-      }
-    }
-    for (size_t b = 0; b < numPixels; ++b) {
-      *dataptr16 = (uint16_t)((src32[b] - lowest) / (highest - lowest) * 65535.0);
-      dataptr16++;
-    }
-    return 1;
-  } else {
-    LOG_ERROR << "Unexpected tiff pixel size " << srcBitsPerPixel << " bits";
-    return 0;
-  }
-  return 0;
-}
-
 std::string
 getSpatialUnit(nlohmann::json axes)
 {
@@ -399,6 +349,9 @@ FileReaderZarr::loadDimensions(const std::string& filepath, uint32_t scene)
 std::shared_ptr<ImageXYZC>
 FileReaderZarr::loadFromFile(const LoadSpec& loadSpec)
 {
+  TraceSpan span("FileReaderZarr::loadFromFile", "io");
+  LoadTimer loadTimer("zarr");
+  MemoryAccounting::ScopedOwner memoryOwner("dataset:" + loadSpec.filepath);
   auto tStart = std::chrono::high_resolution_clock::now();
   // load channels
   std::shared_ptr<ImageXYZC> emptyimage;
@@ -531,22 +484,25 @@ FileReaderZarr::loadFromFile(const LoadSpec& loadSpec)
     tsdim++;
 
     tensorstore::Index shapeToLoad[5] = { 1, 1, dims.sizeZ, dims.sizeY, dims.sizeX };
-    if (levelDims.dtype == "uint8") {
-      auto arr = tensorstore::Array(reinterpret_cast<uint8_t*>(destptr), shapeToLoad, tensorstore::c_order);
-      tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
-    } else if (levelDims.dtype == "int32") {
-      auto arr = tensorstore::Array(reinterpret_cast<int32_t*>(destptr), shapeToLoad, tensorstore::c_order);
-      tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
-    } else if (levelDims.dtype == "uint16") {
-      auto arr = tensorstore::Array(reinterpret_cast<uint16_t*>(destptr), shapeToLoad, tensorstore::c_order);
-      tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
-    } else if (levelDims.dtype == "float32") {
-      auto arr = tensorstore::Array(reinterpret_cast<float*>(destptr), shapeToLoad, tensorstore::c_order);
-      tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
-    } else {
-      LOG_ERROR << "Unrecognized format (" << levelDims.dtype
-                << "). Please let us know if you need support for this format. Can not load data.";
-      return emptyimage;
+    {
+      LoadPhaseTimer readTimer(LoadProfile::READ, dims.sizeZ * rawPlanesize);
+      if (levelDims.dtype == "uint8") {
+        auto arr = tensorstore::Array(reinterpret_cast<uint8_t*>(destptr), shapeToLoad, tensorstore::c_order);
+        tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
+      } else if (levelDims.dtype == "int32") {
+        auto arr = tensorstore::Array(reinterpret_cast<int32_t*>(destptr), shapeToLoad, tensorstore::c_order);
+        tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
+      } else if (levelDims.dtype == "uint16") {
+        auto arr = tensorstore::Array(reinterpret_cast<uint16_t*>(destptr), shapeToLoad, tensorstore::c_order);
+        tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
+      } else if (levelDims.dtype == "float32") {
+        auto arr = tensorstore::Array(reinterpret_cast<float*>(destptr), shapeToLoad, tensorstore::c_order);
+        tensorstore::Read(m_store | transform, tensorstore::UnownedToShared(arr)).value();
+      } else {
+        LOG_ERROR << "Unrecognized format (" << levelDims.dtype
+                  << "). Please let us know if you need support for this format. Can not load data.";
+        return emptyimage;
+      }
     }
 
     // convert to our internal format (IN_MEMORY_BPP)
@@ -563,16 +519,20 @@ FileReaderZarr::loadFromFile(const LoadSpec& loadSpec)
 
   // TODO: convert data to uint16_t pixels if not already.
   // we can release the smartPtr because ImageXYZC will now own the raw data memory
-  ImageXYZC* im = new ImageXYZC(dims.sizeX,
-                                dims.sizeY,
-                                dims.sizeZ,
-                                nch,
-                                ImageXYZC::IN_MEMORY_BPP, // dims.bitsPerPixel,
-                                smartPtr.release(),
-                                dims.physicalSizeX,
-                                dims.physicalSizeY,
-                                dims.physicalSizeZ,
-                                dims.spatialUnits);
+  ImageXYZC* im = nullptr;
+  {
+    LoadPhaseTimer statsTimer(LoadProfile::STATS);
+    im = new ImageXYZC(dims.sizeX,
+                       dims.sizeY,
+                       dims.sizeZ,
+                       nch,
+                       ImageXYZC::IN_MEMORY_BPP, // dims.bitsPerPixel,
+                       smartPtr.release(),
+                       dims.physicalSizeX,
+                       dims.physicalSizeY,
+                       dims.physicalSizeZ,
+                       dims.spatialUnits);
+  }
 
   std::vector<std::string> channelNames = dims.getChannelNames(loadSpec.channels);
   im->setChannelNames(channelNames);
@@ -9,7 +9,9 @@
 #include <QGuiApplication>
 #include <QOpenGLDebugLogger>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #if HAS_EGL
 #include <EGL/egl.h>
@@ -37,7 +39,10 @@ static bool renderLibHeadless = false;
 static std::string s_assetPath = "";
 
 #if HAS_EGL
+// of the first device; others are only rendered on by contexts placed on them
 static EGLDisplay eglDpy = NULL;
+// one per device rendered on
+static std::vector<EGLDisplay> eglDisplays;
 #endif
 
 static QOpenGLContext* dummyContext = nullptr;
@@ -46,6 +51,11 @@ static QOffscreenSurface* dummySurface = nullptr;
 static QOpenGLDebugLogger* logger = nullptr;
 
 std::map<std::shared_ptr<ImageXYZC>, std::shared_ptr<ImageGpu>> renderlib::sGpuImageCache;
+std::map<renderlib::SharedVolumeKey, renderlib::SharedVolume> renderlib::sSharedGpuVolumes;
+std::mutex renderlib::sSharedGpuVolumesMutex;
+
+// of the RendererGLContext current on this thread
+static thread_local const void* tCurrentShareGroup = nullptr;
 
 static const struct
 {
@@ -121,8 +131,10 @@ getEGLDefaultDisplay()
   return eglDisplay;
 }
 
-EGLDisplay
-initEGLDisplay(int selectedGpu)
+// the displays of the devices in gpus, by index into the devices found; renderlib::ALL_GPUS picks all of them.
+// Without devices to pick from, the default display, which may render in software.
+std::vector<EGLDisplay>
+initEGLDisplays(const std::vector<int>& gpus)
 {
   PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
   checkEGLError("Failed to get EGLEXT: eglQueryDevicesEXT");
@@ -137,7 +149,7 @@ initEGLDisplay(int selectedGpu)
   checkEGLError("Failed to get EGLEXT: eglQueryDeviceStringEXT");
 
   if (!eglQueryDevicesEXT || !eglGetPlatformDisplayEXT || !eglQueryDeviceAttribEXT || !eglQueryDeviceStringEXT) {
-    return getEGLDefaultDisplay();
+    return { getEGLDefaultDisplay() };
   }
 
   EGLint numberDevices;
@@ -150,8 +162,8 @@ initEGLDisplay(int selectedGpu)
 
   LOG_INFO << numberDevices << " devices found";
   if (numberDevices > 0) {
-    EGLDeviceEXT* eglDevs = new EGLDeviceEXT[numberDevices];
-    ok = eglQueryDevicesEXT(numberDevices, eglDevs, &numberDevices);
+    std::vector<EGLDeviceEXT> eglDevs(numberDevices);
+    ok = eglQueryDevicesEXT(numberDevices, eglDevs.data(), &numberDevices);
     if (!ok) {
       LOG_ERROR << "Failed to get devices. Bad parameter suspected";
     }
@@ -180,22 +192,46 @@ initEGLDisplay(int selectedGpu)
       }
 #endif
     }
-    if (selectedGpu >= numberDevices || selectedGpu < 0) {
-      LOG_WARNING << "Invalid GPU " << selectedGpu << " requested. Using default gpu.";
-      return getEGLDefaultDisplay();
+    std::vector<int> selected;
+    for (int gpu : gpus) {
+      if (gpu == renderlib::ALL_GPUS) {
+        for (int i = 0; i < numberDevices; ++i) {
+          selected.push_back(i);
+        }
+      } else if (gpu >= numberDevices || gpu < 0) {
+        LOG_WARNING << "Invalid GPU " << gpu << " requested.";
+      } else {
+        selected.push_back(gpu);
+      }
+    }
+    std::vector<EGLDisplay> displays;
+    std::vector<bool> taken(numberDevices, false);
+    for (int gpu : selected) {
+      if (taken[gpu]) {
+        continue;
+      }
+      taken[gpu] = true;
+      // select device by index
+      EGLDisplay eglDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[gpu], 0);
+      checkEGLError("Error getting Platform Display: eglGetPlatformDisplayEXT");
+      if (eglDisplay != EGL_NO_DISPLAY) {
+        LOG_INFO << "Rendering on device " << gpu;
+        displays.push_back(eglDisplay);
+      }
+    }
+    if (displays.empty()) {
+      LOG_WARNING << "No valid GPU requested. Using default gpu.";
+      return { getEGLDefaultDisplay() };
     }
-    // select device by index
-    EGLDisplay eglDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[selectedGpu], 0);
-    checkEGLError("Error getting Platform Display: eglGetPlatformDisplayEXT");
-    return eglDisplay;
+    return displays;
   } else {
-    return getEGLDefaultDisplay();
+    return { getEGLDefaultDisplay() };
   }
 }
 #endif
 
 int
-renderlib::initialize(std::string assetPath, bool headless, bool listDevices, int selectedGpu)
+renderlib::initialize(std::string assetPath, bool headless, bool listDevices, const std::vector<int>& gpus)
 {
   if (renderLibInitialized) {
     return 1;
@@ -227,7 +263,7 @@ renderlib::initialize(std::string assetPath, bool headless, bool listDevices, in
     EGLint lastError = EGL_SUCCESS;
 
     // 1. Initialize EGL
-    eglDpy = initEGLDisplay(selectedGpu);
+    std::vector<EGLDisplay> displays = initEGLDisplays(gpus);
 
     if (listDevices) {
       return 0;
@@ -235,13 +271,21 @@ renderlib::initialize(std::string assetPath, bool headless, bool listDevices, in
 
     EGLint major, minor;
 
-    EGLBoolean init_ok = eglInitialize(eglDpy, &major, &minor);
-    if (init_ok == EGL_FALSE) {
-      LOG_ERROR << "renderlib::initialize, eglInitialize failed";
-    }
-    if ((lastError = eglGetError()) != EGL_SUCCESS) {
-      LOG_ERROR << "eglGetError " << lastError;
+    eglDisplays.clear();
+    for (EGLDisplay display : displays) {
+      EGLBoolean init_ok = eglInitialize(display, &major, &minor);
+      if (init_ok == EGL_FALSE) {
+        LOG_ERROR << "renderlib::initialize, eglInitialize failed";
+      }
+      if ((lastError = eglGetError()) != EGL_SUCCESS) {
+        LOG_ERROR << "eglGetError " << lastError;
+      }
+      // a device that fails is left out, unless it is the only one
+      if (init_ok == EGL_TRUE || (eglDisplays.empty() && display == displays.back())) {
+        eglDisplays.push_back(display);
+      }
     }
+    eglDpy = eglDisplays[0];
     // 2. Bind the API
     EGLBoolean bindapi_ok = eglBindAPI(EGL_OPENGL_API);
     if (bindapi_ok == EGL_FALSE) {
@@ -332,12 +376,26 @@ renderlib::cleanup()
 
   if (renderLibHeadless) {
 #if HAS_EGL
-    eglTerminate(eglDpy);
+    for (EGLDisplay display : eglDisplays) {
+      eglTerminate(display);
+    }
+    eglDisplays.clear();
 #endif
   }
   renderLibInitialized = false;
 }
 
+int
+renderlib::deviceCount()
+{
+#if HAS_EGL
+  if (renderLibHeadless && !eglDisplays.empty()) {
+    return (int)eglDisplays.size();
+  }
+#endif
+  return 1;
+}
+
 std::shared_ptr<ImageGpu>
 renderlib::imageAllocGPU(std::shared_ptr<ImageXYZC> image, bool do_cache)
 {
@@ -369,9 +427,108 @@ renderlib::imageDeallocGPU(std::shared_ptr<ImageXYZC> image)
   }
 }
 
-HeadlessGLContext::HeadlessGLContext()
+const void*
+renderlib::currentShareGroup()
+{
+  return tCurrentShareGroup;
+}
+
+std::shared_ptr<ImageGpu>
+renderlib::volumeAllocGPU(std::shared_ptr<ImageXYZC> image, uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3)
+{
+  const void* shareGroup = currentShareGroup();
+  if (!shareGroup) {
+    auto volume = std::make_shared<ImageGpu>();
+    volume->allocGpuVolume(image.get(), c0, c1, c2, c3);
+    return volume;
+  }
+
+  // held while uploading, so that renderers asking for the same volume wait for it instead of uploading it again
+  std::lock_guard<std::mutex> lock(sSharedGpuVolumesMutex);
+  for (auto it = sSharedGpuVolumes.begin(); it != sSharedGpuVolumes.end();) {
+    if (it->second.image.expired() || it->second.volume.expired()) {
+      it = sSharedGpuVolumes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  SharedVolumeKey key(image.get(), shareGroup, c0, c1, c2, c3);
+  auto found = sSharedGpuVolumes.find(key);
+  if (found != sSharedGpuVolumes.end()) {
+    std::shared_ptr<ImageGpu> volume = found->second.volume.lock();
+    if (volume && found->second.image.lock() == image) {
+      return volume;
+    }
+  }
+
+  auto volume = std::make_shared<ImageGpu>();
+  volume->allocGpuVolume(image.get(), c0, c1, c2, c3);
+  // the upload has to be complete before another context samples it
+  glFinish();
+  sSharedGpuVolumes[key] = SharedVolume{ image, volume };
+  return volume;
+}
+
+bool
+renderlib::volumeUpdateGPU(const std::shared_ptr<ImageGpu>& volume,
+                           std::shared_ptr<ImageXYZC> image,
+                           uint32_t c0,
+                           uint32_t c1,
+                           uint32_t c2,
+                           uint32_t c3)
+{
+  if (!volume) {
+    return false;
+  }
+  const void* shareGroup = currentShareGroup();
+  SharedVolumeKey key(image.get(), shareGroup, c0, c1, c2, c3);
+  // held throughout, so that no renderer borrows the texture while its channels change
+  std::unique_lock<std::mutex> lock(sSharedGpuVolumesMutex, std::defer_lock);
+  if (shareGroup) {
+    lock.lock();
+    // only borrowers hold strong references
+    if (volume.use_count() > 1) {
+      return false;
+    }
+    auto found = sSharedGpuVolumes.find(key);
+    if (found != sSharedGpuVolumes.end() && !found->second.volume.expired()) {
+      return false;
+    }
+    // the texture no longer holds the channels it was shared under
+    for (auto it = sSharedGpuVolumes.begin(); it != sSharedGpuVolumes.end();) {
+      if (it->second.volume.expired() || it->second.volume.lock() == volume) {
+        it = sSharedGpuVolumes.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  uint32_t numChannels = image->sizeC();
+  volume->updateVolumeData4x16(image.get(),
+                               std::min(c0, numChannels - 1),
+                               std::min(c1, numChannels - 1),
+                               std::min(c2, numChannels - 1),
+                               std::min(c3, numChannels - 1));
+  if (shareGroup) {
+    // the upload has to be complete before another context samples it
+    glFinish();
+    sSharedGpuVolumes[key] = SharedVolume{ image, volume };
+  }
+  return true;
+}
+
+HeadlessGLContext::HeadlessGLContext(HeadlessGLContext* shareWith, int device)
+  : m_shareGroup(shareWith ? shareWith->m_shareGroup : this)
 {
 #if HAS_EGL
+  if (shareWith) {
+    m_eglDpy = shareWith->m_eglDpy;
+  } else {
+    m_eglDpy = (device > 0 && device < (int)eglDisplays.size()) ? eglDisplays[device] : eglDpy;
+  }
+
   EGLint lastError = EGL_SUCCESS;
 
   // Bind the API
@@ -404,7 +561,7 @@ HeadlessGLContext::HeadlessGLContext()
                                           EGL_RENDERABLE_TYPE,
                                           EGL_OPENGL_BIT,
                                           EGL_NONE };
-  EGLBoolean chooseConfig_ok = eglChooseConfig(eglDpy, configAttribs, &eglCfg, 1, &numConfigs);
+  EGLBoolean chooseConfig_ok = eglChooseConfig(m_eglDpy, configAttribs, &eglCfg, 1, &numConfigs);
   if (chooseConfig_ok == EGL_FALSE) {
     LOG_ERROR << "renderlib::initialize, eglChooseConfig failed";
   }
@@ -416,7 +573,8 @@ HeadlessGLContext::HeadlessGLContext()
   static const EGLint contextAttribs[] = {
     EGL_CONTEXT_MAJOR_VERSION, AICS_GL_VERSION.major, EGL_CONTEXT_MINOR_VERSION, AICS_GL_VERSION.minor, EGL_NONE
   };
-  EGLContext eglCtx = eglCreateContext(eglDpy, eglCfg, EGL_NO_CONTEXT, contextAttribs);
+  EGLContext eglCtx =
+    eglCreateContext(m_eglDpy, eglCfg, shareWith ? shareWith->m_eglCtx : EGL_NO_CONTEXT, contextAttribs);
   if (eglCtx == EGL_NO_CONTEXT) {
     LOG_ERROR << "renderlib::initialize, eglCreateContext failed";
   } else {
@@ -433,7 +591,7 @@ HeadlessGLContext::HeadlessGLContext()
 HeadlessGLContext::~HeadlessGLContext()
 {
 #if HAS_EGL
-  eglDestroyContext(eglDpy, m_eglCtx);
+  eglDestroyContext(m_eglDpy, m_eglCtx);
 #endif
 }
 
@@ -441,7 +599,7 @@ void
 HeadlessGLContext::makeCurrent()
 {
 #if HAS_EGL
-  eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, m_eglCtx);
+  eglMakeCurrent(m_eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, m_eglCtx);
 #endif
 }
 
@@ -449,7 +607,7 @@ void
 HeadlessGLContext::doneCurrent()
 {
 #if HAS_EGL
-  eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglMakeCurrent(m_eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 #endif
 }
 
@@ -515,21 +673,28 @@ RendererGLContext::initQOpenGLContext()
 // gui linux: always use QOpenGLContext
 // else: use QOpenGLContext
 void
-RendererGLContext::init()
+RendererGLContext::init(RendererGLContext* shareWith, int device)
 {
   if (renderLibHeadless && HAS_EGL) {
-    this->m_eglContext = new HeadlessGLContext();
-    this->m_eglContext->makeCurrent();
+    this->m_eglContext = new HeadlessGLContext(shareWith ? shareWith->m_eglContext : nullptr, device);
+    this->makeCurrent();
   } else {
     initQOpenGLContext();
   }
 }
 
+bool
+RendererGLContext::canShare()
+{
+  return renderLibHeadless && HAS_EGL;
+}
+
 void
 RendererGLContext::makeCurrent()
 {
   if (renderLibHeadless && HAS_EGL) {
     this->m_eglContext->makeCurrent();
+    tCurrentShareGroup = this->m_eglContext->shareGroup();
   } else {
     this->m_glContext->makeCurrent(this->m_surface);
   }
@@ -542,6 +707,7 @@ RendererGLContext::doneCurrent()
     m_glContext->doneCurrent();
   if (m_eglContext)
     this->m_eglContext->doneCurrent();
+  tCurrentShareGroup = nullptr;
 }
 
 IRenderWindow*
@@ -6,9 +6,13 @@
 #include <QOpenGLContext>
 #include <QSurfaceFormat>
 
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #if defined(__APPLE__) || defined(_WIN32)
 #define HAS_EGL false
@@ -22,16 +26,27 @@ class IRenderWindow;
 class RenderSettings;
 
 typedef void* EGLContext; // Forward declaration from EGL.h.
+typedef void* EGLDisplay; // Forward declaration from EGL.h.
 
 class renderlib
 {
 public:
-  static int initialize(std::string assetPath, bool headless = false, bool listDevices = false, int selectedGpu = 0);
+  // in gpus, for every EGL device
+  static const int ALL_GPUS = -1;
+  // headless: render on the EGL devices in gpus, by index into the list logged with listDevices. The first one is
+  // the default for contexts; without any valid ones, or without EGL devices at all, the default display is used.
+  static int initialize(std::string assetPath,
+                        bool headless = false,
+                        bool listDevices = false,
+                        const std::vector<int>& gpus = { 0 });
   static void clearGpuVolumeCache();
   static void cleanup();
 
   static std::string assetPath();
 
+  // the devices contexts can be created on (see RendererGLContext::init); 1 unless headless on several GPUs
+  static int deviceCount();
+
   // usage of this cache:
   // websocketserver:
   //   preloaded images will be cached at preload time and never deallocated
@@ -50,6 +65,27 @@ public:
   static std::shared_ptr<ImageGpu> imageAllocGPU(std::shared_ptr<ImageXYZC> image, bool do_cache = true);
   static void imageDeallocGPU(std::shared_ptr<ImageXYZC> image);
 
+  // The volume texture of channels c0..c3 of image, shared by the renderers whose GL contexts share their objects with
+  // the current one; it is deleted along with the last ImageGpu that borrows it (see ImageGpu::allocGpuShared).
+  // Without a share group, as on the desktop, the texture is the caller's own.
+  // Thread safe; needs a current gl context.
+  static std::shared_ptr<ImageGpu> volumeAllocGPU(std::shared_ptr<ImageXYZC> image,
+                                                  uint32_t c0,
+                                                  uint32_t c1,
+                                                  uint32_t c2,
+                                                  uint32_t c3);
+  // Put channels c0..c3 of image into volume, a texture from volumeAllocGPU, in place. False, leaving volume as it was,
+  // if other renderers borrow it or a texture of the new channels is shared already; take that one from
+  // volumeAllocGPU then. Thread safe; needs a current gl context.
+  static bool volumeUpdateGPU(const std::shared_ptr<ImageGpu>& volume,
+                              std::shared_ptr<ImageXYZC> image,
+                              uint32_t c0,
+                              uint32_t c1,
+                              uint32_t c2,
+                              uint32_t c3);
+  // identifies the objects the current RendererGLContext shares with others; null if none
+  static const void* currentShareGroup();
+
   static QSurfaceFormat getQSurfaceFormat(bool enableDebug = false);
   static QOpenGLContext* createOpenGLContext();
 
@@ -65,20 +101,37 @@ public:
 
 private:
   static std::map<std::shared_ptr<ImageXYZC>, std::shared_ptr<ImageGpu>> sGpuImageCache;
+
+  // volume textures in use by renderers, by image, share group and channels
+  struct SharedVolume
+  {
+    std::weak_ptr<ImageXYZC> image;
+    std::weak_ptr<ImageGpu> volume;
+  };
+  typedef std::tuple<const ImageXYZC*, const void*, uint32_t, uint32_t, uint32_t, uint32_t> SharedVolumeKey;
+  static std::map<SharedVolumeKey, SharedVolume> sSharedGpuVolumes;
+  static std::mutex sSharedGpuVolumesMutex;
 };
 
 class HeadlessGLContext
 {
 public:
-  HeadlessGLContext();
+  // textures, buffers and shaders are shared with shareWith and every context it shares with.
+  // device: index into the devices renderlib was initialized with; a shared context is on the device of shareWith
+  HeadlessGLContext(HeadlessGLContext* shareWith = nullptr, int device = 0);
   ~HeadlessGLContext();
   void makeCurrent();
   void doneCurrent();
 
+  // the same for all the contexts that share their objects
+  inline const void* shareGroup() const { return m_shareGroup; }
+
 private:
 #if HAS_EGL
+  EGLDisplay m_eglDpy;
   EGLContext m_eglCtx;
 #endif
+  const void* m_shareGroup;
 };
 
 // wrap a gl context intended to run on a separate thread
@@ -89,12 +142,17 @@ public:
   RendererGLContext();
   ~RendererGLContext();
   void configure(QOpenGLContext* glContext = nullptr);
-  void init();
+  // shareWith: an initialized context to share objects with; only headless contexts share (see canShare)
+  // device: see renderlib::deviceCount; only headless contexts are placed on a device
+  void init(RendererGLContext* shareWith = nullptr, int device = 0);
   void destroy();
 
   void makeCurrent();
   void doneCurrent();
 
+  // whether contexts can share their objects, and be made current on one thread after another: headless, with EGL
+  static bool canShare();
+
 private:
   bool m_ownGLContext;
   // only one of the following two can be non-null
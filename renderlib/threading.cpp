@@ -1,8 +1,42 @@
 #include "threading.h"
 
+#include "Tracing.h"
+
 #include <algorithm>
-#include <thread>
-#include <vector>
+#include <string>
+
+namespace {
+// pool that the calling thread is a worker of, and its index in that pool
+thread_local const ThreadPool* tWorkerPool = nullptr;
+thread_local int tWorkerIndex = -1;
+
+// shared state of one parallel_for; outlives the call if a helper task starts late
+struct ParallelForJob
+{
+  std::function<void(size_t, size_t)> functor;
+  size_t nb_elements;
+  size_t grain_size;
+  size_t nb_chunks;
+  std::atomic<size_t> next_chunk{ 0 };
+  std::atomic<size_t> done_chunks{ 0 };
+  std::mutex m;
+  std::condition_variable all_done;
+
+  // process chunks until none are left to claim
+  void run()
+  {
+    size_t chunk;
+    while ((chunk = next_chunk.fetch_add(1)) < nb_chunks) {
+      size_t start = chunk * grain_size;
+      functor(start, std::min(start + grain_size, nb_elements));
+      if (done_chunks.fetch_add(1) + 1 == nb_chunks) {
+        std::lock_guard<std::mutex> lock(m);
+        all_done.notify_all();
+      }
+    }
+  }
+};
+} // namespace
 
 /// @param[in] nb_elements : size of your for loop
 /// @param[in] functor(start, end) :
@@ -17,124 +51,161 @@
 ///
 ///
 void
-parallel_for(size_t nb_elements, std::function<void(size_t start, size_t end)> functor, bool use_threads)
+parallel_for(size_t nb_elements,
+             std::function<void(size_t start, size_t end)> functor,
+             bool use_threads,
+             size_t grain_size,
+             TaskPriority priority)
 {
-  // -------
-  unsigned nb_threads_hint = std::thread::hardware_concurrency();
-  unsigned nb_threads = nb_threads_hint == 0 ? 8 : (nb_threads_hint);
-
-  size_t batch_size = nb_elements / nb_threads;
-  size_t batch_remainder = nb_elements % nb_threads;
+  if (nb_elements == 0) {
+    return;
+  }
 
-  std::vector<std::thread> my_threads(nb_threads);
+  ThreadPool& pool = ThreadPool::instance();
+  const size_t nb_threads = pool.size() + 1;
+  if (grain_size == 0) {
+    // a few chunks per thread, so that threads that finish early can pick up more work
+    static const size_t CHUNKS_PER_THREAD = 4;
+    grain_size = std::max((size_t)1, nb_elements / (nb_threads * CHUNKS_PER_THREAD));
+  }
+  const size_t nb_chunks = (nb_elements + grain_size - 1) / grain_size;
 
-  if (use_threads) {
-    // Multithread execution
-    for (size_t i = 0; i < nb_threads; ++i) {
-      size_t start = i * batch_size;
-      my_threads[i] = std::thread(functor, start, start + batch_size);
-    }
-  } else {
-    // Single thread execution (for easy debugging)
-    for (size_t i = 0; i < nb_threads; ++i) {
-      size_t start = i * batch_size;
-      functor(start, start + batch_size);
+  if (!use_threads || nb_chunks == 1) {
+    // Single thread execution (for easy debugging), in the same chunks as the threaded path
+    for (size_t start = 0; start < nb_elements; start += grain_size) {
+      functor(start, std::min(start + grain_size, nb_elements));
     }
+    return;
   }
 
-  // Deform the elements left, on THIS thread
-  size_t start = nb_threads * batch_size;
-  functor(start, start + batch_remainder);
+  auto job = std::make_shared<ParallelForJob>();
+  job->functor = std::move(functor);
+  job->nb_elements = nb_elements;
+  job->grain_size = grain_size;
+  job->nb_chunks = nb_chunks;
 
-  // Wait for the other thread to finish their task
-  if (use_threads)
-    std::for_each(my_threads.begin(), my_threads.end(), std::mem_fn(&std::thread::join));
-}
+  // helpers that find no chunk left just return
+  size_t nb_helpers = std::min(nb_chunks - 1, (size_t)pool.size());
+  for (size_t i = 0; i < nb_helpers; ++i) {
+    pool.submit([job]() { job->run(); }, priority);
+  }
 
-// queue( lambda ) will enqueue the lambda into the tasks for the threads
-// to use.  A future of the type the lambda returns is given to let you get
-// the result out.
-template<class F, class R>
-std::future<R>
-Tasks::queue(F&& f)
-{
-  // wrap the function object into a packaged task, splitting
-  // execution from the return value:
-  std::packaged_task<R()> p(std::forward<F>(f));
+  // This thread works too. It claims chunks until none are left, so the loop always completes even if every
+  // worker is busy, e.g. when parallel_for is nested. Then it only waits for chunks already running elsewhere.
+  job->run();
 
-  auto r = p.get_future(); // get the return value before we hand off the task
-  {
-    std::unique_lock<std::mutex> l(m);
-    work.emplace_back(std::move(p)); // store the task<R()> as a task<void()>
-  }
-  v.notify_one(); // wake a thread to work on the task
+  std::unique_lock<std::mutex> lock(job->m);
+  job->all_done.wait(lock, [&job]() { return job->done_chunks.load() == job->nb_chunks; });
+}
 
-  return r; // return the future result of the task
+ThreadPool&
+ThreadPool::instance()
+{
+  static ThreadPool pool([]() {
+    unsigned nb_threads_hint = std::thread::hardware_concurrency();
+    unsigned nb_threads = nb_threads_hint == 0 ? 8 : (nb_threads_hint);
+    // the thread calling parallel_for works as well
+    return std::max(1u, nb_threads - 1);
+  }());
+  return pool;
 }
 
-// start N threads in the thread pool.
-void
-Tasks::start(std::size_t N)
+ThreadPool::ThreadPool(unsigned numThreads)
+  : m_pending(0)
+  , m_stop(false)
 {
-  for (std::size_t i = 0; i < N; ++i) {
-    // each thread is a std::async running this->thread_task():
-    finished.push_back(std::async(std::launch::async, [this] { thread_task(); }));
+  for (unsigned i = 0; i < numThreads + 1; ++i) {
+    m_queues.push_back(std::make_unique<TaskQueue>());
+  }
+  for (unsigned i = 0; i < numThreads; ++i) {
+    m_workers.emplace_back([this, i]() { workerLoop((int)i); });
   }
 }
 
-// abort() cancels all non-started tasks, and tells every working thread
-// stop running, and waits for them to finish up.
-void
-Tasks::abort()
+ThreadPool::~ThreadPool()
 {
-  cancel_pending();
-  finish();
+  {
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (std::thread& t : m_workers) {
+    t.join();
+  }
 }
-// cancel_pending() merely cancels all non-started tasks:
-void
-Tasks::cancel_pending()
+
+int
+ThreadPool::workerIndex() const
 {
-  std::unique_lock<std::mutex> l(m);
-  work.clear();
+  return (tWorkerPool == this) ? tWorkerIndex : -1;
 }
-// finish enques a "stop the thread" message for every thread, then waits for them:
+
 void
-Tasks::finish()
+ThreadPool::submit(std::function<void()> task, TaskPriority priority)
 {
   {
-    std::unique_lock<std::mutex> l(m);
-    for (auto&& unused : finished) {
-      work.push_back({});
-    }
+    // counted before it is queued, so that m_pending never drops below zero when a worker takes it right away.
+    // Under the lock, so that a worker cannot miss the wakeup between checking m_pending and waiting.
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    ++m_pending;
   }
-  v.notify_all();
-  finished.clear();
+  // a worker keeps what it submits local; everyone else shares one queue
+  TaskQueue& q = *m_queues[workerIndex() + 1];
+  {
+    std::lock_guard<std::mutex> lock(q.m);
+    q.tasks[(int)priority].push_back(std::move(task));
+  }
+  m_wake.notify_one();
 }
-Tasks::~Tasks()
+
+std::function<void()>
+ThreadPool::take(int self)
 {
-  finish();
+  std::function<void()> task;
+  const size_t nqueues = m_queues.size();
+  for (int p = 0; p < NUM_PRIORITIES; ++p) {
+    // own queue first, newest task: it is the most likely to still be in cache
+    {
+      TaskQueue& own = *m_queues[self + 1];
+      std::lock_guard<std::mutex> lock(own.m);
+      if (!own.tasks[p].empty()) {
+        task = std::move(own.tasks[p].back());
+        own.tasks[p].pop_back();
+      }
+    }
+    // then the shared queue and the other workers, oldest task first
+    for (size_t k = 1; !task && k < nqueues; ++k) {
+      TaskQueue& q = *m_queues[(self + 1 + k) % nqueues];
+      std::lock_guard<std::mutex> lock(q.m);
+      if (!q.tasks[p].empty()) {
+        task = std::move(q.tasks[p].front());
+        q.tasks[p].pop_front();
+      }
+    }
+    if (task) {
+      --m_pending;
+      return task;
+    }
+  }
+  return task;
 }
 
-// the work that a worker thread does:
 void
-Tasks::thread_task()
+ThreadPool::workerLoop(int self)
 {
+  tWorkerPool = this;
+  tWorkerIndex = self;
+  Tracing::setThreadName("worker " + std::to_string(self));
   while (true) {
-    // pop a task off the queue:
-    std::packaged_task<bool()> f;
-    {
-      // usual thread-safe queue code:
-      std::unique_lock<std::mutex> l(m);
-      if (work.empty()) {
-        v.wait(l, [&] { return !work.empty(); });
-      }
-      f = std::move(work.front());
-      work.pop_front();
+    std::function<void()> task = take(self);
+    if (task) {
+      task();
+      continue;
     }
-    // if the task is invalid, it means we are asked to abort:
-    if (!f.valid())
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    m_wake.wait(lock, [this]() { return m_stop || m_pending.load() > 0; });
+    if (m_stop) {
       return;
-    // otherwise, run the task:
-    f();
+    }
   }
 }
@@ -1,11 +1,22 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <functional>
-#include <future>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
+// Tasks of higher priority are always started before tasks of lower priority.
+enum class TaskPriority
+{
+  HIGH = 0,
+  NORMAL = 1,
+  LOW = 2
+};
+
 /// @param[in] nb_elements : size of your for loop
 /// @param[in] functor(start, end) :
 /// your function processing a sub chunk of the for loop.
@@ -16,59 +27,71 @@
 ///         computation(i);
 /// @endcode
 /// @param use_threads : enable / disable threads.
+/// @param grain_size : number of elements per chunk; 0 picks a size that gives every thread a few chunks.
+/// The functor is called once per chunk, possibly on several threads at once.
+/// @param priority : priority of the chunks on the shared ThreadPool.
 ///
-///
+/// The calling thread processes chunks too, so parallel_for may be called from inside another parallel_for
+/// or from a ThreadPool task without deadlocking.
 void
-parallel_for(size_t nb_elements, std::function<void(size_t start, size_t end)> functor, bool use_threads = true);
+parallel_for(size_t nb_elements,
+             std::function<void(size_t start, size_t end)> functor,
+             bool use_threads = true,
+             size_t grain_size = 0,
+             TaskPriority priority = TaskPriority::NORMAL);
 
-// Thread pool for running concurrent async jobs
+// Persistent pool of worker threads.
+// Each worker has its own queue: tasks submitted from a worker go to its own queue and are run newest first,
+// tasks submitted from other threads are shared, and idle workers steal the oldest tasks of busy workers.
+//
 // Usage example:
 //
-// unsigned int min_cores = 1; // for the case when hardware_concurency fails and returns 0
-// unsigned int number_of_cores = std::max(min_cores, std::min(cores_, std::thread::hardware_concurrency() - 1));
-// {
-//   std::vector<std::future<bool>> jobs;
-//   Tasks tasks;
-//   for_each(matches.begin(), matches.end(), [&]() {
-//     jobs.push_back(tasks.queue([]() -> bool {
-//       // do something
-//       return true;
-//     }));
-//   });
-//   tasks.start(number_of_cores);
-//   for_each(jobs.begin(), jobs.end(), [](auto& x) { x.get(); });
-// }
-struct Tasks
+// std::promise<bool> done;
+// ThreadPool::instance().submit([&done]() {
+//   // do something
+//   done.set_value(true);
+// });
+// done.get_future().get();
+class ThreadPool
 {
-  // the mutex, condition variable and deque form a single
-  // thread-safe triggered queue of tasks:
-  std::mutex m;
-  std::condition_variable v;
-  // note that a packaged_task<void> can store a packaged_task<R>:
-  std::deque<std::packaged_task<bool()>> work;
+public:
+  // the process-wide pool, with one worker per hardware thread besides the caller's
+  static ThreadPool& instance();
 
-  // this holds futures representing the worker threads being done:
-  std::vector<std::future<void>> finished;
+  explicit ThreadPool(unsigned numThreads);
+  ~ThreadPool();
 
-  // queue( lambda ) will enqueue the lambda into the tasks for the threads
-  // to use.  A future of the type the lambda returns is given to let you get
-  // the result out.
-  template<class F, class R = std::result_of_t<F&()>>
-  std::future<R> queue(F&& f);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
 
-  // start N threads in the thread pool.
-  void start(std::size_t N = 1);
+  unsigned size() const { return (unsigned)m_workers.size(); }
 
-  // abort() cancels all non-started tasks, and tells every working thread
-  // stop running, and waits for them to finish up.
-  void abort();
-  // cancel_pending() merely cancels all non-started tasks:
-  void cancel_pending();
-  // finish enques a "stop the thread" message for every thread, then waits for them:
-  void finish();
-  ~Tasks();
+  // queue a task to run on one of the workers
+  void submit(std::function<void()> task, TaskPriority priority = TaskPriority::NORMAL);
+
+  // index of the calling thread in this pool, or -1 if it is not one of its workers
+  int workerIndex() const;
 
 private:
-  // the work that a worker thread does:
-  void thread_task();
+  static const int NUM_PRIORITIES = 3;
+
+  struct TaskQueue
+  {
+    std::mutex m;
+    std::deque<std::function<void()>> tasks[NUM_PRIORITIES];
+  };
+
+  // next task for worker `self`, or an empty function if nothing is queued
+  std::function<void()> take(int self);
+  void workerLoop(int self);
+
+  // m_queues[0] is shared, m_queues[i + 1] belongs to worker i
+  std::vector<std::unique_ptr<TaskQueue>> m_queues;
+  std::vector<std::thread> m_workers;
+
+  // workers sleep on m_wake while there is nothing queued
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wake;
+  std::atomic<size_t> m_pending;
+  bool m_stop;
 };
@@ -0,0 +1,126 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/admissionControl.h"
+#include "../agave_app/commandBuffer.h"
+#include "renderlib/command.h"
+
+#include <deque>
+#include <vector>
+
+TEST_CASE("Admission waits for sessions, render load and memory", "[admissionControl]")
+{
+  AdmissionControl::Options options;
+  options.maxSessions = 2;
+  options.maxWaiting = 1;
+  options.maxRenderLoad = 0.9;
+  AdmissionControl admission(options);
+
+  REQUIRE(admission.decide(0, 0, 0.0, true) == AdmissionControl::Decision::Admit);
+  REQUIRE(admission.decide(1, 0, 0.5, true) == AdmissionControl::Decision::Admit);
+  // out of sessions
+  REQUIRE(admission.decide(2, 0, 0.0, true) == AdmissionControl::Decision::Wait);
+  // out of render time or memory
+  REQUIRE(admission.decide(1, 0, 0.95, true) == AdmissionControl::Decision::Wait);
+  REQUIRE(admission.decide(1, 0, 0.5, false) == AdmissionControl::Decision::Wait);
+  // an idle server always admits
+  REQUIRE(admission.decide(0, 0, 0.95, false) == AdmissionControl::Decision::Admit);
+  // no overtaking the waiting client, and the queue is full
+  REQUIRE(admission.decide(1, 1, 0.0, true) == AdmissionControl::Decision::Reject);
+
+  options.maxRenderLoad = 0.0;
+  REQUIRE(AdmissionControl(options).decide(1, 0, 5.0, true) == AdmissionControl::Decision::Admit);
+}
+
+TEST_CASE("Quality is lowered for the busiest session and restored for the most degraded", "[admissionControl]")
+{
+  AdmissionControl::Options options;
+  options.degradeRenderLoad = 0.8;
+  options.restoreRenderLoad = 0.5;
+  AdmissionControl admission(options);
+
+  std::vector<double> loads = { 0.2, 0.6, 0.3 };
+  std::vector<int> levels = { 0, 0, 0 };
+
+  levels = admission.adjustQuality(0.9, false, loads, levels);
+  REQUIRE(levels == std::vector<int>{ 0, 1, 0 });
+  levels = admission.adjustQuality(0.9, false, loads, levels);
+  REQUIRE(levels == std::vector<int>{ 0, 2, 0 });
+  // the busiest is as low as it goes, so the next busiest is lowered
+  levels = admission.adjustQuality(0.9, false, loads, levels);
+  REQUIRE(levels == std::vector<int>{ 0, 2, 1 });
+  // memory pressure lowers quality too
+  levels = admission.adjustQuality(0.0, true, loads, levels);
+  REQUIRE(levels == std::vector<int>{ 0, 2, 2 });
+
+  // between the thresholds nothing changes
+  REQUIRE(admission.adjustQuality(0.7, false, loads, levels) == levels);
+
+  // the most degraded first; of those the least busy
+  levels = admission.adjustQuality(0.3, false, loads, levels);
+  REQUIRE(levels == std::vector<int>{ 0, 2, 1 });
+  levels = admission.adjustQuality(0.3, false, loads, levels);
+  REQUIRE(levels == std::vector<int>{ 0, 1, 1 });
+
+  REQUIRE(AdmissionControl::quality(0).resolutionScale == 1.0f);
+  REQUIRE(AdmissionControl::quality(0).maxIterations == 0);
+  REQUIRE(AdmissionControl::quality(AdmissionControl::MAX_QUALITY_LEVEL).resolutionScale < 1.0f);
+  REQUIRE(AdmissionControl::quality(99).resolutionScale == AdmissionControl::quality(2).resolutionScale);
+}
+
+TEST_CASE("Waiting clients are admitted in order with the commands they sent", "[admissionControl]")
+{
+  WaitingQueue queue;
+  queue.push(1);
+  queue.push(2);
+  queue.push(3);
+  REQUIRE(queue.length() == 3);
+  REQUIRE(queue.addMessage(2, { 1, 2, 3 }));
+  REQUIRE(queue.addMessage(2, { 4 }));
+
+  std::vector<std::vector<uint8_t>> messages;
+  REQUIRE(queue.admit(messages) == 1);
+  REQUIRE(messages.empty());
+  REQUIRE(queue.admit(messages) == 2);
+  REQUIRE(messages == std::vector<std::vector<uint8_t>>{ { 1, 2, 3 }, { 4 } });
+  REQUIRE(!queue.contains(2));
+  REQUIRE(queue.clients() == std::deque<uint64_t>{ 3 });
+
+  // an admitted client is told position 0
+  REQUIRE(WaitingQueue::positionMessage(0) == "{\"queue_position\":0}");
+  REQUIRE(WaitingQueue::positionMessage(1) == "{\"queue_position\":1}");
+
+  REQUIRE(queue.remove(3));
+  REQUIRE(!queue.remove(3));
+  REQUIRE(queue.length() == 0);
+}
+
+TEST_CASE("A waiting client's messages are merged beyond the limit", "[admissionControl]")
+{
+  WaitingQueue queue;
+  queue.push(7);
+  for (size_t i = 0; i <= WaitingQueue::MAX_MESSAGES; ++i) {
+    SetWindowLevelCommandD level = { 0, 1.0f, (float)i };
+    std::vector<Command*> cmds({ new SetWindowLevelCommand(level), new RequestRedrawCommand({}) });
+    commandBuffer* buffer = commandBuffer::createBuffer(cmds);
+    REQUIRE(queue.addMessage(7, std::vector<uint8_t>(buffer->head(), buffer->head() + buffer->length())));
+    for (Command* c : cmds) {
+      delete c;
+    }
+    delete[] buffer->head();
+    delete buffer;
+  }
+
+  std::vector<std::vector<uint8_t>> messages;
+  REQUIRE(queue.admit(messages) == 7);
+  REQUIRE(messages.size() == 1);
+  commandBuffer merged(messages[0].size(), messages[0].data());
+  merged.processBuffer();
+  // only the last of the window levels and redraws
+  REQUIRE(merged.getQueue().size() == 2);
+  auto level = dynamic_cast<SetWindowLevelCommand*>(merged.getQueue()[0]);
+  REQUIRE(level != nullptr);
+  REQUIRE(level->m_data.m_level == (float)WaitingQueue::MAX_MESSAGES);
+  for (Command* c : merged.getQueue()) {
+    delete c;
+  }
+}
@@ -0,0 +1,95 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/commandBuffer.h"
+#include "../agave_app/commandTrace.h"
+#include "renderlib/command.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+std::string
+tracePath(const char* name)
+{
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+} // namespace
+
+TEST_CASE("Command traces keep their command buffers and times", "[commandTrace]")
+{
+  std::vector<Command*> orbit = { new OrbitCameraCommand({ 10.0f, -5.0f }), new RequestRedrawCommand({}) };
+  std::vector<Command*> resize = { new SetResolutionCommand({ 640, 480 }) };
+
+  std::vector<CommandTraceEntry> entries(3);
+  entries[0].timeNs = 0;
+  entries[0].buffer = encodeCommands(resize);
+  entries[1].timeNs = 16666667;
+  entries[1].buffer = encodeCommands(orbit);
+  // an empty request is allowed
+  entries[2].timeNs = 5000000000ull;
+
+  std::string path = tracePath("agave_test_trace.agvtrace");
+  REQUIRE(writeCommandTrace(path, entries));
+
+  std::vector<CommandTraceEntry> read;
+  REQUIRE(readCommandTrace(path, read));
+  REQUIRE(read.size() == 3);
+  for (size_t i = 0; i < read.size(); ++i) {
+    REQUIRE(read[i].timeNs == entries[i].timeNs);
+    REQUIRE(read[i].buffer == entries[i].buffer);
+  }
+
+  // the buffers still decode to the same commands
+  commandBuffer b(read[1].buffer.size(), read[1].buffer.data());
+  b.processBuffer();
+  std::vector<Command*> decoded = b.getQueue();
+  REQUIRE(decoded.size() == 2);
+  OrbitCameraCommand* decodedOrbit = dynamic_cast<OrbitCameraCommand*>(decoded[0]);
+  REQUIRE(decodedOrbit != nullptr);
+  REQUIRE(decodedOrbit->m_data.m_theta == 10.0f);
+  REQUIRE(decodedOrbit->m_data.m_phi == -5.0f);
+  REQUIRE(dynamic_cast<RequestRedrawCommand*>(decoded[1]) != nullptr);
+
+  for (Command* c : decoded) {
+    delete c;
+  }
+  for (Command* c : orbit) {
+    delete c;
+  }
+  for (Command* c : resize) {
+    delete c;
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("A truncated command trace keeps its complete entries", "[commandTrace]")
+{
+  std::vector<Command*> redraw = { new RequestRedrawCommand({}) };
+  std::vector<CommandTraceEntry> entries(2);
+  entries[0].timeNs = 1;
+  entries[0].buffer = encodeCommands(redraw);
+  entries[1].timeNs = 2;
+  entries[1].buffer = encodeCommands(redraw);
+  delete redraw[0];
+
+  std::string path = tracePath("agave_test_truncated.agvtrace");
+  REQUIRE(writeCommandTrace(path, entries));
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+  std::vector<CommandTraceEntry> read;
+  REQUIRE(readCommandTrace(path, read));
+  REQUIRE(read.size() == 1);
+  REQUIRE(read[0].timeNs == 1);
+
+  // not a trace at all
+  {
+    std::ofstream notATrace(path, std::ios::binary | std::ios::trunc);
+    notATrace << "not a trace";
+  }
+  read.clear();
+  REQUIRE(!readCommandTrace(path, read));
+  REQUIRE(read.empty());
+  std::filesystem::remove(path);
+}
@@ -1,8 +1,10 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include "../agave_app/commandBuffer.h"
+#include "renderlib/JobScheduler.h"
 #include "renderlib/command.h"
 
+#include <functional>
 #include <vector>
 
 Command*
@@ -450,4 +452,114 @@ TEST_CASE("Commands can write and read from binary", "[command]")
     REQUIRE(cmd->toPythonString() == "set_interpolation(1)");
     REQUIRE(cmd->m_data.m_on == data.m_on);
   }
+  SECTION("GetMemoryUsageCommand")
+  {
+    GetMemoryUsageCommandD data = {};
+    auto cmd = testcodec<GetMemoryUsageCommand, GetMemoryUsageCommandD>(data);
+    REQUIRE(cmd->toPythonString() == "memory_usage()");
+  }
+}
+
+TEST_CASE("Later setters replace earlier ones up to a command that is not a setter", "[command]")
+{
+  SetWindowLevelCommandD level0 = { 0, 1.0f, 0.5f };
+  SetWindowLevelCommandD level1 = { 1, 1.0f, 0.5f };
+  SetCameraPosCommandD eye = { 1.0f, 2.0f, 3.0f };
+  OrbitCameraCommandD orbit = { 10.0f, 0.0f };
+  std::vector<Command*> commands = {
+    new SetWindowLevelCommand(level0), new RequestRedrawCommand({}), new SetWindowLevelCommand(level1),
+    new SetCameraPosCommand(eye),      new SetWindowLevelCommand(level0), new RequestRedrawCommand({}),
+    new OrbitCameraCommand(orbit),     new SetCameraPosCommand(eye),
+  };
+  REQUIRE(commandKey(commands[0]) != 0);
+  REQUIRE(commandKey(commands[0]) != commandKey(commands[2]));
+  REQUIRE(commandKey(commands[6]) == 0);
+
+  std::vector<bool> replaced = replacedCommands(commands);
+  // the other channel, and the camera across the orbit, are kept
+  REQUIRE(replaced == std::vector<bool>{ true, true, false, false, false, false, false, false });
+  for (Command* command : commands) {
+    delete command;
+  }
+}
+
+TEST_CASE("Command buffers parse at any alignment and stop at a truncated command", "[command]")
+{
+  SetControlPointsCommandD data;
+  data.m_channel = 2;
+  data.m_data = { 0.0f, 0.1f, 0.2f, 0.3f, 1.0f };
+  LoadDataCommandD load = { "test", 1, 2, 3, { 4, 5 }, 0, 10, 0, 20, 0, 30 };
+  std::vector<Command*> cmds({ new SetControlPointsCommand(data), new LoadDataCommand(load) });
+  commandBuffer* buffer = commandBuffer::createBuffer(cmds);
+  for (Command* c : cmds) {
+    delete c;
+  }
+
+  // one byte off the alignment of the allocation
+  std::vector<uint8_t> bytes(buffer->length() + 1);
+  std::copy(buffer->head(), buffer->head() + buffer->length(), bytes.begin() + 1);
+  commandBuffer unaligned(buffer->length(), bytes.data() + 1);
+  unaligned.processBuffer();
+  REQUIRE(unaligned.getQueue().size() == 2);
+  auto points = dynamic_cast<SetControlPointsCommand*>(unaligned.getQueue()[0]);
+  REQUIRE(points != nullptr);
+  REQUIRE(points->m_data.m_channel == 2);
+  REQUIRE(points->m_data.m_data == data.m_data);
+  auto loaded = dynamic_cast<LoadDataCommand*>(unaligned.getQueue()[1]);
+  REQUIRE(loaded != nullptr);
+  REQUIRE(loaded->m_data.m_channels == load.m_channels);
+  REQUIRE(loaded->m_data.m_zmax == 30);
+  for (Command* c : unaligned.getQueue()) {
+    delete c;
+  }
+
+  // the first command is complete, the second is not
+  commandBuffer truncated(buffer->length() - 6, buffer->head());
+  truncated.processBuffer();
+  REQUIRE(truncated.getQueue().size() == 1);
+  delete truncated.getQueue()[0];
+
+  delete[] buffer->head();
+  delete buffer;
+}
+
+namespace {
+// keeps the submitted work, to run it when the test says
+class HeldJobRunner : public CommandJobRunner
+{
+public:
+  virtual void runInBackground(std::function<std::function<void(ExecutionContext*)>(JobToken&)> work,
+                               bool replacesData)
+  {
+    m_work = work;
+    m_replacesData = replacesData;
+  }
+  std::function<std::function<void(ExecutionContext*)>(JobToken&)> m_work;
+  bool m_replacesData = false;
+};
+} // namespace
+
+TEST_CASE("A load that fails leaves the loaded data's spec", "[command]")
+{
+  ExecutionContext context;
+  context.m_loadSpec.filepath = "loaded.ome.tif";
+  context.m_loadSpec.time = 2;
+  // no reader knows the extension
+  LoadDataCommand load({ "missing.unknown", 0, 0, 5, {}, 0, 0, 0, 0, 0, 0 });
+
+  load.execute(&context);
+  REQUIRE(context.m_loadSpec.filepath == "loaded.ome.tif");
+  REQUIRE(context.m_loadSpec.time == 2);
+
+  HeldJobRunner runner;
+  context.m_jobRunner = &runner;
+  load.execute(&context);
+  REQUIRE(runner.m_work);
+  REQUIRE(runner.m_replacesData);
+  // pending
+  REQUIRE(context.m_loadSpec.filepath == "loaded.ome.tif");
+  JobToken token;
+  REQUIRE(!runner.m_work(token));
+  REQUIRE(context.m_loadSpec.filepath == "loaded.ome.tif");
+  REQUIRE(context.m_loadSpec.time == 2);
 }
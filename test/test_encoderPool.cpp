@@ -0,0 +1,68 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/encoderPool.h"
+
+#include <future>
+#include <mutex>
+#include <vector>
+
+TEST_CASE("EncoderPool delivers each stream in submission order", "[encoderPool]")
+{
+  EncoderPool encoders(4);
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+
+  std::mutex m;
+  std::vector<int> delivered[2];
+
+  // the first frame of stream 0 finishes encoding last
+  encoders.submit(0, [released]() { released.wait(); }, [&]() {
+    std::lock_guard<std::mutex> lock(m);
+    delivered[0].push_back(0);
+  });
+  for (int i = 1; i < 8; ++i) {
+    for (uint64_t stream = 0; stream < 2; ++stream) {
+      encoders.submit(stream, []() {}, [&, stream, i]() {
+        std::lock_guard<std::mutex> lock(m);
+        delivered[stream].push_back(i);
+      });
+    }
+  }
+
+  // stream 1 is not held up by stream 0
+  while (encoders.pending() > 8) {
+    std::this_thread::yield();
+  }
+  {
+    std::lock_guard<std::mutex> lock(m);
+    REQUIRE(delivered[0].empty());
+    REQUIRE(delivered[1] == std::vector<int>{ 1, 2, 3, 4, 5, 6, 7 });
+  }
+
+  release.set_value();
+  encoders.waitForAll();
+  REQUIRE(encoders.pending() == 0);
+  REQUIRE(delivered[0] == std::vector<int>{ 0, 1, 2, 3, 4, 5, 6, 7 });
+}
+
+TEST_CASE("EncoderPool encodes frames in parallel", "[encoderPool]")
+{
+  EncoderPool encoders(2);
+  REQUIRE(encoders.size() == 2);
+
+  // each encode waits for the other to start, which only works on two threads at once
+  std::promise<void> started[2];
+  std::shared_future<void> startedFutures[2] = { started[0].get_future().share(), started[1].get_future().share() };
+  int deliveries = 0;
+  for (int i = 0; i < 2; ++i) {
+    encoders.submit(
+      0,
+      [&started, startedFutures, i]() {
+        started[i].set_value();
+        startedFutures[1 - i].wait();
+      },
+      [&deliveries]() { deliveries++; });
+  }
+  encoders.waitForAll();
+  REQUIRE(deliveries == 2);
+}
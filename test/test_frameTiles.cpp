@@ -0,0 +1,62 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/frameTiles.h"
+
+#include <vector>
+
+static uint32_t
+readUint32(const std::vector<uint8_t>& bytes, size_t offset)
+{
+  return bytes[offset] | (bytes[offset + 1] << 8) | (bytes[offset + 2] << 16) | ((uint32_t)bytes[offset + 3] << 24);
+}
+
+TEST_CASE("Only tiles that changed beyond the threshold are found", "[frameTiles]")
+{
+  const int width = 10;
+  const int height = 6;
+  const size_t bytesPerLine = width * 4;
+  std::vector<uint8_t> reference(bytesPerLine * height, 100);
+  std::vector<uint8_t> image = reference;
+
+  REQUIRE(FrameTiles::changedTiles(image.data(), reference.data(), width, height, bytesPerLine, 4, 0.5f).empty());
+
+  // one pixel in the bottom right tile, which is cut short by the edges
+  image[(5 * width + 9) * 4 + 1] = 200;
+  std::vector<FrameTiles::Tile> tiles =
+    FrameTiles::changedTiles(image.data(), reference.data(), width, height, bytesPerLine, 4, 0.5f);
+  REQUIRE(tiles.size() == 1);
+  REQUIRE(tiles[0].x == 8);
+  REQUIRE(tiles[0].y == 4);
+  REQUIRE(tiles[0].width == 2);
+  REQUIRE(tiles[0].height == 2);
+
+  // a difference of 100 over 2x2 pixels of 4 channels is a mean of 6.25
+  REQUIRE(FrameTiles::changedTiles(image.data(), reference.data(), width, height, bytesPerLine, 4, 6.0f).size() == 1);
+  REQUIRE(FrameTiles::changedTiles(image.data(), reference.data(), width, height, bytesPerLine, 4, 7.0f).empty());
+
+  FrameTiles::copyTiles(tiles, image.data(), reference.data(), bytesPerLine);
+  REQUIRE(reference == image);
+}
+
+TEST_CASE("Tile frames are packed with their header", "[frameTiles]")
+{
+  std::vector<FrameTiles::Tile> tiles = { { 0, 0, 64, 64 }, { 64, 128, 16, 8 } };
+  std::vector<std::vector<uint8_t>> encoded = { { 1, 2, 3 }, { 4 } };
+  std::vector<uint8_t> message = FrameTiles::pack(80, 136, tiles, encoded);
+
+  REQUIRE(message.size() == 16 + 2 * 20 + 4);
+  REQUIRE(std::vector<uint8_t>(message.begin(), message.begin() + 4) == std::vector<uint8_t>{ 'A', 'G', 'T', 'F' });
+  REQUIRE(readUint32(message, 4) == 80);
+  REQUIRE(readUint32(message, 8) == 136);
+  REQUIRE(readUint32(message, 12) == 2);
+  REQUIRE(readUint32(message, 16) == 0);
+  REQUIRE(readUint32(message, 32) == 3);
+  REQUIRE(message[36] == 1);
+  REQUIRE(message[38] == 3);
+  REQUIRE(readUint32(message, 39) == 64);
+  REQUIRE(readUint32(message, 43) == 128);
+  REQUIRE(readUint32(message, 47) == 16);
+  REQUIRE(readUint32(message, 51) == 8);
+  REQUIRE(readUint32(message, 55) == 1);
+  REQUIRE(message[59] == 4);
+}
@@ -0,0 +1,324 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "renderlib/Fuse.h"
+#include "renderlib/ImageXYZC.h"
+#include "renderlib/Logging.h"
+#include "renderlib/threading.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// the original per-voxel float implementation, kept as a reference for correctness and benchmarking
+void
+referenceFuse(const ImageXYZC* img, const std::vector<glm::vec3>& colorsPerChannel, uint8_t* rgbVolume)
+{
+  size_t nvox = (size_t)img->sizeX() * img->sizeY() * img->sizeZ();
+  memset(rgbVolume, 0, 3 * nvox);
+  parallel_for(nvox, [&img, &colorsPerChannel, &rgbVolume](size_t s, size_t e) {
+    size_t nch = std::min((size_t)img->sizeC(), colorsPerChannel.size());
+    for (uint32_t i = 0; i < nch; ++i) {
+      glm::vec3 c = colorsPerChannel[i];
+      if (c == glm::vec3(0, 0, 0)) {
+        continue;
+      }
+      uint16_t* channeldata = reinterpret_cast<uint16_t*>(img->ptr(i));
+      float* lut = img->channel(i)->m_lut;
+      float chmax = (float)img->channel(i)->m_max;
+      float chmin = (float)img->channel(i)->m_min;
+      for (size_t cx = s, fx = s * 3; cx < e; cx++, fx += 3) {
+        float value = (float)(channeldata[cx] - chmin) / (float)(chmax - chmin);
+        value = lut[(int)(value * 255.0 + 0.5)];
+        rgbVolume[fx + 0] = std::max(rgbVolume[fx + 0], static_cast<uint8_t>(c.x * value * 255));
+        rgbVolume[fx + 1] = std::max(rgbVolume[fx + 1], static_cast<uint8_t>(c.y * value * 255));
+        rgbVolume[fx + 2] = std::max(rgbVolume[fx + 2], static_cast<uint8_t>(c.z * value * 255));
+      }
+    }
+  });
+}
+
+// per-voxel reference for any of the built-in modes, using the documented definitions directly
+void
+referenceFuseMode(const ImageXYZC* img,
+                  const std::vector<glm::vec3>& colorsPerChannel,
+                  FuseMode mode,
+                  uint8_t* rgbVolume)
+{
+  size_t nvox = (size_t)img->sizeX() * img->sizeY() * img->sizeZ();
+  size_t nch = std::min((size_t)img->sizeC(), colorsPerChannel.size());
+  for (size_t v = 0; v < nvox; ++v) {
+    uint32_t acc[3] = { 0, 0, 0 };
+    uint32_t weights = 0;
+    for (uint32_t i = 0; i < nch; ++i) {
+      glm::vec3 c = colorsPerChannel[i];
+      if (c == glm::vec3(0, 0, 0)) {
+        continue;
+      }
+      const Channelu16* ch = img->channel(i);
+      float chmax = (float)ch->m_max;
+      float chmin = (float)ch->m_min;
+      float value = (float)(ch->m_ptr[v] - chmin) / (float)(chmax - chmin);
+      value = ch->m_lut[(int)(value * 255.0 + 0.5)];
+      uint32_t contribution[3] = { static_cast<uint8_t>(c.x * value * 255),
+                                   static_cast<uint8_t>(c.y * value * 255),
+                                   static_cast<uint8_t>(c.z * value * 255) };
+      uint32_t w = static_cast<uint8_t>(value * 255);
+      for (int k = 0; k < 3; ++k) {
+        switch (mode) {
+          case FuseMode::MAX:
+            acc[k] = std::max(acc[k], contribution[k]);
+            break;
+          case FuseMode::ADDITIVE:
+            acc[k] = std::min(255u, acc[k] + contribution[k]);
+            break;
+          case FuseMode::AVERAGE:
+            acc[k] += w * contribution[k];
+            break;
+        }
+      }
+      weights += w;
+    }
+    for (int k = 0; k < 3; ++k) {
+      if (mode == FuseMode::AVERAGE) {
+        acc[k] = weights ? (acc[k] + weights / 2) / weights : 0;
+      }
+      rgbVolume[3 * v + k] = (uint8_t)acc[k];
+    }
+  }
+}
+
+std::shared_ptr<ImageXYZC>
+makeImage(uint32_t x, uint32_t y, uint32_t z, uint32_t c, float sx = 1.0f, float sy = 1.0f, float sz = 1.0f)
+{
+  size_t nvox = (size_t)x * y * z;
+  uint16_t* data = new uint16_t[nvox * c];
+  for (size_t i = 0; i < nvox * c; ++i) {
+    // deterministic pseudo-random intensities with a different range per channel
+    data[i] = (uint16_t)(((i * 2654435761u) >> 16) % (1000 + 3000 * (i / nvox)));
+  }
+  return std::make_shared<ImageXYZC>(
+    x, y, z, c, ImageXYZC::IN_MEMORY_BPP, reinterpret_cast<uint8_t*>(data), sx, sy, sz);
+}
+
+} // namespace
+
+TEST_CASE("Fuse matches the reference implementation", "[fuse]")
+{
+  Logging::Enable(false);
+  auto img = makeImage(37, 21, 9, 3);
+  size_t nvox = (size_t)img->sizeX() * img->sizeY() * img->sizeZ();
+  std::vector<uint8_t> expected(3 * nvox);
+  std::vector<uint8_t> actual(3 * nvox, 0xff);
+
+  SECTION("All channels enabled")
+  {
+    std::vector<glm::vec3> colors = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.5f }, { 0.25f, 0.25f, 1.0f } };
+    referenceFuse(img.get(), colors, expected.data());
+    uint8_t* out = actual.data();
+    Fuse::fuse(img.get(), colors, &out, nullptr);
+    REQUIRE(expected == actual);
+  }
+
+  SECTION("Disabled channels do not contribute")
+  {
+    std::vector<glm::vec3> colors = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.5f }, { 0.0f, 0.0f, 0.0f } };
+    referenceFuse(img.get(), colors, expected.data());
+    uint8_t* out = actual.data();
+    Fuse::fuse(img.get(), colors, &out, nullptr);
+    REQUIRE(expected == actual);
+  }
+
+  SECTION("No channels clears the volume")
+  {
+    std::vector<glm::vec3> colors = { { 0.0f, 0.0f, 0.0f } };
+    uint8_t* out = actual.data();
+    Fuse::fuse(img.get(), colors, &out, nullptr);
+    REQUIRE(std::all_of(actual.begin(), actual.end(), [](uint8_t v) { return v == 0; }));
+  }
+}
+
+TEST_CASE("Fuse kernels combine channels as documented", "[fuse]")
+{
+  Logging::Enable(false);
+  auto img = makeImage(37, 21, 9, 3);
+  size_t nvox = (size_t)img->sizeX() * img->sizeY() * img->sizeZ();
+  std::vector<uint8_t> expected(3 * nvox);
+  std::vector<uint8_t> actual(3 * nvox, 0xff);
+  std::vector<glm::vec3> colors = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.5f }, { 0.25f, 0.25f, 1.0f } };
+  uint8_t* out = actual.data();
+
+  for (FuseMode mode : { FuseMode::MAX, FuseMode::ADDITIVE, FuseMode::AVERAGE }) {
+    referenceFuseMode(img.get(), colors, mode, expected.data());
+    Fuse::fuse(img.get(), colors, &out, nullptr, FuseKernel::get(mode));
+    REQUIRE(expected == actual);
+  }
+
+  SECTION("Max is the original behavior")
+  {
+    std::vector<uint8_t> original(3 * nvox);
+    referenceFuse(img.get(), colors, original.data());
+    Fuse::fuse(img.get(), colors, &out, nullptr, FuseKernel::get(FuseMode::MAX));
+    REQUIRE(original == actual);
+  }
+
+  SECTION("A single channel is unchanged by every mode")
+  {
+    std::vector<glm::vec3> one = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.5f }, { 0.0f, 0.0f, 0.0f } };
+    referenceFuse(img.get(), one, expected.data());
+    for (FuseMode mode : { FuseMode::MAX, FuseMode::ADDITIVE, FuseMode::AVERAGE }) {
+      Fuse::fuse(img.get(), one, &out, nullptr, FuseKernel::get(mode));
+      REQUIRE(expected == actual);
+    }
+  }
+}
+
+TEST_CASE("Fuse produces the gradient of the fused intensity", "[fuse]")
+{
+  Logging::Enable(false);
+  // anisotropic spacing, and enough planes to be split across threads
+  auto img = makeImage(19, 11, 17, 3, 0.5f, 0.5f, 1.5f);
+  size_t nvox = (size_t)img->sizeX() * img->sizeY() * img->sizeZ();
+  std::vector<glm::vec3> colors = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.5f }, { 0.25f, 0.25f, 1.0f } };
+
+  for (FuseMode mode : { FuseMode::MAX, FuseMode::ADDITIVE, FuseMode::AVERAGE }) {
+    std::vector<uint8_t> rgb(3 * nvox);
+    std::vector<uint8_t> rgbWithGradient(3 * nvox);
+    std::vector<uint16_t> gradient(nvox, 0xffff);
+    uint8_t* out = rgb.data();
+    Fuse::fuse(img.get(), colors, &out, nullptr, FuseKernel::get(mode));
+    out = rgbWithGradient.data();
+    uint16_t* grad = gradient.data();
+    Fuse::fuse(img.get(), colors, &out, &grad, FuseKernel::get(mode));
+    // the color output does not depend on whether the gradient is requested
+    REQUIRE(rgb == rgbWithGradient);
+
+    // separate pass over the fused intensity, scaled to 16 bits
+    std::vector<uint16_t> intensity(nvox);
+    for (size_t v = 0; v < nvox; ++v) {
+      intensity[v] = 257 * std::max(rgb[3 * v], std::max(rgb[3 * v + 1], rgb[3 * v + 2]));
+    }
+    Channelu16 ch(img->sizeX(), img->sizeY(), img->sizeZ(), intensity.data());
+    const uint16_t* expected =
+      ch.generateGradientMagnitudeVolume(img->physicalSizeX(), img->physicalSizeY(), img->physicalSizeZ());
+    REQUIRE(std::equal(gradient.begin(), gradient.end(), expected));
+  }
+}
+
+TEST_CASE("Incremental fuse only redoes what changed", "[fuse]")
+{
+  Logging::Enable(false);
+  auto img = makeImage(37, 21, 9, 3);
+  size_t nvox = (size_t)img->sizeX() * img->sizeY() * img->sizeZ();
+  std::vector<uint8_t> expected(3 * nvox);
+  std::vector<uint8_t> actual(3 * nvox, 0xff);
+  std::vector<glm::vec3> colors = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.5f }, { 0.25f, 0.25f, 1.0f } };
+
+  IncrementalFuse fuse;
+  REQUIRE(fuse.update(img.get(), colors, actual.data()));
+  referenceFuse(img.get(), colors, expected.data());
+  REQUIRE(expected == actual);
+
+  SECTION("Nothing changed")
+  {
+    REQUIRE(!fuse.update(img.get(), colors, actual.data()));
+    REQUIRE(expected == actual);
+  }
+
+  SECTION("Repeated edits of one channel")
+  {
+    for (float window : { 0.9f, 0.5f, 0.1f }) {
+      GradientData gd;
+      gd.m_activeMode = GradientEditMode::WINDOW_LEVEL;
+      gd.m_window = window;
+      img->channel(1)->generateFromGradientData(gd);
+      REQUIRE(fuse.update(img.get(), colors, actual.data()));
+      referenceFuse(img.get(), colors, expected.data());
+      REQUIRE(expected == actual);
+    }
+  }
+
+  SECTION("Edits alternating between channels")
+  {
+    colors[0] = glm::vec3(0.5f, 0.5f, 0.0f);
+    REQUIRE(fuse.update(img.get(), colors, actual.data()));
+    referenceFuse(img.get(), colors, expected.data());
+    REQUIRE(expected == actual);
+
+    colors[2] = glm::vec3(0.0f, 0.0f, 0.0f);
+    REQUIRE(fuse.update(img.get(), colors, actual.data()));
+    referenceFuse(img.get(), colors, expected.data());
+    REQUIRE(expected == actual);
+
+    colors[0] = glm::vec3(1.0f, 1.0f, 1.0f);
+    REQUIRE(fuse.update(img.get(), colors, actual.data()));
+    referenceFuse(img.get(), colors, expected.data());
+    REQUIRE(expected == actual);
+  }
+
+  SECTION("Several channels at once")
+  {
+    colors[0] = glm::vec3(0.0f, 0.0f, 0.0f);
+    colors[1] = glm::vec3(1.0f, 1.0f, 1.0f);
+    REQUIRE(fuse.update(img.get(), colors, actual.data()));
+    referenceFuse(img.get(), colors, expected.data());
+    REQUIRE(expected == actual);
+  }
+
+  SECTION("Non-decomposable kernels")
+  {
+    const FuseKernel& average = FuseKernel::get(FuseMode::AVERAGE);
+    // switching kernels refuses everything
+    REQUIRE(fuse.update(img.get(), colors, actual.data(), average));
+    referenceFuseMode(img.get(), colors, FuseMode::AVERAGE, expected.data());
+    REQUIRE(expected == actual);
+    REQUIRE(!fuse.update(img.get(), colors, actual.data(), average));
+
+    colors[1] = glm::vec3(0.5f, 0.5f, 0.5f);
+    REQUIRE(fuse.update(img.get(), colors, actual.data(), average));
+    referenceFuseMode(img.get(), colors, FuseMode::AVERAGE, expected.data());
+    REQUIRE(expected == actual);
+  }
+
+  SECTION("Additive kernel edits")
+  {
+    const FuseKernel& additive = FuseKernel::get(FuseMode::ADDITIVE);
+    for (float opacity : { 0.9f, 0.5f }) {
+      colors[2] = glm::vec3(0.25f, 0.25f, 1.0f) * opacity;
+      REQUIRE(fuse.update(img.get(), colors, actual.data(), additive));
+      referenceFuseMode(img.get(), colors, FuseMode::ADDITIVE, expected.data());
+      REQUIRE(expected == actual);
+    }
+  }
+
+  SECTION("A different image")
+  {
+    auto img2 = makeImage(37, 21, 9, 3);
+    REQUIRE(fuse.update(img2.get(), colors, actual.data()));
+  }
+}
+
+// hidden from the default run; select with `agave_test [benchmark]`
+TEST_CASE("Fuse benchmark", "[.][benchmark]")
+{
+  Logging::Enable(false);
+  auto img = makeImage(512, 512, 64, 6);
+  std::vector<glm::vec3> colors = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f },
+                                    { 1.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 1.0f }, { 1.0f, 0.0f, 1.0f } };
+  std::vector<uint8_t> rgb(3 * (size_t)img->sizeX() * img->sizeY() * img->sizeZ());
+
+  BENCHMARK("reference fuse 512x512x64x6")
+  {
+    referenceFuse(img.get(), colors, rgb.data());
+    return rgb[0];
+  };
+  BENCHMARK("Fuse::fuse 512x512x64x6")
+  {
+    uint8_t* out = rgb.data();
+    Fuse::fuse(img.get(), colors, &out, nullptr);
+    return out[0];
+  };
+}
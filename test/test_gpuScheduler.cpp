@@ -0,0 +1,97 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/gpuScheduler.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Sessions are spread over the contexts", "[gpuScheduler]")
+{
+  GpuScheduler scheduler(2);
+  REQUIRE(scheduler.contextCount() == 2);
+  REQUIRE(scheduler.addSession(1) == 0);
+  REQUIRE(scheduler.addSession(2) == 1);
+  REQUIRE(scheduler.addSession(3) == 0);
+  // a session stays where it is
+  REQUIRE(scheduler.addSession(2) == 1);
+  REQUIRE(scheduler.contextOf(3) == 0);
+
+  scheduler.removeSession(2);
+  REQUIRE(scheduler.contextOf(2) == -1);
+  REQUIRE(scheduler.addSession(4) == 1);
+
+  REQUIRE(GpuScheduler(0).contextCount() == 1);
+}
+
+TEST_CASE("Interactive turns go first, by deadline, then background turns round robin", "[gpuScheduler]")
+{
+  std::vector<GpuScheduler::Waiter> waiters = {
+    { 1, false, 0.0, 1, 5 },
+    { 2, false, 0.0, 2, 3 },
+    { 3, true, 2.0, 3, 1 },
+    { 4, true, 1.0, 4, 9 },
+  };
+  REQUIRE(GpuScheduler::pickNext(waiters) == 3);
+  waiters.erase(waiters.begin() + 3);
+  REQUIRE(GpuScheduler::pickNext(waiters) == 2);
+  waiters.erase(waiters.begin() + 2);
+  // the session served least recently
+  REQUIRE(GpuScheduler::pickNext(waiters) == 1);
+
+  // otherwise in order of arrival
+  std::vector<GpuScheduler::Waiter> ties = { { 1, true, 1.0, 7, 0 }, { 2, true, 1.0, 6, 0 } };
+  REQUIRE(GpuScheduler::pickNext(ties) == 1);
+}
+
+TEST_CASE("New sessions go to the least loaded device", "[gpuScheduler]")
+{
+  const size_t MB = 1024 * 1024;
+  // queues and memory count alike
+  std::vector<GpuScheduler::DeviceLoad> devices = { { 3, 100 * MB, 2 }, { 1, 300 * MB, 1 }, { 0, 100 * MB, 3 } };
+  REQUIRE(GpuScheduler::pickDevice(devices) == 2);
+  devices[2].memoryBytes = 600 * MB;
+  REQUIRE(GpuScheduler::pickDevice(devices) == 1);
+
+  // idle devices by their sessions, then in order
+  std::vector<GpuScheduler::DeviceLoad> idle = { { 0, 0, 2 }, { 0, 0, 1 }, { 0, 0, 1 } };
+  REQUIRE(GpuScheduler::pickDevice(idle) == 1);
+  REQUIRE(GpuScheduler::pickDevice({ { 0, 0, 0 } }) == 0);
+}
+
+TEST_CASE("Turns nest and are handed to waiting sessions in order", "[gpuScheduler]")
+{
+  GpuScheduler scheduler;
+  scheduler.acquire(1);
+  scheduler.acquire(1);
+  scheduler.release(1);
+
+  std::mutex orderMutex;
+  std::vector<uint64_t> order;
+  auto take = [&](uint64_t session, bool interactive, double deadline) {
+    scheduler.acquire(session, interactive, deadline);
+    {
+      std::lock_guard<std::mutex> lock(orderMutex);
+      order.push_back(session);
+    }
+    scheduler.release(session);
+  };
+  std::vector<std::thread> threads;
+  threads.emplace_back(take, 2, false, 0.0);
+  threads.emplace_back(take, 3, true, 2.0);
+  threads.emplace_back(take, 4, true, 1.0);
+  // a waiter is counted once it waits
+  while (scheduler.waiting(0) < 3) {
+    std::this_thread::yield();
+  }
+  {
+    std::lock_guard<std::mutex> lock(orderMutex);
+    REQUIRE(order.empty());
+  }
+
+  scheduler.release(1);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(order == std::vector<uint64_t>{ 4, 3, 2 });
+}
@@ -0,0 +1,82 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "renderlib/ImageXYZC.h"
+
+#include <vector>
+
+TEST_CASE("Gradient magnitude volume is correct", "[gradient]")
+{
+  static const uint32_t X = 5, Y = 4, Z = 3;
+  // ramp along x: value = 10 * x
+  std::vector<uint16_t> data(X * Y * Z);
+  for (uint32_t z = 0; z < Z; ++z) {
+    for (uint32_t y = 0; y < Y; ++y) {
+      for (uint32_t x = 0; x < X; ++x) {
+        data[z * X * Y + y * X + x] = (uint16_t)(10 * x);
+      }
+    }
+  }
+
+  SECTION("Isotropic spacing")
+  {
+    Channelu16 ch(X, Y, Z, data.data());
+    uint16_t* g = ch.generateGradientMagnitudeVolume(1.0f, 1.0f, 1.0f);
+    REQUIRE(g == ch.m_gradientMagnitudePtr);
+    for (uint32_t z = 0; z < Z; ++z) {
+      for (uint32_t y = 0; y < Y; ++y) {
+        const uint16_t* row = g + z * X * Y + y * X;
+        // one-sided differences at the x boundaries
+        REQUIRE(row[0] == 10);
+        REQUIRE(row[X - 1] == 10);
+        for (uint32_t x = 1; x < X - 1; ++x) {
+          REQUIRE(row[x] == 20);
+        }
+      }
+    }
+  }
+
+  SECTION("Anisotropic spacing scales relative to the largest spacing")
+  {
+    Channelu16 ch(X, Y, Z, data.data());
+    uint16_t* g = ch.generateGradientMagnitudeVolume(1.0f, 1.0f, 2.0f);
+    REQUIRE(g[1] == 40);
+    // regenerating replaces the previous volume
+    g = ch.generateGradientMagnitudeVolume(2.0f, 2.0f, 2.0f);
+    REQUIRE(g[1] == 20);
+  }
+
+  SECTION("Constant volume has no gradient")
+  {
+    std::vector<uint16_t> flat(X * Y * Z, 1234);
+    Channelu16 ch(X, Y, Z, flat.data());
+    uint16_t* g = ch.generateGradientMagnitudeVolume(1.0f, 1.0f, 1.0f);
+    for (size_t i = 0; i < flat.size(); ++i) {
+      REQUIRE(g[i] == 0);
+    }
+  }
+
+  SECTION("Magnitude saturates instead of wrapping")
+  {
+    std::vector<uint16_t> step = { 0, 65535, 0 };
+    Channelu16 ch(3, 1, 1, step.data());
+    uint16_t* g = ch.generateGradientMagnitudeVolume(0.5f, 1.0f, 1.0f);
+    REQUIRE(g[0] == 65535);
+  }
+}
+
+// hidden from the default run; select with `agave_test [benchmark]`
+TEST_CASE("Gradient magnitude volume benchmark", "[.][benchmark]")
+{
+  static const uint32_t X = 512, Y = 512, Z = 64;
+  std::vector<uint16_t> data((size_t)X * Y * Z);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (uint16_t)((i * 2654435761u) >> 16);
+  }
+  Channelu16 ch(X, Y, Z, data.data());
+
+  BENCHMARK("generateGradientMagnitudeVolume 512x512x64")
+  {
+    return ch.generateGradientMagnitudeVolume(1.0f, 1.0f, 3.0f);
+  };
+}
@@ -1,6 +1,11 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include "renderlib/Histogram.h"
+#include "renderlib/ImageXYZC.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
 
 TEST_CASE("Histogram edge cases are stable", "[histogram]")
 {
@@ -137,3 +142,85 @@ TEST_CASE("Histogram LUT generation is working", "[histogram]")
     REQUIRE(lut[197] == 0.75);
   }
 }
+
+TEST_CASE("Histogram subsampling", "[histogram]")
+{
+  // ramp 0..999 repeated, with a single outlier that a strided sample skips
+  std::vector<uint16_t> data(100000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (uint16_t)(i % 1000);
+  }
+  data[2] = 5000;
+
+  SECTION("Stride selection")
+  {
+    REQUIRE(Histogram::strideForSampleCount(100, 0) == 1);
+    REQUIRE(Histogram::strideForSampleCount(100, 1000) == 1);
+    REQUIRE(Histogram::strideForSampleCount(100000, 10000) == 11);
+    REQUIRE(Histogram::strideForSampleCount(100000, 20000) == 5);
+  }
+
+  SECTION("Sampled histogram keeps the exact data range")
+  {
+    Histogram full(data.data(), data.size());
+    Histogram sampled(data.data(), data.size(), 512, 11);
+
+    REQUIRE(sampled._pixelCount == (data.size() + 10) / 11);
+    REQUIRE(sampled._ccounts[sampled._bins.size() - 1] == sampled._pixelCount);
+    REQUIRE(sampled._dataMin == full._dataMin);
+    REQUIRE(sampled._dataMax == full._dataMax);
+
+    // the distribution is close: compare percentile based window/level
+    float fullWindow, fullLevel, sampledWindow, sampledLevel;
+    full.computeWindowLevelFromPercentiles(0.1f, 0.9f, fullWindow, fullLevel);
+    sampled.computeWindowLevelFromPercentiles(0.1f, 0.9f, sampledWindow, sampledLevel);
+    REQUIRE(std::abs(fullWindow - sampledWindow) < 0.01f);
+    REQUIRE(std::abs(fullLevel - sampledLevel) < 0.01f);
+  }
+}
+
+TEST_CASE("Channel histograms are reused across timepoints", "[histogram]")
+{
+  static const uint32_t X = 16, Y = 8, Z = 4;
+  auto makeImage = [](uint16_t lo, uint16_t hi) {
+    uint16_t* data = new uint16_t[X * Y * Z];
+    for (size_t i = 0; i < X * Y * Z; ++i) {
+      data[i] = (uint16_t)(lo + i % (hi - lo + 1));
+    }
+    return std::make_shared<ImageXYZC>(X, Y, Z, 1, ImageXYZC::IN_MEMORY_BPP, reinterpret_cast<uint8_t*>(data));
+  };
+
+  auto t0 = makeImage(10, 200);
+  REQUIRE(t0->channel(0)->m_min == 10);
+  REQUIRE(t0->channel(0)->m_max == 200);
+
+  ChannelStatsOptions stats;
+  stats.histogramSource = t0.get();
+
+  SECTION("Data within the previous range reuses its histogram")
+  {
+    ScopedChannelStatsOptions scoped(stats);
+    auto t1 = makeImage(20, 100);
+    REQUIRE(t1->channel(0)->m_min == 10);
+    REQUIRE(t1->channel(0)->m_max == 200);
+    REQUIRE(t1->channel(0)->m_histogram._bins == t0->channel(0)->m_histogram._bins);
+  }
+
+  SECTION("Data outside the previous range gets a new histogram")
+  {
+    ScopedChannelStatsOptions scoped(stats);
+    auto t1 = makeImage(0, 100);
+    REQUIRE(t1->channel(0)->m_min == 0);
+    REQUIRE(t1->channel(0)->m_max == 100);
+  }
+
+  SECTION("Options only apply within their scope")
+  {
+    {
+      ScopedChannelStatsOptions scoped(stats);
+    }
+    auto t1 = makeImage(20, 100);
+    REQUIRE(t1->channel(0)->m_min == 20);
+    REQUIRE(t1->channel(0)->m_max == 100);
+  }
+}
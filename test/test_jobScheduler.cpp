@@ -0,0 +1,87 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "renderlib/JobScheduler.h"
+
+#include <atomic>
+#include <future>
+
+TEST_CASE("JobScheduler runs jobs and reports progress", "[jobScheduler]")
+{
+  JobScheduler jobs;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::promise<void> halfway;
+
+  auto token = jobs.submit("load", [released, &halfway](JobToken& token) {
+    token.setProgress(0.5f);
+    halfway.set_value();
+    released.wait();
+  });
+  halfway.get_future().wait();
+  REQUIRE(jobs.progress("load") == 0.5f);
+  REQUIRE(jobs.activeJobs() == 1);
+
+  release.set_value();
+  jobs.waitForAll();
+  REQUIRE(jobs.activeJobs() == 0);
+  REQUIRE(jobs.progress("load") == -1.0f);
+  REQUIRE(token->progress() == 1.0f);
+  REQUIRE(!token->isCancelled());
+}
+
+TEST_CASE("JobScheduler cancels superseded jobs", "[jobScheduler]")
+{
+  JobScheduler jobs;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::promise<void> started;
+  std::atomic<bool> sawCancel(false);
+
+  // the first job is running when it is superseded, and sees the cancellation at its next check
+  auto first = jobs.submit("load", [released, &started, &sawCancel](JobToken& token) {
+    started.set_value();
+    released.wait();
+    sawCancel = token.isCancelled();
+  });
+  started.get_future().wait();
+
+  std::atomic<int> runs(0);
+  auto second = jobs.submit("load", [&runs](JobToken&) { runs++; });
+  auto other = jobs.submit("other", [&runs](JobToken&) { runs++; });
+  REQUIRE(first->isCancelled());
+  REQUIRE(!second->isCancelled());
+  REQUIRE(!other->isCancelled());
+
+  release.set_value();
+  jobs.waitForAll();
+  REQUIRE(sawCancel);
+  REQUIRE(runs == 2);
+
+  SECTION("Cancelled jobs that have not started never run")
+  {
+    // a single worker, so that nothing else starts while it is busy
+    ThreadPool pool(1);
+    JobScheduler queued(pool);
+    std::promise<void> releaseQueue;
+    std::shared_future<void> queueReleased = releaseQueue.get_future().share();
+    std::promise<void> blocking;
+    auto blocker = queued.submit("blocker", [queueReleased, &blocking](JobToken&) {
+      blocking.set_value();
+      queueReleased.wait();
+    });
+    blocking.get_future().wait();
+
+    std::atomic<int> cancelledRuns(0);
+    auto a = queued.submit("a", [&cancelledRuns](JobToken&) { cancelledRuns++; });
+    auto b = queued.submit("b", [&cancelledRuns](JobToken&) { cancelledRuns++; });
+    queued.cancel("a");
+    queued.cancelAll();
+    REQUIRE(a->isCancelled());
+    REQUIRE(b->isCancelled());
+    REQUIRE(blocker->isCancelled());
+
+    releaseQueue.set_value();
+    queued.waitForAll();
+    REQUIRE(cancelledRuns == 0);
+  }
+}
@@ -0,0 +1,77 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "renderlib/ImageXYZC.h"
+#include "renderlib/MemoryAccounting.h"
+
+using namespace MemoryAccounting;
+
+TEST_CASE("Allocations add to their owner and category until destroyed", "[memoryAccounting]")
+{
+  Usage before = total();
+  {
+    Allocation voxels(Category::VoxelData, "dataset:test_a");
+    voxels.set(1000);
+    Allocation fb(Category::Framebuffers, "session:test_a");
+    fb.set(64);
+
+    REQUIRE(ownerUsage("dataset:test_a")[Category::VoxelData] == 1000);
+    REQUIRE(ownerUsage("dataset:test_a").total() == 1000);
+    REQUIRE(ownerUsage("session:test_a")[Category::Framebuffers] == 64);
+    REQUIRE(total()[Category::VoxelData] == before[Category::VoxelData] + 1000);
+    REQUIRE(total().total() == before.total() + 1064);
+
+    // resizing replaces the previous size
+    voxels.set(250);
+    REQUIRE(ownerUsage("dataset:test_a").total() == 250);
+
+    voxels.reassign(Category::Caches, "image cache:test_a");
+    REQUIRE(ownerUsage("dataset:test_a").total() == 0);
+    REQUIRE(ownerUsage("image cache:test_a")[Category::Caches] == 250);
+    REQUIRE(usageByOwner().count("image cache:test_a") == 1);
+  }
+  REQUIRE(total().total() == before.total());
+  // owners without memory are not listed
+  REQUIRE(usageByOwner().count("session:test_a") == 0);
+}
+
+TEST_CASE("Allocations take the owner of the enclosing scope", "[memoryAccounting]")
+{
+  Allocation outside(Category::DerivedVolumes);
+  REQUIRE(outside.owner() == currentOwner());
+  {
+    ScopedOwner session("session:test_b");
+    {
+      ScopedOwner dataset("dataset:test_b");
+      // the image takes ownership of its data
+      ImageXYZC image(4, 4, 2, 3, ImageXYZC::IN_MEMORY_BPP, new uint8_t[4 * 4 * 2 * 3 * 2]());
+      REQUIRE(ownerUsage("dataset:test_b")[Category::VoxelData] == image.size());
+      Allocation lut(Category::DerivedVolumes);
+      REQUIRE(lut.owner() == "dataset:test_b");
+    }
+    REQUIRE(ownerUsage("dataset:test_b")[Category::VoxelData] == 0);
+    REQUIRE(currentOwner() == "session:test_b");
+  }
+  REQUIRE(currentOwner() == outside.owner());
+}
+
+TEST_CASE("Budgets limit what fits", "[memoryAccounting]")
+{
+  Allocation textures(Category::GpuTextures, "session:test_c");
+  textures.set(100);
+  uint64_t used = total()[Category::GpuTextures];
+
+  REQUIRE(fits(Category::GpuTextures, 1ull << 40));
+  setBudget(Category::GpuTextures, used + 50);
+  REQUIRE(budget(Category::GpuTextures) == used + 50);
+  REQUIRE(fits(Category::GpuTextures, 50));
+  REQUIRE(!fits(Category::GpuTextures, 51));
+  // other categories are not limited by it
+  REQUIRE(fits(Category::Framebuffers, 51));
+
+  setBudget(Category::GpuTextures, 0);
+  setTotalBudget(total().total() + 10);
+  REQUIRE(!fits(Category::Framebuffers, 11));
+  REQUIRE(fits(Category::GpuTextures, 10));
+  setTotalBudget(0);
+  REQUIRE(fits(Category::Framebuffers, 1ull << 40));
+}
@@ -0,0 +1,105 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "renderlib/Metrics.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Metrics series are shared by name and labels", "[metrics]")
+{
+  Metrics::clear();
+
+  auto a = Metrics::counter("test_frames_total", "Frames", { { "session", "1" } });
+  auto b = Metrics::counter("test_frames_total", "Frames", { { "session", "1" } });
+  auto c = Metrics::counter("test_frames_total", "Frames", { { "session", "2" } });
+  REQUIRE(a == b);
+  REQUIRE(a != c);
+
+  a->add();
+  b->add(2.0);
+  REQUIRE(a->value() == 3.0);
+  REQUIRE(c->value() == 0.0);
+
+  // a name keeps the type it was first registered with
+  auto wrongType = Metrics::gauge("test_frames_total", "Frames", { { "session", "1" } });
+  wrongType->set(42.0);
+  REQUIRE(Metrics::prometheusText().find("42") == std::string::npos);
+
+  Metrics::clear();
+}
+
+TEST_CASE("Metrics are exported in the Prometheus text format", "[metrics]")
+{
+  Metrics::clear();
+
+  Metrics::counter("test_bytes_total", "Bytes sent", { { "session", "a\"b" } })->add(1536.0);
+  Metrics::gauge("test_queue_depth", "Queued requests")->set(3.0);
+  auto latency = Metrics::histogram("test_latency_seconds", "Latency", { { "session", "1" } }, { 0.01, 0.1, 1.0 });
+  latency->observe(0.005);
+  latency->observe(0.1);
+  latency->observe(0.5);
+  latency->observe(20.0);
+
+  std::string text = Metrics::prometheusText();
+  REQUIRE(text.find("# HELP test_bytes_total Bytes sent\n# TYPE test_bytes_total counter\n") != std::string::npos);
+  REQUIRE(text.find("test_bytes_total{session=\"a\\\"b\"} 1536\n") != std::string::npos);
+  REQUIRE(text.find("# TYPE test_queue_depth gauge\ntest_queue_depth 3\n") != std::string::npos);
+
+  // buckets are cumulative, and an observation equal to a bound falls in that bucket
+  REQUIRE(text.find("# TYPE test_latency_seconds histogram\n") != std::string::npos);
+  REQUIRE(text.find("test_latency_seconds_bucket{session=\"1\",le=\"0.01\"} 1\n") != std::string::npos);
+  REQUIRE(text.find("test_latency_seconds_bucket{session=\"1\",le=\"0.1\"} 2\n") != std::string::npos);
+  REQUIRE(text.find("test_latency_seconds_bucket{session=\"1\",le=\"1\"} 3\n") != std::string::npos);
+  REQUIRE(text.find("test_latency_seconds_bucket{session=\"1\",le=\"+Inf\"} 4\n") != std::string::npos);
+  REQUIRE(text.find("test_latency_seconds_sum{session=\"1\"} 20.605\n") != std::string::npos);
+  REQUIRE(text.find("test_latency_seconds_count{session=\"1\"} 4\n") != std::string::npos);
+
+  Metrics::clear();
+}
+
+TEST_CASE("Removed series are no longer exported but stay usable", "[metrics]")
+{
+  Metrics::clear();
+
+  auto kept = Metrics::gauge("test_gpu_bytes", "GPU bytes", { { "session", "1" } });
+  auto removed = Metrics::gauge("test_gpu_bytes", "GPU bytes", { { "session", "2" } });
+  kept->set(1.0);
+  removed->set(2.0);
+  Metrics::removeSeries("session", "2");
+  removed->set(3.0);
+
+  std::string text = Metrics::prometheusText();
+  REQUIRE(text.find("test_gpu_bytes{session=\"1\"} 1\n") != std::string::npos);
+  REQUIRE(text.find("session=\"2\"") == std::string::npos);
+
+  // every series of a family gone: nothing at all is exported for it
+  Metrics::removeSeries("session", "1");
+  REQUIRE(Metrics::prometheusText().find("test_gpu_bytes") == std::string::npos);
+
+  Metrics::clear();
+}
+
+TEST_CASE("Metrics can be updated from many threads", "[metrics]")
+{
+  Metrics::clear();
+
+  auto frames = Metrics::counter("test_frames_total", "Frames");
+  auto latency = Metrics::histogram("test_latency_seconds", "Latency");
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 1000; ++i) {
+        frames->add();
+        latency->observe(0.002);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(frames->value() == 4000.0);
+  REQUIRE(latency->snapshot().count == 4000);
+
+  Metrics::clear();
+}
@@ -0,0 +1,161 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/renderrequest.h"
+#include "../agave_app/requestQueue.h"
+#include "renderlib/command.h"
+
+#include <vector>
+
+namespace {
+RenderRequest*
+setterRequest(float window)
+{
+  std::vector<Command*> cmds;
+  cmds.push_back(new SetWindowLevelCommand({ 0, window, 0.5f }));
+  return new RenderRequest(nullptr, cmds);
+}
+
+RenderRequest*
+refinement()
+{
+  std::vector<Command*> cmds;
+  cmds.push_back(new RequestRedrawCommand({}));
+  RenderRequest* r = new RenderRequest(nullptr, cmds);
+  r->setRefinement(true);
+  return r;
+}
+
+// the windows set by the commands of request from index start on
+void
+runSetters(RenderRequest* request, size_t start, std::vector<float>& windows)
+{
+  std::vector<Command*> cmds = request->getParameters();
+  for (size_t i = start; i < cmds.size(); ++i) {
+    if (cmds[i]->id() == SetWindowLevelCommand::m_ID) {
+      windows.push_back(static_cast<SetWindowLevelCommand*>(cmds[i])->m_data.m_window);
+    }
+  }
+}
+} // namespace
+
+TEST_CASE("Requests wait behind a request waiting for its background job", "[requestQueue]")
+{
+  RequestQueue queue;
+
+  // load_data then set_window_level, followed by two more set_window_level requests
+  std::vector<Command*> cmds;
+  cmds.push_back(new LoadDataCommand({ "volume.ome.tif", 0, 0, 0, {}, 0, 0, 0, 0, 0, 0 }));
+  cmds.push_back(new SetWindowLevelCommand({ 0, 1.0f, 0.5f }));
+  RenderRequest* load = new RenderRequest(nullptr, cmds);
+  queue.push(load);
+  REQUIRE(queue.takeNext() == load);
+  // load_data moves to the background; the request resumes at its second command
+  queue.hold(true);
+
+  RenderRequest* first = setterRequest(2.0f);
+  RenderRequest* second = setterRequest(3.0f);
+  queue.push(first);
+  queue.push(second);
+  REQUIRE(queue.count() == 2);
+  REQUIRE(!queue.hasNext());
+  REQUIRE(queue.takeNext() == nullptr);
+
+  // the stream goes on refining the current volume
+  RenderRequest* redraw = refinement();
+  queue.push(redraw);
+  REQUIRE(queue.next() == redraw);
+  REQUIRE(queue.takeNext() == redraw);
+  delete redraw;
+  REQUIRE(!queue.hasNext());
+
+  // the job is applied
+  queue.pushFront(load);
+  queue.release();
+
+  std::vector<float> windows;
+  RenderRequest* r = queue.takeNext();
+  REQUIRE(r == load);
+  runSetters(r, 1, windows);
+  delete r;
+  while (queue.hasNext()) {
+    r = queue.takeNext();
+    runSetters(r, 0, windows);
+    delete r;
+  }
+  // the newest setting is the last one applied
+  REQUIRE(windows == std::vector<float>({ 1.0f, 2.0f, 3.0f }));
+  REQUIRE(queue.isEmpty());
+  REQUIRE(queue.totalDuration() == 0);
+}
+
+TEST_CASE("A client's request drops the queued refinements unless the queue is held", "[requestQueue]")
+{
+  RequestQueue queue;
+  queue.push(refinement());
+  RenderRequest* setter = setterRequest(2.0f);
+  queue.push(setter);
+  REQUIRE(queue.count() == 1);
+  REQUIRE(queue.next() == setter);
+
+  queue.hold(true);
+  RenderRequest* redraw = refinement();
+  queue.push(redraw);
+  queue.push(setterRequest(3.0f));
+  REQUIRE(queue.count() == 3);
+  REQUIRE(queue.next() == redraw);
+
+  queue.release();
+  REQUIRE(queue.next() == setter);
+  REQUIRE(queue.remove(setter));
+  REQUIRE(!queue.remove(setter));
+  delete setter;
+  REQUIRE(queue.count() == 2);
+}
+
+TEST_CASE("A newer load supersedes the background job the queue is held behind", "[requestQueue]")
+{
+  RequestQueue queue;
+
+  std::vector<Command*> cmds;
+  cmds.push_back(new LoadDataCommand({ "first.ome.tif", 0, 0, 0, {}, 0, 0, 0, 0, 0, 0 }));
+  RenderRequest* firstLoad = new RenderRequest(nullptr, cmds);
+  queue.push(firstLoad);
+  REQUIRE(queue.takeNext() == firstLoad);
+  queue.hold(true);
+
+  RenderRequest* setter = setterRequest(2.0f);
+  REQUIRE(!queue.supersedesHeld(setter));
+  queue.push(setter);
+  // another time of the data still loading waits for it
+  cmds = { new SetTimeCommand({ 3 }) };
+  RenderRequest* time = new RenderRequest(nullptr, cmds);
+  REQUIRE(!queue.supersedesHeld(time));
+  queue.push(time);
+  REQUIRE(!queue.hasNext());
+
+  cmds = { new LoadDataCommand({ "second.ome.tif", 0, 0, 0, {}, 0, 0, 0, 0, 0, 0 }) };
+  RenderRequest* secondLoad = new RenderRequest(nullptr, cmds);
+  REQUIRE(queue.supersedesHeld(secondLoad));
+  // the first load is cancelled, and its request answered with the next image
+  delete firstLoad;
+  queue.release();
+  queue.push(secondLoad);
+
+  // the requests held behind the first load run, then the second load
+  REQUIRE(queue.takeNext() == setter);
+  REQUIRE(queue.takeNext() == time);
+  REQUIRE(queue.takeNext() == secondLoad);
+  delete setter;
+  delete time;
+
+  // behind a pending set_time, a newer set_time supersedes it too
+  queue.hold(false);
+  cmds = { new SetTimeCommand({ 4 }) };
+  RenderRequest* newerTime = new RenderRequest(nullptr, cmds);
+  REQUIRE(queue.supersedesHeld(newerTime));
+  REQUIRE(queue.supersedesHeld(secondLoad));
+  queue.release();
+  REQUIRE(!queue.supersedesHeld(newerTime));
+  delete newerTime;
+  delete secondLoad;
+}
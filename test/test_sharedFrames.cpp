@@ -0,0 +1,76 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/sharedFrames.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+
+static SharedFrameRing::Frame
+writeFrame(SharedFrameRing& ring, const std::vector<uint8_t>& data)
+{
+  uint8_t* slot = ring.beginWrite(data.size());
+  REQUIRE(slot != nullptr);
+  memcpy(slot, data.data(), data.size());
+  return ring.endWrite();
+}
+
+TEST_CASE("Frames are read back from shared memory until their slot is reused", "[sharedFrames]")
+{
+  std::string prefix = "/agave-test-" + std::to_string(getpid());
+  SharedFrameRing ring(prefix, 2, "test:sharedFrames");
+
+  std::vector<uint8_t> first(1000, 1);
+  SharedFrameRing::Frame frame1 = writeFrame(ring, first);
+  REQUIRE(frame1.name == prefix + "-0");
+  REQUIRE(frame1.slot == 0);
+  REQUIRE(frame1.size == first.size());
+  REQUIRE(frame1.sequence % 2 == 0);
+
+  std::vector<uint8_t> out;
+  REQUIRE(SharedFrameRing::read(frame1, out));
+  REQUIRE(out == first);
+
+  std::vector<uint8_t> second(500, 2);
+  SharedFrameRing::Frame frame2 = writeFrame(ring, second);
+  REQUIRE(frame2.slot == 1);
+  REQUIRE(SharedFrameRing::read(frame2, out));
+  REQUIRE(out == second);
+  REQUIRE(SharedFrameRing::read(frame1, out));
+
+  // the ring wraps around onto the first frame
+  SharedFrameRing::Frame frame3 = writeFrame(ring, std::vector<uint8_t>(10, 3));
+  REQUIRE(frame3.slot == 0);
+  REQUIRE(frame3.sequence > frame1.sequence);
+  REQUIRE_FALSE(SharedFrameRing::read(frame1, out));
+  REQUIRE(SharedFrameRing::read(frame3, out));
+  REQUIRE(out == std::vector<uint8_t>(10, 3));
+
+  // a frame too large for the slots moves the ring to a new segment
+  std::vector<uint8_t> large(100000, 4);
+  SharedFrameRing::Frame frame4 = writeFrame(ring, large);
+  REQUIRE(frame4.name == prefix + "-1");
+  REQUIRE(SharedFrameRing::read(frame4, out));
+  REQUIRE(out == large);
+  // the old segment stays linked until the next one, for frames announced in it that are still on their way
+  REQUIRE(SharedFrameRing::read(frame2, out));
+  REQUIRE(out == second);
+  SharedFrameRing::Frame frame5 = writeFrame(ring, std::vector<uint8_t>(1000000, 5));
+  REQUIRE(frame5.name == prefix + "-2");
+  REQUIRE_FALSE(SharedFrameRing::read(frame2, out));
+  REQUIRE(SharedFrameRing::read(frame4, out));
+
+  // a ring unlinks its previous segment too
+  SharedFrameRing::Frame small;
+  {
+    SharedFrameRing gone(prefix + "-gone", 2, "test:sharedFrames");
+    small = writeFrame(gone, second);
+    frame4 = writeFrame(gone, large);
+  }
+  REQUIRE_FALSE(SharedFrameRing::read(small, out));
+  REQUIRE_FALSE(SharedFrameRing::read(frame4, out));
+}
+#endif
@@ -0,0 +1,76 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/streamFormat.h"
+
+#include <cstring>
+#include <vector>
+
+static uint32_t
+readUint32(const std::vector<uint8_t>& bytes, size_t offset)
+{
+  return bytes[offset] | (bytes[offset + 1] << 8) | (bytes[offset + 2] << 16) | ((uint32_t)bytes[offset + 3] << 24);
+}
+
+TEST_CASE("Format names parse and round trip", "[streamFormat]")
+{
+  StreamFormat::Format format = StreamFormat::Format::Png;
+  REQUIRE(StreamFormat::parse("jpg", format));
+  REQUIRE(format == StreamFormat::Format::Jpeg);
+  for (StreamFormat::Format f : { StreamFormat::Format::Jpeg,
+                                  StreamFormat::Format::Png,
+                                  StreamFormat::Format::Webp,
+                                  StreamFormat::Format::Bgra8,
+                                  StreamFormat::Format::Rgba32f }) {
+    REQUIRE(StreamFormat::parse(StreamFormat::name(f), format));
+    REQUIRE(format == f);
+  }
+  // unknown names leave the format alone
+  REQUIRE_FALSE(StreamFormat::parse("gif", format));
+  REQUIRE(format == StreamFormat::Format::Rgba32f);
+
+  REQUIRE(StreamFormat::autoFormat(true) == StreamFormat::Format::Bgra8);
+  REQUIRE(StreamFormat::autoFormat(false) == StreamFormat::Format::Jpeg);
+  REQUIRE(StreamFormat::isRaw(StreamFormat::Format::Rgba32f));
+  REQUIRE_FALSE(StreamFormat::isRaw(StreamFormat::Format::Webp));
+}
+
+TEST_CASE("Raw frames carry a header and unpadded rows", "[streamFormat]")
+{
+  const uint32_t width = 3;
+  const uint32_t height = 2;
+  // rows padded to 16 bytes
+  const size_t bytesPerLine = 16;
+  std::vector<uint8_t> pixels(bytesPerLine * height, 0xee);
+  for (uint32_t y = 0; y < height; ++y) {
+    for (size_t i = 0; i < width * 4; ++i) {
+      pixels[y * bytesPerLine + i] = (uint8_t)(y * 100 + i);
+    }
+  }
+
+  std::vector<uint8_t> out(StreamFormat::rawSize(StreamFormat::Format::Bgra8, width, height));
+  REQUIRE(out.size() == StreamFormat::RAW_HEADER_BYTES + width * height * 4);
+  StreamFormat::packRaw(StreamFormat::Format::Bgra8, width, height, pixels.data(), bytesPerLine, out.data());
+  REQUIRE(memcmp(out.data(), StreamFormat::RAW_MAGIC, 4) == 0);
+  REQUIRE(readUint32(out, 4) == width);
+  REQUIRE(readUint32(out, 8) == height);
+  REQUIRE(readUint32(out, 12) == 0);
+  const uint8_t* rows = out.data() + StreamFormat::RAW_HEADER_BYTES;
+  REQUIRE(rows[0] == 0);
+  REQUIRE(rows[width * 4 - 1] == width * 4 - 1);
+  REQUIRE(rows[width * 4] == 100);
+  REQUIRE(rows[2 * width * 4 - 1] == 100 + width * 4 - 1);
+
+  std::vector<float> hdr(width * height * 4, 0.5f);
+  hdr.back() = 2.0f;
+  out.resize(StreamFormat::rawSize(StreamFormat::Format::Rgba32f, width, height));
+  StreamFormat::packRaw(StreamFormat::Format::Rgba32f,
+                        width,
+                        height,
+                        reinterpret_cast<const uint8_t*>(hdr.data()),
+                        width * 16,
+                        out.data());
+  REQUIRE(readUint32(out, 12) == 1);
+  float last = 0.0f;
+  memcpy(&last, out.data() + out.size() - 4, 4);
+  REQUIRE(last == 2.0f);
+}
@@ -0,0 +1,59 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../agave_app/streamQuality.h"
+
+TEST_CASE("Stream quality rises with the iterations", "[streamQuality]")
+{
+  StreamQuality::Options options;
+  options.minQuality = 40;
+  options.maxQuality = 90;
+  options.settleIterations = 11;
+  options.earlyScale = 0.5f;
+  options.earlyIterations = 2;
+  options.maxFramesPerSecond = 0.0;
+  StreamQuality quality(options);
+
+  StreamQuality::Encoding first = quality.decide(1, false, 0.0);
+  REQUIRE(first.send);
+  REQUIRE(first.quality == 40);
+  REQUIRE(first.scale == 0.5f);
+  REQUIRE(!first.lossless);
+
+  StreamQuality::Encoding middle = quality.decide(6, false, 0.0);
+  REQUIRE(middle.quality == 65);
+  REQUIRE(middle.scale == 1.0f);
+  REQUIRE(quality.decide(11, false, 0.0).quality == 90);
+  REQUIRE(quality.decide(500, false, 0.0).quality == 90);
+
+  // not a progressive renderer
+  REQUIRE(quality.decide(0, false, 0.0).quality == 90);
+  REQUIRE(quality.decide(0, false, 0.0).scale == 1.0f);
+
+  // the last image is at full quality
+  REQUIRE(quality.decide(1, true, 0.0).quality == 90);
+  options.losslessLast = true;
+  REQUIRE(StreamQuality(options).decide(3, true, 0.0).lossless);
+}
+
+TEST_CASE("Stream images are throttled to the frame rate and bandwidth", "[streamQuality]")
+{
+  StreamQuality::Options options;
+  options.maxFramesPerSecond = 10.0;
+  options.maxBytesPerSecond = 1000.0;
+  StreamQuality quality(options);
+
+  REQUIRE(quality.decide(1, false, 0.0).send);
+  quality.sent(100, 0.0);
+  // too soon after the last image
+  REQUIRE(!quality.decide(2, false, 0.05).send);
+  // the last image of a stream always goes
+  REQUIRE(quality.decide(2, true, 0.05).send);
+  quality.sent(100, 0.05);
+
+  REQUIRE(quality.decide(3, false, 0.3).send);
+  // a burst beyond the bandwidth holds images back until it is paid off
+  quality.sent(3000, 0.3);
+  REQUIRE(!quality.decide(4, false, 0.5).send);
+  REQUIRE(!quality.decide(4, false, 2.0).send);
+  REQUIRE(quality.decide(4, false, 3.5).send);
+}
@@ -0,0 +1,113 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "renderlib/threading.h"
+
+#include <atomic>
+#include <future>
+#include <vector>
+
+TEST_CASE("parallel_for visits every element once", "[threading]")
+{
+  for (size_t n : { 0, 1, 7, 1000, 100003 }) {
+    for (size_t grain : { 0, 1, 3, 4096 }) {
+      std::vector<std::atomic<int>> visits(n);
+      // assertions are not thread safe; count bad chunks and check on this thread
+      std::atomic<int> badChunks(0);
+      parallel_for(
+        n,
+        [&visits, &badChunks, grain](size_t s, size_t e) {
+          if (s >= e || (grain > 0 && e - s > grain)) {
+            badChunks++;
+          }
+          for (size_t i = s; i < e; ++i) {
+            visits[i]++;
+          }
+        },
+        true,
+        grain);
+      REQUIRE(badChunks == 0);
+      for (size_t i = 0; i < n; ++i) {
+        REQUIRE(visits[i] == 1);
+      }
+    }
+  }
+
+  SECTION("Without threads")
+  {
+    std::vector<int> visits(1000, 0);
+    parallel_for(
+      visits.size(),
+      [&visits](size_t s, size_t e) {
+        for (size_t i = s; i < e; ++i) {
+          visits[i]++;
+        }
+      },
+      false);
+    for (int v : visits) {
+      REQUIRE(v == 1);
+    }
+  }
+}
+
+TEST_CASE("parallel_for can be nested", "[threading]")
+{
+  static const size_t OUTER = 64, INNER = 1000;
+  std::vector<std::atomic<int>> visits(OUTER * INNER);
+  parallel_for(
+    OUTER,
+    [&visits](size_t s, size_t e) {
+      for (size_t o = s; o < e; ++o) {
+        parallel_for(INNER, [&visits, o](size_t is, size_t ie) {
+          for (size_t i = is; i < ie; ++i) {
+            visits[o * INNER + i]++;
+          }
+        });
+      }
+    },
+    true,
+    1);
+  for (auto& v : visits) {
+    REQUIRE(v == 1);
+  }
+}
+
+TEST_CASE("ThreadPool runs higher priority tasks first", "[threading]")
+{
+  ThreadPool pool(1);
+  REQUIRE(pool.size() == 1);
+  REQUIRE(pool.workerIndex() == -1);
+
+  // keep the only worker busy while the other tasks are queued
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::promise<void> started;
+  pool.submit([&started, released]() {
+    started.set_value();
+    released.wait();
+  });
+  started.get_future().wait();
+
+  std::vector<int> order;
+  std::promise<void> done;
+  pool.submit([&order]() { order.push_back(2); }, TaskPriority::LOW);
+  pool.submit([&order]() { order.push_back(1); }, TaskPriority::NORMAL);
+  pool.submit([&order]() { order.push_back(0); }, TaskPriority::HIGH);
+  pool.submit([&done]() { done.set_value(); }, TaskPriority::LOW);
+  release.set_value();
+  done.get_future().wait();
+
+  REQUIRE(order == std::vector<int>{ 0, 1, 2 });
+}
+
+TEST_CASE("ThreadPool tasks can submit tasks", "[threading]")
+{
+  ThreadPool pool(2);
+  std::promise<int> result;
+  pool.submit([&pool, &result]() {
+    int index = pool.workerIndex();
+    pool.submit([&result, index]() { result.set_value(index); });
+  });
+  int index = result.get_future().get();
+  REQUIRE(index >= 0);
+  REQUIRE(index < 2);
+}
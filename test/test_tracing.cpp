@@ -0,0 +1,89 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "renderlib/Tracing.h"
+
+#include <string>
+#include <thread>
+
+namespace {
+size_t
+countOf(const std::string& s, const std::string& sub)
+{
+  size_t count = 0;
+  for (size_t pos = s.find(sub); pos != std::string::npos; pos = s.find(sub, pos + sub.size())) {
+    count++;
+  }
+  return count;
+}
+} // namespace
+
+TEST_CASE("TraceSpans are recorded only while tracing is enabled", "[tracing]")
+{
+  Tracing::enable(false);
+  Tracing::clear();
+  {
+    TraceSpan span("disabled");
+  }
+  REQUIRE(Tracing::eventCount() == 0);
+
+  Tracing::enable(true);
+  {
+    TraceSpan outer("outer", "test");
+    {
+      TraceSpan inner("inner", "test");
+    }
+  }
+  // a span started while enabled is recorded even if tracing is disabled before it ends
+  {
+    TraceSpan last("last", "test");
+    Tracing::enable(false);
+  }
+  REQUIRE(Tracing::eventCount() == 3);
+
+  std::string json = Tracing::chromeTraceJson();
+  REQUIRE(json.find("\"traceEvents\":[") != std::string::npos);
+  REQUIRE(countOf(json, "\"ph\":\"X\"") == 3);
+  REQUIRE(json.find("\"name\":\"disabled\"") == std::string::npos);
+  // spans are recorded as they end, innermost first
+  size_t inner = json.find("\"name\":\"inner\"");
+  size_t outer = json.find("\"name\":\"outer\"");
+  REQUIRE(inner != std::string::npos);
+  REQUIRE(outer != std::string::npos);
+  REQUIRE(inner < outer);
+  REQUIRE(json.find("\"depth\":1", inner) < outer);
+  REQUIRE(json.find("\"depth\":0", outer) != std::string::npos);
+
+  Tracing::clear();
+  REQUIRE(Tracing::eventCount() == 0);
+}
+
+TEST_CASE("TraceSpans of each thread are kept apart", "[tracing]")
+{
+  Tracing::clear();
+  Tracing::enable(true);
+  {
+    TraceSpan span("main thread span");
+  }
+  std::thread worker([]() {
+    Tracing::setThreadName("test \"worker\"");
+    TraceSpan span("worker thread span");
+  });
+  worker.join();
+  Tracing::enable(false);
+
+  // spans of finished threads are still exported
+  REQUIRE(Tracing::eventCount() == 2);
+  std::string json = Tracing::chromeTraceJson();
+  REQUIRE(json.find("\"name\":\"thread_name\"") != std::string::npos);
+  REQUIRE(json.find("test \\\"worker\\\"") != std::string::npos);
+
+  size_t mainSpan = json.find("\"name\":\"main thread span\"");
+  size_t workerSpan = json.find("\"name\":\"worker thread span\"");
+  REQUIRE(mainSpan != std::string::npos);
+  REQUIRE(workerSpan != std::string::npos);
+  std::string mainTid = json.substr(json.find("\"tid\":", mainSpan), 8);
+  std::string workerTid = json.substr(json.find("\"tid\":", workerSpan), 8);
+  REQUIRE(mainTid != workerTid);
+
+  Tracing::clear();
+}
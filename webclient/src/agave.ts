@@ -1,4 +1,5 @@
 import { CommandBuffer, COMMANDS } from "./commandbuffer";
+import { TileFrameDecoder } from "./frames";
 
 export type JSONValue =
   | string
@@ -15,6 +16,9 @@ export class AgaveClient {
   private onOpen: () => void;
   private onJson: (json: JSONValue) => void;
   private onImage: (data: Blob) => void;
+  // with frames = "tiles", images are reassembled from the tiles that changed, one at a time in order
+  private frames?: TileFrameDecoder;
+  private framesDecoded: Promise<void>;
 
   constructor(
     url = "ws://localhost:1235/",
@@ -27,7 +31,10 @@ export class AgaveClient {
     },
     onImage = (_data: Blob) => {
       return;
-    }
+    },
+    frames = "full",
+    // "jpeg", "png" or "webp"; "bgra8" and "rgba32f" images are handed to onImage as they come, see streamFormat.h
+    format = "jpeg"
   ) {
     if (rendermode !== "pathtrace" && rendermode !== "raymarch") {
       rendermode = "pathtrace";
@@ -38,6 +45,15 @@ export class AgaveClient {
     this.cb = new CommandBuffer();
     this.sessionName = "";
     this.url = url + "?mode=" + rendermode;
+    if (format !== "jpeg") {
+      this.url += "&format=" + format;
+    }
+    // the server does not diff raw pixels
+    if (frames === "tiles" && format !== "bgra8" && format !== "rgba32f") {
+      this.url += "&frames=tiles";
+      this.frames = new TileFrameDecoder();
+    }
+    this.framesDecoded = Promise.resolve();
     this.socket = undefined;
   }
 
@@ -79,11 +95,31 @@ export class AgaveClient {
             if (this.onJson) {
               this.onJson(returnedObj);
             }
+          } else if (returnedObj.queue_position !== undefined || returnedObj.error !== undefined) {
+            // the server is busy: this client waits for a session (queue_position 0 once it has one), or was
+            // turned away
+            if (this.onJson) {
+              this.onJson(returnedObj);
+            }
           }
           return;
         }
 
         const arraybuf = evt.data;
+        if (this.frames) {
+          const frames = this.frames;
+          this.framesDecoded = this.framesDecoded
+            .then(() => frames.decode(arraybuf as Blob))
+            .then((image) => {
+              if (this.onImage) {
+                this.onImage(image);
+              }
+            })
+            .catch((error) => {
+              console.warn("AGAVE tile frame could not be decoded", error);
+            });
+          return;
+        }
         // let users do something with this data
         if (this.onImage) {
           this.onImage(arraybuf as Blob);
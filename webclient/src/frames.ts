@@ -0,0 +1,51 @@
+// Reassembles the images of a client that asked for tile frames (frames=tiles).
+// The server sends either a whole image, or a message of the tiles that changed since the last one:
+// "AGTF", then little endian uint32 width, height and tile count, then per tile
+// uint32 x, y, width, height and byte count followed by the encoded tile.
+const TILE_FRAME_MAGIC = "AGTF";
+const TILE_FRAME_HEADER_BYTES = 16;
+const TILE_HEADER_BYTES = 20;
+
+export class TileFrameDecoder {
+  private canvas?: OffscreenCanvas;
+  private context?: OffscreenCanvasRenderingContext2D | null;
+
+  private resize(width: number, height: number): OffscreenCanvasRenderingContext2D | null | undefined {
+    if (!this.canvas || this.canvas.width !== width || this.canvas.height !== height) {
+      this.canvas = new OffscreenCanvas(width, height);
+      this.context = this.canvas.getContext("2d");
+    }
+    return this.context;
+  }
+
+  // returns the whole image after applying data to it
+  async decode(data: Blob): Promise<Blob> {
+    const buffer = await data.arrayBuffer();
+    const view = new DataView(buffer);
+    const magic = String.fromCharCode(...new Uint8Array(buffer, 0, Math.min(4, buffer.byteLength)));
+    if (magic !== TILE_FRAME_MAGIC) {
+      // a whole image, which the next tiles are drawn over
+      const image = await createImageBitmap(data);
+      this.resize(image.width, image.height)?.drawImage(image, 0, 0);
+      image.close();
+      return data;
+    }
+
+    const width = view.getUint32(4, true);
+    const height = view.getUint32(8, true);
+    const count = view.getUint32(12, true);
+    const context = this.resize(width, height);
+    let offset = TILE_FRAME_HEADER_BYTES;
+    for (let i = 0; i < count; ++i) {
+      const x = view.getUint32(offset, true);
+      const y = view.getUint32(offset + 4, true);
+      const length = view.getUint32(offset + 16, true);
+      offset += TILE_HEADER_BYTES;
+      const tile = await createImageBitmap(new Blob([buffer.slice(offset, offset + length)]));
+      context?.drawImage(tile, x, y);
+      tile.close();
+      offset += length;
+    }
+    return (this.canvas as OffscreenCanvas).convertToBlob({ type: "image/png" });
+  }
+}